@@ -1,6 +1,7 @@
 #ifndef _PLATINUM_APP_H
 #define _PLATINUM_APP_H
 
+#include "p_event.h"
 #include "p_graphics.h"
 #include "p_util.h"
 #include "p_window.h"
@@ -38,13 +39,20 @@ struct PAppData {
 	PAppConfig *app_config;
 	EDynarr *window_data; // Array of (PWindowData *)
 	//PDeviceManager *input_manager;
-	PMutex window_mutex;
+	PLightMutex window_mutex;
+	PCondVar window_cond_var; // signaled whenever a window is removed from window_data
+	EDynarr *closed_window_data; // Array of (PWindowData *) destroyed by the display server, freed by p_app_poll_events
+	atomic_uint num_closed_windows; // items in closed_window_data, read without window_mutex
+	PWindowData *destroyed_window_data; // reported by the last P_EVENT_DESTROY, freed by the next poll
+	PWindowSystem *window_system;
+	PEventQueue *event_queue; // filled by the window event threads, drained by p_app_poll_events
 	PGraphicalAppData graphical_app_data;
 };
 
 
 PAppData *p_app_init(PAppRequest app_request);
 void p_app_deinit(PAppData *app_data);
+bool p_app_poll_events(PAppData *app_data, PEvent *event);
 
 
 #ifdef PLATINUM_PLATFORM_LINUX
@@ -0,0 +1,67 @@
+#ifndef _PLATINUM_EVENT_H
+#define _PLATINUM_EVENT_H
+
+#include "p_util.h"
+#include <stdbool.h>
+
+// External Forward Declarations
+typedef struct PWindowData PWindowData;
+
+// Internal Forward Declarations
+typedef struct PEvent PEvent;
+typedef struct PEventQueue PEventQueue;
+
+// Number of events the app queue can hold before new events are dropped
+#ifndef P_EVENT_QUEUE_SIZE
+#define P_EVENT_QUEUE_SIZE 1024
+#endif // P_EVENT_QUEUE_SIZE
+
+enum PEventType {
+	P_EVENT_EXPOSE,
+	P_EVENT_CONFIGURE,
+	P_EVENT_PROPERTY,
+	P_EVENT_CLIENT,
+	P_EVENT_FOCUS_IN,
+	P_EVENT_FOCUS_OUT,
+	P_EVENT_ENTER,
+	P_EVENT_LEAVE,
+	P_EVENT_DESTROY,
+	P_EVENT_MAX
+};
+
+/**
+ * PEvent
+ *
+ * A window manager event, copied out of the event thread.
+ * every window gets exactly one P_EVENT_DESTROY, after all of its other events, even if enable_destroy is unset.
+ * window_data stays valid until the next p_app_poll_events call after its P_EVENT_DESTROY
+ */
+struct PEvent {
+	enum PEventType type;
+	PWindowData *window_data;
+	union {
+		struct {
+			uint x;
+			uint y;
+			uint width;
+			uint height;
+			uint count; // number of expose events that follow for the same window
+		} expose;
+		struct {
+			int x;
+			int y;
+			uint width;
+			uint height;
+		} configure;
+	};
+};
+
+PEventQueue *p_event_queue_init(uint size);
+void p_event_queue_deinit(PEventQueue *event_queue);
+bool p_event_queue_push(PEventQueue *event_queue, const PEvent *event);
+bool p_event_queue_pop(PEventQueue *event_queue, PEvent *event);
+uint p_event_queue_dropped(const PEventQueue *event_queue);
+size_t p_event_queue_pushed(const PEventQueue *event_queue);
+size_t p_event_queue_popped(const PEventQueue *event_queue);
+
+#endif // _PLATINUM_EVENT_H
@@ -5,22 +5,52 @@
 
 // External Forward Declarations
 typedef struct PWindowData PWindowData;
+typedef struct PJobSystem PJobSystem;
 
 // Internal Forward Declarations
 typedef struct PGraphicalAppRequest PGraphicalAppRequest;
 typedef struct PGraphicalDisplayRequest PGraphicalDisplayRequest;
 typedef struct PGraphicalDevice PGraphicalDevice;
+typedef struct PGraphicsBuffer PGraphicsBuffer;
+typedef struct PGraphicsImage PGraphicsImage;
+typedef struct PGraphicsBufferRequest PGraphicsBufferRequest;
+typedef struct PGraphicsImageRequest PGraphicsImageRequest;
+typedef struct PGraphicsMemoryBudget PGraphicsMemoryBudget;
+typedef struct PGraphicsCommandBuffer PGraphicsCommandBuffer;
+typedef struct PGraphicsProfileScope PGraphicsProfileScope;
+typedef struct PGraphicsShader PGraphicsShader;
+typedef struct PGraphicsPipeline PGraphicsPipeline;
+typedef struct PGraphicsPipelineRequest PGraphicsPipelineRequest;
 
 typedef struct PGraphicalAppData *PGraphicalAppData;
 typedef struct PGraphicalDisplayData *PGraphicalDisplayData;
 
 struct PGraphicalAppRequest {
 	bool headless;
+	char *pipeline_cache_path; // where compiled pipelines are kept between runs, NULL to not keep them
+	char *shader_path; // directory whose <name>.spv files replace the embedded shaders, NULL to use only those
+};
+
+/**
+ * PGraphicalLatencyMode
+ *
+ * How frames are handed to the display, trading input latency against tearing and power use
+ * When a mode is not supported the next best one is used, vsync is always available
+ */
+enum PGraphicalLatencyMode {
+	P_GRAPHICAL_LATENCY_DEFAULT, // triple buffered if supported, otherwise vsync
+	P_GRAPHICAL_LATENCY_LOWEST, // present immediately, may tear
+	P_GRAPHICAL_LATENCY_TRIPLE_BUFFERED, // newest frame replaces the queued one, no tearing
+	P_GRAPHICAL_LATENCY_POWER_SAVING, // vsync, the CPU and GPU wait for the display
+	P_GRAPHICAL_LATENCY_ADAPTIVE, // vsync, but late frames are shown immediately and may tear
+	P_GRAPHICAL_LATENCY_MAX
 };
 
 struct PGraphicalDisplayRequest {
 	bool headless;
 	bool stereoscopic;
+	enum PGraphicalLatencyMode latency_mode;
+	uint image_count; // swapchain images wanted, 0 to let the display decide. Clamped to what is supported
 };
 
 struct PGraphicalDevice {
@@ -28,23 +58,200 @@ struct PGraphicalDevice {
 	void *handle; // backend-specific handle (for vulkan its VkPhysicalDevice)
 };
 
+// Most memory heaps a device reports
+#define P_GRAPHICS_MEMORY_HEAPS_MAX 16
+
+/**
+ * PGraphicsMemoryUsage
+ *
+ * Who reads and writes the memory of a buffer or image, decides where it is placed
+ */
+enum PGraphicsMemoryUsage {
+	P_GRAPHICS_MEMORY_GPU_ONLY, // fastest for the GPU, not mappable
+	P_GRAPHICS_MEMORY_CPU_TO_GPU, // written by the CPU, read by the GPU, mapped
+	P_GRAPHICS_MEMORY_GPU_TO_CPU, // written by the GPU, read back by the CPU, mapped
+	P_GRAPHICS_MEMORY_TRANSIENT, // like CPU_TO_GPU but short lived, packed into linear pages
+	P_GRAPHICS_MEMORY_MAX
+};
+
+enum PGraphicsBufferUsage {
+	P_GRAPHICS_BUFFER_VERTEX = 1 << 0,
+	P_GRAPHICS_BUFFER_INDEX = 1 << 1,
+	P_GRAPHICS_BUFFER_UNIFORM = 1 << 2,
+	P_GRAPHICS_BUFFER_STORAGE = 1 << 3,
+	P_GRAPHICS_BUFFER_TRANSFER_SRC = 1 << 4,
+	P_GRAPHICS_BUFFER_TRANSFER_DST = 1 << 5,
+};
+
+enum PGraphicsImageUsage {
+	P_GRAPHICS_IMAGE_SAMPLED = 1 << 0,
+	P_GRAPHICS_IMAGE_COLOR_ATTACHMENT = 1 << 1,
+	P_GRAPHICS_IMAGE_DEPTH_ATTACHMENT = 1 << 2,
+	P_GRAPHICS_IMAGE_TRANSFER_SRC = 1 << 3,
+	P_GRAPHICS_IMAGE_TRANSFER_DST = 1 << 4,
+};
+
+enum PGraphicsFormat {
+	P_GRAPHICS_FORMAT_RGBA8_UNORM,
+	P_GRAPHICS_FORMAT_RGBA8_SRGB,
+	P_GRAPHICS_FORMAT_BGRA8_UNORM,
+	P_GRAPHICS_FORMAT_BGRA8_SRGB,
+	P_GRAPHICS_FORMAT_R32_FLOAT,
+	P_GRAPHICS_FORMAT_D32_FLOAT,
+	P_GRAPHICS_FORMAT_MAX
+};
+
+enum PGraphicsTopology {
+	P_GRAPHICS_TOPOLOGY_TRIANGLE_LIST,
+	P_GRAPHICS_TOPOLOGY_TRIANGLE_STRIP,
+	P_GRAPHICS_TOPOLOGY_LINE_LIST,
+	P_GRAPHICS_TOPOLOGY_POINT_LIST,
+	P_GRAPHICS_TOPOLOGY_MAX
+};
+
+/**
+ * PGraphicsBufferRequest
+ *
+ * This struct is used to create a new buffer with the requested settings
+ */
+struct PGraphicsBufferRequest {
+	uint64_t size;
+	uint usage; // PGraphicsBufferUsage flags
+	enum PGraphicsMemoryUsage memory_usage;
+};
+
+/**
+ * PGraphicsImageRequest
+ *
+ * This struct is used to create a new 2D image with the requested settings
+ */
+struct PGraphicsImageRequest {
+	uint width;
+	uint height;
+	enum PGraphicsFormat format;
+	uint usage; // PGraphicsImageUsage flags
+	enum PGraphicsMemoryUsage memory_usage;
+};
 
+/**
+ * PGraphicsPipelineRequest
+ *
+ * This struct describes a graphics pipeline drawing into a display's render pass
+ * Viewport and scissor are dynamic, they follow the display's size
+ */
+struct PGraphicsPipelineRequest {
+	const PGraphicsShader *vertex_shader;
+	const PGraphicsShader *fragment_shader;
+	enum PGraphicsTopology topology;
+	bool cull; // cull back faces, front faces are clockwise
+	bool blend; // alpha blending, otherwise fragments replace what is drawn
+};
+
+/**
+ * PGraphicsMemoryBudget
+ *
+ * This struct describes how much of a memory heap is used and how much may be used
+ */
+struct PGraphicsMemoryBudget {
+	uint64_t budget; // bytes the app can use before allocations start failing or slowing down
+	uint64_t usage; // bytes used by the app, estimated if the driver does not report it
+	uint64_t allocated; // bytes of device memory held by platinum's allocator
+	bool device_local;
+};
+
+/**
+ * PGraphicsProfileScope
+ *
+ * This struct is the GPU time spent between p_graphics_profile_begin and p_graphics_profile_end
+ * Names are not copied, they are read frames later and when the trace is dumped,
+ * so p_graphics_profile_begin must be given static strings such as string literals
+ */
+struct PGraphicsProfileScope {
+	const char *name; // the pointer given to p_graphics_profile_begin
+	double begin_ms; // since the first scope of the frame began
+	double duration_ms;
+	uint depth; // number of scopes it is nested in
+};
+
+/**
+ * PGraphicsShader
+ *
+ * This struct is a SPIR-V shader compiled into the library
+ */
+struct PGraphicsShader {
+	const char *name; // file name without .spv, shader_vert.spv is "shader_vert"
+	const uint32_t *code;
+	size_t size; // in bytes
+};
+
+/**
+ * PGraphicsMoveFunction
+ *
+ * Called while defragmenting to copy the contents of a buffer to its new place
+ * The copy must be finished when the function returns, source is destroyed afterwards
+ */
+typedef void (*PGraphicsMoveFunction)(const PGraphicsBuffer *source, const PGraphicsBuffer *destination, void *args);
+
+/**
+ * PGraphicsRecordFunction
+ *
+ * Records part of a frame into command_buffer, index tells which part
+ * Called from job workers, several at once, each part is drawn in index order
+ */
+typedef void (*PGraphicsRecordFunction)(PGraphicsCommandBuffer *command_buffer, uint index, void *args);
+
+
+const PGraphicsShader *p_graphics_shader_find(const char *name);
 PGraphicalAppData p_graphics_init(PGraphicalAppRequest *graphical_app_request);
 void p_graphics_deinit(PGraphicalAppData graphical_app_data);
 void p_graphics_display_create(PWindowData *window_data, const PGraphicalAppData graphical_app_data,
 		const PGraphicalDisplayRequest * const graphical_display_request);
 void p_graphics_display_destroy(PGraphicalDisplayData graphical_display_data);
-void p_graphics_device_set(
-		PGraphicalDisplayData graphical_display_data,
-		const PGraphicalDisplayRequest * const graphical_display_request,
-		const PGraphicalDevice physical_device,
-		const PGraphicalDisplayData display,
-		const PWindowData * const window_data);
+bool p_graphics_display_draw(PWindowData *window_data);
+PGraphicalDisplayData p_graphics_headless_display_create(const PGraphicalAppData graphical_app_data,
+		const PGraphicalDisplayRequest * const graphical_display_request, uint width, uint height);
+bool p_graphics_headless_display_draw(PGraphicalDisplayData graphical_display_data);
+bool p_graphics_display_read(PGraphicalDisplayData graphical_display_data, void *pixels);
+enum PGraphicalLatencyMode p_graphics_display_latency_mode(const PGraphicalDisplayData graphical_display_data);
 PGraphicalDevice p_graphics_device_auto_pick(
-		PGraphicalDisplayData graphical_display_data,
-		const PGraphicalAppData graphical_app_data,
+		PGraphicalAppData graphical_app_data,
+		const PGraphicalDisplayData display,
 		const PGraphicalDisplayRequest * const graphical_display_request);
-
+PGraphicsBuffer *p_graphics_buffer_create(PGraphicalDisplayData graphical_display_data,
+		const PGraphicsBufferRequest * const buffer_request);
+void p_graphics_buffer_destroy(PGraphicsBuffer *buffer);
+void *p_graphics_buffer_map(const PGraphicsBuffer *buffer);
+void p_graphics_buffer_flush(const PGraphicsBuffer *buffer, uint64_t offset, uint64_t size);
+void p_graphics_buffer_invalidate(const PGraphicsBuffer *buffer, uint64_t offset, uint64_t size);
+PGraphicsImage *p_graphics_image_create(PGraphicalDisplayData graphical_display_data,
+		const PGraphicsImageRequest * const image_request);
+void p_graphics_image_destroy(PGraphicsImage *image);
+uint p_graphics_memory_budget(const PGraphicalDisplayData graphical_display_data,
+		PGraphicsMemoryBudget budgets[P_GRAPHICS_MEMORY_HEAPS_MAX]);
+uint p_graphics_memory_defragment(PGraphicalDisplayData graphical_display_data, PGraphicsMoveFunction move_function,
+		void *args);
+uint64_t p_graphics_buffer_upload(PGraphicalDisplayData graphical_display_data, PGraphicsBuffer *buffer,
+		uint64_t offset, const void *data, uint64_t size);
+uint64_t p_graphics_image_upload(PGraphicalDisplayData graphical_display_data, PGraphicsImage *image,
+		const void *data);
+void p_graphics_upload_flush(PGraphicalDisplayData graphical_display_data);
+bool p_graphics_upload_done(const PGraphicalDisplayData graphical_display_data, uint64_t upload);
+void p_graphics_upload_wait(PGraphicalDisplayData graphical_display_data, uint64_t upload);
+void p_graphics_display_set_recorder(PGraphicalDisplayData graphical_display_data, PJobSystem *job_system,
+		uint record_count, PGraphicsRecordFunction record_function, void *args);
+void p_graphics_command_draw(PGraphicsCommandBuffer *command_buffer, uint vertex_count, uint instance_count,
+		uint first_vertex, uint first_instance);
+void p_graphics_profile_begin(PGraphicsCommandBuffer *command_buffer, const char *name);
+void p_graphics_profile_end(PGraphicsCommandBuffer *command_buffer);
+uint p_graphics_profile_frame(const PGraphicalDisplayData graphical_display_data,
+		const PGraphicsProfileScope **scopes);
+bool p_graphics_profile_dump(const PGraphicalDisplayData graphical_display_data, const char *path);
+void p_graphics_pipelines_build(PGraphicalDisplayData graphical_display_data, PJobSystem *job_system, uint count,
+		const PGraphicsPipelineRequest *pipeline_requests, PGraphicsPipeline **pipelines);
+bool p_graphics_pipeline_ready(const PGraphicsPipeline *pipeline);
+bool p_graphics_pipeline_wait(PGraphicsPipeline *pipeline);
+void p_graphics_pipeline_destroy(PGraphicsPipeline *pipeline);
+void p_graphics_command_bind_pipeline(PGraphicsCommandBuffer *command_buffer, const PGraphicsPipeline *pipeline);
 
 
 // Vulkan specific implementation
@@ -59,18 +266,85 @@ void p_graphics_vulkan_display_create(PWindowData *window_data, const PGraphical
 
 void p_graphics_vulkan_display_destroy(PGraphicalDisplayData vulkan_display_data);
 
-void p_graphics_vulkan_device_set(
-		PGraphicalDisplayData graphical_display_data,
-		const PGraphicalDisplayRequest * const graphical_display_request,
-		const PGraphicalDevice physical_device,
-		const PGraphicalDisplayData display,
-		const PWindowData * const window_data);
+bool p_graphics_vulkan_display_draw(PWindowData *window_data);
+
+PGraphicalDisplayData p_graphics_vulkan_headless_display_create(const PGraphicalAppData vulkan_app_data,
+		const PGraphicalDisplayRequest * const vulkan_display_request, uint width, uint height);
+
+bool p_graphics_vulkan_headless_display_draw(PGraphicalDisplayData vulkan_display_data);
+
+bool p_graphics_vulkan_display_read(PGraphicalDisplayData vulkan_display_data, void *pixels);
+
+enum PGraphicalLatencyMode p_graphics_vulkan_display_latency_mode(const PGraphicalDisplayData vulkan_display_data);
 
 PGraphicalDevice p_graphics_vulkan_device_auto_pick(
-		PGraphicalDisplayData graphical_display_data,
-		const PGraphicalAppData graphical_app_data,
+		PGraphicalAppData graphical_app_data,
+		const PGraphicalDisplayData display,
 		const PGraphicalDisplayRequest * const graphical_display_request);
 
+PGraphicsBuffer *p_graphics_vulkan_buffer_create(PGraphicalDisplayData vulkan_display_data,
+		const PGraphicsBufferRequest * const buffer_request);
+
+void p_graphics_vulkan_buffer_destroy(PGraphicsBuffer *buffer);
+
+void *p_graphics_vulkan_buffer_map(const PGraphicsBuffer *buffer);
+
+void p_graphics_vulkan_buffer_flush(const PGraphicsBuffer *buffer, uint64_t offset, uint64_t size);
+
+void p_graphics_vulkan_buffer_invalidate(const PGraphicsBuffer *buffer, uint64_t offset, uint64_t size);
+
+PGraphicsImage *p_graphics_vulkan_image_create(PGraphicalDisplayData vulkan_display_data,
+		const PGraphicsImageRequest * const image_request);
+
+void p_graphics_vulkan_image_destroy(PGraphicsImage *image);
+
+uint p_graphics_vulkan_memory_budget(const PGraphicalDisplayData vulkan_display_data,
+		PGraphicsMemoryBudget budgets[P_GRAPHICS_MEMORY_HEAPS_MAX]);
+
+uint p_graphics_vulkan_memory_defragment(PGraphicalDisplayData vulkan_display_data,
+		PGraphicsMoveFunction move_function, void *args);
+
+uint64_t p_graphics_vulkan_buffer_upload(PGraphicalDisplayData vulkan_display_data, PGraphicsBuffer *buffer,
+		uint64_t offset, const void *data, uint64_t size);
+
+uint64_t p_graphics_vulkan_image_upload(PGraphicalDisplayData vulkan_display_data, PGraphicsImage *image,
+		const void *data);
+
+void p_graphics_vulkan_upload_flush(PGraphicalDisplayData vulkan_display_data);
+
+bool p_graphics_vulkan_upload_done(const PGraphicalDisplayData vulkan_display_data, uint64_t upload);
+
+void p_graphics_vulkan_upload_wait(PGraphicalDisplayData vulkan_display_data, uint64_t upload);
+
+void p_graphics_vulkan_display_set_recorder(PGraphicalDisplayData vulkan_display_data, PJobSystem *job_system,
+		uint record_count, PGraphicsRecordFunction record_function, void *args);
+
+void p_graphics_vulkan_command_draw(PGraphicsCommandBuffer *command_buffer, uint vertex_count, uint instance_count,
+		uint first_vertex, uint first_instance);
+
+void *p_graphics_vulkan_command_buffer_handle(const PGraphicsCommandBuffer *command_buffer);
+
+void p_graphics_vulkan_profile_begin(PGraphicsCommandBuffer *command_buffer, const char *name);
+
+void p_graphics_vulkan_profile_end(PGraphicsCommandBuffer *command_buffer);
+
+uint p_graphics_vulkan_profile_frame(const PGraphicalDisplayData vulkan_display_data,
+		const PGraphicsProfileScope **scopes);
+
+bool p_graphics_vulkan_profile_dump(const PGraphicalDisplayData vulkan_display_data, const char *path);
+
+void p_graphics_vulkan_pipelines_build(PGraphicalDisplayData vulkan_display_data, PJobSystem *job_system, uint count,
+		const PGraphicsPipelineRequest *pipeline_requests, PGraphicsPipeline **pipelines);
+
+bool p_graphics_vulkan_pipeline_ready(const PGraphicsPipeline *pipeline);
+
+bool p_graphics_vulkan_pipeline_wait(PGraphicsPipeline *pipeline);
+
+void p_graphics_vulkan_pipeline_destroy(PGraphicsPipeline *pipeline);
+
+void p_graphics_vulkan_command_bind_pipeline(PGraphicsCommandBuffer *command_buffer,
+		const PGraphicsPipeline *pipeline);
+
 #endif // PLATINUM_GRAPHICS_VULKAN
 
 #endif // _PLATINUM_GRAPHICS_H
@@ -1,7 +1,10 @@
 #ifndef PLATINUM_UTIL_H
 #define PLATINUM_UTIL_H
 
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h> // declared before malloc, calloc, realloc and free may be replaced below
 #include <wchar.h>
 
 #ifndef _UINT
@@ -20,6 +23,63 @@ typedef void *PThreadResult;
 typedef void *PThreadArguments;
 typedef PThreadResult (*PThreadFunction)(void *);
 
+// -------- Lightweight Locks ---------
+typedef struct PLightMutex PLightMutex;
+typedef struct PCondVar PCondVar;
+
+/**
+ * PLightMutex
+ *
+ * Non-allocating mutex built on futexes (WaitOnAddress on windows).
+ * Spins briefly before sleeping. Zeroed memory is an unlocked mutex.
+ */
+struct PLightMutex {
+	atomic_uint state; // 0: unlocked, 1: locked, 2: locked with sleeping waiters
+};
+
+/**
+ * PCondVar
+ *
+ * Non-allocating condition variable used together with a PLightMutex.
+ * Zeroed memory is a valid condition variable.
+ */
+struct PCondVar {
+	atomic_uint sequence;
+};
+
+#define P_LIGHT_MUTEX_INIT {0}
+#define P_COND_VAR_INIT {0}
+
+// -------------- Jobs ----------------
+typedef struct PJobSystem PJobSystem;
+typedef struct PJobCounter PJobCounter;
+typedef void (*PJobFunction)(void *);
+
+/**
+ * PJobCounter
+ *
+ * Tracks the number of unfinished jobs submitted against it.
+ * Must be zero initialized before it is first submitted against.
+ */
+struct PJobCounter {
+	atomic_uint value;
+};
+
+// ------------- Arenas ---------------
+typedef struct PArena PArena;
+typedef struct PArenaBlock PArenaBlock;
+typedef struct PArenaMark PArenaMark;
+
+/**
+ * PArenaMark
+ *
+ * A position in an arena. Resetting to it releases everything allocated after it was taken.
+ */
+struct PArenaMark {
+	PArenaBlock *block;
+	size_t used;
+};
+
 // ------------ Logging -------------
 enum PLogLevel {
 	P_LOG_DEBUG,
@@ -35,7 +95,9 @@ void p_log_message(enum PLogLevel level, const wchar_t *channel, const wchar_t *
 bool p_file_exists(const char *filename);
 uint p_file_get_size(const char *filename);
 bool p_file_write(const char *filename, void *buffer, uint size);
+bool p_file_replace(const char *filename, void *buffer, uint size);
 bool p_file_read(const char *filename, void *buffer, uint size);
+bool p_file_text_append(char **text, size_t *length, size_t *capacity, const char *format, ...);
 
 
 void p_sleep_ms(uint milis);
@@ -44,17 +106,50 @@ void p_mutex_unlock(PMutex mutex);
 PMutex p_mutex_init(void);
 void p_mutex_destroy(PMutex mutex);
 
+void p_light_mutex_init(PLightMutex *mutex);
+bool p_light_mutex_trylock(PLightMutex *mutex);
+void p_light_mutex_lock(PLightMutex *mutex);
+void p_light_mutex_unlock(PLightMutex *mutex);
+void p_cond_var_init(PCondVar *cond_var);
+void p_cond_var_wait(PCondVar *cond_var, PLightMutex *mutex);
+void p_cond_var_signal(PCondVar *cond_var);
+void p_cond_var_broadcast(PCondVar *cond_var);
+
 PThread p_thread_create(PThreadFunction func, PThreadArguments args);
 PThread p_thread_self(void);
+uint p_thread_id(void);
+void p_thread_set_name(const char *name);
+const char *p_thread_name(void);
 void p_thread_detach(PThread thread);
 void p_thread_discard(PThread thread);
 void p_thread_join(PThread thread);
+uint p_thread_core_count(void);
+
+PJobSystem *p_job_system_init(uint num_workers);
+void p_job_system_deinit(PJobSystem *job_system);
+uint p_job_system_worker_count(const PJobSystem *job_system);
+int p_job_worker_index(const PJobSystem *job_system);
+void p_job_submit(PJobSystem *job_system, PJobFunction func, void *args, PJobCounter *counter);
+void p_job_submit_after(PJobSystem *job_system, PJobFunction func, void *args, PJobCounter *dependency,
+		PJobCounter *counter);
+void p_job_wait(PJobSystem *job_system, PJobCounter *counter);
+
+PArena *p_arena_init(size_t block_size, bool grow);
+void p_arena_deinit(PArena *arena);
+void *p_arena_alloc(PArena *arena, size_t size);
+void *p_arena_calloc(PArena *arena, size_t nmemb, size_t size);
+PArenaMark p_arena_mark(const PArena *arena);
+void p_arena_reset(PArena *arena, PArenaMark mark);
+void p_arena_clear(PArena *arena);
+PArena *p_arena_scratch(void);
+void p_arena_scratch_deinit(void);
 
 /* ----- Debugging -----
 If PLATINUM_DEBUG_MEMORY is enabled, the memory debugging system will create macros that replace malloc, free and realloc and allows the system to keep track of and report where memory is beeing allocated, how much and if the memory is beeing freed. This is very useful for finding memory leaks in large applications. The system can also over allocate memory and fill it with a magic number and can therfor detect if the application writes outside of the allocated memory. if PLATINUM_EXIT_CRASH is defined, then exit(); will be replaced with a funtion that writes to NULL. This will make it trivial ti find out where an application exits using any debugger., */
 
 
-void p_debug_memory_init(PMutex *mutex); /* Required for memory debugger to be thread safe */
+void p_debug_memory_init(PLightMutex *mutex); /* Required for memory debugger to be thread safe */
+void p_debug_memory_guard(bool guard, size_t quarantine_bytes); /* While guard is TRUE every new allocation is placed on pages of its own, ending right before an inaccessible guard page, so writing past its end faults at that instruction instead of waiting for p_debug_memory. Up to quarantine_bytes of freed guarded memory is kept inaccessible rather than released, so using it after free faults too. Uses far more memory and is far slower than the default mode */
 void *p_debug_mem_malloc(size_t size, char *file, uint line); /* Replaces malloc and records the c file and line where it was called*/
 void *p_debug_mem_calloc(size_t nmemb, size_t size, char *file, uint line); /* Replaces malloc and records the c file and line where it was called*/
 void *p_debug_mem_realloc(void *pointer, size_t size, char *file, uint line); /* Replaces realloc and records the c file and line where it was called*/
@@ -63,6 +158,17 @@ void p_debug_mem_print(uint min_allocs); /* Prints out a list of all allocations
 void p_debug_mem_reset(void); /* f_debug_mem_reset allows you to clear all memory stored in the debugging system if you only want to record allocations after a specific point in your code*/
 bool p_debug_memory(void); /*f_debug_memory checks if any of the bounds of any allocation has been over written and reports where to standard out. The function returns TRUE if any error was found*/
 
+/* ----- Heap profiling -----
+If PLATINUM_HEAP_PROFILE is enabled, malloc, calloc, realloc and free are replaced with cheap wrappers that, while profiling is started, sample roughly one allocation per sample_bytes allocated and record its backtrace. Every thread counts down to its next sample on its own, so allocations that are not sampled take no lock. p_heap_profile_dump writes the sampled allocations that are still live, and all that were made, in the gperftools heap profile format read by pprof. Memory must be freed by the same kind of free it was allocated with. Without PLATINUM_HEAP_PROFILE the functions below do nothing. */
+
+void p_heap_profile_start(size_t sample_bytes); /* Starts sampling about one allocation per sample_bytes, 0 for 512 KiB. May be called again to change the rate */
+void p_heap_profile_stop(void); /* Stops sampling new allocations, the samples taken so far are kept for p_heap_profile_dump */
+bool p_heap_profile_dump(const char *path); /* Writes the heap profile to path, view it with pprof <binary> <path>. Returns false if nothing could be written */
+void *p_heap_profile_malloc(size_t size); /* Replaces malloc */
+void *p_heap_profile_calloc(size_t nmemb, size_t size); /* Replaces calloc */
+void *p_heap_profile_realloc(void *pointer, size_t size); /* Replaces realloc */
+void p_heap_profile_free(void *pointer); /* Replaces free */
+
 #ifdef PLATINUM_DEBUG_MEMORY
 
 #define malloc(n) p_debug_mem_malloc(n, __FILE__, __LINE__) /* Replaces malloc. */
@@ -70,6 +176,13 @@ bool p_debug_memory(void); /*f_debug_memory checks if any of the bounds of any a
 #define realloc(n, m) p_debug_mem_realloc(n, m, __FILE__, __LINE__) /* Replaces realloc. */
 #define free(n) p_debug_mem_free(n) /* Replaces free. */
 
+#elif defined PLATINUM_HEAP_PROFILE
+
+#define malloc(n) p_heap_profile_malloc(n) /* Replaces malloc. */
+#define calloc(n, m) p_heap_profile_calloc(n, m) /* Replaces calloc. */
+#define realloc(n, m) p_heap_profile_realloc(n, m) /* Replaces realloc. */
+#define free(n) p_heap_profile_free(n) /* Replaces free. */
+
 #endif // PLATINUM_DEBUG_MEMORY
 
 // Crash on exit.
@@ -9,6 +9,7 @@
 // External Forward Declarations
 typedef struct PAppData PAppData;
 typedef struct PDisplayInfo PDisplayInfo;
+typedef struct PWindowSystem PWindowSystem;
 
 // Internal Forward Declarations
 typedef struct PWindowRequest PWindowRequest;
@@ -75,10 +76,11 @@ struct PWindowData{
 	enum PWindowDisplayType display_type;
 	enum PWindowInteractType interact_type;
 	enum PWindowStatus status;
-	PThread event_manager;
+	PThread event_manager; // NULL if events are handled by the PWindowSystem
 	PEventCalls *event_calls;
 	PDisplayInfo *display_info;
 	PGraphicalDisplayData graphical_display_data;
+	size_t closed_event_position; // events pushed for the app before the window was destroyed
 };
 
 /**
@@ -98,6 +100,8 @@ struct PWindowRequest{
 	PGraphicalDisplayRequest graphical_display_request;
 };
 
+PWindowSystem *p_window_system_init(PAppData *app_data);
+void p_window_system_deinit(PWindowSystem *window_system);
 void p_window_create(PAppData *app_data, const PWindowRequest window_request);
 void p_window_close(PWindowData *window_data);
 void p_window_fullscreen(PWindowData *window_data);
@@ -124,6 +128,8 @@ void p_win32_window_set_graphical_display(PWindowData *window_data, PGraphicalAp
 
 #elif defined PLATINUM_DISPLAY_X11
 
+PWindowSystem *p_x11_window_system_init(PAppData *app_data);
+void p_x11_window_system_deinit(PWindowSystem *window_system);
 void p_x11_window_create(PAppData *app_data, const PWindowRequest window_request);
 void p_x11_window_close(PWindowData *window_data);
 void p_x11_window_fullscreen(PWindowData *window_data);
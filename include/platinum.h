@@ -2,6 +2,7 @@
 #define _PLATINUM_H
 
 #include "p_app.h"
+#include "p_event.h"
 #include "p_graphics.h"
 #include "p_util.h"
 #include "p_window.h"
@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+# Writes compiled SPIR-V files into a C source as word arrays, so platinum needs no file I/O to load them
+# usage: embed_spirv.py output.c input.spv...
+# each shader is named after its file without the .spv extension, shader_vert.spv becomes "shader_vert"
+
+import os
+import re
+import struct
+import sys
+
+SPIRV_MAGIC = 0x07230203
+WORDS_PER_LINE = 8
+
+
+def read_spirv(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    if len(data) == 0 or len(data) % 4 != 0:
+        sys.exit(f'{path}: not a SPIR-V module, size {len(data)} is not a multiple of 4')
+    words = struct.unpack(f'<{len(data) // 4}I', data)
+    if words[0] != SPIRV_MAGIC:
+        sys.exit(f'{path}: not a SPIR-V module, bad magic number {words[0]:#010x}')
+    return words
+
+
+def identifier(name):
+    return '_' + re.sub(r'\W', '_', name)
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit('usage: embed_spirv.py output.c input.spv...')
+    output = sys.argv[1]
+    shaders = sorted((os.path.basename(path)[:-len('.spv')], read_spirv(path)) for path in sys.argv[2:])
+
+    lines = [
+        '// Generated by embed_spirv.py, do not edit',
+        '#include "platinum.h"',
+        '',
+    ]
+    for name, words in shaders:
+        lines.append(f'static const uint32_t {identifier(name)}[] = {{')
+        for i in range(0, len(words), WORDS_PER_LINE):
+            lines.append('\t' + ', '.join(f'0x{word:08x}' for word in words[i:i + WORDS_PER_LINE]) + ',')
+        lines.append('};')
+        lines.append('')
+
+    # sorted by name for p_graphics_shader_find
+    lines.append('const PGraphicsShader p_graphics_shaders_embedded[] = {')
+    for name, words in shaders:
+        lines.append(f'\t{{ "{name}", {identifier(name)}, sizeof {identifier(name)} }},')
+    if not shaders:
+        lines.append('\t{ NULL, NULL, 0 },')
+    lines.append('};')
+    lines.append(f'const uint p_graphics_shaders_embedded_count = {len(shaders)};')
+    lines.append('')
+
+    with open(output, 'w') as f:
+        f.write('\n'.join(lines))
+
+
+if __name__ == '__main__':
+    main()
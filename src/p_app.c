@@ -2,7 +2,36 @@
 #include <locale.h>
 #include <stdio.h>
 
-PMutex debug_memory_mutex;
+PLightMutex debug_memory_mutex = P_LIGHT_MUTEX_INIT;
+
+// Forward function declarations for internal functions
+void _window_close(PAppData *app_data, PWindowData *window_data);
+
+/**
+ * _app_closed_windows_free
+ *
+ * frees every window the display server has destroyed, without reporting the ones not reported yet
+ */
+static void _app_closed_windows_free(PAppData *app_data)
+{
+	if (app_data->destroyed_window_data != NULL)
+	{
+		_window_close(app_data, app_data->destroyed_window_data);
+		app_data->destroyed_window_data = NULL;
+	}
+	p_light_mutex_lock(&app_data->window_mutex);
+	while (app_data->closed_window_data->num_items > 0)
+	{
+		uint last = app_data->closed_window_data->num_items - 1;
+		PWindowData *window_data = E_DYNARR_GET(app_data->closed_window_data, PWindowData *, last);
+		e_dynarr_remove_unordered(app_data->closed_window_data, last);
+		atomic_fetch_sub(&app_data->num_closed_windows, 1);
+		p_light_mutex_unlock(&app_data->window_mutex);
+		_window_close(app_data, window_data);
+		p_light_mutex_lock(&app_data->window_mutex);
+	}
+	p_light_mutex_unlock(&app_data->window_mutex);
+}
 
 /**
  * p_app_init
@@ -14,17 +43,23 @@ PAppData *p_app_init(PAppRequest app_request)
 {
 	setlocale(LC_ALL, "");
 
-	debug_memory_mutex = p_mutex_init();
 	p_debug_memory_init(&debug_memory_mutex);
 
 	PAppData *app_data = malloc(sizeof *app_data);
 	app_data->app_config = app_request.app_config;
 
 	// init window mutex
-	app_data->window_mutex = p_mutex_init();
+	p_light_mutex_init(&app_data->window_mutex);
+	p_cond_var_init(&app_data->window_cond_var);
 
 	// create the window array
 	app_data->window_data = e_dynarr_init(sizeof (PWindowData *), 1);
+	app_data->closed_window_data = e_dynarr_init(sizeof (PWindowData *), 1);
+	atomic_init(&app_data->num_closed_windows, 0);
+	app_data->destroyed_window_data = NULL;
+
+	// create the event queue
+	app_data->event_queue = p_event_queue_init(P_EVENT_QUEUE_SIZE);
 
 	// create the input manager
 	//app_data->input_manager = p_event_init();
@@ -32,6 +67,10 @@ PAppData *p_app_init(PAppRequest app_request)
 	// create the vulkan instance
 	app_data->graphical_app_data = p_graphics_init(&app_request.graphical_app_request);
 
+	// connect to the display server, a headless app never opens windows and may run without one
+	app_data->window_system = app_request.graphical_app_request.headless ? NULL :
+		p_window_system_init(app_data);
+
 #ifdef PLATINUM_PLATFORM_LINUX
 	p_linux_app_init(app_data, app_request);
 #elif defined PLATINUM_PLATFORM_WINDOWS
@@ -55,25 +94,71 @@ void p_app_deinit(PAppData *app_data)
 	p_windows_app_deinit(app_data);
 #endif // PLATINUM_PLATFORM_LINUX
 
-	while (app_data->window_data->num_items > 0)
+	// windows are handed over by their event thread once the display server has destroyed them
+	p_light_mutex_lock(&app_data->window_mutex);
+	for (uint i = 0; i < app_data->window_data->num_items; i++)
 	{
-		PWindowData *window_data = E_DYNARR_GET(app_data->window_data, PWindowData *, 0);
-		p_window_close(window_data);
-		p_thread_join(window_data->event_manager);
-		int index = e_dynarr_find(app_data->window_data, &window_data);
-		free(window_data->event_calls);
-		free(window_data->name);
-		free(window_data);
-		e_dynarr_remove_unordered(app_data->window_data, index);
+		PWindowData *window_data = E_DYNARR_GET(app_data->window_data, PWindowData *, i);
+		if (window_data->status == P_WINDOW_STATUS_ALIVE)
+			p_window_close(window_data);
 	}
+	while (app_data->window_data->num_items > 0)
+		p_cond_var_wait(&app_data->window_cond_var, &app_data->window_mutex);
+	p_light_mutex_unlock(&app_data->window_mutex);
+	_app_closed_windows_free(app_data);
+
+	if (app_data->window_system != NULL)
+		p_window_system_deinit(app_data->window_system);
 	e_dynarr_deinit(app_data->window_data);
-	p_mutex_destroy(app_data->window_mutex);
+	e_dynarr_deinit(app_data->closed_window_data);
+	p_event_queue_deinit(app_data->event_queue);
 
 	//p_event_deinit(app_data->input_manager);
 	p_graphics_deinit(app_data->graphical_app_data);
 
 	free(app_data);
 
+	// every other thread of the app has exited and freed its own
+	p_arena_scratch_deinit();
+
 	p_debug_mem_print(0);
-	p_mutex_destroy(debug_memory_mutex);
+}
+
+/**
+ * p_app_poll_events
+ *
+ * takes the oldest window event queued for the app.
+ * a destroyed window is reported with P_EVENT_DESTROY once all of its queued events have been taken,
+ * and freed along with its graphical display on the next call.
+ * must only be called from one thread, the one that draws to the windows, usually the main loop.
+ * returns false if there are no events left
+ */
+bool p_app_poll_events(PAppData *app_data, PEvent *event)
+{
+	// no event refers to the window of the last P_EVENT_DESTROY anymore
+	if (app_data->destroyed_window_data != NULL)
+	{
+		_window_close(app_data, app_data->destroyed_window_data);
+		app_data->destroyed_window_data = NULL;
+	}
+
+	if (atomic_load(&app_data->num_closed_windows) > 0)
+	{
+		size_t popped = p_event_queue_popped(app_data->event_queue);
+		p_light_mutex_lock(&app_data->window_mutex);
+		for (uint i = 0; i < app_data->closed_window_data->num_items; i++)
+		{
+			PWindowData *window_data = E_DYNARR_GET(app_data->closed_window_data, PWindowData *, i);
+			if (popped < window_data->closed_event_position)
+				continue;
+			e_dynarr_remove_unordered(app_data->closed_window_data, i);
+			atomic_fetch_sub(&app_data->num_closed_windows, 1);
+			p_light_mutex_unlock(&app_data->window_mutex);
+			app_data->destroyed_window_data = window_data;
+			*event = (PEvent){.type = P_EVENT_DESTROY, .window_data = window_data};
+			return true;
+		}
+		p_light_mutex_unlock(&app_data->window_mutex);
+	}
+	return p_event_queue_pop(app_data->event_queue, event);
 }
@@ -0,0 +1,157 @@
+#include "platinum.h"
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define P_EVENT_CACHE_LINE 64
+
+// Internal Structs
+
+typedef struct PEventCell PEventCell;
+
+/**
+ * PEventCell
+ *
+ * A slot in the event ring.
+ * sequence tells producers and the consumer whose turn it is to use the slot
+ */
+struct PEventCell {
+	atomic_size_t sequence;
+	PEvent event;
+};
+
+/**
+ * PEventQueue
+ *
+ * Bounded lock-free queue with many producers (event threads) and a single consumer (the app).
+ * Based on Dmitry Vyukov's bounded MPMC queue, with the consumer side simplified.
+ */
+struct PEventQueue {
+	PEventCell *cells;
+	size_t mask;
+	_Alignas(P_EVENT_CACHE_LINE) atomic_size_t enqueue_position;
+	_Alignas(P_EVENT_CACHE_LINE) size_t dequeue_position;
+	_Alignas(P_EVENT_CACHE_LINE) atomic_uint dropped;
+};
+
+/**
+ * p_event_queue_init
+ *
+ * creates an event queue holding at least size events
+ */
+PEventQueue *p_event_queue_init(uint size)
+{
+	size_t capacity = 2;
+	while (capacity < size)
+		capacity <<= 1;
+
+	// the positions are kept on their own cache lines, which needs the queue itself aligned to one
+	PEventQueue *event_queue = aligned_alloc(P_EVENT_CACHE_LINE, sizeof *event_queue);
+	if (event_queue == NULL)
+	{
+		p_log_message(P_LOG_ERROR, L"Phantom", L"Could not allocate the event queue");
+		exit(1);
+	}
+	event_queue->cells = malloc(capacity * sizeof *event_queue->cells);
+	event_queue->mask = capacity - 1;
+	for (size_t i = 0; i < capacity; i++)
+		atomic_init(&event_queue->cells[i].sequence, i);
+	atomic_init(&event_queue->enqueue_position, 0);
+	event_queue->dequeue_position = 0;
+	atomic_init(&event_queue->dropped, 0);
+	return event_queue;
+}
+
+/**
+ * p_event_queue_deinit
+ *
+ * frees an event queue and any events still in it
+ */
+void p_event_queue_deinit(PEventQueue *event_queue)
+{
+	free(event_queue->cells);
+	(free)(event_queue); // from aligned_alloc, not tracked by the memory debugger
+}
+
+/**
+ * p_event_queue_push
+ *
+ * copies event into the queue. Safe to call from any number of threads at once.
+ * returns false and drops the event if the queue is full
+ */
+bool p_event_queue_push(PEventQueue *event_queue, const PEvent *event)
+{
+	size_t position = atomic_load_explicit(&event_queue->enqueue_position, memory_order_relaxed);
+	PEventCell *cell;
+	for (;;)
+	{
+		cell = &event_queue->cells[position & event_queue->mask];
+		size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		ptrdiff_t difference = (ptrdiff_t)sequence - (ptrdiff_t)position;
+		if (difference == 0)
+		{
+			if (atomic_compare_exchange_weak_explicit(&event_queue->enqueue_position, &position, position + 1,
+						memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (difference < 0) {
+			if (atomic_fetch_add_explicit(&event_queue->dropped, 1, memory_order_relaxed) == 0)
+				p_log_message(P_LOG_WARNING, L"Phantom", L"Event queue is full, dropping events");
+			return false;
+		} else {
+			position = atomic_load_explicit(&event_queue->enqueue_position, memory_order_relaxed);
+		}
+	}
+
+	cell->event = *event;
+	atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+	return true;
+}
+
+/**
+ * p_event_queue_pop
+ *
+ * copies the oldest event out of the queue. Only one thread may pop from a queue.
+ * returns false if the queue is empty
+ */
+bool p_event_queue_pop(PEventQueue *event_queue, PEvent *event)
+{
+	size_t position = event_queue->dequeue_position;
+	PEventCell *cell = &event_queue->cells[position & event_queue->mask];
+	size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+	if (sequence != position + 1)
+		return false;
+
+	*event = cell->event;
+	atomic_store_explicit(&cell->sequence, position + event_queue->mask + 1, memory_order_release);
+	event_queue->dequeue_position = position + 1;
+	return true;
+}
+
+/**
+ * p_event_queue_dropped
+ *
+ * returns how many events were dropped because the queue was full
+ */
+uint p_event_queue_dropped(const PEventQueue *event_queue)
+{
+	return atomic_load_explicit(&event_queue->dropped, memory_order_relaxed);
+}
+
+/**
+ * p_event_queue_pushed
+ *
+ * returns how many events have been pushed, or are being pushed, onto the queue so far
+ */
+size_t p_event_queue_pushed(const PEventQueue *event_queue)
+{
+	return atomic_load_explicit(&event_queue->enqueue_position, memory_order_relaxed);
+}
+
+/**
+ * p_event_queue_popped
+ *
+ * returns how many events have been popped off the queue so far. Only the popping thread may call this
+ */
+size_t p_event_queue_popped(const PEventQueue *event_queue)
+{
+	return event_queue->dequeue_position;
+}
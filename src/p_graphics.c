@@ -54,37 +54,405 @@ void p_graphics_display_destroy(PGraphicalDisplayData graphical_display_data)
 }
 
 /**
- * p_graphics_device_set
+ * p_graphics_display_draw
  *
- * sets the physical device to use in graphical_display_data from physical_device
+ * Draws and presents one frame to the window's display
+ * returns false if nothing was drawn
  */
-void p_graphics_device_set(
-		PGraphicalDisplayData graphical_display_data,
-		const PGraphicalDisplayRequest * const graphical_display_request,
-		const PGraphicalDevice physical_device,
-		const PGraphicalDisplayData display,
-		const PWindowData * const window_data)
+bool p_graphics_display_draw(PWindowData *window_data)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	return p_graphics_vulkan_display_draw(window_data);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_headless_display_create
+ *
+ * creates a display that renders into offscreen images instead of a window
+ * returns the display, drawn with p_graphics_headless_display_draw and destroyed with p_graphics_display_destroy
+ */
+PGraphicalDisplayData p_graphics_headless_display_create(const PGraphicalAppData graphical_app_data,
+		const PGraphicalDisplayRequest * const graphical_display_request, uint width, uint height)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	return p_graphics_vulkan_headless_display_create(graphical_app_data, graphical_display_request, width, height);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_headless_display_draw
+ *
+ * draws a frame of a headless display
+ */
+bool p_graphics_headless_display_draw(PGraphicalDisplayData graphical_display_data)
 {
 #ifdef PLATINUM_GRAPHICS_VULKAN
-	p_graphics_vulkan_device_set(graphical_display_data, graphical_display_request, physical_device,
-			display, window_data);
+	return p_graphics_vulkan_headless_display_draw(graphical_display_data);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_display_read
+ *
+ * copies the last frame of a headless display into pixels as RGBA8
+ */
+bool p_graphics_display_read(PGraphicalDisplayData graphical_display_data, void *pixels)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	return p_graphics_vulkan_display_read(graphical_display_data, pixels);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_display_latency_mode
+ *
+ * returns the latency mode the display is presenting with
+ */
+enum PGraphicalLatencyMode p_graphics_display_latency_mode(const PGraphicalDisplayData graphical_display_data)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	return p_graphics_vulkan_display_latency_mode(graphical_display_data);
 #endif // PLATINUM_GRAPHICS
 }
 
 /**
  * p_graphics_device_auto_pick
  *
- * initializes compatible_devices in graphical_display_data
- * picks the physical device for use with vulkan and returns it
+ * initializes compatible_devices in graphical_app_data
+ * picks the physical device for use with display and returns it
  * returns a PGraphicalDevice
  */
 PGraphicalDevice p_graphics_device_auto_pick(
-		PGraphicalDisplayData graphical_display_data,
-		const PGraphicalAppData graphical_app_data,
+		PGraphicalAppData graphical_app_data,
+		const PGraphicalDisplayData display,
 		const PGraphicalDisplayRequest * const graphical_display_request)
 {
 #ifdef PLATINUM_GRAPHICS_VULKAN
-	return p_graphics_vulkan_device_auto_pick(graphical_display_data, graphical_app_data,
-			graphical_display_request);
+	return p_graphics_vulkan_device_auto_pick(graphical_app_data, display, graphical_display_request);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_buffer_create
+ *
+ * creates a buffer with its memory taken from the device's allocator
+ */
+PGraphicsBuffer *p_graphics_buffer_create(PGraphicalDisplayData graphical_display_data,
+		const PGraphicsBufferRequest * const buffer_request)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	return p_graphics_vulkan_buffer_create(graphical_display_data, buffer_request);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_buffer_destroy
+ *
+ * destroys a buffer and returns its memory to the allocator
+ */
+void p_graphics_buffer_destroy(PGraphicsBuffer *buffer)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	p_graphics_vulkan_buffer_destroy(buffer);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_buffer_map
+ *
+ * returns the CPU address of a buffer, NULL if its memory usage is P_GRAPHICS_MEMORY_GPU_ONLY
+ */
+void *p_graphics_buffer_map(const PGraphicsBuffer *buffer)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	return p_graphics_vulkan_buffer_map(buffer);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_buffer_flush
+ *
+ * makes CPU writes to a mapped range of a buffer visible to the GPU
+ */
+void p_graphics_buffer_flush(const PGraphicsBuffer *buffer, uint64_t offset, uint64_t size)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	p_graphics_vulkan_buffer_flush(buffer, offset, size);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_buffer_invalidate
+ *
+ * makes GPU writes to a mapped range of a buffer visible to the CPU
+ */
+void p_graphics_buffer_invalidate(const PGraphicsBuffer *buffer, uint64_t offset, uint64_t size)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	p_graphics_vulkan_buffer_invalidate(buffer, offset, size);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_image_create
+ *
+ * creates an image with its memory taken from the device's allocator
+ */
+PGraphicsImage *p_graphics_image_create(PGraphicalDisplayData graphical_display_data,
+		const PGraphicsImageRequest * const image_request)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	return p_graphics_vulkan_image_create(graphical_display_data, image_request);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_image_destroy
+ *
+ * destroys an image and returns its memory to the allocator
+ */
+void p_graphics_image_destroy(PGraphicsImage *image)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	p_graphics_vulkan_image_destroy(image);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_memory_budget
+ *
+ * fills budgets with the usage and budget of every memory heap
+ * returns the number of heaps
+ */
+uint p_graphics_memory_budget(const PGraphicalDisplayData graphical_display_data,
+		PGraphicsMemoryBudget budgets[P_GRAPHICS_MEMORY_HEAPS_MAX])
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	return p_graphics_vulkan_memory_budget(graphical_display_data, budgets);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_memory_defragment
+ *
+ * compacts buffers into fewer memory blocks and frees the emptied blocks
+ * none of the buffers may be in use by the GPU while this runs
+ * returns the number of buffers moved
+ */
+uint p_graphics_memory_defragment(PGraphicalDisplayData graphical_display_data, PGraphicsMoveFunction move_function,
+		void *args)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	return p_graphics_vulkan_memory_defragment(graphical_display_data, move_function, args);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_buffer_upload
+ *
+ * copies data into buffer on the transfer queue, overlapping with rendering
+ * data can be reused as soon as this returns
+ * returns an upload value to pass to p_graphics_upload_done or p_graphics_upload_wait
+ */
+uint64_t p_graphics_buffer_upload(PGraphicalDisplayData graphical_display_data, PGraphicsBuffer *buffer,
+		uint64_t offset, const void *data, uint64_t size)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	return p_graphics_vulkan_buffer_upload(graphical_display_data, buffer, offset, data, size);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_image_upload
+ *
+ * replaces the contents of image with data on the transfer queue, overlapping with rendering
+ * data can be reused as soon as this returns
+ * returns an upload value to pass to p_graphics_upload_done or p_graphics_upload_wait
+ */
+uint64_t p_graphics_image_upload(PGraphicalDisplayData graphical_display_data, PGraphicsImage *image,
+		const void *data)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	return p_graphics_vulkan_image_upload(graphical_display_data, image, data);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_upload_flush
+ *
+ * starts the uploads made so far, drawing does this too
+ */
+void p_graphics_upload_flush(PGraphicalDisplayData graphical_display_data)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	p_graphics_vulkan_upload_flush(graphical_display_data);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_upload_done
+ *
+ * returns whether the upload is finished
+ */
+bool p_graphics_upload_done(const PGraphicalDisplayData graphical_display_data, uint64_t upload)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	return p_graphics_vulkan_upload_done(graphical_display_data, upload);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_upload_wait
+ *
+ * blocks until the upload is finished
+ */
+void p_graphics_upload_wait(PGraphicalDisplayData graphical_display_data, uint64_t upload)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	p_graphics_vulkan_upload_wait(graphical_display_data, upload);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_display_set_recorder
+ *
+ * records every frame of the display as record_count parts on job_system instead of on the drawing thread
+ * record_function(command_buffer, index, args) is called once per part each frame
+ * a NULL job_system goes back to recording on the drawing thread
+ */
+void p_graphics_display_set_recorder(PGraphicalDisplayData graphical_display_data, PJobSystem *job_system,
+		uint record_count, PGraphicsRecordFunction record_function, void *args)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	p_graphics_vulkan_display_set_recorder(graphical_display_data, job_system, record_count, record_function, args);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_command_draw
+ *
+ * records a draw with the display's pipeline into command_buffer
+ */
+void p_graphics_command_draw(PGraphicsCommandBuffer *command_buffer, uint vertex_count, uint instance_count,
+		uint first_vertex, uint first_instance)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	p_graphics_vulkan_command_draw(command_buffer, vertex_count, instance_count, first_vertex, first_instance);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_profile_begin
+ *
+ * starts timing the GPU work recorded into command_buffer until the matching p_graphics_profile_end
+ * scopes nest, name is not copied and must be a static string such as a string literal
+ */
+void p_graphics_profile_begin(PGraphicsCommandBuffer *command_buffer, const char *name)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	p_graphics_vulkan_profile_begin(command_buffer, name);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_profile_end
+ *
+ * ends the last scope begun in command_buffer
+ */
+void p_graphics_profile_end(PGraphicsCommandBuffer *command_buffer)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	p_graphics_vulkan_profile_end(command_buffer);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_profile_frame
+ *
+ * sets scopes to the GPU times of the latest frame the GPU finished and returns how many there are
+ * the frame is a few frames behind the one being drawn, scopes stay valid until the next draw
+ */
+uint p_graphics_profile_frame(const PGraphicalDisplayData graphical_display_data,
+		const PGraphicsProfileScope **scopes)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	return p_graphics_vulkan_profile_frame(graphical_display_data, scopes);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_profile_dump
+ *
+ * writes the GPU times of the latest frames to path as a Chrome trace (chrome://tracing, Perfetto)
+ * returns false if the file could not be written
+ */
+bool p_graphics_profile_dump(const PGraphicalDisplayData graphical_display_data, const char *path)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	return p_graphics_vulkan_profile_dump(graphical_display_data, path);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_pipelines_build
+ *
+ * starts compiling count pipelines for the display's render pass at once on job_system
+ * pipelines gets a handle per request right away, usable once the pipeline is ready
+ */
+void p_graphics_pipelines_build(PGraphicalDisplayData graphical_display_data, PJobSystem *job_system, uint count,
+		const PGraphicsPipelineRequest *pipeline_requests, PGraphicsPipeline **pipelines)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	p_graphics_vulkan_pipelines_build(graphical_display_data, job_system, count, pipeline_requests, pipelines);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_pipeline_ready
+ *
+ * returns true once the pipeline is done compiling, without waiting
+ */
+bool p_graphics_pipeline_ready(const PGraphicsPipeline *pipeline)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	return p_graphics_vulkan_pipeline_ready(pipeline);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_pipeline_wait
+ *
+ * waits for the pipeline to be done compiling
+ * returns false if compiling it failed
+ */
+bool p_graphics_pipeline_wait(PGraphicsPipeline *pipeline)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	return p_graphics_vulkan_pipeline_wait(pipeline);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_pipeline_destroy
+ *
+ * destroys a pipeline, waiting for it to be compiled first
+ */
+void p_graphics_pipeline_destroy(PGraphicsPipeline *pipeline)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	p_graphics_vulkan_pipeline_destroy(pipeline);
+#endif // PLATINUM_GRAPHICS
+}
+
+/**
+ * p_graphics_command_bind_pipeline
+ *
+ * makes the following draws in command_buffer use pipeline, which must be ready
+ */
+void p_graphics_command_bind_pipeline(PGraphicsCommandBuffer *command_buffer, const PGraphicsPipeline *pipeline)
+{
+#ifdef PLATINUM_GRAPHICS_VULKAN
+	p_graphics_vulkan_command_bind_pipeline(command_buffer, pipeline);
 #endif // PLATINUM_GRAPHICS
 }
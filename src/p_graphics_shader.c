@@ -0,0 +1,29 @@
+#include "platinum.h"
+#include <string.h>
+
+// Generated from the compiled shaders by shaders/embed_spirv.py, sorted by name
+extern const PGraphicsShader p_graphics_shaders_embedded[];
+extern const uint p_graphics_shaders_embedded_count;
+
+/**
+ * p_graphics_shader_find
+ *
+ * returns the shader compiled into the library under name, NULL if there is none
+ */
+const PGraphicsShader *p_graphics_shader_find(const char *name)
+{
+	uint low = 0;
+	uint high = p_graphics_shaders_embedded_count;
+	while (low < high)
+	{
+		uint middle = low + (high - low) / 2;
+		int order = strcmp(name, p_graphics_shaders_embedded[middle].name);
+		if (order == 0)
+			return &p_graphics_shaders_embedded[middle];
+		if (order < 0)
+			high = middle;
+		else
+			low = middle + 1;
+	}
+	return NULL;
+}
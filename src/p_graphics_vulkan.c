@@ -1,4 +1,5 @@
 #include "platinum.h"
+#include <stdio.h>
 #include <string.h>
 #include "p_graphics_vulkan.h"
 
@@ -55,12 +56,13 @@ void _vulkan_app_request_destroy(PVulkanAppRequest *vulkan_app_request)
 /**
  * _vulkan_display_request_convert
  *
- * converts PGraphicalDisplayRequest into PVulkanDisplayRequest
+ * converts PGraphicalDisplayRequest into PVulkanDisplayRequest, allocated from arena
  */
 static
-PVulkanDisplayRequest *_vulkan_display_request_convert(const PGraphicalDisplayRequest * const graphic_display_request)
+PVulkanDisplayRequest *_vulkan_display_request_convert(PArena *arena,
+		const PGraphicalDisplayRequest * const graphic_display_request)
 {
-	PVulkanDisplayRequest *vulkan_display_request = malloc(sizeof(PVulkanDisplayRequest));
+	PVulkanDisplayRequest *vulkan_display_request = p_arena_alloc(arena, sizeof(PVulkanDisplayRequest));
 
 	// Convert wrapper request into needed data
 	vulkan_display_request->stereoscopic = graphic_display_request->stereoscopic;
@@ -87,62 +89,238 @@ PVulkanDisplayRequest *_vulkan_display_request_convert(const PGraphicalDisplayRe
 /**
  * _vulkan_display_request_destroy
  *
- * deinits data created as a part of request init
+ * deinits data created as a part of request init, the request itself is released with its arena
  */
 void _vulkan_display_request_destroy(PVulkanDisplayRequest *vulkan_display_request)
 {
 	e_dynarr_deinit(vulkan_display_request->required_extensions);
 	e_dynarr_deinit(vulkan_display_request->required_layers);
-	free(vulkan_display_request);
 }
 
 /**
- * _vulkan_extension_exists
+ * _vulkan_name_hash
  *
- * returns true if the vulkan_extension is found
+ * FNV-1a hash of a nul terminated name
  */
-static bool _vulkan_extension_exists(const char * const vulkan_extension)
+static uint32_t _vulkan_name_hash(const char *name)
 {
-	// Check availible extensions
-	uint32_t vulkan_available_extension_count;
-	vkEnumerateInstanceExtensionProperties(NULL, &vulkan_available_extension_count, NULL);
-	VkExtensionProperties *vulkan_available_extensions = malloc(vulkan_available_extension_count *
-			sizeof(VkExtensionProperties));
-	vkEnumerateInstanceExtensionProperties(NULL, &vulkan_available_extension_count, vulkan_available_extensions);
-	for (uint32_t i = 0; i < vulkan_available_extension_count; i++)
+	uint32_t hash = 2166136261u;
+	for (; *name != '\0'; name++)
 	{
-		if (strcmp(vulkan_extension, vulkan_available_extensions[i].extensionName))
-		{
-			free(vulkan_available_extensions);
+		hash ^= (uint8_t)*name;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * _vulkan_name_set_init
+ *
+ * creates an empty name set with room for count names
+ */
+static void _vulkan_name_set_init(PVulkanNameSet *name_set, uint32_t count)
+{
+	// keep the table at most half full so probes stay short
+	uint32_t slot_count = 8;
+	while (slot_count < count * 2)
+		slot_count <<= 1;
+	name_set->count = 0;
+	name_set->mask = slot_count - 1;
+	name_set->names = malloc((count > 0 ? count : 1) * sizeof *name_set->names);
+	name_set->slots = calloc(slot_count, sizeof *name_set->slots);
+}
+
+/**
+ * _vulkan_name_set_deinit
+ *
+ * frees the memory held by a name set
+ */
+static void _vulkan_name_set_deinit(PVulkanNameSet *name_set)
+{
+	free(name_set->names);
+	free(name_set->slots);
+}
+
+/**
+ * _vulkan_name_set_contains
+ *
+ * returns true if name is in name_set
+ */
+static bool _vulkan_name_set_contains(const PVulkanNameSet * const name_set, const char * const name)
+{
+	for (uint32_t i = _vulkan_name_hash(name) & name_set->mask;; i = (i + 1) & name_set->mask)
+	{
+		uint32_t slot = name_set->slots[i];
+		if (slot == 0)
+			return false;
+		if (strcmp(name_set->names[slot - 1], name) == 0)
 			return true;
-		}
 	}
-	free(vulkan_available_extensions);
-	return false;
 }
 
 /**
- * _vulkan_layer_exists
+ * _vulkan_name_set_add
  *
- * returns true if the vulkan_layer is found
+ * adds name to name_set, which must have been created with room for it
  */
-static bool _vulkan_layer_exists(const char * const vulkan_layer)
+static void _vulkan_name_set_add(PVulkanNameSet *name_set, const char * const name)
 {
-	// Check availible layers
-	uint32_t vulkan_available_layer_count;
-	vkEnumerateInstanceLayerProperties(&vulkan_available_layer_count, NULL);
-	VkLayerProperties *vulkan_available_layers = malloc(vulkan_available_layer_count * sizeof(VkLayerProperties));
-	vkEnumerateInstanceLayerProperties(&vulkan_available_layer_count, vulkan_available_layers);
-	for (uint32_t i = 0; i < vulkan_available_layer_count; i++)
+	if (_vulkan_name_set_contains(name_set, name))
+		return;
+	uint32_t i = _vulkan_name_hash(name) & name_set->mask;
+	while (name_set->slots[i] != 0)
+		i = (i + 1) & name_set->mask;
+	strncpy(name_set->names[name_set->count], name, VK_MAX_EXTENSION_NAME_SIZE - 1);
+	name_set->names[name_set->count][VK_MAX_EXTENSION_NAME_SIZE - 1] = '\0';
+	name_set->slots[i] = ++name_set->count;
+}
+
+/**
+ * _vulkan_instance_extensions_init
+ *
+ * fills name_set with the extensions available to the vulkan instance
+ */
+static void _vulkan_instance_extensions_init(PVulkanNameSet *name_set)
+{
+	PArena *scratch = p_arena_scratch();
+	PArenaMark mark = p_arena_mark(scratch);
+	uint32_t extension_count = 0;
+	vkEnumerateInstanceExtensionProperties(NULL, &extension_count, NULL);
+	VkExtensionProperties *extensions = p_arena_alloc(scratch, extension_count * sizeof *extensions);
+	vkEnumerateInstanceExtensionProperties(NULL, &extension_count, extensions);
+	_vulkan_name_set_init(name_set, extension_count);
+	for (uint32_t i = 0; i < extension_count; i++)
+		_vulkan_name_set_add(name_set, extensions[i].extensionName);
+	p_arena_reset(scratch, mark);
+}
+
+/**
+ * _vulkan_instance_layers_init
+ *
+ * fills name_set with the layers available to the vulkan instance
+ */
+static void _vulkan_instance_layers_init(PVulkanNameSet *name_set)
+{
+	PArena *scratch = p_arena_scratch();
+	PArenaMark mark = p_arena_mark(scratch);
+	uint32_t layer_count = 0;
+	vkEnumerateInstanceLayerProperties(&layer_count, NULL);
+	VkLayerProperties *layers = p_arena_alloc(scratch, layer_count * sizeof *layers);
+	vkEnumerateInstanceLayerProperties(&layer_count, layers);
+	_vulkan_name_set_init(name_set, layer_count);
+	for (uint32_t i = 0; i < layer_count; i++)
+		_vulkan_name_set_add(name_set, layers[i].layerName);
+	p_arena_reset(scratch, mark);
+}
+
+/**
+ * _vulkan_physical_device_infos_init
+ *
+ * queries everything device selection and device creation need from every physical device once
+ * returns a dynarr of PVulkanPhysicalDeviceInfo
+ */
+static EDynarr *_vulkan_physical_device_infos_init(const VkInstance instance)
+{
+	PArena *scratch = p_arena_scratch();
+	PArenaMark mark = p_arena_mark(scratch);
+	uint32_t device_count = 0;
+	vkEnumeratePhysicalDevices(instance, &device_count, NULL);
+	VkPhysicalDevice *devices = p_arena_alloc(scratch, device_count * sizeof *devices);
+	vkEnumeratePhysicalDevices(instance, &device_count, devices);
+
+	EDynarr *physical_device_infos = e_dynarr_init(sizeof (PVulkanPhysicalDeviceInfo), device_count);
+	for (uint32_t i = 0; i < device_count; i++)
 	{
-		if (strcmp(vulkan_layer, vulkan_available_layers[i].layerName))
+		PVulkanPhysicalDeviceInfo info = {0};
+		info.handle = devices[i];
+		vkGetPhysicalDeviceProperties(info.handle, &info.properties);
+		vkGetPhysicalDeviceFeatures(info.handle, &info.features);
+		vkGetPhysicalDeviceMemoryProperties(info.handle, &info.memory_properties);
+		if (info.properties.apiVersion >= VK_API_VERSION_1_2)
 		{
-			free(vulkan_available_layers);
-			return true;
+			VkPhysicalDeviceVulkan12Features features_12 = {0};
+			features_12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+			VkPhysicalDeviceFeatures2 features = {0};
+			features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+			features.pNext = &features_12;
+			vkGetPhysicalDeviceFeatures2(info.handle, &features);
+			info.timeline_semaphore = features_12.timelineSemaphore;
 		}
+
+		vkGetPhysicalDeviceQueueFamilyProperties(info.handle, &info.queue_family_count, NULL);
+		info.queue_families = malloc(info.queue_family_count * sizeof *info.queue_families);
+		vkGetPhysicalDeviceQueueFamilyProperties(info.handle, &info.queue_family_count, info.queue_families);
+
+		PArenaMark device_mark = p_arena_mark(scratch);
+		uint32_t extension_count = 0;
+		vkEnumerateDeviceExtensionProperties(info.handle, NULL, &extension_count, NULL);
+		VkExtensionProperties *extensions = p_arena_alloc(scratch, extension_count * sizeof *extensions);
+		vkEnumerateDeviceExtensionProperties(info.handle, NULL, &extension_count, extensions);
+		_vulkan_name_set_init(&info.extensions, extension_count);
+		for (uint32_t j = 0; j < extension_count; j++)
+			_vulkan_name_set_add(&info.extensions, extensions[j].extensionName);
+		p_arena_reset(scratch, device_mark);
+
+		e_dynarr_add(physical_device_infos, &info);
 	}
-	free(vulkan_available_layers);
-	return false;
+	p_arena_reset(scratch, mark);
+	return physical_device_infos;
+}
+
+/**
+ * _vulkan_physical_device_infos_deinit
+ *
+ * frees the physical device infos made by _vulkan_physical_device_infos_init
+ */
+static void _vulkan_physical_device_infos_deinit(EDynarr *physical_device_infos)
+{
+	for (uint i = 0; i < physical_device_infos->num_items; i++)
+	{
+		PVulkanPhysicalDeviceInfo *info = &E_DYNARR_GET(physical_device_infos, PVulkanPhysicalDeviceInfo, i);
+		free(info->queue_families);
+		_vulkan_name_set_deinit(&info->extensions);
+	}
+	e_dynarr_deinit(physical_device_infos);
+}
+
+/**
+ * _vulkan_physical_device_info_find
+ *
+ * returns the cached info of physical_device, NULL if it is unknown
+ */
+static const PVulkanPhysicalDeviceInfo *_vulkan_physical_device_info_find(const PGraphicalAppData vulkan_app_data,
+		const VkPhysicalDevice physical_device)
+{
+	for (uint i = 0; i < vulkan_app_data->physical_device_infos->num_items; i++)
+	{
+		const PVulkanPhysicalDeviceInfo *info = &E_DYNARR_GET(vulkan_app_data->physical_device_infos,
+				PVulkanPhysicalDeviceInfo, i);
+		if (info->handle == physical_device)
+			return info;
+	}
+	return NULL;
+}
+
+/**
+ * _vulkan_present_queue_families
+ *
+ * returns a mask of the queue families of a device that can present to surface
+ * bit i is set if queue family i can present
+ */
+static uint64_t _vulkan_present_queue_families(const PVulkanPhysicalDeviceInfo * const info,
+		const VkSurfaceKHR surface)
+{
+	uint64_t present_queue_families = 0;
+	if (surface == VK_NULL_HANDLE)
+		return present_queue_families;
+	for (uint32_t i = 0; i < info->queue_family_count && i < 64; i++)
+	{
+		VkBool32 present_supported = VK_FALSE;
+		vkGetPhysicalDeviceSurfaceSupportKHR(info->handle, i, surface, &present_supported);
+		if (present_supported)
+			present_queue_families |= 1ULL << i;
+	}
+	return present_queue_families;
 }
 
 /**
@@ -322,28 +500,46 @@ static VkDebugUtilsMessengerCreateInfoEXT _vulkan_init_debug_messenger(void)
  *
  * returns the first viable queue family info, when present_queue is true, it ignores queue_flag
  * and returns a present queue
+ * present_queue_families comes from _vulkan_present_queue_families
  */
-static PVulkanQueueFamilyInfo _vulkan_find_viable_queue_family_info(const VkPhysicalDevice device,
-		const VkSurfaceKHR surface, VkQueueFlagBits queue_flag, bool require_present)
+static PVulkanQueueFamilyInfo _vulkan_find_viable_queue_family_info(const PVulkanPhysicalDeviceInfo * const info,
+		const uint64_t present_queue_families, VkQueueFlagBits queue_flag, bool require_present)
 {
-	uint32_t queue_family_count = 0;
-	vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count, NULL);
-	VkQueueFamilyProperties *queue_families = malloc(queue_family_count * sizeof *queue_families);
-	vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count, queue_families);
-
-	for (uint i = 0; i < queue_family_count; i++)
+	for (uint i = 0; i < info->queue_family_count; i++)
 	{
-		VkBool32 present_supported = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &present_supported);
+		bool present_supported = i < 64 && (present_queue_families & (1ULL << i));
 		PVulkanQueueFamilyInfo queue_family_info = { .flags = queue_flag, .exists = true, .index = i };
 
-		if ((require_present && present_supported) || (queue_families[i].queueFlags & queue_flag))
-		{
-			free(queue_families);
+		if ((require_present && present_supported) || (info->queue_families[i].queueFlags & queue_flag))
 			return queue_family_info;
+	}
+	return (PVulkanQueueFamilyInfo){0};
+}
+
+/**
+ * _vulkan_find_transfer_queue_family_info
+ *
+ * returns the queue family best suited for uploads
+ * prefers a transfer only family, then one without graphics, then any that can transfer
+ * graphics and compute families can always transfer even when they do not say so
+ */
+static PVulkanQueueFamilyInfo _vulkan_find_transfer_queue_family_info(const PVulkanPhysicalDeviceInfo * const info)
+{
+	const VkQueueFlags transfer_flags = VK_QUEUE_TRANSFER_BIT | VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
+	const VkQueueFlags avoided_flags[] = {
+		VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT,
+		VK_QUEUE_GRAPHICS_BIT,
+		0,
+	};
+	for (uint pass = 0; pass < sizeof avoided_flags / sizeof *avoided_flags; pass++)
+	{
+		for (uint i = 0; i < info->queue_family_count; i++)
+		{
+			VkQueueFlags flags = info->queue_families[i].queueFlags;
+			if ((flags & transfer_flags) && !(flags & avoided_flags[pass]))
+				return (PVulkanQueueFamilyInfo){ .flags = VK_QUEUE_TRANSFER_BIT, .exists = true, .index = i };
 		}
 	}
-	free(queue_families);
 	return (PVulkanQueueFamilyInfo){0};
 }
 
@@ -355,10 +551,9 @@ static PVulkanQueueFamilyInfo _vulkan_find_viable_queue_family_info(const VkPhys
  * if a required feature does not exist it exits
  */
 static VkPhysicalDeviceFeatures _vulkan_get_required_features(const PVulkanDisplayRequest * const vulkan_display_request,
-		const VkPhysicalDevice device)
+		const PVulkanPhysicalDeviceInfo * const info)
 {
-	VkPhysicalDeviceFeatures device_features;
-	vkGetPhysicalDeviceFeatures(device, &device_features);
+	const VkPhysicalDeviceFeatures device_features = info->features;
 
 	EDynarr *missing_features = e_dynarr_init(sizeof (const wchar_t *), 1);
 	if (vulkan_display_request->required_features.robustBufferAccess && !device_features.robustBufferAccess) e_dynarr_add(missing_features, L"robustBufferAccess");
@@ -434,13 +629,13 @@ static VkPhysicalDeviceFeatures _vulkan_get_required_features(const PVulkanDispl
  * if a required queue flag does not exist it exits
  */
 static VkQueueFlags _vulkan_get_required_queue_flags(const PVulkanDisplayRequest * const vulkan_display_request,
-		const VkPhysicalDevice device,
-		const VkSurfaceKHR surface)
+		const PVulkanPhysicalDeviceInfo * const info,
+		const uint64_t present_queue_families)
 {
 	if (vulkan_display_request->require_present)
 	{
 		PVulkanQueueFamilyInfo queue_family_info = _vulkan_find_viable_queue_family_info(
-				device, surface, 0, true);
+				info, present_queue_families, 0, true);
 		if (!queue_family_info.exists)
 		{
 			p_log_message(P_LOG_ERROR, L"Vulkan General", L"Presentation not supported.");
@@ -452,7 +647,8 @@ static VkQueueFlags _vulkan_get_required_queue_flags(const PVulkanDisplayRequest
 	// evaluate optional and required queue flags
 	for (VkQueueFlags flag = 1ULL; flag < VK_QUEUE_FLAG_BITS_MAX_ENUM; flag <<= 1)
 	{
-		PVulkanQueueFamilyInfo queue_family_info = _vulkan_find_viable_queue_family_info(device, surface, flag, false);
+		PVulkanQueueFamilyInfo queue_family_info = _vulkan_find_viable_queue_family_info(info,
+				present_queue_families, flag, false);
 		if ((flag & vulkan_display_request->required_queue_flags) && !queue_family_info.exists)
 		{
 			p_log_message(P_LOG_ERROR, L"Vulkan General", L"Required Vulkan queue type \"%i\" does not exist!", flag);
@@ -466,16 +662,17 @@ static VkQueueFlags _vulkan_get_required_queue_flags(const PVulkanDisplayRequest
 /**
  * _vulkan_get_required_extensions
  *
- * returns the required and optional extensions that exist
+ * returns the required and optional extensions that exist in available_extensions
  * if a required extension does not exist it exits
  */
-static EDynarr *_vulkan_get_required_extensions(const EDynarr * const required_extensions)
+static EDynarr *_vulkan_get_required_extensions(const PVulkanNameSet * const available_extensions,
+		const EDynarr * const required_extensions)
 {
 	EDynarr *extensions = e_dynarr_init(sizeof (char *), required_extensions->num_items);
 	for (uint i = 0; i < required_extensions->num_items; i++)
 	{
 		char *extension = E_DYNARR_GET(required_extensions, char *, i);
-		if(_vulkan_extension_exists(extension))
+		if(_vulkan_name_set_contains(available_extensions, extension))
 			e_dynarr_add(extensions, E_VOID_PTR_FROM_VALUE(char *, extension));
 		else
 		{
@@ -489,16 +686,17 @@ static EDynarr *_vulkan_get_required_extensions(const EDynarr * const required_e
 /**
  * _vulkan_get_required_layers
  *
- * returns the required and optional layers that exist
+ * returns the required and optional layers that exist in available_layers
  * if a required layer does not exist it exits
  */
-EDynarr *_vulkan_get_required_layers(const EDynarr * const required_layers)
+EDynarr *_vulkan_get_required_layers(const PVulkanNameSet * const available_layers,
+		const EDynarr * const required_layers)
 {
 	EDynarr *enabled_layers = e_dynarr_init(sizeof (char *), required_layers->num_items);
 	for (uint i = 0; i < required_layers->num_items; i++)
 	{
 		char *layer = E_DYNARR_GET(required_layers, char *, i);
-		if(_vulkan_layer_exists(layer))
+		if(_vulkan_name_set_contains(available_layers, layer))
 			e_dynarr_add(enabled_layers, E_VOID_PTR_FROM_VALUE(char *,layer));
 		else
 		{
@@ -509,36 +707,245 @@ EDynarr *_vulkan_get_required_layers(const EDynarr * const required_layers)
 	return enabled_layers;
 }
 
+/**
+ * _vulkan_present_modes_preferred
+ *
+ * returns the present modes that fit latency_mode, best first, ending with FIFO which is always supported
+ */
+static const VkPresentModeKHR *_vulkan_present_modes_preferred(const enum PGraphicalLatencyMode latency_mode)
+{
+	static const VkPresentModeKHR lowest[] = {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR,
+		VK_PRESENT_MODE_FIFO_KHR};
+	static const VkPresentModeKHR triple_buffered[] = {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR};
+	static const VkPresentModeKHR power_saving[] = {VK_PRESENT_MODE_FIFO_KHR};
+	static const VkPresentModeKHR adaptive[] = {VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_FIFO_KHR};
+	switch (latency_mode)
+	{
+		case P_GRAPHICAL_LATENCY_LOWEST:
+			return lowest;
+		case P_GRAPHICAL_LATENCY_POWER_SAVING:
+			return power_saving;
+		case P_GRAPHICAL_LATENCY_ADAPTIVE:
+			return adaptive;
+		case P_GRAPHICAL_LATENCY_TRIPLE_BUFFERED:
+		case P_GRAPHICAL_LATENCY_DEFAULT:
+		default:
+			return triple_buffered;
+	}
+}
+
+/**
+ * _vulkan_swapchain_auto_pick
+ *
+ * helper function that returns the swapchain details closest to the desired settings
+ * the present mode is the first supported one from _vulkan_present_modes_preferred
+ * if none exist returns NULL in appropriate fields. The fields are allocated from arena
+ */
+static PVulkanSwapchainSupport _vulkan_swapchain_auto_pick(PArena *arena, const VkPhysicalDevice physical_device,
+		const VkSurfaceKHR surface, const enum PGraphicalLatencyMode latency_mode)
+{
+	PVulkanSwapchainSupport swapchain_support = {0};
+
+	// Set swapchain details
+	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, surface, &swapchain_support.capabilities);
+
+	// Set surface format
+	uint32_t format_count;
+	vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &format_count, NULL);
+	if (format_count != 0)
+	{
+		VkSurfaceFormatKHR *formats = p_arena_alloc(arena, format_count * sizeof *formats);
+		vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &format_count, formats);
+
+		swapchain_support.format = &formats[0];
+		for (uint i = 0; i < format_count; i++)
+		{
+			if (formats[i].format == VK_FORMAT_B8G8R8A8_SRGB)
+			{
+				swapchain_support.format = &formats[i];
+				break;
+			}
+		}
+	}
+
+	// Set present mode
+	uint32_t present_mode_count;
+	vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &present_mode_count, NULL);
+	if (present_mode_count != 0)
+	{
+		VkPresentModeKHR *present_modes = p_arena_alloc(arena, present_mode_count * sizeof *present_modes);
+		vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &present_mode_count, present_modes);
+
+		const VkPresentModeKHR *preferred_present_modes = _vulkan_present_modes_preferred(latency_mode);
+		VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
+		for (uint i = 0; preferred_present_modes[i] != VK_PRESENT_MODE_FIFO_KHR; i++)
+		{
+			uint j = 0;
+			while (j < present_mode_count && present_modes[j] != preferred_present_modes[i])
+				j++;
+			if (j < present_mode_count)
+			{
+				present_mode = preferred_present_modes[i];
+				break;
+			}
+		}
+		swapchain_support.present_mode = p_arena_alloc(arena, sizeof *swapchain_support.present_mode);
+		*swapchain_support.present_mode = present_mode;
+	}
+	return swapchain_support;
+}
+
+/**
+ * _vulkan_swapchain_framebuffers_create
+ *
+ * creates a framebuffer for every image of the current swapchain
+ */
+static void _vulkan_swapchain_framebuffers_create(PGraphicalDisplayData vulkan_display_data)
+{
+	uint image_count = vulkan_display_data->swapchain_image_views->num_items;
+	vulkan_display_data->swapchain_framebuffers = e_dynarr_init(sizeof (VkFramebuffer), image_count);
+	vulkan_display_data->swapchain_framebuffers->num_items = image_count;
+	for (uint i = 0; i < image_count; i++)
+	{
+		VkFramebufferCreateInfo framebuffer_create_info = {0};
+		framebuffer_create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebuffer_create_info.renderPass = vulkan_display_data->render_pass;
+		framebuffer_create_info.attachmentCount = 1;
+		framebuffer_create_info.pAttachments = &E_DYNARR_GET(vulkan_display_data->swapchain_image_views, VkImageView, i);
+		framebuffer_create_info.width = vulkan_display_data->swapchain_extent.width;
+		framebuffer_create_info.height = vulkan_display_data->swapchain_extent.height;
+		framebuffer_create_info.layers = 1;
+		if (vkCreateFramebuffer(vulkan_display_data->logical_device, &framebuffer_create_info, NULL,
+				&E_DYNARR_GET(vulkan_display_data->swapchain_framebuffers, VkFramebuffer, i)) != VK_SUCCESS)
+		{
+			p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create framebuffer!");
+			exit(1);
+		}
+	}
+}
+
+/**
+ * _vulkan_swapchain_retire
+ *
+ * moves the current swapchain and everything made from it to retired_swapchains
+ * it is destroyed by _vulkan_retired_swapchains_release once no frame in flight can still use it
+ */
+static void _vulkan_swapchain_retire(PGraphicalDisplayData vulkan_display_data)
+{
+	if (vulkan_display_data->swapchain == VK_NULL_HANDLE)
+		return;
+
+	PVulkanRetiredSwapchain retired_swapchain = {0};
+	retired_swapchain.swapchain = vulkan_display_data->swapchain;
+	retired_swapchain.images = vulkan_display_data->swapchain_images;
+	retired_swapchain.image_views = vulkan_display_data->swapchain_image_views;
+	retired_swapchain.framebuffers = vulkan_display_data->swapchain_framebuffers;
+	retired_swapchain.render_finished = vulkan_display_data->swapchain_render_finished;
+	retired_swapchain.retire_frame = vulkan_display_data->frame_count;
+	e_dynarr_add(vulkan_display_data->retired_swapchains, &retired_swapchain);
+
+	vulkan_display_data->swapchain = VK_NULL_HANDLE;
+	vulkan_display_data->swapchain_images = NULL;
+	vulkan_display_data->swapchain_image_views = NULL;
+	vulkan_display_data->swapchain_framebuffers = NULL;
+	vulkan_display_data->swapchain_render_finished = NULL;
+}
+
+/**
+ * _vulkan_retired_swapchains_release
+ *
+ * destroys the retired swapchains that no frame in flight uses anymore
+ * when all is true every retired swapchain is destroyed, the caller must have waited for the GPU
+ */
+static void _vulkan_retired_swapchains_release(PGraphicalDisplayData vulkan_display_data, bool all)
+{
+	VkDevice logical_device = vulkan_display_data->logical_device;
+	for (uint i = 0; i < vulkan_display_data->retired_swapchains->num_items;)
+	{
+		PVulkanRetiredSwapchain *retired_swapchain = &E_DYNARR_GET(vulkan_display_data->retired_swapchains,
+				PVulkanRetiredSwapchain, i);
+		if (!all && vulkan_display_data->frame_count < retired_swapchain->retire_frame + P_VULKAN_FRAMES_IN_FLIGHT)
+		{
+			i++;
+			continue;
+		}
+
+		if (retired_swapchain->framebuffers != NULL)
+		{
+			for (uint j = 0; j < retired_swapchain->framebuffers->num_items; j++)
+				vkDestroyFramebuffer(logical_device,
+						E_DYNARR_GET(retired_swapchain->framebuffers, VkFramebuffer, j), NULL);
+			e_dynarr_deinit(retired_swapchain->framebuffers);
+		}
+		for (uint j = 0; j < retired_swapchain->image_views->num_items; j++)
+			vkDestroyImageView(logical_device, E_DYNARR_GET(retired_swapchain->image_views, VkImageView, j), NULL);
+		e_dynarr_deinit(retired_swapchain->image_views);
+		for (uint j = 0; j < retired_swapchain->render_finished->num_items; j++)
+			vkDestroySemaphore(logical_device, E_DYNARR_GET(retired_swapchain->render_finished, VkSemaphore, j), NULL);
+		e_dynarr_deinit(retired_swapchain->render_finished);
+		e_dynarr_deinit(retired_swapchain->images);
+		vkDestroySwapchainKHR(logical_device, retired_swapchain->swapchain, NULL);
+
+		e_dynarr_remove_unordered(vulkan_display_data->retired_swapchains, i);
+	}
+}
+
 /**
  * _vulkan_swapchain_create
  *
  * helper function that creates a swapchain for the given window
+ * the current swapchain is passed to vulkan as oldSwapchain and retired, never waited on
+ * returns false if the surface has no area (e.g. a minimized window) and no swapchain was made
  */
-static void _vulkan_swapchain_create(
+static bool _vulkan_swapchain_create(
 		PGraphicalDisplayData const vulkan_display_data,
 		const uint32_t framebuffer_width,
-		const uint32_t framebuffer_height,
-		const PGraphicalDisplayRequest * const graphical_display_request,
-		const PVulkanSwapchainSupport swapchain_support)
+		const uint32_t framebuffer_height)
 {
+	PArena *scratch = p_arena_scratch();
+	PArenaMark mark = p_arena_mark(scratch);
+	PVulkanSwapchainSupport swapchain_support = _vulkan_swapchain_auto_pick(scratch,
+			vulkan_display_data->current_physical_device, vulkan_display_data->surface,
+			vulkan_display_data->latency_mode);
+	if (swapchain_support.format == NULL || swapchain_support.present_mode == NULL)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Surface no longer supports a swapchain!");
+		exit(1);
+	}
+
+	// Save format for later
+	vulkan_display_data->swapchain_format = swapchain_support.format->format;
 
 	// Set extent
-	vulkan_display_data->swapchain_extent.width = E_MIN(
+	VkExtent2D swapchain_extent;
+	swapchain_extent.width = E_MIN(
 			E_MAX(framebuffer_width, swapchain_support.capabilities.minImageExtent.width),
 			swapchain_support.capabilities.maxImageExtent.width);
 
-	vulkan_display_data->swapchain_extent.height = E_MIN(
+	swapchain_extent.height = E_MIN(
 			E_MAX(framebuffer_height, swapchain_support.capabilities.minImageExtent.height),
 			swapchain_support.capabilities.maxImageExtent.height);
-
-	// Save format for later
-	vulkan_display_data->swapchain_format = swapchain_support.format->format;
+	if (swapchain_extent.width == 0 || swapchain_extent.height == 0)
+	{
+		p_arena_reset(scratch, mark);
+		return false;
+	}
+	vulkan_display_data->swapchain_extent = swapchain_extent;
+	vulkan_display_data->swapchain_width = framebuffer_width;
+	vulkan_display_data->swapchain_height = framebuffer_height;
 
 	// Set image count
 	uint32_t image_count = swapchain_support.capabilities.minImageCount + 1;
+	if (vulkan_display_data->requested_image_count > 0)
+		image_count = E_MAX(vulkan_display_data->requested_image_count, swapchain_support.capabilities.minImageCount);
 	if (swapchain_support.capabilities.maxImageCount > 0 && image_count > swapchain_support.capabilities.maxImageCount)
 		image_count = swapchain_support.capabilities.maxImageCount;
 
+	if (vulkan_display_data->present_mode != *swapchain_support.present_mode)
+		p_log_message(P_LOG_DEBUG, L"Vulkan General", L"Presenting with mode %i and %u images",
+				*swapchain_support.present_mode, image_count);
+	vulkan_display_data->present_mode = *swapchain_support.present_mode;
+
 	VkSwapchainCreateInfoKHR swapchain_create_info = {0};
 	swapchain_create_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
 	swapchain_create_info.surface = vulkan_display_data->surface;
@@ -551,8 +958,8 @@ static void _vulkan_swapchain_create(
 	swapchain_create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 	swapchain_create_info.presentMode = *swapchain_support.present_mode;
 	swapchain_create_info.clipped = VK_TRUE;
-	swapchain_create_info.oldSwapchain = VK_NULL_HANDLE; // TODO: change this when we recreate the swapchain
-	swapchain_create_info.imageArrayLayers = (graphical_display_request->stereoscopic) ? 2 : 1;
+	swapchain_create_info.oldSwapchain = vulkan_display_data->swapchain; // lets the driver reuse its resources
+	swapchain_create_info.imageArrayLayers = (vulkan_display_data->stereoscopic) ? 2 : 1;
 
 	// TODO: change this if/when we add post processing
 	// right now we are rendering directly to the swapchain
@@ -574,14 +981,19 @@ static void _vulkan_swapchain_create(
 		swapchain_create_info.pQueueFamilyIndices = NULL; // Optional
 	}
 
-	if (vulkan_display_data->swapchain != VK_NULL_HANDLE)
-		vkDestroySwapchainKHR(vulkan_display_data->logical_device, vulkan_display_data->swapchain, NULL);
+	VkSwapchainKHR swapchain;
 	if (vkCreateSwapchainKHR(vulkan_display_data->logical_device, &swapchain_create_info, NULL,
-			&vulkan_display_data->swapchain) != VK_SUCCESS)
+			&swapchain) != VK_SUCCESS)
 	{
 		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create swapchain!");
 		exit(1);
 	}
+	p_arena_reset(scratch, mark);
+
+	_vulkan_swapchain_retire(vulkan_display_data);
+	vulkan_display_data->swapchain = swapchain;
+	vulkan_display_data->swapchain_stale = false;
+
 	vkGetSwapchainImagesKHR(vulkan_display_data->logical_device, vulkan_display_data->swapchain, &image_count, NULL);
 	vulkan_display_data->swapchain_images = e_dynarr_init(sizeof (VkImage), image_count);
 	vulkan_display_data->swapchain_images->num_items = image_count;
@@ -616,126 +1028,153 @@ static void _vulkan_swapchain_create(
 		}
 	}
 
+	// Create one render finished semaphore per image, presentation of an image may still wait on its semaphore
+	// after the frame that signaled it is done
+	vulkan_display_data->swapchain_render_finished = e_dynarr_init(sizeof (VkSemaphore), image_count);
+	vulkan_display_data->swapchain_render_finished->num_items = image_count;
+	for (uint i = 0; i < image_count; i++)
+	{
+		VkSemaphoreCreateInfo semaphore_create_info = {0};
+		semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		if (vkCreateSemaphore(vulkan_display_data->logical_device, &semaphore_create_info, NULL,
+				&E_DYNARR_GET(vulkan_display_data->swapchain_render_finished, VkSemaphore, i)) != VK_SUCCESS)
+		{
+			p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create semaphore!");
+			exit(1);
+		}
+	}
+
+	// Framebuffers need the render pass, the first swapchain is made before it exists
+	if (vulkan_display_data->render_pass != VK_NULL_HANDLE)
+		_vulkan_swapchain_framebuffers_create(vulkan_display_data);
+	return true;
 }
 
 /**
- * _vulkan_swapchain_auto_pick
+ * _vulkan_offscreen_create
  *
- * helper function that returns the swapchain details closest to the desired settings
- * if none exist returns NULL in appropriate fields. Must be freed
+ * creates the images a headless display renders into in place of a swapchain, one per frame in flight
+ * they take the place of the swapchain images, so framebuffers are made the same way
  */
-static PVulkanSwapchainSupport _vulkan_swapchain_auto_pick(const VkPhysicalDevice physical_device,
-		const VkSurfaceKHR surface)
+static void _vulkan_offscreen_create(PGraphicalDisplayData vulkan_display_data, uint width, uint height)
 {
-	PVulkanSwapchainSupport swapchain_support = {0};
-
-	// Set swapchain details
-	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, surface, &swapchain_support.capabilities);
-
-	// Set surface format
-	uint32_t format_count;
-	vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &format_count, NULL);
-	if (format_count != 0)
+	vulkan_display_data->swapchain_format = VK_FORMAT_R8G8B8A8_UNORM;
+	vulkan_display_data->swapchain_extent = (VkExtent2D){ .width = width, .height = height };
+	vulkan_display_data->swapchain_width = width;
+	vulkan_display_data->swapchain_height = height;
+
+	PGraphicsImageRequest image_request = {0};
+	image_request.width = width;
+	image_request.height = height;
+	image_request.format = P_GRAPHICS_FORMAT_RGBA8_UNORM;
+	image_request.usage = P_GRAPHICS_IMAGE_COLOR_ATTACHMENT | P_GRAPHICS_IMAGE_TRANSFER_SRC;
+	image_request.memory_usage = P_GRAPHICS_MEMORY_GPU_ONLY;
+	vulkan_display_data->swapchain_images = e_dynarr_init(sizeof (VkImage), P_VULKAN_FRAMES_IN_FLIGHT);
+	vulkan_display_data->swapchain_image_views = e_dynarr_init(sizeof (VkImageView), P_VULKAN_FRAMES_IN_FLIGHT);
+	for (uint i = 0; i < P_VULKAN_FRAMES_IN_FLIGHT; i++)
 	{
-		EDynarr *formats = e_dynarr_init(sizeof (VkSurfaceFormatKHR), format_count);
-		vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &format_count, formats->arr);
-		formats->num_items = format_count;
-
-
-		VkSurfaceFormatKHR format = E_DYNARR_GET(formats, VkSurfaceFormatKHR, 0);
-		for (uint i = 0; i < format_count; i++)
+		PGraphicsImage *image = p_graphics_vulkan_image_create(vulkan_display_data, &image_request);
+		if (image == NULL)
 		{
-			VkSurfaceFormatKHR current_format = E_DYNARR_GET(formats, VkSurfaceFormatKHR, i);
-			if (current_format.format == VK_FORMAT_B8G8R8A8_SRGB)
-			{
-				format = current_format;
-				break;
-			}
+			p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create offscreen image!");
+			exit(1);
 		}
-		swapchain_support.format = malloc(sizeof (VkSurfaceFormatKHR));
-		*swapchain_support.format = format;
-		e_dynarr_deinit(formats);
+		vulkan_display_data->offscreen_images[i] = image;
+		e_dynarr_add(vulkan_display_data->swapchain_images, &image->handle);
+		e_dynarr_add(vulkan_display_data->swapchain_image_views, &image->view);
 	}
 
-	// Set present mode
-	uint32_t present_mode_count;
-	vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &present_mode_count, NULL);
-	if (present_mode_count != 0)
-	{
-		EDynarr *present_modes = e_dynarr_init(sizeof (VkPresentModeKHR), present_mode_count);
-		vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &present_mode_count, present_modes->arr);
-		present_modes->num_items = present_mode_count;
+	if (vulkan_display_data->render_pass != VK_NULL_HANDLE)
+		_vulkan_swapchain_framebuffers_create(vulkan_display_data);
+}
 
-		VkPresentModeKHR present_mode = E_DYNARR_GET(present_modes, VkPresentModeKHR, 0);
-		for (uint i = 0; i < present_mode_count; i++)
-		{
-			VkPresentModeKHR current_present_mode = E_DYNARR_GET(present_modes, VkPresentModeKHR, i);
-			if (current_present_mode == VK_PRESENT_MODE_MAILBOX_KHR)
-			{
-				present_mode = current_present_mode;
-				break;
-			}
-		}
-		swapchain_support.present_mode = malloc(sizeof (VkPresentModeKHR));
-		*swapchain_support.present_mode = present_mode;
-		e_dynarr_deinit(present_modes);
+/**
+ * _vulkan_offscreen_destroy
+ *
+ * destroys the offscreen images of a headless display along with their framebuffers and readback buffer
+ * the GPU must be done with every frame
+ */
+static void _vulkan_offscreen_destroy(PGraphicalDisplayData vulkan_display_data)
+{
+	VkDevice logical_device = vulkan_display_data->logical_device;
+	if (vulkan_display_data->swapchain_framebuffers != NULL)
+	{
+		for (uint i = 0; i < vulkan_display_data->swapchain_framebuffers->num_items; i++)
+			vkDestroyFramebuffer(logical_device,
+					E_DYNARR_GET(vulkan_display_data->swapchain_framebuffers, VkFramebuffer, i), NULL);
+		e_dynarr_deinit(vulkan_display_data->swapchain_framebuffers);
 	}
-	return swapchain_support;
+	// the views belong to the images
+	e_dynarr_deinit(vulkan_display_data->swapchain_image_views);
+	e_dynarr_deinit(vulkan_display_data->swapchain_images);
+	for (uint i = 0; i < P_VULKAN_FRAMES_IN_FLIGHT; i++)
+		p_graphics_vulkan_image_destroy(vulkan_display_data->offscreen_images[i]);
+
+	if (vulkan_display_data->readback != NULL)
+		p_graphics_vulkan_buffer_destroy(vulkan_display_data->readback);
+	if (vulkan_display_data->readback_fence != VK_NULL_HANDLE)
+		vkDestroyFence(logical_device, vulkan_display_data->readback_fence, NULL);
 }
 
 /**
- * p_graphics_vulkan_device_set
+ * _vulkan_device_set
  *
- * sets the physical device to use in vulkan_display_data from physical_device
- * also creates a logical device with vulkan_app_request and sets it to vulkan_display_data
+ * sets the physical device to use in vulkan_app_data from physical_device
+ * also creates the logical device shared by all displays and sets it to vulkan_app_data
+ * display is only used to find a queue family that can present
+ * only _vulkan_display_init calls this, once, with device_mutex held
  */
-void p_graphics_vulkan_device_set(
-		PGraphicalDisplayData graphical_display_data,
+static void _vulkan_device_set(
+		PGraphicalAppData graphical_app_data,
 		const PGraphicalDisplayRequest * const graphical_display_request,
 		const PGraphicalDevice physical_device,
-		const PGraphicalDisplayData display,
-		const PWindowData * const window_data)
+		const PGraphicalDisplayData display)
 
 {
 	// convert
-	PVulkanDisplayRequest *vulkan_display_request = _vulkan_display_request_convert(graphical_display_request);
-	PGraphicalDisplayData vulkan_display_data = graphical_display_data;
+	PArena *scratch = p_arena_scratch();
+	PArenaMark mark = p_arena_mark(scratch);
+	PVulkanDisplayRequest *vulkan_display_request = _vulkan_display_request_convert(scratch,
+			graphical_display_request);
+	PGraphicalAppData vulkan_app_data = graphical_app_data;
 
-	if (e_dynarr_find(vulkan_display_data->compatible_devices, &physical_device.handle) == -1)
+	if (e_dynarr_find(vulkan_app_data->compatible_devices, &physical_device.handle) == -1)
 	{
 		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Selected device is not compatible");
 		exit(1);
 	}
 
 	// Set physical device
-	vulkan_display_data->current_physical_device = physical_device.handle;
+	vulkan_app_data->physical_device = physical_device.handle;
+	const PVulkanPhysicalDeviceInfo *info = _vulkan_physical_device_info_find(vulkan_app_data, physical_device.handle);
+	uint64_t present_queue_families = _vulkan_present_queue_families(info, display->surface);
 
 	// Set queue family indices
-	VkQueueFlags enabled_queue_flags = _vulkan_get_required_queue_flags(vulkan_display_request, physical_device.handle, display->surface);
+	VkQueueFlags enabled_queue_flags = _vulkan_get_required_queue_flags(vulkan_display_request, info,
+			present_queue_families);
 	if (enabled_queue_flags & VK_QUEUE_GRAPHICS_BIT)
-		vulkan_display_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_GRAPHICS] =
-			_vulkan_find_viable_queue_family_info(physical_device.handle, display->surface, VK_QUEUE_GRAPHICS_BIT, false);
+		vulkan_app_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_GRAPHICS] =
+			_vulkan_find_viable_queue_family_info(info, present_queue_families, VK_QUEUE_GRAPHICS_BIT, false);
 	if (vulkan_display_request->require_present)
-		vulkan_display_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_PRESENT] =
-			_vulkan_find_viable_queue_family_info(physical_device.handle, display->surface, VK_QUEUE_GRAPHICS_BIT, true);
+		vulkan_app_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_PRESENT] =
+			_vulkan_find_viable_queue_family_info(info, present_queue_families, VK_QUEUE_GRAPHICS_BIT, true);
 	if (enabled_queue_flags & VK_QUEUE_COMPUTE_BIT)
-		vulkan_display_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_COMPUTE] =
-			_vulkan_find_viable_queue_family_info(physical_device.handle, display->surface, VK_QUEUE_COMPUTE_BIT, false);
-	if (enabled_queue_flags & VK_QUEUE_TRANSFER_BIT)
-		vulkan_display_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_TRANSFER] =
-			_vulkan_find_viable_queue_family_info(physical_device.handle, display->surface, VK_QUEUE_TRANSFER_BIT, false);
+		vulkan_app_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_COMPUTE] =
+			_vulkan_find_viable_queue_family_info(info, present_queue_families, VK_QUEUE_COMPUTE_BIT, false);
+	// always wanted, uploads run on it alongside rendering
+	vulkan_app_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_TRANSFER] = _vulkan_find_transfer_queue_family_info(info);
 	if (enabled_queue_flags & VK_QUEUE_SPARSE_BINDING_BIT)
-		vulkan_display_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_SPARSE] =
-			_vulkan_find_viable_queue_family_info(physical_device.handle, display->surface, VK_QUEUE_SPARSE_BINDING_BIT, false);
+		vulkan_app_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_SPARSE] =
+			_vulkan_find_viable_queue_family_info(info, present_queue_families, VK_QUEUE_SPARSE_BINDING_BIT, false);
 	if (enabled_queue_flags & VK_QUEUE_PROTECTED_BIT)
-		vulkan_display_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_PROTECTED] =
-			_vulkan_find_viable_queue_family_info(physical_device.handle, display->surface, VK_QUEUE_PROTECTED_BIT, false);
+		vulkan_app_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_PROTECTED] =
+			_vulkan_find_viable_queue_family_info(info, present_queue_families, VK_QUEUE_PROTECTED_BIT, false);
 	if (enabled_queue_flags & VK_QUEUE_VIDEO_DECODE_BIT_KHR)
-		vulkan_display_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_VIDEO_DECODE] =
-			_vulkan_find_viable_queue_family_info(physical_device.handle, display->surface, VK_QUEUE_VIDEO_DECODE_BIT_KHR, false);
+		vulkan_app_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_VIDEO_DECODE] =
+			_vulkan_find_viable_queue_family_info(info, present_queue_families, VK_QUEUE_VIDEO_DECODE_BIT_KHR, false);
 	if (enabled_queue_flags & VK_QUEUE_OPTICAL_FLOW_BIT_NV)
-		vulkan_display_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_OPTICAL_FLOW] =
-			_vulkan_find_viable_queue_family_info(physical_device.handle, display->surface, VK_QUEUE_OPTICAL_FLOW_BIT_NV, false);
+		vulkan_app_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_OPTICAL_FLOW] =
+			_vulkan_find_viable_queue_family_info(info, present_queue_families, VK_QUEUE_OPTICAL_FLOW_BIT_NV, false);
 
 	EDynarr *queue_family_infos = e_dynarr_init(sizeof (PVulkanQueueFamilyInfo), 1);
 	for (uint i = 0; i < P_VULKAN_QUEUE_TYPE_MAX; i++)
@@ -744,7 +1183,7 @@ void p_graphics_vulkan_device_set(
 		for (uint j = 0; j < queue_family_infos->num_items; j++)
 		{
 			if ((E_DYNARR_GET(queue_family_infos, PVulkanQueueFamilyInfo, j).exists) &&
-				vulkan_display_data->queue_family_infos[i].index ==
+				vulkan_app_data->queue_family_infos[i].index ==
 				E_DYNARR_GET(queue_family_infos, PVulkanQueueFamilyInfo, j).index)
 			{
 				unique = false;
@@ -752,7 +1191,7 @@ void p_graphics_vulkan_device_set(
 			}
 		}
 		if (unique)
-			e_dynarr_add(queue_family_infos, &vulkan_display_data->queue_family_infos[i]);
+			e_dynarr_add(queue_family_infos, &vulkan_app_data->queue_family_infos[i]);
 	}
 
 	uint num_queue_families = queue_family_infos->num_items;
@@ -767,24 +1206,39 @@ void p_graphics_vulkan_device_set(
 	}
 
 	// Set device features
-	VkPhysicalDeviceFeatures device_features  = _vulkan_get_required_features(vulkan_display_request, physical_device.handle);
+	VkPhysicalDeviceFeatures device_features  = _vulkan_get_required_features(vulkan_display_request, info);
+
+	// optional, uploads are tracked with fences without it
+	vulkan_app_data->timeline_semaphore = info->timeline_semaphore;
+	VkPhysicalDeviceVulkan12Features device_features_12 = {0};
+	device_features_12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	device_features_12.timelineSemaphore = vulkan_app_data->timeline_semaphore;
 
 	// Create logical device
 	VkDeviceCreateInfo device_create_info = {0};
 	device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	device_create_info.pNext = info->properties.apiVersion >= VK_API_VERSION_1_2 ? &device_features_12 : NULL;
 	device_create_info.pQueueCreateInfos = queue_create_infos;
 	device_create_info.queueCreateInfoCount = num_queue_families;
 	device_create_info.pEnabledFeatures = &device_features;
 
-	EDynarr *enabled_extensions = _vulkan_get_required_extensions(vulkan_display_request->required_extensions);
+	EDynarr *enabled_extensions = _vulkan_get_required_extensions(&info->extensions,
+			vulkan_display_request->required_extensions);
+	// optional, the allocator estimates the budget without it. Querying it needs vulkan 1.1
+	vulkan_app_data->memory_budget = info->properties.apiVersion >= VK_API_VERSION_1_1 &&
+		_vulkan_name_set_contains(&info->extensions, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+	if (vulkan_app_data->memory_budget)
+		e_dynarr_add(enabled_extensions, E_VOID_PTR_FROM_VALUE(char *, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME));
 	device_create_info.enabledExtensionCount = enabled_extensions->num_items;
 	device_create_info.ppEnabledExtensionNames = enabled_extensions->arr;
 
-	EDynarr *enabled_layers = _vulkan_get_required_layers(vulkan_display_request->required_layers);
+	EDynarr *enabled_layers = _vulkan_get_required_layers(&vulkan_app_data->instance_layers,
+			vulkan_display_request->required_layers);
 	device_create_info.enabledLayerCount = enabled_layers->num_items;
 	device_create_info.ppEnabledLayerNames = enabled_layers->arr;
 
 	_vulkan_display_request_destroy(vulkan_display_request);
+	p_arena_reset(scratch, mark);
 
 	// Set logical device queues
 	EDynarr *device_queue_create_infos = e_dynarr_init(sizeof (VkDeviceQueueCreateInfo), 1);
@@ -801,10 +1255,8 @@ void p_graphics_vulkan_device_set(
 	device_create_info.pQueueCreateInfos = device_queue_create_infos->arr;
 
 	// create logical device
-	if (vulkan_display_data->logical_device != VK_NULL_HANDLE)
-		vkDestroyDevice(vulkan_display_data->logical_device, NULL);
-	if (vkCreateDevice(vulkan_display_data->current_physical_device, &device_create_info, NULL,
-				&vulkan_display_data->logical_device) != VK_SUCCESS)
+	if (vkCreateDevice(vulkan_app_data->physical_device, &device_create_info, NULL,
+				&vulkan_app_data->logical_device) != VK_SUCCESS)
 	{
 		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create logical device!");
 		exit(1);
@@ -817,83 +1269,92 @@ void p_graphics_vulkan_device_set(
 	// Set queue handles
 	for (uint i = 0; i < P_VULKAN_QUEUE_TYPE_MAX; i++)
 	{
-		if (!vulkan_display_data->queue_family_infos[i].exists)
+		if (!vulkan_app_data->queue_family_infos[i].exists)
 			continue;
 		VkQueue vk_queue = {0};
-		vkGetDeviceQueue(vulkan_display_data->logical_device, vulkan_display_data->queue_family_infos[i].index, 0, &vk_queue);
-		vulkan_display_data->queue_family_infos[i].queue = vk_queue;
+		vkGetDeviceQueue(vulkan_app_data->logical_device, vulkan_app_data->queue_family_infos[i].index, 0, &vk_queue);
+		vulkan_app_data->queue_family_infos[i].queue = vk_queue;
 	}
-
-	// Set swapchain data
-	PVulkanSwapchainSupport swapchain_support = _vulkan_swapchain_auto_pick(physical_device.handle, display->surface);
-	_vulkan_swapchain_create(vulkan_display_data, window_data->x, window_data->y, graphical_display_request,
-			swapchain_support);
-	free(swapchain_support.format);
-	free(swapchain_support.present_mode);
 }
 
 /**
  * p_graphics_vulkan_device_auto_pick
  *
- * initializes compatible_devices in vulkan_display_data
- * picks the physical device for use with vulkan and returns it
+ * initializes compatible_devices in vulkan_app_data
+ * picks the physical device for use with display and returns it
  * returns VK_NULL_HANDLE if no suitable device is found
  */
 PGraphicalDevice p_graphics_vulkan_device_auto_pick(
-		PGraphicalDisplayData graphical_display_data,
-		const PGraphicalAppData graphical_app_data,
+		PGraphicalAppData graphical_app_data,
+		const PGraphicalDisplayData display,
 		const PGraphicalDisplayRequest * const graphical_display_request)
 {
-	PGraphicalDisplayData vulkan_display_data = graphical_display_data;
-	const PGraphicalAppData vulkan_app_data = graphical_app_data;
-	vulkan_display_data->current_physical_device = VK_NULL_HANDLE;
+	PGraphicalAppData vulkan_app_data = graphical_app_data;
+	EDynarr *physical_device_infos = vulkan_app_data->physical_device_infos;
 
-	uint32_t vulkan_available_device_count = 0;
-	vkEnumeratePhysicalDevices(vulkan_app_data->instance, &vulkan_available_device_count, NULL);
+	if (vulkan_app_data->compatible_devices != NULL)
+		e_dynarr_deinit(vulkan_app_data->compatible_devices);
+	vulkan_app_data->compatible_devices = e_dynarr_init(sizeof (VkPhysicalDevice), physical_device_infos->num_items);
+	EDynarr *compatible_devices = vulkan_app_data->compatible_devices;
+	for (uint i = 0; i < physical_device_infos->num_items; i++)
+		e_dynarr_add(compatible_devices, &E_DYNARR_GET(physical_device_infos, PVulkanPhysicalDeviceInfo, i).handle);
 
-	if (vulkan_display_data->compatible_devices != NULL)
-		e_dynarr_deinit(vulkan_display_data->compatible_devices);
-	vulkan_display_data->compatible_devices = e_dynarr_init(sizeof (VkPhysicalDevice), vulkan_available_device_count);
-	EDynarr *compatible_devices = vulkan_display_data->compatible_devices;
-	vkEnumeratePhysicalDevices(vulkan_app_data->instance, &vulkan_available_device_count, compatible_devices->arr);
-	compatible_devices->num_items = vulkan_available_device_count;
+	PArena *scratch = p_arena_scratch();
+	PArenaMark mark = p_arena_mark(scratch);
+	PVulkanDisplayRequest *vulkan_display_request = _vulkan_display_request_convert(scratch,
+			graphical_display_request);
 
 	// check device suitability, assign scores
 	EDynarr *device_score = e_dynarr_init(sizeof (int), compatible_devices->num_items);
 	for (uint i = 0; i < compatible_devices->num_items; i++) {
 		int score = 0;
-		VkPhysicalDevice device = E_DYNARR_GET(compatible_devices, VkPhysicalDevice, i);
-		VkPhysicalDeviceProperties device_properties = {0};
-		vkGetPhysicalDeviceProperties(device, &device_properties);
+		const PVulkanPhysicalDeviceInfo *info = &E_DYNARR_GET(physical_device_infos, PVulkanPhysicalDeviceInfo, i);
 
 		// lots of score goes to discrete gpus
-		if (device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
+		if (info->properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
 			score = 10000;
 
 		// Maximum possible size of textures affects graphics quality
-		score += device_properties.limits.maxImageDimension2D;
+		score += info->properties.limits.maxImageDimension2D;
+
+		// Check for required device extensions
+		for (uint j = 0; j < vulkan_display_request->required_extensions->num_items; j++)
+		{
+			if (!_vulkan_name_set_contains(&info->extensions,
+						E_DYNARR_GET(vulkan_display_request->required_extensions, char *, j)))
+			{
+				score = -1;
+				goto end_device_score_eval;
+			}
+		}
 
 		// Check for swapchain support
-		PVulkanSwapchainSupport swapchain = _vulkan_swapchain_auto_pick(device, vulkan_display_data->surface);
-		if (swapchain.format == NULL || swapchain.present_mode == NULL)
+		if (vulkan_display_request->require_present)
 		{
-			score = -1;
-			goto end_device_score_eval;
+			PArenaMark device_mark = p_arena_mark(scratch);
+			PVulkanSwapchainSupport swapchain = _vulkan_swapchain_auto_pick(scratch, info->handle, display->surface,
+					graphical_display_request->latency_mode);
+			bool swapchain_supported = swapchain.format != NULL && swapchain.present_mode != NULL;
+			p_arena_reset(scratch, device_mark);
+			if (!swapchain_supported)
+			{
+				score = -1;
+				goto end_device_score_eval;
+			}
 		}
-		free(swapchain.format);
-		free(swapchain.present_mode);
 
 		// get required queue flags to make sure they exist
-		PVulkanDisplayRequest *vulkan_display_request = _vulkan_display_request_convert(graphical_display_request);
-		_vulkan_get_required_queue_flags(vulkan_display_request, device, vulkan_display_data->surface);
+		_vulkan_get_required_queue_flags(vulkan_display_request, info,
+				_vulkan_present_queue_families(info, display->surface));
 
 		// get required features to make sure they exist
-		_vulkan_get_required_features(vulkan_display_request, device);
-		_vulkan_display_request_destroy(vulkan_display_request);
+		_vulkan_get_required_features(vulkan_display_request, info);
 
 end_device_score_eval:
 		e_dynarr_add(device_score, E_VOID_PTR_FROM_VALUE(int, score));
 	}
+	_vulkan_display_request_destroy(vulkan_display_request);
+	p_arena_reset(scratch, mark);
 
 	// remove incompatible gpus and set default gpu
 	int max_score = 0;
@@ -919,15 +1380,123 @@ end_device_score_eval:
 	{
 		PGraphicalDevice device = (PGraphicalDevice){0};
 		device.handle = E_DYNARR_GET(compatible_devices, VkPhysicalDevice, max_score_index);
-		VkPhysicalDeviceProperties device_properties;
-		vkGetPhysicalDeviceProperties(device.handle, &device_properties);
-		device.name = device_properties.deviceName;
+		const PVulkanPhysicalDeviceInfo *info = _vulkan_physical_device_info_find(vulkan_app_data, device.handle);
+		device.name = (char *)info->properties.deviceName;
 		return device;
 	} else {
 		return (PGraphicalDevice){0};
 	}
 }
 
+/**
+ * _vulkan_pipeline_cache_header_read
+ *
+ * reads a little endian uint32_t from a pipeline cache header
+ */
+static uint32_t _vulkan_pipeline_cache_header_read(const uint8_t *data)
+{
+	return (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+/**
+ * _vulkan_pipeline_cache_data_valid
+ *
+ * returns true if pipeline cache data read from disk was made by the same driver for physical_device
+ * vulkan is supposed to reject foreign data itself, but not every driver does so safely
+ */
+static bool _vulkan_pipeline_cache_data_valid(const PVulkanPhysicalDeviceInfo * const info, const uint8_t *data,
+		size_t data_size)
+{
+	const size_t header_size_min = 4 * sizeof (uint32_t) + VK_UUID_SIZE;
+	if (data_size < header_size_min)
+		return false;
+
+	uint32_t header_size = _vulkan_pipeline_cache_header_read(data);
+	uint32_t header_version = _vulkan_pipeline_cache_header_read(data + 4);
+	uint32_t vendor_id = _vulkan_pipeline_cache_header_read(data + 8);
+	uint32_t device_id = _vulkan_pipeline_cache_header_read(data + 12);
+	const uint8_t *pipeline_cache_uuid = data + 16;
+	if (header_size < header_size_min || header_size > data_size ||
+			header_version != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+		return false;
+
+	return vendor_id == info->properties.vendorID && device_id == info->properties.deviceID &&
+		memcmp(pipeline_cache_uuid, info->properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+/**
+ * _vulkan_pipeline_cache_create
+ *
+ * creates the pipeline cache used for every pipeline on the shared device
+ * it is seeded from pipeline_cache_path when that holds data made by the current driver
+ */
+static void _vulkan_pipeline_cache_create(PGraphicalAppData vulkan_app_data)
+{
+	uint8_t *cache_data = NULL;
+	uint cache_data_size = 0;
+	const char *path = vulkan_app_data->pipeline_cache_path;
+	if (path != NULL && p_file_exists(path))
+	{
+		cache_data_size = p_file_get_size(path);
+		cache_data = malloc(cache_data_size);
+		if (cache_data_size == 0 || !p_file_read(path, cache_data, cache_data_size) ||
+				!_vulkan_pipeline_cache_data_valid(
+					_vulkan_physical_device_info_find(vulkan_app_data, vulkan_app_data->physical_device), cache_data,
+					cache_data_size))
+		{
+			p_log_message(P_LOG_INFO, L"Vulkan General", L"Pipeline cache %s is stale, rebuilding it", path);
+			cache_data_size = 0;
+		}
+	}
+
+	VkPipelineCacheCreateInfo pipeline_cache_create_info = {0};
+	pipeline_cache_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	pipeline_cache_create_info.initialDataSize = cache_data_size;
+	pipeline_cache_create_info.pInitialData = (cache_data_size > 0) ? cache_data : NULL;
+	VkResult result = vkCreatePipelineCache(vulkan_app_data->logical_device, &pipeline_cache_create_info, NULL,
+			&vulkan_app_data->pipeline_cache);
+	if (result != VK_SUCCESS && cache_data_size > 0)
+	{
+		// the driver refused the data, start from an empty cache instead
+		pipeline_cache_create_info.initialDataSize = 0;
+		pipeline_cache_create_info.pInitialData = NULL;
+		result = vkCreatePipelineCache(vulkan_app_data->logical_device, &pipeline_cache_create_info, NULL,
+				&vulkan_app_data->pipeline_cache);
+		cache_data_size = 0;
+	}
+	free(cache_data);
+	if (result != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create pipeline cache!");
+		exit(1);
+	}
+	if (cache_data_size > 0)
+		p_log_message(P_LOG_DEBUG, L"Vulkan General", L"Loaded %u bytes of pipeline cache from %s",
+				cache_data_size, path);
+}
+
+/**
+ * _vulkan_pipeline_cache_save
+ *
+ * writes the pipeline cache to pipeline_cache_path
+ * the file is replaced in one step so a crash never leaves a half written cache behind
+ */
+static void _vulkan_pipeline_cache_save(const PGraphicalAppData vulkan_app_data)
+{
+	if (vulkan_app_data->pipeline_cache_path == NULL || vulkan_app_data->pipeline_cache == VK_NULL_HANDLE)
+		return;
+
+	size_t cache_data_size = 0;
+	if (vkGetPipelineCacheData(vulkan_app_data->logical_device, vulkan_app_data->pipeline_cache,
+				&cache_data_size, NULL) != VK_SUCCESS || cache_data_size == 0)
+		return;
+	void *cache_data = malloc(cache_data_size);
+	if (vkGetPipelineCacheData(vulkan_app_data->logical_device, vulkan_app_data->pipeline_cache,
+				&cache_data_size, cache_data) == VK_SUCCESS)
+		p_file_replace(vulkan_app_data->pipeline_cache_path, cache_data, cache_data_size);
+	free(cache_data);
+}
+
 /**
  * p_graphics_vulkan_init
  *
@@ -936,13 +1505,32 @@ end_device_score_eval:
 PGraphicalAppData p_graphics_vulkan_init(PGraphicalAppRequest *graphical_app_request)
 {
 	PVulkanAppRequest *vulkan_app_request = _vulkan_app_request_convert(graphical_app_request);
-	PGraphicalAppData vulkan_app_data = malloc(sizeof *vulkan_app_data);
+	PGraphicalAppData vulkan_app_data = calloc(1, sizeof *vulkan_app_data);
+	p_light_mutex_init(&vulkan_app_data->device_mutex);
+	p_light_mutex_init(&vulkan_app_data->queue_mutex);
+
+	if (graphical_app_request->pipeline_cache_path != NULL)
+	{
+		size_t path_size = strlen(graphical_app_request->pipeline_cache_path) + 1;
+		vulkan_app_data->pipeline_cache_path = malloc(path_size);
+		memcpy(vulkan_app_data->pipeline_cache_path, graphical_app_request->pipeline_cache_path, path_size);
+	}
+	if (graphical_app_request->shader_path != NULL)
+	{
+		size_t path_size = strlen(graphical_app_request->shader_path) + 1;
+		vulkan_app_data->shader_path = malloc(path_size);
+		memcpy(vulkan_app_data->shader_path, graphical_app_request->shader_path, path_size);
+	}
 
 #ifdef PLATINUM_DEBUG_GRAPHICS
 	p_vulkan_list_available_extensions();
 	p_vulkan_list_available_layers();
 #endif // PLATINUM_DEBUG_GRAPHICS
 
+	// query what the instance can offer once, device checks look these up later
+	_vulkan_instance_extensions_init(&vulkan_app_data->instance_extensions);
+	_vulkan_instance_layers_init(&vulkan_app_data->instance_layers);
+
 	// create vulkan instance
 	VkApplicationInfo vk_app_info = {0};
 	vk_app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
@@ -950,18 +1538,20 @@ PGraphicalAppData p_graphics_vulkan_init(PGraphicalAppRequest *graphical_app_req
 	vk_app_info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
 	vk_app_info.pEngineName = "No Engine";
 	vk_app_info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-	vk_app_info.apiVersion = VK_API_VERSION_1_0;
+	vk_app_info.apiVersion = VK_API_VERSION_1_2;
 
 	VkInstanceCreateInfo vk_instance_create_info = {0};
 	vk_instance_create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 	vk_instance_create_info.pApplicationInfo = &vk_app_info;
 
 	// Add all required extensions and optional extensions that exist
-	EDynarr *enabled_extensions = _vulkan_get_required_extensions(vulkan_app_request->required_extensions);
+	EDynarr *enabled_extensions = _vulkan_get_required_extensions(&vulkan_app_data->instance_extensions,
+			vulkan_app_request->required_extensions);
 	vk_instance_create_info.enabledExtensionCount = enabled_extensions->num_items;
 	vk_instance_create_info.ppEnabledExtensionNames = enabled_extensions->arr;
 
-	EDynarr *enabled_layers = _vulkan_get_required_layers(vulkan_app_request->required_layers);
+	EDynarr *enabled_layers = _vulkan_get_required_layers(&vulkan_app_data->instance_layers,
+			vulkan_app_request->required_layers);
 	vk_instance_create_info.enabledLayerCount = enabled_layers->num_items;
 	vk_instance_create_info.ppEnabledLayerNames = enabled_layers->arr;
 	vk_instance_create_info.flags = 0;
@@ -990,6 +1580,8 @@ PGraphicalAppData p_graphics_vulkan_init(PGraphicalAppRequest *graphical_app_req
 		exit(1);
 	}
 #endif // PLATINUM_DEBUG_GRAPHICS
+
+	vulkan_app_data->physical_device_infos = _vulkan_physical_device_infos_init(vulkan_app_data->instance);
 	return vulkan_app_data;
 }
 
@@ -1000,133 +1592,726 @@ PGraphicalAppData p_graphics_vulkan_init(PGraphicalAppRequest *graphical_app_req
  */
 void p_graphics_vulkan_deinit(PGraphicalAppData vulkan_app_data)
 {
+	if (vulkan_app_data->logical_device != VK_NULL_HANDLE)
+	{
+		vkDeviceWaitIdle(vulkan_app_data->logical_device);
+		_vulkan_pipeline_cache_save(vulkan_app_data);
+		vkDestroyPipelineCache(vulkan_app_data->logical_device, vulkan_app_data->pipeline_cache, NULL);
+		for (uint i = 0; i < vulkan_app_data->shaders->num_items; i++)
+			p_vulkan_shader_module_release(vulkan_app_data->shader_cache,
+					E_DYNARR_GET(vulkan_app_data->shaders, VkShaderModule, i));
+		e_dynarr_deinit(vulkan_app_data->shaders);
+		p_vulkan_shader_cache_deinit(vulkan_app_data->shader_cache);
+		p_vulkan_uploader_deinit(vulkan_app_data->uploader);
+		p_vulkan_allocator_deinit(vulkan_app_data->allocator);
+		vkDestroyDevice(vulkan_app_data->logical_device, NULL);
+	}
+	if (vulkan_app_data->compatible_devices != NULL)
+		e_dynarr_deinit(vulkan_app_data->compatible_devices);
+	_vulkan_physical_device_infos_deinit(vulkan_app_data->physical_device_infos);
+	_vulkan_name_set_deinit(&vulkan_app_data->instance_extensions);
+	_vulkan_name_set_deinit(&vulkan_app_data->instance_layers);
+
 #ifdef PLATINUM_DEBUG_GRAPHICS
 	_vulkan_destroy_debug_utils_messenger(vulkan_app_data->instance, vulkan_app_data->debug_messenger, NULL);
 #endif // PLATINUM_DEBUG_GRAPHICS
 	vkDestroyInstance(vulkan_app_data->instance, NULL);
+	free(vulkan_app_data->pipeline_cache_path);
+	free(vulkan_app_data->shader_path);
 	free(vulkan_app_data);
 }
 
 /**
- * _create_shader_module
+ * _vulkan_shader_module_load
  *
+ * acquires a shader module from <shader_path>/<name>.spv if that file exists, from the embedded shader otherwise
+ */
+static VkShaderModule _vulkan_shader_module_load(const PGraphicalAppData vulkan_app_data, const char *name)
+{
+	if (vulkan_app_data->shader_path != NULL)
+	{
+		size_t path_size = strlen(vulkan_app_data->shader_path) + strlen(name) + sizeof "/.spv";
+		char *path = malloc(path_size);
+		snprintf(path, path_size, "%s/%s.spv", vulkan_app_data->shader_path, name);
+		if (p_file_exists(path))
+		{
+			uint shader_size = p_file_get_size(path);
+			uint32_t *shader_data = malloc(shader_size);
+			p_file_read(path, shader_data, shader_size);
+			VkShaderModule shader_module = p_vulkan_shader_module_acquire(vulkan_app_data->shader_cache,
+					shader_data, shader_size);
+			free(shader_data);
+			free(path);
+			return shader_module;
+		}
+		free(path);
+	}
+
+	const PGraphicsShader *shader = p_graphics_shader_find(name);
+	if (shader == NULL)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Shader %s is not embedded!", name);
+		exit(1);
+	}
+	return p_vulkan_shader_module_acquire(vulkan_app_data->shader_cache, shader->code, shader->size);
+}
+
+/**
+ * _vulkan_shaders_create
+ *
+ * loads the shaders once for the shared device
+ * they are compiled into the library, shader_path only has to hold the ones to replace
  * TODO: move me into renderer
  */
-VkShaderModule _create_shader_module(PGraphicalDisplayData vulkan_display_data, const char *shader_data,
-		uint shader_data_size)
+static void _vulkan_shaders_create(PGraphicalAppData vulkan_app_data)
+{
+	vulkan_app_data->shaders = e_dynarr_init(sizeof (VkShaderModule), 2);
+
+	VkShaderModule vertShaderModule = _vulkan_shader_module_load(vulkan_app_data, "shader_vert");
+	VkShaderModule fragShaderModule = _vulkan_shader_module_load(vulkan_app_data, "shader_frag");
+
+	e_dynarr_add(vulkan_app_data->shaders, &vertShaderModule);
+	e_dynarr_add(vulkan_app_data->shaders, &fragShaderModule);
+}
+
+/**
+ * _vulkan_device_supports_display
+ *
+ * returns true if the shared device can present to and build a swapchain for vulkan_display_data
+ */
+static bool _vulkan_device_supports_display(const PGraphicalAppData vulkan_app_data,
+		const PGraphicalDisplayData vulkan_display_data)
+{
+	// a headless display only needs the graphics queue every device has
+	if (vulkan_display_data->headless)
+		return true;
+
+	const PVulkanQueueFamilyInfo *present_queue = &vulkan_app_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_PRESENT];
+	uint64_t present_queue_families = _vulkan_present_queue_families(
+			_vulkan_physical_device_info_find(vulkan_app_data, vulkan_app_data->physical_device),
+			vulkan_display_data->surface);
+	if (!present_queue->exists || present_queue->index >= 64 ||
+			!(present_queue_families & (1ULL << present_queue->index)))
+		return false;
+
+	PArena *scratch = p_arena_scratch();
+	PArenaMark mark = p_arena_mark(scratch);
+	PVulkanSwapchainSupport swapchain = _vulkan_swapchain_auto_pick(scratch, vulkan_app_data->physical_device,
+			vulkan_display_data->surface, vulkan_display_data->latency_mode);
+	bool swapchain_supported = swapchain.format != NULL && swapchain.present_mode != NULL;
+	p_arena_reset(scratch, mark);
+	return swapchain_supported;
+}
+
+/**
+ * _vulkan_frames_create
+ *
+ * creates the command pool, command buffers and synchronization of every frame in flight
+ */
+static void _vulkan_frames_create(PGraphicalDisplayData vulkan_display_data)
 {
-	VkShaderModule shader_module;
-	VkShaderModuleCreateInfo create_info = {0};
-	create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	create_info.codeSize = shader_data_size;
-	create_info.pCode = (uint32_t *)shader_data;
-	if (vkCreateShaderModule(vulkan_display_data->logical_device, &create_info, NULL, &shader_module)
+	VkDevice logical_device = vulkan_display_data->logical_device;
+
+	VkCommandPoolCreateInfo command_pool_create_info = {0};
+	command_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	command_pool_create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	command_pool_create_info.queueFamilyIndex = vulkan_display_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_GRAPHICS].index;
+	if (vkCreateCommandPool(logical_device, &command_pool_create_info, NULL, &vulkan_display_data->command_pool)
 			!= VK_SUCCESS)
 	{
-		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create shader module!");
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create command pool!");
+		exit(1);
+	}
+
+	VkCommandBuffer command_buffers[P_VULKAN_FRAMES_IN_FLIGHT];
+	VkCommandBufferAllocateInfo command_buffer_allocate_info = {0};
+	command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	command_buffer_allocate_info.commandPool = vulkan_display_data->command_pool;
+	command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	command_buffer_allocate_info.commandBufferCount = P_VULKAN_FRAMES_IN_FLIGHT;
+	if (vkAllocateCommandBuffers(logical_device, &command_buffer_allocate_info, command_buffers) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to allocate command buffers!");
 		exit(1);
 	}
-	return shader_module;
+
+	VkSemaphoreCreateInfo semaphore_create_info = {0};
+	semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	VkFenceCreateInfo fence_create_info = {0};
+	fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fence_create_info.flags = VK_FENCE_CREATE_SIGNALED_BIT; // so the first wait on each frame returns
+	for (uint i = 0; i < P_VULKAN_FRAMES_IN_FLIGHT; i++)
+	{
+		PVulkanFrame *frame = &vulkan_display_data->frames[i];
+		frame->command_buffer = command_buffers[i];
+		if (vkCreateSemaphore(logical_device, &semaphore_create_info, NULL, &frame->image_available) != VK_SUCCESS ||
+				vkCreateFence(logical_device, &fence_create_info, NULL, &frame->in_flight) != VK_SUCCESS)
+		{
+			p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create frame synchronization objects!");
+			exit(1);
+		}
+	}
 }
 
+/**
+ * _vulkan_display_init
+ *
+ * creates everything a display renders with, its surface must already be set unless it is headless
+ * The first display picks and creates the device, later displays share it
+ * returns false, having created nothing, if the shared device cannot present to the display
+ */
+static bool _vulkan_display_init(PGraphicalDisplayData vulkan_display_data, const PGraphicalAppData vulkan_app_data,
+		const PGraphicalDisplayRequest * const vulkan_display_request, uint width, uint height)
+{
+	p_light_mutex_lock(&vulkan_app_data->device_mutex);
+	if (vulkan_app_data->logical_device == VK_NULL_HANDLE)
+	{
+		PGraphicalDevice physical_device = p_graphics_vulkan_device_auto_pick(vulkan_app_data, vulkan_display_data,
+				vulkan_display_request);
+		if (physical_device.handle == VK_NULL_HANDLE)
+		{
+			p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to find a suitable GPU!");
+			exit(1);
+		}
+		_vulkan_device_set(vulkan_app_data, vulkan_display_request, physical_device, vulkan_display_data);
+		vulkan_app_data->allocator = p_vulkan_allocator_init(vulkan_app_data->physical_device,
+				vulkan_app_data->logical_device, vulkan_app_data->memory_budget);
+		const PVulkanQueueFamilyInfo *graphics = &vulkan_app_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_GRAPHICS];
+		const PVulkanQueueFamilyInfo *transfer = &vulkan_app_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_TRANSFER];
+		if (graphics->exists && transfer->index != graphics->index)
+		{
+			vulkan_app_data->allocator->shared_queue_families[0] = graphics->index;
+			vulkan_app_data->allocator->shared_queue_families[1] = transfer->index;
+			vulkan_app_data->allocator->shared_queue_family_count = 2;
+		}
+		vulkan_app_data->uploader = p_vulkan_uploader_init(vulkan_app_data->logical_device,
+				vulkan_app_data->allocator, *transfer, &vulkan_app_data->queue_mutex,
+				vulkan_app_data->timeline_semaphore);
+		_vulkan_pipeline_cache_create(vulkan_app_data);
+		vulkan_app_data->shader_cache = p_vulkan_shader_cache_init(vulkan_app_data->logical_device);
+		_vulkan_shaders_create(vulkan_app_data);
+	} else if (!_vulkan_device_supports_display(vulkan_app_data, vulkan_display_data)) {
+		// a device made for a headless display has no present queue, windows must be created first
+		if (!vulkan_app_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_PRESENT].exists)
+			p_log_message(P_LOG_ERROR, L"Vulkan General",
+					L"The shared device was made for a headless display and cannot present to windows!");
+		else
+			p_log_message(P_LOG_ERROR, L"Vulkan General", L"The shared device cannot present to this window!");
+		p_light_mutex_unlock(&vulkan_app_data->device_mutex);
+		return false;
+	}
+	p_light_mutex_unlock(&vulkan_app_data->device_mutex);
+
+	vulkan_display_data->current_physical_device = vulkan_app_data->physical_device;
+	vulkan_display_data->logical_device = vulkan_app_data->logical_device;
+	memcpy(vulkan_display_data->queue_family_infos, vulkan_app_data->queue_family_infos,
+			sizeof vulkan_display_data->queue_family_infos);
+	vulkan_display_data->pipeline_cache = vulkan_app_data->pipeline_cache;
+	vulkan_display_data->queue_mutex = &vulkan_app_data->queue_mutex;
+	vulkan_display_data->allocator = vulkan_app_data->allocator;
+	vulkan_display_data->uploader = vulkan_app_data->uploader;
+	vulkan_display_data->shader_cache = vulkan_app_data->shader_cache;
+
+	// Set swapchain data
+	vulkan_display_data->stereoscopic = vulkan_display_request->stereoscopic;
+	vulkan_display_data->latency_mode = vulkan_display_request->latency_mode;
+	vulkan_display_data->requested_image_count = vulkan_display_request->image_count;
+	vulkan_display_data->present_mode = VK_PRESENT_MODE_MAX_ENUM_KHR;
+	vulkan_display_data->retired_swapchains = e_dynarr_init(sizeof (PVulkanRetiredSwapchain), 1);
+	if (vulkan_display_data->headless)
+		_vulkan_offscreen_create(vulkan_display_data, width, height);
+	else
+		_vulkan_swapchain_create(vulkan_display_data, width, height);
+
+	VkPipelineLayoutCreateInfo pipeline_layout_create_info = {0};
+	pipeline_layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	if (vkCreatePipelineLayout(vulkan_display_data->logical_device, &pipeline_layout_create_info, NULL,
+				&vulkan_display_data->pipeline_layout) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create pipeline layout!");
+		exit(1);
+	}
+
+	// Render pass
+	VkAttachmentDescription color_attachment = {0};
+	color_attachment.format = vulkan_display_data->swapchain_format;
+	color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	// offscreen images are left ready to be copied out by p_graphics_vulkan_display_read
+	color_attachment.finalLayout = vulkan_display_data->headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL :
+		VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+	VkAttachmentReference color_attachment_ref = {0};
+	color_attachment_ref.attachment = 0;
+	color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkSubpassDescription subpass = {0};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &color_attachment_ref;
+
+	VkRenderPassCreateInfo render_pass_create_info = {0};
+	render_pass_create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	render_pass_create_info.attachmentCount = 1;
+	render_pass_create_info.pAttachments = &color_attachment;
+	render_pass_create_info.subpassCount = 1;
+	render_pass_create_info.pSubpasses = &subpass;
+	// the image is only available once the acquire semaphore, waited on at this stage, is signaled
+	VkSubpassDependency dependency = {0};
+	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependency.dstSubpass = 0;
+	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependency.srcAccessMask = 0;
+	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	render_pass_create_info.dependencyCount = 1;
+	render_pass_create_info.pDependencies = &dependency;
+	if (vkCreateRenderPass(vulkan_display_data->logical_device, &render_pass_create_info, NULL,
+				&vulkan_display_data->render_pass) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create render pass!");
+		exit(1);
+	}
+
+	// the default pipeline draws with the app's shaders, others are made with p_graphics_vulkan_pipelines_build
+	PGraphicsPipelineRequest pipeline_request = {0};
+	pipeline_request.topology = P_GRAPHICS_TOPOLOGY_TRIANGLE_LIST;
+	pipeline_request.cull = true;
+	vulkan_display_data->graphics_pipeline = p_vulkan_pipeline_create(vulkan_display_data, &pipeline_request,
+			E_DYNARR_GET(vulkan_app_data->shaders, VkShaderModule, 0),
+			E_DYNARR_GET(vulkan_app_data->shaders, VkShaderModule, 1));
+	if (vulkan_display_data->graphics_pipeline == VK_NULL_HANDLE)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create graphics pipeline!");
+		exit(1);
+	}
+
+	if (vulkan_display_data->swapchain != VK_NULL_HANDLE || vulkan_display_data->headless)
+		_vulkan_swapchain_framebuffers_create(vulkan_display_data);
+	_vulkan_frames_create(vulkan_display_data);
+
+	// timestamps are only measured when the graphics queue family has them
+	const PVulkanPhysicalDeviceInfo *info = _vulkan_physical_device_info_find(vulkan_app_data,
+			vulkan_app_data->physical_device);
+	uint32_t timestamp_valid_bits =
+		info->queue_families[vulkan_display_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_GRAPHICS].index]
+		.timestampValidBits;
+	if (timestamp_valid_bits > 0)
+		vulkan_display_data->profiler = p_vulkan_profiler_init(vulkan_display_data->logical_device,
+				info->properties.limits.timestampPeriod, timestamp_valid_bits);
+	return true;
+}
 
 /**
  * p_graphics_vulkan_display_create
  *
  * Creates a vulkan surface based on the platform
  * and assigns it to window_data
+ * The first display picks and creates the device, later displays share it
+ * If that device cannot present to the window, the window is left without a display and draws nothing
  */
 void p_graphics_vulkan_display_create(PWindowData *window_data, const PGraphicalAppData vulkan_app_data,
 		const PGraphicalDisplayRequest * const vulkan_display_request)
 {
 	PGraphicalDisplayData vulkan_display_data = calloc(1, sizeof *vulkan_display_data);
 	vulkan_display_data->instance = vulkan_app_data->instance;
+	p_light_mutex_init(&vulkan_display_data->shared_pool_mutex);
 
 	p_window_set_graphical_display(window_data, vulkan_app_data, vulkan_display_data);
+	if (!_vulkan_display_init(vulkan_display_data, vulkan_app_data, vulkan_display_request, window_data->width,
+			window_data->height))
+	{
+		vkDestroySurfaceKHR(vulkan_display_data->instance, vulkan_display_data->surface, NULL);
+		free(vulkan_display_data);
+		window_data->graphical_display_data = NULL;
+		return;
+	}
+	window_data->graphical_display_data = vulkan_display_data;
+}
 
-	PGraphicalDevice physical_device = p_graphics_vulkan_device_auto_pick(vulkan_display_data, vulkan_app_data,
-			vulkan_display_request);
-	if (physical_device.handle == VK_NULL_HANDLE)
+/**
+ * p_graphics_vulkan_headless_display_create
+ *
+ * creates a display without a window, surface or swapchain that renders into width x height offscreen images
+ * frames are drawn with p_graphics_vulkan_headless_display_draw and read with p_graphics_vulkan_display_read
+ */
+PGraphicalDisplayData p_graphics_vulkan_headless_display_create(const PGraphicalAppData vulkan_app_data,
+		const PGraphicalDisplayRequest * const vulkan_display_request, uint width, uint height)
+{
+	if (width == 0 || height == 0)
 	{
-		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to find a suitable GPU!");
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Headless display must have an area!");
 		exit(1);
 	}
-	p_graphics_vulkan_device_set(vulkan_display_data, vulkan_display_request,physical_device, vulkan_display_data,
-			window_data);
+	PGraphicalDisplayData vulkan_display_data = calloc(1, sizeof *vulkan_display_data);
+	vulkan_display_data->instance = vulkan_app_data->instance;
+	vulkan_display_data->headless = true;
+	p_light_mutex_init(&vulkan_display_data->shared_pool_mutex);
+
+	// the device picked for it does not need to present
+	PGraphicalDisplayRequest headless_request = *vulkan_display_request;
+	headless_request.headless = true;
+	_vulkan_display_init(vulkan_display_data, vulkan_app_data, &headless_request, width, height);
+	return vulkan_display_data;
+}
 
-	window_data->graphical_display_data = vulkan_display_data;
+/**
+ * p_graphics_vulkan_display_latency_mode
+ *
+ * returns the latency mode the display's swapchain ended up with
+ * this differs from the requested one when the surface does not support it
+ */
+enum PGraphicalLatencyMode p_graphics_vulkan_display_latency_mode(const PGraphicalDisplayData vulkan_display_data)
+{
+	switch (vulkan_display_data->present_mode)
+	{
+		case VK_PRESENT_MODE_IMMEDIATE_KHR:
+			return P_GRAPHICAL_LATENCY_LOWEST;
+		case VK_PRESENT_MODE_MAILBOX_KHR:
+			return P_GRAPHICAL_LATENCY_TRIPLE_BUFFERED;
+		case VK_PRESENT_MODE_FIFO_KHR:
+			return P_GRAPHICAL_LATENCY_POWER_SAVING;
+		case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+			return P_GRAPHICAL_LATENCY_ADAPTIVE;
+		default:
+			return P_GRAPHICAL_LATENCY_DEFAULT;
+	}
+}
 
-	// TODO: refactor this to get shader path from config, also put render stuff in renderer
-	char *shader_vert_path = "build/src/platinum/shaders/shader_vert.spv";
-	uint shader_vert_size = p_file_get_size(shader_vert_path);
-	char *shader_vert_data = malloc(shader_vert_size * sizeof(char));
-	p_file_read(shader_vert_path, shader_vert_data, shader_vert_size);
+/**
+ * _vulkan_display_draw
+ *
+ * records, submits and presents one frame to the window, width x height is the window's size
+ * the swapchain is rebuilt first if the window was resized or presenting found it out of date
+ * headless displays render into their offscreen image instead and present nothing
+ * returns false if nothing was drawn, e.g. while the window is minimized or has no display
+ */
+static bool _vulkan_display_draw(PGraphicalDisplayData vulkan_display_data, uint width, uint height)
+{
+	VkDevice logical_device = vulkan_display_data->logical_device;
+	PVulkanFrame *frame = &vulkan_display_data->frames[vulkan_display_data->frame_index];
+
+	// Wait until the GPU is done with the last use of this frame, older frames are done too
+	vkWaitForFences(logical_device, 1, &frame->in_flight, VK_TRUE, UINT64_MAX);
+	_vulkan_retired_swapchains_release(vulkan_display_data, false);
+	p_vulkan_thread_pools_reset(frame, vulkan_display_data->thread_pool_count, logical_device);
+	p_vulkan_profiler_resolve(vulkan_display_data->profiler, vulkan_display_data->frame_index);
+
+	// a headless display renders into the offscreen image of the frame, free once the frame's fence signaled
+	uint32_t image_index = vulkan_display_data->frame_index;
+	VkResult result = VK_SUCCESS;
+	if (!vulkan_display_data->headless)
+	{
+		if (vulkan_display_data->swapchain == VK_NULL_HANDLE || vulkan_display_data->swapchain_stale ||
+				width != vulkan_display_data->swapchain_width || height != vulkan_display_data->swapchain_height)
+		{
+			if (!_vulkan_swapchain_create(vulkan_display_data, width, height))
+				return false;
+		}
 
-	char *shader_frag_path = "build/src/platinum/shaders/shader_frag.spv";
-	uint shader_frag_size = p_file_get_size(shader_frag_path);
-	char *shader_frag_data = malloc(shader_frag_size * sizeof(char));
-	p_file_read(shader_frag_path, shader_frag_data, shader_frag_size);
+		result = vkAcquireNextImageKHR(logical_device, vulkan_display_data->swapchain, UINT64_MAX,
+				frame->image_available, VK_NULL_HANDLE, &image_index);
+		if (result == VK_ERROR_OUT_OF_DATE_KHR)
+		{
+			vulkan_display_data->swapchain_stale = true;
+			return false;
+		} else if (result == VK_SUBOPTIMAL_KHR) {
+			vulkan_display_data->swapchain_stale = true;
+		} else if (result != VK_SUCCESS) {
+			p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to acquire swapchain image!");
+			exit(1);
+		}
+	}
 
+	// Only reset once work is certain to be submitted, otherwise the next wait on it never returns
+	vkResetFences(logical_device, 1, &frame->in_flight);
 
-	if (vulkan_display_data->shaders != NULL)
-		e_dynarr_deinit(vulkan_display_data->shaders);
-	vulkan_display_data->shaders = e_dynarr_init(sizeof (VkShaderModule), 2);
+	// Record
+	VkCommandBuffer command_buffer = frame->command_buffer;
+	vkResetCommandBuffer(command_buffer, 0);
+	VkCommandBufferBeginInfo begin_info = {0};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to begin recording command buffer!");
+		exit(1);
+	}
+	p_vulkan_profiler_frame_begin(vulkan_display_data->profiler, vulkan_display_data->frame_index,
+			vulkan_display_data->frame_count, command_buffer);
+	PGraphicsCommandBuffer primary = { .handle = command_buffer, .display = vulkan_display_data };
+	p_graphics_vulkan_profile_begin(&primary, "frame");
+
+	VkClearValue clear_color = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+	VkRenderPassBeginInfo render_pass_begin_info = {0};
+	render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	render_pass_begin_info.renderPass = vulkan_display_data->render_pass;
+	render_pass_begin_info.framebuffer = E_DYNARR_GET(vulkan_display_data->swapchain_framebuffers, VkFramebuffer,
+			image_index);
+	render_pass_begin_info.renderArea.offset = (VkOffset2D){0, 0};
+	render_pass_begin_info.renderArea.extent = vulkan_display_data->swapchain_extent;
+	render_pass_begin_info.clearValueCount = 1;
+	render_pass_begin_info.pClearValues = &clear_color;
+	if (vulkan_display_data->job_system != NULL)
+	{
+		vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		p_vulkan_record_secondaries(vulkan_display_data, render_pass_begin_info.framebuffer, command_buffer);
+	} else {
+		vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
 
-	VkShaderModule vertShaderModule = _create_shader_module(vulkan_display_data, shader_vert_data, shader_vert_size);
-	VkShaderModule fragShaderModule = _create_shader_module(vulkan_display_data, shader_frag_data, shader_frag_size);
-	free(shader_vert_data);
-	free(shader_frag_data);
+		vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vulkan_display_data->graphics_pipeline);
 
-	e_dynarr_add(vulkan_display_data->shaders, &vertShaderModule);
-	e_dynarr_add(vulkan_display_data->shaders, &fragShaderModule);
+		VkViewport viewport = {0};
+		viewport.width = (float) vulkan_display_data->swapchain_extent.width;
+		viewport.height = (float) vulkan_display_data->swapchain_extent.height;
+		viewport.maxDepth = 1.0f;
+		vkCmdSetViewport(command_buffer, 0, 1, &viewport);
 
-	VkPipelineShaderStageCreateInfo vertShaderStageInfo = {0};
-	vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vertShaderStageInfo.module = vertShaderModule;
-	vertShaderStageInfo.pName = "main";
+		VkRect2D scissor = {0};
+		scissor.extent = vulkan_display_data->swapchain_extent;
+		vkCmdSetScissor(command_buffer, 0, 1, &scissor);
 
-	VkPipelineShaderStageCreateInfo fragShaderStageInfo = {0};
-	fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	fragShaderStageInfo.module = fragShaderModule;
-	fragShaderStageInfo.pName = "main";
+		vkCmdDraw(command_buffer, 3, 1, 0, 0);
+	}
+	vkCmdEndRenderPass(command_buffer);
+	p_graphics_vulkan_profile_end(&primary);
+	if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to record command buffer!");
+		exit(1);
+	}
 
-	VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+	// Submit and present
+	VkSemaphore wait_semaphores[2];
+	VkPipelineStageFlags wait_stages[2];
+	uint64_t wait_values[2];
+	uint32_t wait_count = 0;
+	VkSemaphore render_finished = VK_NULL_HANDLE;
+	VkSubmitInfo submit_info = {0};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.pWaitSemaphores = wait_semaphores;
+	submit_info.pWaitDstStageMask = wait_stages;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &command_buffer;
+	if (!vulkan_display_data->headless)
+	{
+		render_finished = E_DYNARR_GET(vulkan_display_data->swapchain_render_finished, VkSemaphore, image_index);
+		wait_semaphores[wait_count] = frame->image_available;
+		wait_stages[wait_count] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		wait_values[wait_count++] = 0;
+		submit_info.signalSemaphoreCount = 1;
+		submit_info.pSignalSemaphores = &render_finished;
+	}
 
-	VkDynamicState dynamicStates[2] = {
-		VK_DYNAMIC_STATE_VIEWPORT,
-		VK_DYNAMIC_STATE_SCISSOR
-	};
+	// Rendering may read anything uploaded so far, only the parts that read wait for the transfer queue
+	uint64_t upload_value = p_vulkan_uploader_flush(vulkan_display_data->uploader);
+	VkTimelineSemaphoreSubmitInfo timeline_submit_info = {0};
+	timeline_submit_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timeline_submit_info.pWaitSemaphoreValues = wait_values;
+	if (upload_value > vulkan_display_data->upload_value)
+	{
+		if (vulkan_display_data->uploader->timeline != VK_NULL_HANDLE)
+		{
+			wait_semaphores[wait_count] = vulkan_display_data->uploader->timeline;
+			wait_stages[wait_count] = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+				VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+			wait_values[wait_count++] = upload_value;
+			timeline_submit_info.waitSemaphoreValueCount = wait_count;
+			submit_info.pNext = &timeline_submit_info;
+		} else {
+			p_vulkan_uploader_wait(vulkan_display_data->uploader, upload_value);
+		}
+		vulkan_display_data->upload_value = upload_value;
+	}
+	submit_info.waitSemaphoreCount = wait_count;
+
+	VkPresentInfoKHR present_info = {0};
+	present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+	present_info.waitSemaphoreCount = 1;
+	present_info.pWaitSemaphores = &render_finished;
+	present_info.swapchainCount = 1;
+	present_info.pSwapchains = &vulkan_display_data->swapchain;
+	present_info.pImageIndices = &image_index;
+
+	p_light_mutex_lock(vulkan_display_data->queue_mutex);
+	if (vkQueueSubmit(vulkan_display_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_GRAPHICS].queue, 1, &submit_info,
+				frame->in_flight) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to submit draw command buffer!");
+		exit(1);
+	}
+	if (!vulkan_display_data->headless)
+		result = vkQueuePresentKHR(vulkan_display_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_PRESENT].queue,
+				&present_info);
+	p_light_mutex_unlock(vulkan_display_data->queue_mutex);
+	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+	{
+		vulkan_display_data->swapchain_stale = true;
+	} else if (result != VK_SUCCESS) {
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to present swapchain image!");
+		exit(1);
+	}
+
+	vulkan_display_data->frame_index = (vulkan_display_data->frame_index + 1) % P_VULKAN_FRAMES_IN_FLIGHT;
+	vulkan_display_data->frame_count++;
+	return true;
+}
+
+/**
+ * p_graphics_vulkan_display_draw
+ *
+ * draws a frame of the window's display
+ * returns false if nothing was drawn, e.g. while the window is minimized or has no display
+ */
+bool p_graphics_vulkan_display_draw(PWindowData *window_data)
+{
+	if (window_data->graphical_display_data == NULL)
+		return false;
+	return _vulkan_display_draw(window_data->graphical_display_data, window_data->width, window_data->height);
+}
+
+/**
+ * p_graphics_vulkan_headless_display_draw
+ *
+ * draws a frame of a headless display into its offscreen image
+ */
+bool p_graphics_vulkan_headless_display_draw(PGraphicalDisplayData vulkan_display_data)
+{
+	return _vulkan_display_draw(vulkan_display_data, vulkan_display_data->swapchain_width,
+			vulkan_display_data->swapchain_height);
+}
+
+/**
+ * _vulkan_readback_record
+ *
+ * records copying image, left in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL by the render pass, into the readback buffer
+ */
+static void _vulkan_readback_record(const PGraphicalDisplayData vulkan_display_data, VkImage image)
+{
+	VkCommandBuffer command_buffer = vulkan_display_data->readback_command_buffer;
+	VkCommandBufferBeginInfo begin_info = {0};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to begin recording readback command buffer!");
+		exit(1);
+	}
+
+	// the frame's fence only says rendering is done, its writes still have to be made visible to the copy
+	VkImageMemoryBarrier image_barrier = {0};
+	image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	image_barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	image_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	image_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	image_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	image_barrier.image = image;
+	image_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	image_barrier.subresourceRange.levelCount = 1;
+	image_barrier.subresourceRange.layerCount = 1;
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 0, NULL, 0, NULL, 1, &image_barrier);
+
+	VkBufferImageCopy region = {0};
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent = (VkExtent3D){ vulkan_display_data->swapchain_extent.width,
+		vulkan_display_data->swapchain_extent.height, 1 };
+	vkCmdCopyImageToBuffer(command_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			vulkan_display_data->readback->handle, 1, &region);
+
+	VkBufferMemoryBarrier buffer_barrier = {0};
+	buffer_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	buffer_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	buffer_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	buffer_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	buffer_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	buffer_barrier.buffer = vulkan_display_data->readback->handle;
+	buffer_barrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 1,
+			&buffer_barrier, 0, NULL);
+
+	if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to record readback command buffer!");
+		exit(1);
+	}
+}
 
-	VkPipelineDynamicStateCreateInfo dynamicState = {0};
-	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-	dynamicState.dynamicStateCount = 2;
-	dynamicState.pDynamicStates = dynamicStates;
-
-	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {0};
-	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputInfo.vertexBindingDescriptionCount = 0;
-	vertexInputInfo.pVertexBindingDescriptions = NULL; // Optional
-	vertexInputInfo.vertexAttributeDescriptionCount = 0;
-	vertexInputInfo.pVertexAttributeDescriptions = NULL; // Optional
-
-	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {0};
-	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-	inputAssembly.primitiveRestartEnable = VK_FALSE;
-
-	VkViewport viewport = {0};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = (float) vulkan_display_data->swapchain_extent.width;
-	viewport.height = (float) vulkan_display_data->swapchain_extent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-
-	VkRect2D scissor = {0};
-	scissor.offset = (VkOffset2D){0, 0};
-	scissor.extent = vulkan_display_data->swapchain_extent;
+/**
+ * p_graphics_vulkan_display_read
+ *
+ * copies the last frame drawn by a headless display into pixels, width * height * 4 bytes of tightly packed RGBA8
+ * blocks until the frame is rendered and copied
+ * returns false if nothing was drawn yet or the display is not headless
+ */
+bool p_graphics_vulkan_display_read(PGraphicalDisplayData vulkan_display_data, void *pixels)
+{
+	if (!vulkan_display_data->headless || vulkan_display_data->frame_count == 0)
+		return false;
+	VkDevice logical_device = vulkan_display_data->logical_device;
+	uint last_frame_index = (vulkan_display_data->frame_index + P_VULKAN_FRAMES_IN_FLIGHT - 1) %
+		P_VULKAN_FRAMES_IN_FLIGHT;
+	vkWaitForFences(logical_device, 1, &vulkan_display_data->frames[last_frame_index].in_flight, VK_TRUE, UINT64_MAX);
+
+	uint64_t size = (uint64_t)vulkan_display_data->swapchain_extent.width *
+		vulkan_display_data->swapchain_extent.height * 4;
+	if (vulkan_display_data->readback == NULL)
+	{
+		PGraphicsBufferRequest buffer_request = {0};
+		buffer_request.size = size;
+		buffer_request.usage = P_GRAPHICS_BUFFER_TRANSFER_DST;
+		buffer_request.memory_usage = P_GRAPHICS_MEMORY_GPU_TO_CPU;
+		vulkan_display_data->readback = p_vulkan_buffer_create(vulkan_display_data->allocator, &buffer_request);
+		if (vulkan_display_data->readback == NULL)
+		{
+			p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create readback buffer!");
+			exit(1);
+		}
+
+		VkCommandBufferAllocateInfo allocate_info = {0};
+		allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocate_info.commandPool = vulkan_display_data->command_pool;
+		allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocate_info.commandBufferCount = 1;
+		VkFenceCreateInfo fence_create_info = {0};
+		fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		if (vkAllocateCommandBuffers(logical_device, &allocate_info, &vulkan_display_data->readback_command_buffer)
+				!= VK_SUCCESS || vkCreateFence(logical_device, &fence_create_info, NULL,
+					&vulkan_display_data->readback_fence) != VK_SUCCESS)
+		{
+			p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create readback command buffer!");
+			exit(1);
+		}
+	}
+
+	// the command pool is only used by the drawing thread, which is this one
+	vkResetCommandBuffer(vulkan_display_data->readback_command_buffer, 0);
+	_vulkan_readback_record(vulkan_display_data, vulkan_display_data->offscreen_images[last_frame_index]->handle);
+	VkSubmitInfo submit_info = {0};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &vulkan_display_data->readback_command_buffer;
+	vkResetFences(logical_device, 1, &vulkan_display_data->readback_fence);
+	p_light_mutex_lock(vulkan_display_data->queue_mutex);
+	if (vkQueueSubmit(vulkan_display_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_GRAPHICS].queue, 1, &submit_info,
+				vulkan_display_data->readback_fence) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to submit readback command buffer!");
+		exit(1);
+	}
+	p_light_mutex_unlock(vulkan_display_data->queue_mutex);
+	vkWaitForFences(logical_device, 1, &vulkan_display_data->readback_fence, VK_TRUE, UINT64_MAX);
+
+	p_graphics_vulkan_buffer_invalidate(vulkan_display_data->readback, 0, size);
+	memcpy(pixels, p_graphics_vulkan_buffer_map(vulkan_display_data->readback), size);
+	return true;
 }
 
 /**
@@ -1136,23 +2321,40 @@ void p_graphics_vulkan_display_create(PWindowData *window_data, const PGraphical
  */
 void p_graphics_vulkan_display_destroy(PGraphicalDisplayData vulkan_display_data)
 {
+	VkDevice logical_device = vulkan_display_data->logical_device;
 
-	for (uint i = 0; i < vulkan_display_data->shaders->num_items; i++)
-		vkDestroyShaderModule(vulkan_display_data->logical_device,
-				E_DYNARR_GET(vulkan_display_data->shaders, VkShaderModule, i), NULL);
-	e_dynarr_deinit(vulkan_display_data->shaders);
+	// Only wait for this display's work, the device is shared with other windows
+	for (uint i = 0; i < P_VULKAN_FRAMES_IN_FLIGHT; i++)
+		vkWaitForFences(logical_device, 1, &vulkan_display_data->frames[i].in_flight, VK_TRUE, UINT64_MAX);
+	if (!vulkan_display_data->headless)
+	{
+		p_light_mutex_lock(vulkan_display_data->queue_mutex);
+		vkQueueWaitIdle(vulkan_display_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_PRESENT].queue);
+		p_light_mutex_unlock(vulkan_display_data->queue_mutex);
+	}
 
-	e_dynarr_deinit(vulkan_display_data->compatible_devices);
-	e_dynarr_deinit(vulkan_display_data->swapchain_images);
+	vkDestroyPipeline(logical_device, vulkan_display_data->graphics_pipeline, NULL);
+	vkDestroyPipelineLayout(logical_device, vulkan_display_data->pipeline_layout, NULL);
+	vkDestroyRenderPass(logical_device, vulkan_display_data->render_pass, NULL);
 
-	for (uint i = 0; i < vulkan_display_data->swapchain_image_views->num_items; i++)
-		vkDestroyImageView(vulkan_display_data->logical_device,
-				E_DYNARR_GET(vulkan_display_data->swapchain_image_views, VkImageView, i), NULL);
-	e_dynarr_deinit(vulkan_display_data->swapchain_image_views);
+	if (vulkan_display_data->headless)
+		_vulkan_offscreen_destroy(vulkan_display_data);
+	_vulkan_swapchain_retire(vulkan_display_data);
+	_vulkan_retired_swapchains_release(vulkan_display_data, true);
+	e_dynarr_deinit(vulkan_display_data->retired_swapchains);
+
+	for (uint i = 0; i < P_VULKAN_FRAMES_IN_FLIGHT; i++)
+	{
+		vkDestroySemaphore(logical_device, vulkan_display_data->frames[i].image_available, NULL);
+		vkDestroyFence(logical_device, vulkan_display_data->frames[i].in_flight, NULL);
+	}
+	vkDestroyCommandPool(logical_device, vulkan_display_data->command_pool, NULL);
+	p_vulkan_thread_pools_destroy(vulkan_display_data);
+	free(vulkan_display_data->record_tasks);
+	p_vulkan_profiler_deinit(vulkan_display_data->profiler);
 
-	vkDestroySwapchainKHR(vulkan_display_data->logical_device, vulkan_display_data->swapchain, NULL);
-	vkDestroySurfaceKHR(vulkan_display_data->instance, vulkan_display_data->surface, NULL);
-	vkDestroyDevice(vulkan_display_data->logical_device, NULL);
+	if (vulkan_display_data->surface != VK_NULL_HANDLE)
+		vkDestroySurfaceKHR(vulkan_display_data->instance, vulkan_display_data->surface, NULL);
 	free(vulkan_display_data);
 }
 
@@ -3,6 +3,7 @@
 
 #include <vulkan/vulkan.h>
 #include <enigma.h>
+#include "p_util.h"
 
 #ifdef PLATINUM_DISPLAY_X11
 #include <xcb/xcb.h>
@@ -59,6 +60,34 @@ typedef struct {
 	VkQueue queue;
 } PVulkanQueueFamilyInfo;
 
+/**
+ * PVulkanNameSet
+ *
+ * This struct is an open addressing hash set of extension or layer names
+ */
+typedef struct {
+	uint32_t count;
+	uint32_t mask; // number of slots - 1, the number of slots is a power of two
+	char (*names)[VK_MAX_EXTENSION_NAME_SIZE];
+	uint32_t *slots; // index into names + 1, 0 if the slot is empty
+} PVulkanNameSet;
+
+/**
+ * PVulkanPhysicalDeviceInfo
+ *
+ * This struct caches everything queried about a physical device when vulkan is initialized
+ */
+typedef struct {
+	VkPhysicalDevice handle;
+	VkPhysicalDeviceProperties properties;
+	VkPhysicalDeviceFeatures features;
+	VkPhysicalDeviceMemoryProperties memory_properties;
+	uint32_t queue_family_count;
+	VkQueueFamilyProperties *queue_families;
+	PVulkanNameSet extensions;
+	bool timeline_semaphore; // vulkan 1.2 timeline semaphores are supported
+} PVulkanPhysicalDeviceInfo;
+
 enum PVulkanQueueType {
 	P_VULKAN_QUEUE_TYPE_GRAPHICS,
 	P_VULKAN_QUEUE_TYPE_PRESENT,
@@ -71,25 +100,413 @@ enum PVulkanQueueType {
 	P_VULKAN_QUEUE_TYPE_MAX
 };
 
+// Number of frames the CPU may record ahead of the GPU
+#ifndef P_VULKAN_FRAMES_IN_FLIGHT
+#define P_VULKAN_FRAMES_IN_FLIGHT 2
+#endif // P_VULKAN_FRAMES_IN_FLIGHT
+
+/**
+ * PVulkanThreadCommandPool
+ *
+ * This struct is the command pool one thread records secondary command buffers from during one frame
+ * The whole pool is reset when the frame is reused, its command buffers are never freed one by one
+ */
+typedef struct {
+	VkCommandPool command_pool;
+	EDynarr *command_buffers; // contains VkCommandBuffer, secondary, kept for the next use of the frame
+	uint used; // command buffers handed out since the last reset
+} PVulkanThreadCommandPool;
+
+/**
+ * PVulkanRecordTask
+ *
+ * This struct is one secondary command buffer recorded by a job
+ */
+typedef struct {
+	PGraphicalDisplayData display;
+	uint index;
+	VkFramebuffer framebuffer;
+	VkCommandBuffer command_buffer; // set by the job
+} PVulkanRecordTask;
+
+// Timestamp scopes one frame of a display may record, each one uses two queries
+#ifndef P_VULKAN_PROFILE_SCOPES_MAX
+#define P_VULKAN_PROFILE_SCOPES_MAX 256
+#endif // P_VULKAN_PROFILE_SCOPES_MAX
+
+// Resolved frames kept for p_graphics_profile_dump
+#ifndef P_VULKAN_PROFILE_HISTORY
+#define P_VULKAN_PROFILE_HISTORY 32
+#endif // P_VULKAN_PROFILE_HISTORY
+
+// Scopes one command buffer may have open at once
+#define P_VULKAN_PROFILE_DEPTH_MAX 16
+
+/**
+ * PGraphicsCommandBuffer
+ *
+ * This struct is a command buffer being recorded inside the display's render pass
+ */
+struct PGraphicsCommandBuffer {
+	VkCommandBuffer handle;
+	PGraphicalDisplayData display;
+	uint profile_scopes[P_VULKAN_PROFILE_DEPTH_MAX]; // open timestamp scopes, UINT_MAX if the frame ran out
+	uint profile_depth;
+	uint profile_base_depth; // scopes of the primary command buffer this one is nested in
+};
+
+/**
+ * PVulkanProfileScope
+ *
+ * This struct is a timestamp scope recorded during a frame, its queries are 2 * index and 2 * index + 1
+ */
+typedef struct {
+	const char *name;
+	uint depth;
+} PVulkanProfileScope;
+
+/**
+ * PVulkanProfileFrame
+ *
+ * This struct holds the timestamp queries of one frame in flight
+ */
+typedef struct {
+	VkQueryPool query_pool;
+	uint scope_count;
+	PVulkanProfileScope scopes[P_VULKAN_PROFILE_SCOPES_MAX];
+	uint64_t frame_count; // display frame_count when it was recorded
+} PVulkanProfileFrame;
+
+/**
+ * PVulkanProfileEvent
+ *
+ * This struct is a resolved timestamp scope, times are in nanoseconds of the device's clock
+ */
+typedef struct {
+	const char *name;
+	double begin;
+	double end;
+	uint depth;
+} PVulkanProfileEvent;
+
+/**
+ * PVulkanProfileHistoryFrame
+ *
+ * This struct holds the resolved scopes of one frame
+ */
+typedef struct {
+	uint64_t frame_count;
+	uint event_count;
+	PVulkanProfileEvent events[P_VULKAN_PROFILE_SCOPES_MAX];
+} PVulkanProfileHistoryFrame;
+
+/**
+ * PVulkanProfiler
+ *
+ * This struct measures GPU time with timestamp queries, one per display
+ * A frame's queries are read once its fence has signaled, so resolving never stalls
+ */
+typedef struct {
+	VkDevice logical_device;
+	double timestamp_period; // nanoseconds per timestamp tick
+	uint64_t timestamp_mask; // bits of a timestamp that are valid
+	PLightMutex mutex; // guards the scope counts of the frames while jobs record
+	PVulkanProfileFrame frames[P_VULKAN_FRAMES_IN_FLIGHT];
+	PGraphicsProfileScope table[P_VULKAN_PROFILE_SCOPES_MAX]; // latest resolved frame
+	uint table_count;
+	PVulkanProfileHistoryFrame history[P_VULKAN_PROFILE_HISTORY];
+	uint history_next;
+	uint history_count;
+} PVulkanProfiler;
+
+/**
+ * PVulkanFrame
+ *
+ * This struct holds what one frame in flight needs, reused once its fence signals
+ */
+typedef struct {
+	PVulkanThreadCommandPool *thread_pools; // one per job worker and one for the drawing thread, NULL if unused
+	VkCommandBuffer command_buffer;
+	VkSemaphore image_available; // signaled when the acquired swapchain image can be rendered to
+	VkFence in_flight; // signaled when the GPU is done with this frame
+} PVulkanFrame;
+
+/**
+ * PVulkanRetiredSwapchain
+ *
+ * This struct holds a swapchain replaced by a resize until the frames still using it are done
+ */
+typedef struct {
+	VkSwapchainKHR swapchain;
+	EDynarr *images; // contains VkImage
+	EDynarr *image_views; // contains VkImageView
+	EDynarr *framebuffers; // contains VkFramebuffer
+	EDynarr *render_finished; // contains VkSemaphore
+	uint64_t retire_frame; // frame_count when it was replaced
+} PVulkanRetiredSwapchain;
+
+// Smallest piece of device memory handed out by the allocator, order 0 of the buddy blocks
+#define P_VULKAN_MEMORY_MIN_SIZE 256
+
+// Size of a memory block, smaller blocks are used on heaps too small to hold a few of these
+#ifndef P_VULKAN_MEMORY_BLOCK_SIZE
+#define P_VULKAN_MEMORY_BLOCK_SIZE (64ull * 1024 * 1024)
+#endif // P_VULKAN_MEMORY_BLOCK_SIZE
+
+enum PVulkanPoolKind {
+	P_VULKAN_POOL_KIND_BUFFER, // buddy blocks for buffers
+	P_VULKAN_POOL_KIND_IMAGE, // buddy blocks for optimal tiling images, kept apart to respect bufferImageGranularity
+	P_VULKAN_POOL_KIND_TRANSIENT, // linear pages for short lived buffers
+	P_VULKAN_POOL_KIND_MAX
+};
+
+enum PVulkanAllocationKind {
+	P_VULKAN_ALLOCATION_BUDDY,
+	P_VULKAN_ALLOCATION_LINEAR,
+	P_VULKAN_ALLOCATION_DEDICATED, // too large for a block, has a VkDeviceMemory of its own
+	P_VULKAN_ALLOCATION_MAX
+};
+
+typedef struct PVulkanMemoryPool PVulkanMemoryPool;
+
+/**
+ * PVulkanMemoryBlock
+ *
+ * This struct is one VkDeviceMemory that allocations are carved out of
+ */
+typedef struct {
+	VkDeviceMemory memory;
+	VkDeviceSize size;
+	VkDeviceSize used;
+	void *mapped; // NULL unless the memory type is host visible
+	uint max_order; // size == P_VULKAN_MEMORY_MIN_SIZE << max_order
+	EDynarr **free_lists; // max_order + 1 lists, each contains VkDeviceSize offsets of free buddies
+	VkDeviceSize linear_offset; // next free byte of a linear page
+	uint live_count; // allocations not yet freed
+	PVulkanMemoryPool *pool;
+	EDynarr *buffers; // contains PGraphicsBuffer *, the buffers in this block that defragmenting may move
+} PVulkanMemoryBlock;
+
+/**
+ * PVulkanMemoryPool
+ *
+ * This struct holds the blocks of one memory type used for one kind of resource
+ */
+struct PVulkanMemoryPool {
+	uint32_t memory_type;
+	enum PVulkanPoolKind kind;
+	VkDeviceSize block_size;
+	EDynarr *blocks; // contains PVulkanMemoryBlock *
+};
+
+/**
+ * PVulkanAllocation
+ *
+ * This struct is a piece of device memory given to a buffer or image
+ */
+typedef struct {
+	enum PVulkanAllocationKind kind;
+	PVulkanMemoryBlock *block; // NULL for dedicated allocations
+	VkDeviceMemory memory;
+	VkDeviceSize offset;
+	VkDeviceSize size;
+	uint order; // buddy order of the allocation
+	uint32_t memory_type;
+	void *mapped; // NULL unless the memory type is host visible
+} PVulkanAllocation;
+
+/**
+ * PVulkanAllocator
+ *
+ * This struct sub-allocates the device's memory, one per VkDevice
+ */
+typedef struct {
+	VkDevice logical_device;
+	VkPhysicalDevice physical_device;
+	VkPhysicalDeviceMemoryProperties memory_properties;
+	VkDeviceSize non_coherent_atom_size;
+	bool memory_budget; // VK_EXT_memory_budget is enabled
+	uint32_t shared_queue_families[2]; // transfer destinations are shared by these when there are 2
+	uint32_t shared_queue_family_count;
+	PLightMutex mutex; // guards everything below
+	PVulkanMemoryPool pools[VK_MAX_MEMORY_TYPES][P_VULKAN_POOL_KIND_MAX];
+	VkDeviceSize heap_allocated[VK_MAX_MEMORY_HEAPS]; // bytes of VkDeviceMemory allocated from each heap
+} PVulkanAllocator;
+
+/**
+ * PGraphicsBuffer
+ *
+ * This struct is a vulkan buffer along with the memory it is bound to
+ */
+struct PGraphicsBuffer {
+	VkBuffer handle;
+	VkDeviceSize size;
+	VkBufferUsageFlags usage;
+	PVulkanAllocation allocation;
+	PVulkanAllocator *allocator;
+};
+
+/**
+ * PGraphicsImage
+ *
+ * This struct is a 2D vulkan image along with its view and the memory it is bound to
+ */
+struct PGraphicsImage {
+	VkImage handle;
+	VkImageView view;
+	VkExtent2D extent;
+	VkFormat format;
+	VkImageUsageFlags usage;
+	VkImageLayout layout; // layout after the last upload, VK_IMAGE_LAYOUT_UNDEFINED before
+	PVulkanAllocation allocation;
+	PVulkanAllocator *allocator;
+};
+
+// Size of the staging ring that uploads are copied through
+#ifndef P_VULKAN_STAGING_SIZE
+#define P_VULKAN_STAGING_SIZE (64ull * 1024 * 1024)
+#endif // P_VULKAN_STAGING_SIZE
+
+// Number of upload batches that may be recorded or in flight at once
+#define P_VULKAN_UPLOAD_BATCHES 8
+
+/**
+ * PVulkanUploadBatch
+ *
+ * This struct is a command buffer of copies out of the staging ring, submitted together
+ */
+typedef struct {
+	VkCommandBuffer command_buffer;
+	VkFence fence; // VK_NULL_HANDLE when the timeline semaphore tracks completion
+	uint64_t value; // upload value signaled when the batch is done, 0 if never submitted
+	uint64_t ring_end; // staging ring position after the batch's data
+} PVulkanUploadBatch;
+
+/**
+ * PVulkanUploader
+ *
+ * This struct copies data into device memory through a persistently mapped staging ring on the transfer queue
+ * Every submitted batch gets the next upload value, which the timeline semaphore reaches when it is done
+ */
+typedef struct {
+	VkDevice logical_device;
+	VkQueue queue;
+	PLightMutex *queue_mutex; // non-malloced pointer to PVulkanAppData->queue_mutex
+	VkSemaphore timeline; // VK_NULL_HANDLE if timeline semaphores are unsupported
+	PLightMutex mutex; // guards everything below
+	VkCommandPool command_pool;
+	PVulkanUploadBatch batches[P_VULKAN_UPLOAD_BATCHES];
+	uint batch_index; // batch being recorded or recorded next
+	bool recording;
+	uint64_t submitted_value; // value of the last submitted batch
+	uint64_t completed_value; // value of the last batch known to be done
+	PGraphicsBuffer *staging;
+	uint64_t ring_head; // positions grow forever, the offset in staging is position % P_VULKAN_STAGING_SIZE
+	uint64_t ring_tail; // oldest position the GPU may still read
+} PVulkanUploader;
+
+/**
+ * PVulkanShaderEntry
+ *
+ * This struct is a shader module in the shader cache along with the SPIR-V it was made from
+ */
+typedef struct {
+	uint64_t hash; // FNV-1a of the SPIR-V bytes
+	size_t size;
+	uint32_t *code; // copy of the SPIR-V, compared on a hash match
+	VkShaderModule module; // VK_NULL_HANDLE if the slot is empty
+	uint reference_count;
+} PVulkanShaderEntry;
+
+/**
+ * PVulkanShaderCache
+ *
+ * This struct is an open addressing hash table of shader modules keyed by their SPIR-V, one per VkDevice
+ * Identical SPIR-V always gets the same module, which is destroyed when its last reference is released
+ */
+typedef struct {
+	VkDevice logical_device;
+	PLightMutex mutex; // guards everything below
+	uint32_t count;
+	uint32_t mask; // number of slots - 1, the number of slots is a power of two
+	PVulkanShaderEntry *slots;
+} PVulkanShaderCache;
+
+/**
+ * PGraphicsPipeline
+ *
+ * This struct is a graphics pipeline that may still be compiling on a job worker
+ * handle is only valid once built has reached zero
+ */
+struct PGraphicsPipeline {
+	VkPipeline handle; // VK_NULL_HANDLE until built, stays so if compiling failed
+	PGraphicalDisplayData display;
+	PJobSystem *job_system; // NULL if the pipeline was built on the calling thread
+	PJobCounter built; // nonzero while the pipeline is compiling
+	PGraphicsPipelineRequest request;
+	VkShaderModule vertex_module; // references in the shader cache, released once compiled
+	VkShaderModule fragment_module;
+};
+
 /**
  * PGraphicalDisplayData
  *
  * This struct contains data relevant to a vulkan display
+ * The device and everything made from it belong to PVulkanAppData and are shared by all displays
  */
 struct PGraphicalDisplayData{
 	VkSurfaceKHR surface;
-	VkPhysicalDevice current_physical_device;
-	VkDevice logical_device;
-	EDynarr *compatible_devices; // contains VkPhysicalDevice
-	PVulkanQueueFamilyInfo queue_family_infos[P_VULKAN_QUEUE_TYPE_MAX];
+	VkPhysicalDevice current_physical_device; // copy of PVulkanAppData->physical_device
+	VkDevice logical_device; // non-malloced pointer to PVulkanAppData->logical_device
+	PVulkanQueueFamilyInfo queue_family_infos[P_VULKAN_QUEUE_TYPE_MAX]; // copy of PVulkanAppData->queue_family_infos
 	VkInstance instance; // non-malloced pointer to PVulkanAppData->instance
 	VkSwapchainKHR swapchain;
 	VkExtent2D swapchain_extent;
 	VkFormat swapchain_format;
 	EDynarr *swapchain_images; // contains VkImage
 	EDynarr *swapchain_image_views; // contains VkImageView
+	EDynarr *swapchain_framebuffers; // contains VkFramebuffer
+	EDynarr *swapchain_render_finished; // contains VkSemaphore, one per image, signaled when rendering is done
+	uint swapchain_width; // window size the swapchain was made for
+	uint swapchain_height;
+	bool swapchain_stale; // set when presenting reports the swapchain no longer matches the surface
+	bool stereoscopic;
+	bool headless; // renders into offscreen_images, there is no surface or swapchain
+	PGraphicsImage *offscreen_images[P_VULKAN_FRAMES_IN_FLIGHT]; // one per frame in flight when headless
+	PGraphicsBuffer *readback; // frames are copied here to be read, NULL until the first read
+	VkCommandBuffer readback_command_buffer;
+	VkFence readback_fence;
+	enum PGraphicalLatencyMode latency_mode; // requested, see present_mode for what was picked
+	uint requested_image_count; // 0 if the image count is picked automatically
+	VkPresentModeKHR present_mode; // of the current swapchain
+	EDynarr *retired_swapchains; // contains PVulkanRetiredSwapchain
+	VkPipelineCache pipeline_cache; // non-malloced pointer to PVulkanAppData->pipeline_cache
+	PLightMutex *queue_mutex; // non-malloced pointer to PVulkanAppData->queue_mutex
+	PVulkanAllocator *allocator; // non-malloced pointer to PVulkanAppData->allocator
+	PVulkanUploader *uploader; // non-malloced pointer to PVulkanAppData->uploader
+	PVulkanShaderCache *shader_cache; // non-malloced pointer to PVulkanAppData->shader_cache
+	uint64_t upload_value; // last upload value rendering waited for
+
+	// Frames in flight
+	VkCommandPool command_pool;
+	PVulkanFrame frames[P_VULKAN_FRAMES_IN_FLIGHT];
+	uint frame_index;
+	uint64_t frame_count;
+
+	// Parallel recording, NULL job_system if the frame is recorded on the drawing thread
+	PJobSystem *job_system;
+	uint thread_pool_count; // job workers + 1
+	PLightMutex shared_pool_mutex; // guards the last thread pool, used by any thread that is not a job worker
+	PGraphicsRecordFunction record_function;
+	void *record_args;
+	uint record_count;
+	PVulkanRecordTask *record_tasks; // record_count tasks, reused every frame
+
+	PVulkanProfiler *profiler; // NULL if the graphics queue has no timestamps
 
-	EDynarr *shaders; // contains VkShaderModule. TODO: move this to renderer
+	VkRenderPass render_pass; // TODO: move this to renderer
+	VkPipelineLayout pipeline_layout; // TODO: move this to renderer
+	VkPipeline graphics_pipeline; // TODO: move this to renderer
 };
 
 /**
@@ -100,7 +517,59 @@ struct PGraphicalDisplayData{
 struct PGraphicalAppData {
 	VkInstance instance;
 	VkDebugUtilsMessengerEXT debug_messenger;
+	PVulkanNameSet instance_extensions;
+	PVulkanNameSet instance_layers;
+	EDynarr *physical_device_infos; // contains PVulkanPhysicalDeviceInfo
+
+	// Shared device, created along with the first display
+	PLightMutex device_mutex; // guards creating the device and the data below
+	VkPhysicalDevice physical_device;
+	VkDevice logical_device; // VK_NULL_HANDLE until the first display is created
+	EDynarr *compatible_devices; // contains VkPhysicalDevice
+	PVulkanQueueFamilyInfo queue_family_infos[P_VULKAN_QUEUE_TYPE_MAX];
+	PLightMutex queue_mutex; // vulkan queues must not be used by two threads at once
+	bool memory_budget; // VK_EXT_memory_budget is enabled on the device
+	bool timeline_semaphore; // timeline semaphores are enabled on the device
+	PVulkanAllocator *allocator;
+	PVulkanUploader *uploader;
+	PVulkanShaderCache *shader_cache;
+	VkPipelineCache pipeline_cache;
+	char *pipeline_cache_path; // NULL if the pipeline cache is not kept on disk
+	char *shader_path; // NULL if only the embedded shaders are used
+
+	EDynarr *shaders; // contains VkShaderModule, each holds a reference in shader_cache. TODO: move this to renderer
 };
 
+PVulkanAllocator *p_vulkan_allocator_init(const VkPhysicalDevice physical_device, const VkDevice logical_device,
+		bool memory_budget);
+void p_vulkan_allocator_deinit(PVulkanAllocator *allocator);
+PGraphicsBuffer *p_vulkan_buffer_create(PVulkanAllocator *allocator, const PGraphicsBufferRequest * const buffer_request);
+
+PVulkanUploader *p_vulkan_uploader_init(const VkDevice logical_device, PVulkanAllocator *allocator,
+		const PVulkanQueueFamilyInfo transfer_queue_family_info, PLightMutex *queue_mutex, bool timeline_semaphore);
+void p_vulkan_uploader_deinit(PVulkanUploader *uploader);
+uint64_t p_vulkan_uploader_flush(PVulkanUploader *uploader);
+void p_vulkan_uploader_wait(PVulkanUploader *uploader, uint64_t upload);
+
+PVulkanShaderCache *p_vulkan_shader_cache_init(const VkDevice logical_device);
+void p_vulkan_shader_cache_deinit(PVulkanShaderCache *shader_cache);
+VkShaderModule p_vulkan_shader_module_acquire(PVulkanShaderCache *shader_cache, const uint32_t *code, size_t size);
+void p_vulkan_shader_module_release(PVulkanShaderCache *shader_cache, VkShaderModule module);
+
+VkPipeline p_vulkan_pipeline_create(const PGraphicalDisplayData vulkan_display_data,
+		const PGraphicsPipelineRequest * const pipeline_request, VkShaderModule vertex_module,
+		VkShaderModule fragment_module);
+
+PVulkanProfiler *p_vulkan_profiler_init(const VkDevice logical_device, float timestamp_period,
+		uint32_t timestamp_valid_bits);
+void p_vulkan_profiler_deinit(PVulkanProfiler *profiler);
+void p_vulkan_profiler_resolve(PVulkanProfiler *profiler, uint frame_index);
+void p_vulkan_profiler_frame_begin(PVulkanProfiler *profiler, uint frame_index, uint64_t frame_count,
+		VkCommandBuffer command_buffer);
+
+void p_vulkan_thread_pools_reset(PVulkanFrame *frame, uint thread_pool_count, const VkDevice logical_device);
+void p_vulkan_thread_pools_destroy(PGraphicalDisplayData vulkan_display_data);
+void p_vulkan_record_secondaries(PGraphicalDisplayData vulkan_display_data, VkFramebuffer framebuffer,
+		VkCommandBuffer command_buffer);
 
 #endif // PLATINUM_GRAPHICS_VULKAN_H
@@ -0,0 +1,993 @@
+#include "platinum.h"
+#include "p_graphics_vulkan.h"
+#include <string.h>
+
+// Blocks are never made smaller than this when a heap is small or its budget is running out
+#define P_VULKAN_MEMORY_BLOCK_MIN_SIZE (1024ull * 1024)
+
+/**
+ * PVulkanDefragmentMove
+ *
+ * This struct is a buffer that defragmenting is moving and the place it is moving to
+ */
+typedef struct {
+	PGraphicsBuffer *buffer;
+	PGraphicsBuffer destination;
+} PVulkanDefragmentMove;
+
+/**
+ * _vulkan_memory_type_find
+ *
+ * returns the memory type in memory_type_bits that suits memory_usage best
+ * returns -1 if none of them can be used for memory_usage
+ */
+static int32_t _vulkan_memory_type_find(const PVulkanAllocator * const allocator, uint32_t memory_type_bits,
+		const enum PGraphicsMemoryUsage memory_usage)
+{
+	VkMemoryPropertyFlags required = 0, preferred = 0, avoided = 0;
+	switch (memory_usage)
+	{
+		case P_GRAPHICS_MEMORY_GPU_ONLY:
+			preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+			avoided = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+			break;
+		case P_GRAPHICS_MEMORY_CPU_TO_GPU:
+		case P_GRAPHICS_MEMORY_TRANSIENT:
+			required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+			preferred = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+			avoided = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+			break;
+		case P_GRAPHICS_MEMORY_GPU_TO_CPU:
+			required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+			preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+			break;
+		default:
+			return -1;
+	}
+
+	int32_t best_type = -1;
+	int best_score = -1;
+	for (uint32_t i = 0; i < allocator->memory_properties.memoryTypeCount; i++)
+	{
+		VkMemoryPropertyFlags flags = allocator->memory_properties.memoryTypes[i].propertyFlags;
+		if (!(memory_type_bits & (1u << i)) || (flags & required) != required)
+			continue;
+		int score = 2 * __builtin_popcount(flags & preferred) - __builtin_popcount(flags & avoided) + 1;
+		if (score > best_score)
+		{
+			best_score = score;
+			best_type = i;
+		}
+	}
+	return best_type;
+}
+
+/**
+ * _vulkan_memory_type_host_visible
+ *
+ * returns whether memory of memory_type can be mapped
+ */
+static bool _vulkan_memory_type_host_visible(const PVulkanAllocator * const allocator, uint32_t memory_type)
+{
+	return allocator->memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+}
+
+/**
+ * _vulkan_memory_type_coherent
+ *
+ * returns whether CPU writes to memory of memory_type are seen by the GPU without flushing
+ */
+static bool _vulkan_memory_type_coherent(const PVulkanAllocator * const allocator, uint32_t memory_type)
+{
+	return allocator->memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+}
+
+/**
+ * _vulkan_heap_budgets
+ *
+ * fills budget and usage with every heap's budget and usage in bytes
+ * without VK_EXT_memory_budget the budget is 80% of the heap and the usage is what the allocator holds
+ * must be called with allocator->mutex locked
+ */
+static void _vulkan_heap_budgets(const PVulkanAllocator * const allocator, VkDeviceSize budget[VK_MAX_MEMORY_HEAPS],
+		VkDeviceSize usage[VK_MAX_MEMORY_HEAPS])
+{
+	const uint32_t heap_count = allocator->memory_properties.memoryHeapCount;
+	if (allocator->memory_budget)
+	{
+		VkPhysicalDeviceMemoryBudgetPropertiesEXT budget_properties = {0};
+		budget_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+		VkPhysicalDeviceMemoryProperties2 memory_properties = {0};
+		memory_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+		memory_properties.pNext = &budget_properties;
+		vkGetPhysicalDeviceMemoryProperties2(allocator->physical_device, &memory_properties);
+		memcpy(budget, budget_properties.heapBudget, heap_count * sizeof *budget);
+		memcpy(usage, budget_properties.heapUsage, heap_count * sizeof *usage);
+		return;
+	}
+
+	for (uint32_t i = 0; i < heap_count; i++)
+	{
+		budget[i] = allocator->memory_properties.memoryHeaps[i].size / 10 * 8;
+		usage[i] = allocator->heap_allocated[i];
+	}
+}
+
+/**
+ * _vulkan_device_memory_allocate
+ *
+ * allocates size bytes of memory_type and maps it if it is host visible
+ * returns false if the allocation failed
+ * must be called with allocator->mutex locked
+ */
+static bool _vulkan_device_memory_allocate(PVulkanAllocator *allocator, uint32_t memory_type, VkDeviceSize size,
+		VkDeviceMemory *memory, void **mapped)
+{
+	VkMemoryAllocateInfo allocate_info = {0};
+	allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocate_info.allocationSize = size;
+	allocate_info.memoryTypeIndex = memory_type;
+	if (vkAllocateMemory(allocator->logical_device, &allocate_info, NULL, memory) != VK_SUCCESS)
+		return false;
+
+	*mapped = NULL;
+	if (_vulkan_memory_type_host_visible(allocator, memory_type) &&
+			vkMapMemory(allocator->logical_device, *memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS)
+	{
+		vkFreeMemory(allocator->logical_device, *memory, NULL);
+		return false;
+	}
+
+	allocator->heap_allocated[allocator->memory_properties.memoryTypes[memory_type].heapIndex] += size;
+	return true;
+}
+
+/**
+ * _vulkan_device_memory_free
+ *
+ * frees memory from _vulkan_device_memory_allocate
+ * must be called with allocator->mutex locked
+ */
+static void _vulkan_device_memory_free(PVulkanAllocator *allocator, uint32_t memory_type, VkDeviceSize size,
+		VkDeviceMemory memory)
+{
+	vkFreeMemory(allocator->logical_device, memory, NULL);
+	allocator->heap_allocated[allocator->memory_properties.memoryTypes[memory_type].heapIndex] -= size;
+}
+
+/**
+ * _vulkan_memory_block_create
+ *
+ * allocates a new block of at least min_size bytes for pool and adds it to the pool
+ * halves the block size while a full block would go over the heap's budget or cannot be allocated
+ * returns NULL if no block could be allocated
+ * must be called with allocator->mutex locked
+ */
+static PVulkanMemoryBlock *_vulkan_memory_block_create(PVulkanAllocator *allocator, PVulkanMemoryPool *pool,
+		VkDeviceSize min_size)
+{
+	const uint32_t heap = allocator->memory_properties.memoryTypes[pool->memory_type].heapIndex;
+	VkDeviceSize budget[VK_MAX_MEMORY_HEAPS], usage[VK_MAX_MEMORY_HEAPS];
+	_vulkan_heap_budgets(allocator, budget, usage);
+
+	VkDeviceSize smallest_size = E_MAX(min_size, P_VULKAN_MEMORY_BLOCK_MIN_SIZE);
+	VkDeviceSize size = pool->block_size;
+	while (size / 2 >= smallest_size && usage[heap] + size > budget[heap])
+		size /= 2;
+
+	VkDeviceMemory memory;
+	void *mapped;
+	while (!_vulkan_device_memory_allocate(allocator, pool->memory_type, size, &memory, &mapped))
+	{
+		if (size / 2 < smallest_size)
+			return NULL;
+		size /= 2;
+	}
+
+	PVulkanMemoryBlock *block = calloc(1, sizeof *block);
+	block->memory = memory;
+	block->size = size;
+	block->mapped = mapped;
+	block->pool = pool;
+	if (pool->kind != P_VULKAN_POOL_KIND_TRANSIENT)
+	{
+		while ((VkDeviceSize)P_VULKAN_MEMORY_MIN_SIZE << block->max_order < size)
+			block->max_order++;
+		block->free_lists = malloc((block->max_order + 1) * sizeof *block->free_lists);
+		for (uint i = 0; i <= block->max_order; i++)
+			block->free_lists[i] = e_dynarr_init(sizeof (VkDeviceSize), 1);
+		e_dynarr_add(block->free_lists[block->max_order], E_VOID_PTR_FROM_VALUE(VkDeviceSize, 0));
+	}
+	if (pool->kind == P_VULKAN_POOL_KIND_BUFFER)
+		block->buffers = e_dynarr_init(sizeof (PGraphicsBuffer *), 1);
+	e_dynarr_add(pool->blocks, &block);
+	return block;
+}
+
+/**
+ * _vulkan_memory_block_destroy
+ *
+ * frees block and removes it from its pool
+ * must be called with allocator->mutex locked
+ */
+static void _vulkan_memory_block_destroy(PVulkanAllocator *allocator, PVulkanMemoryBlock *block)
+{
+	PVulkanMemoryPool *pool = block->pool;
+	int index = e_dynarr_find(pool->blocks, &block);
+	if (index != -1)
+		e_dynarr_remove_unordered(pool->blocks, index);
+
+	_vulkan_device_memory_free(allocator, pool->memory_type, block->size, block->memory);
+	if (block->free_lists != NULL)
+	{
+		for (uint i = 0; i <= block->max_order; i++)
+			e_dynarr_deinit(block->free_lists[i]);
+		free(block->free_lists);
+	}
+	if (block->buffers != NULL)
+		e_dynarr_deinit(block->buffers);
+	free(block);
+}
+
+/**
+ * _vulkan_buddy_allocate
+ *
+ * takes a piece of at least size bytes aligned to alignment out of block
+ * sets offset and order to the piece and returns true, returns false if block has no piece large enough
+ */
+static bool _vulkan_buddy_allocate(PVulkanMemoryBlock *block, VkDeviceSize size, VkDeviceSize alignment,
+		VkDeviceSize *offset, uint *order)
+{
+	// buddies are aligned to their own size, so a piece as large as the alignment is aligned too
+	VkDeviceSize needed = E_MAX(size, alignment);
+	uint needed_order = 0;
+	while ((VkDeviceSize)P_VULKAN_MEMORY_MIN_SIZE << needed_order < needed)
+		needed_order++;
+	if (needed_order > block->max_order)
+		return false;
+
+	uint free_order = needed_order;
+	while (free_order <= block->max_order && block->free_lists[free_order]->num_items == 0)
+		free_order++;
+	if (free_order > block->max_order)
+		return false;
+
+	EDynarr *free_list = block->free_lists[free_order];
+	VkDeviceSize free_offset = E_DYNARR_GET(free_list, VkDeviceSize, free_list->num_items - 1);
+	e_dynarr_remove_unordered(free_list, free_list->num_items - 1);
+
+	// split until the piece fits, giving the upper halves back
+	while (free_order > needed_order)
+	{
+		free_order--;
+		e_dynarr_add(block->free_lists[free_order],
+				E_VOID_PTR_FROM_VALUE(VkDeviceSize, free_offset + ((VkDeviceSize)P_VULKAN_MEMORY_MIN_SIZE << free_order)));
+	}
+
+	block->used += (VkDeviceSize)P_VULKAN_MEMORY_MIN_SIZE << needed_order;
+	block->live_count++;
+	*offset = free_offset;
+	*order = needed_order;
+	return true;
+}
+
+/**
+ * _vulkan_buddy_free
+ *
+ * gives the piece at offset back to block, merging it with its free buddies
+ */
+static void _vulkan_buddy_free(PVulkanMemoryBlock *block, VkDeviceSize offset, uint order)
+{
+	block->used -= (VkDeviceSize)P_VULKAN_MEMORY_MIN_SIZE << order;
+	block->live_count--;
+
+	while (order < block->max_order)
+	{
+		VkDeviceSize buddy = offset ^ ((VkDeviceSize)P_VULKAN_MEMORY_MIN_SIZE << order);
+		int index = e_dynarr_find(block->free_lists[order], &buddy);
+		if (index == -1)
+			break;
+		e_dynarr_remove_unordered(block->free_lists[order], index);
+		offset = E_MIN(offset, buddy);
+		order++;
+	}
+	e_dynarr_add(block->free_lists[order], &offset);
+}
+
+/**
+ * _vulkan_linear_allocate
+ *
+ * bumps a piece of size bytes aligned to alignment off the end of block
+ * returns false if the rest of block is too small
+ */
+static bool _vulkan_linear_allocate(PVulkanMemoryBlock *block, VkDeviceSize size, VkDeviceSize alignment,
+		VkDeviceSize *offset)
+{
+	VkDeviceSize aligned_offset = (block->linear_offset + alignment - 1) & ~(alignment - 1);
+	if (aligned_offset + size > block->size)
+		return false;
+	block->linear_offset = aligned_offset + size;
+	block->used += size;
+	block->live_count++;
+	*offset = aligned_offset;
+	return true;
+}
+
+/**
+ * _vulkan_allocation_set
+ *
+ * fills allocation with a piece of block
+ */
+static void _vulkan_allocation_set(PVulkanAllocation *allocation, enum PVulkanAllocationKind kind,
+		PVulkanMemoryBlock *block, VkDeviceSize offset, VkDeviceSize size, uint order)
+{
+	allocation->kind = kind;
+	allocation->block = block;
+	allocation->memory = block->memory;
+	allocation->offset = offset;
+	allocation->size = size;
+	allocation->order = order;
+	allocation->memory_type = block->pool->memory_type;
+	allocation->mapped = block->mapped != NULL ? (uint8_t *)block->mapped + offset : NULL;
+}
+
+/**
+ * _vulkan_allocate
+ *
+ * fills allocation with memory of memory_type from the pool for pool_kind
+ * allocations too large for the pool's blocks get a VkDeviceMemory of their own
+ * returns false if the device is out of memory
+ * must be called with allocator->mutex locked
+ */
+static bool _vulkan_allocate(PVulkanAllocator *allocator, uint32_t memory_type, enum PVulkanPoolKind pool_kind,
+		VkDeviceSize size, VkDeviceSize alignment, PVulkanAllocation *allocation)
+{
+	PVulkanMemoryPool *pool = &allocator->pools[memory_type][pool_kind];
+	if (_vulkan_memory_type_host_visible(allocator, memory_type) &&
+			!_vulkan_memory_type_coherent(allocator, memory_type))
+		alignment = E_MAX(alignment, allocator->non_coherent_atom_size); // so flushes never touch a neighbour
+
+	if (size > pool->block_size / 2)
+	{
+		memset(allocation, 0, sizeof *allocation);
+		allocation->kind = P_VULKAN_ALLOCATION_DEDICATED;
+		allocation->size = size;
+		allocation->memory_type = memory_type;
+		return _vulkan_device_memory_allocate(allocator, memory_type, size, &allocation->memory,
+				&allocation->mapped);
+	}
+
+	VkDeviceSize offset;
+	uint order = 0;
+	if (pool_kind == P_VULKAN_POOL_KIND_TRANSIENT)
+	{
+		// newest pages are at the end, they are the most likely to have room
+		for (int i = pool->blocks->num_items - 1; i >= 0; i--)
+		{
+			PVulkanMemoryBlock *block = E_DYNARR_GET(pool->blocks, PVulkanMemoryBlock *, i);
+			if (_vulkan_linear_allocate(block, size, alignment, &offset))
+			{
+				_vulkan_allocation_set(allocation, P_VULKAN_ALLOCATION_LINEAR, block, offset, size, 0);
+				return true;
+			}
+		}
+		PVulkanMemoryBlock *block = _vulkan_memory_block_create(allocator, pool, size + alignment);
+		if (block == NULL || !_vulkan_linear_allocate(block, size, alignment, &offset))
+			return false;
+		_vulkan_allocation_set(allocation, P_VULKAN_ALLOCATION_LINEAR, block, offset, size, 0);
+		return true;
+	}
+
+	for (uint i = 0; i < pool->blocks->num_items; i++)
+	{
+		PVulkanMemoryBlock *block = E_DYNARR_GET(pool->blocks, PVulkanMemoryBlock *, i);
+		if (block->size - block->used >= size && _vulkan_buddy_allocate(block, size, alignment, &offset, &order))
+		{
+			_vulkan_allocation_set(allocation, P_VULKAN_ALLOCATION_BUDDY, block, offset, size, order);
+			return true;
+		}
+	}
+	PVulkanMemoryBlock *block = _vulkan_memory_block_create(allocator, pool, E_MAX(size, alignment));
+	if (block == NULL || !_vulkan_buddy_allocate(block, size, alignment, &offset, &order))
+		return false;
+	_vulkan_allocation_set(allocation, P_VULKAN_ALLOCATION_BUDDY, block, offset, size, order);
+	return true;
+}
+
+/**
+ * _vulkan_free
+ *
+ * gives allocation back to its pool
+ * blocks left empty are freed unless they are the last block of their pool
+ * must be called with allocator->mutex locked
+ */
+static void _vulkan_free(PVulkanAllocator *allocator, const PVulkanAllocation * const allocation)
+{
+	PVulkanMemoryBlock *block = allocation->block;
+	switch (allocation->kind)
+	{
+		case P_VULKAN_ALLOCATION_DEDICATED:
+			_vulkan_device_memory_free(allocator, allocation->memory_type, allocation->size, allocation->memory);
+			return;
+		case P_VULKAN_ALLOCATION_BUDDY:
+			_vulkan_buddy_free(block, allocation->offset, allocation->order);
+			break;
+		case P_VULKAN_ALLOCATION_LINEAR:
+			block->used -= allocation->size;
+			block->live_count--;
+			if (block->live_count == 0)
+				block->linear_offset = 0;
+			break;
+		default:
+			return;
+	}
+
+	if (block->live_count == 0 && block->pool->blocks->num_items > 1)
+		_vulkan_memory_block_destroy(allocator, block);
+}
+
+/**
+ * p_vulkan_allocator_init
+ *
+ * creates the allocator for logical_device
+ * memory_budget is whether VK_EXT_memory_budget is enabled on logical_device
+ */
+PVulkanAllocator *p_vulkan_allocator_init(const VkPhysicalDevice physical_device, const VkDevice logical_device,
+		bool memory_budget)
+{
+	PVulkanAllocator *allocator = calloc(1, sizeof *allocator);
+	allocator->logical_device = logical_device;
+	allocator->physical_device = physical_device;
+	allocator->memory_budget = memory_budget;
+	p_light_mutex_init(&allocator->mutex);
+	vkGetPhysicalDeviceMemoryProperties(physical_device, &allocator->memory_properties);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physical_device, &properties);
+	allocator->non_coherent_atom_size = E_MAX(properties.limits.nonCoherentAtomSize, 1);
+
+	for (uint32_t i = 0; i < allocator->memory_properties.memoryTypeCount; i++)
+	{
+		// keep a handful of blocks within the heap
+		VkDeviceSize heap_size =
+			allocator->memory_properties.memoryHeaps[allocator->memory_properties.memoryTypes[i].heapIndex].size;
+		VkDeviceSize block_size = P_VULKAN_MEMORY_BLOCK_SIZE;
+		while (block_size > P_VULKAN_MEMORY_BLOCK_MIN_SIZE && block_size > heap_size / 8)
+			block_size /= 2;
+
+		for (uint kind = 0; kind < P_VULKAN_POOL_KIND_MAX; kind++)
+		{
+			PVulkanMemoryPool *pool = &allocator->pools[i][kind];
+			pool->memory_type = i;
+			pool->kind = kind;
+			pool->block_size = kind == P_VULKAN_POOL_KIND_TRANSIENT ?
+				E_MAX(block_size / 8, P_VULKAN_MEMORY_BLOCK_MIN_SIZE) : block_size;
+			pool->blocks = e_dynarr_init(sizeof (PVulkanMemoryBlock *), 1);
+		}
+	}
+	return allocator;
+}
+
+/**
+ * p_vulkan_allocator_deinit
+ *
+ * frees every block of allocator and allocator itself
+ * buffers and images must all be destroyed first
+ */
+void p_vulkan_allocator_deinit(PVulkanAllocator *allocator)
+{
+	if (allocator == NULL)
+		return;
+
+	for (uint32_t i = 0; i < allocator->memory_properties.memoryTypeCount; i++)
+	{
+		for (uint kind = 0; kind < P_VULKAN_POOL_KIND_MAX; kind++)
+		{
+			PVulkanMemoryPool *pool = &allocator->pools[i][kind];
+			while (pool->blocks->num_items > 0)
+			{
+				PVulkanMemoryBlock *block = E_DYNARR_GET(pool->blocks, PVulkanMemoryBlock *, 0);
+				if (block->live_count > 0)
+					p_log_message(P_LOG_WARNING, L"Vulkan General",
+							L"%u allocations of memory type %u were never freed", block->live_count, i);
+				_vulkan_memory_block_destroy(allocator, block);
+			}
+			e_dynarr_deinit(pool->blocks);
+		}
+	}
+	free(allocator);
+}
+
+/**
+ * _vulkan_buffer_usage
+ *
+ * returns the vulkan usage flags for PGraphicsBufferUsage flags
+ */
+static VkBufferUsageFlags _vulkan_buffer_usage(uint usage)
+{
+	VkBufferUsageFlags flags = 0;
+	if (usage & P_GRAPHICS_BUFFER_VERTEX)
+		flags |= VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	if (usage & P_GRAPHICS_BUFFER_INDEX)
+		flags |= VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	if (usage & P_GRAPHICS_BUFFER_UNIFORM)
+		flags |= VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+	if (usage & P_GRAPHICS_BUFFER_STORAGE)
+		flags |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	if (usage & P_GRAPHICS_BUFFER_TRANSFER_SRC)
+		flags |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	if (usage & P_GRAPHICS_BUFFER_TRANSFER_DST)
+		flags |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	return flags;
+}
+
+/**
+ * _vulkan_buffer_handle_create
+ *
+ * creates a VkBuffer and returns its memory requirements in memory_requirements
+ * buffers the transfer queue copies into are shared with the graphics queue
+ */
+static VkBuffer _vulkan_buffer_handle_create(const PVulkanAllocator * const allocator, VkDeviceSize size,
+		VkBufferUsageFlags usage, VkMemoryRequirements *memory_requirements)
+{
+	VkBufferCreateInfo buffer_create_info = {0};
+	buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	buffer_create_info.size = size;
+	buffer_create_info.usage = usage;
+	buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if ((usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT) && allocator->shared_queue_family_count > 1)
+	{
+		buffer_create_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		buffer_create_info.queueFamilyIndexCount = allocator->shared_queue_family_count;
+		buffer_create_info.pQueueFamilyIndices = allocator->shared_queue_families;
+	}
+
+	VkBuffer handle;
+	if (vkCreateBuffer(allocator->logical_device, &buffer_create_info, NULL, &handle) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create buffer!");
+		exit(1);
+	}
+	vkGetBufferMemoryRequirements(allocator->logical_device, handle, memory_requirements);
+	return handle;
+}
+
+/**
+ * p_vulkan_buffer_create
+ *
+ * creates a buffer for buffer_request and binds it to memory from allocator
+ * returns NULL if there is no memory left for it
+ */
+PGraphicsBuffer *p_vulkan_buffer_create(PVulkanAllocator *allocator, const PGraphicsBufferRequest * const buffer_request)
+{
+	PGraphicsBuffer *buffer = calloc(1, sizeof *buffer);
+	buffer->size = buffer_request->size;
+	buffer->usage = _vulkan_buffer_usage(buffer_request->usage);
+	buffer->allocator = allocator;
+
+	VkMemoryRequirements memory_requirements;
+	buffer->handle = _vulkan_buffer_handle_create(allocator, buffer->size, buffer->usage, &memory_requirements);
+
+	int32_t memory_type = _vulkan_memory_type_find(allocator, memory_requirements.memoryTypeBits,
+			buffer_request->memory_usage);
+	if (memory_type == -1)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"No memory type fits the requested buffer!");
+		vkDestroyBuffer(allocator->logical_device, buffer->handle, NULL);
+		free(buffer);
+		return NULL;
+	}
+
+	enum PVulkanPoolKind pool_kind = buffer_request->memory_usage == P_GRAPHICS_MEMORY_TRANSIENT ?
+		P_VULKAN_POOL_KIND_TRANSIENT : P_VULKAN_POOL_KIND_BUFFER;
+	p_light_mutex_lock(&allocator->mutex);
+	if (!_vulkan_allocate(allocator, memory_type, pool_kind, memory_requirements.size, memory_requirements.alignment,
+				&buffer->allocation))
+	{
+		p_light_mutex_unlock(&allocator->mutex);
+		p_log_message(P_LOG_WARNING, L"Vulkan General", L"Out of device memory for a %llu byte buffer",
+				(unsigned long long)buffer->size);
+		vkDestroyBuffer(allocator->logical_device, buffer->handle, NULL);
+		free(buffer);
+		return NULL;
+	}
+	if (buffer->allocation.kind == P_VULKAN_ALLOCATION_BUDDY)
+		e_dynarr_add(buffer->allocation.block->buffers, &buffer);
+	p_light_mutex_unlock(&allocator->mutex);
+
+	vkBindBufferMemory(allocator->logical_device, buffer->handle, buffer->allocation.memory,
+			buffer->allocation.offset);
+	return buffer;
+}
+
+/**
+ * p_graphics_vulkan_buffer_create
+ *
+ * creates a buffer for buffer_request and binds it to memory from the device's allocator
+ * returns NULL if there is no memory left for it
+ */
+PGraphicsBuffer *p_graphics_vulkan_buffer_create(PGraphicalDisplayData vulkan_display_data,
+		const PGraphicsBufferRequest * const buffer_request)
+{
+	return p_vulkan_buffer_create(vulkan_display_data->allocator, buffer_request);
+}
+
+/**
+ * p_graphics_vulkan_buffer_destroy
+ *
+ * destroys buffer and gives its memory back to the allocator
+ * the GPU must be done with buffer
+ */
+void p_graphics_vulkan_buffer_destroy(PGraphicsBuffer *buffer)
+{
+	if (buffer == NULL)
+		return;
+
+	PVulkanAllocator *allocator = buffer->allocator;
+	vkDestroyBuffer(allocator->logical_device, buffer->handle, NULL);
+
+	p_light_mutex_lock(&allocator->mutex);
+	if (buffer->allocation.kind == P_VULKAN_ALLOCATION_BUDDY)
+	{
+		EDynarr *buffers = buffer->allocation.block->buffers;
+		int index = e_dynarr_find(buffers, &buffer);
+		if (index != -1)
+			e_dynarr_remove_unordered(buffers, index);
+	}
+	_vulkan_free(allocator, &buffer->allocation);
+	p_light_mutex_unlock(&allocator->mutex);
+	free(buffer);
+}
+
+/**
+ * p_graphics_vulkan_buffer_map
+ *
+ * returns the persistently mapped address of buffer, NULL if it is not host visible
+ */
+void *p_graphics_vulkan_buffer_map(const PGraphicsBuffer *buffer)
+{
+	return buffer->allocation.mapped;
+}
+
+/**
+ * _vulkan_buffer_mapped_range
+ *
+ * sets range to cover size bytes of buffer from offset, widened to nonCoherentAtomSize
+ * returns false if the memory of buffer is not mapped or is host coherent, so no range is needed
+ */
+static bool _vulkan_buffer_mapped_range(const PGraphicsBuffer *buffer, uint64_t offset, uint64_t size,
+		VkMappedMemoryRange *range)
+{
+	const PVulkanAllocator *allocator = buffer->allocator;
+	const PVulkanAllocation *allocation = &buffer->allocation;
+	if (allocation->mapped == NULL || _vulkan_memory_type_coherent(allocator, allocation->memory_type))
+		return false;
+
+	// the range has to be a multiple of nonCoherentAtomSize, allocations start on one
+	VkDeviceSize atom_size = allocator->non_coherent_atom_size;
+	VkDeviceSize memory_size = allocation->block != NULL ? allocation->block->size : allocation->size;
+	VkDeviceSize start = allocation->offset + offset / atom_size * atom_size;
+	VkDeviceSize end = (allocation->offset + E_MIN(offset + size, allocation->size) + atom_size - 1) / atom_size *
+		atom_size;
+
+	*range = (VkMappedMemoryRange){0};
+	range->sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	range->memory = allocation->memory;
+	range->offset = start;
+	range->size = end >= memory_size ? VK_WHOLE_SIZE : end - start;
+	return true;
+}
+
+/**
+ * p_graphics_vulkan_buffer_flush
+ *
+ * flushes size bytes of buffer from offset if its memory is not host coherent
+ */
+void p_graphics_vulkan_buffer_flush(const PGraphicsBuffer *buffer, uint64_t offset, uint64_t size)
+{
+	VkMappedMemoryRange range;
+	if (_vulkan_buffer_mapped_range(buffer, offset, size, &range))
+		vkFlushMappedMemoryRanges(buffer->allocator->logical_device, 1, &range);
+}
+
+/**
+ * p_graphics_vulkan_buffer_invalidate
+ *
+ * makes GPU writes to size bytes of buffer from offset visible to the CPU if its memory is not host coherent
+ */
+void p_graphics_vulkan_buffer_invalidate(const PGraphicsBuffer *buffer, uint64_t offset, uint64_t size)
+{
+	VkMappedMemoryRange range;
+	if (_vulkan_buffer_mapped_range(buffer, offset, size, &range))
+		vkInvalidateMappedMemoryRanges(buffer->allocator->logical_device, 1, &range);
+}
+
+/**
+ * _vulkan_format
+ *
+ * returns the vulkan format for a PGraphicsFormat
+ */
+static VkFormat _vulkan_format(enum PGraphicsFormat format)
+{
+	switch (format)
+	{
+		case P_GRAPHICS_FORMAT_RGBA8_UNORM:
+			return VK_FORMAT_R8G8B8A8_UNORM;
+		case P_GRAPHICS_FORMAT_RGBA8_SRGB:
+			return VK_FORMAT_R8G8B8A8_SRGB;
+		case P_GRAPHICS_FORMAT_BGRA8_UNORM:
+			return VK_FORMAT_B8G8R8A8_UNORM;
+		case P_GRAPHICS_FORMAT_BGRA8_SRGB:
+			return VK_FORMAT_B8G8R8A8_SRGB;
+		case P_GRAPHICS_FORMAT_R32_FLOAT:
+			return VK_FORMAT_R32_SFLOAT;
+		case P_GRAPHICS_FORMAT_D32_FLOAT:
+			return VK_FORMAT_D32_SFLOAT;
+		default:
+			return VK_FORMAT_UNDEFINED;
+	}
+}
+
+/**
+ * _vulkan_image_usage
+ *
+ * returns the vulkan usage flags for PGraphicsImageUsage flags
+ */
+static VkImageUsageFlags _vulkan_image_usage(uint usage)
+{
+	VkImageUsageFlags flags = 0;
+	if (usage & P_GRAPHICS_IMAGE_SAMPLED)
+		flags |= VK_IMAGE_USAGE_SAMPLED_BIT;
+	if (usage & P_GRAPHICS_IMAGE_COLOR_ATTACHMENT)
+		flags |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	if (usage & P_GRAPHICS_IMAGE_DEPTH_ATTACHMENT)
+		flags |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	if (usage & P_GRAPHICS_IMAGE_TRANSFER_SRC)
+		flags |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	if (usage & P_GRAPHICS_IMAGE_TRANSFER_DST)
+		flags |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	return flags;
+}
+
+/**
+ * p_graphics_vulkan_image_create
+ *
+ * creates an optimally tiled 2D image and a view of it for image_request
+ * its memory comes from the device's allocator
+ * returns NULL if there is no memory left for it
+ */
+PGraphicsImage *p_graphics_vulkan_image_create(PGraphicalDisplayData vulkan_display_data,
+		const PGraphicsImageRequest * const image_request)
+{
+	PVulkanAllocator *allocator = vulkan_display_data->allocator;
+	PGraphicsImage *image = calloc(1, sizeof *image);
+	image->extent = (VkExtent2D){image_request->width, image_request->height};
+	image->format = _vulkan_format(image_request->format);
+	image->usage = _vulkan_image_usage(image_request->usage);
+	image->layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	image->allocator = allocator;
+
+	VkImageCreateInfo image_create_info = {0};
+	image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_create_info.imageType = VK_IMAGE_TYPE_2D;
+	image_create_info.format = image->format;
+	image_create_info.extent = (VkExtent3D){image->extent.width, image->extent.height, 1};
+	image_create_info.mipLevels = 1;
+	image_create_info.arrayLayers = 1;
+	image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_create_info.usage = image->usage;
+	image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if ((image->usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT) && allocator->shared_queue_family_count > 1)
+	{
+		image_create_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		image_create_info.queueFamilyIndexCount = allocator->shared_queue_family_count;
+		image_create_info.pQueueFamilyIndices = allocator->shared_queue_families;
+	}
+	image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	if (vkCreateImage(allocator->logical_device, &image_create_info, NULL, &image->handle) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create image!");
+		exit(1);
+	}
+
+	VkMemoryRequirements memory_requirements;
+	vkGetImageMemoryRequirements(allocator->logical_device, image->handle, &memory_requirements);
+	int32_t memory_type = _vulkan_memory_type_find(allocator, memory_requirements.memoryTypeBits,
+			image_request->memory_usage);
+
+	bool allocated = false;
+	if (memory_type != -1)
+	{
+		p_light_mutex_lock(&allocator->mutex);
+		allocated = _vulkan_allocate(allocator, memory_type, P_VULKAN_POOL_KIND_IMAGE, memory_requirements.size,
+				memory_requirements.alignment, &image->allocation);
+		p_light_mutex_unlock(&allocator->mutex);
+	}
+	if (!allocated)
+	{
+		p_log_message(P_LOG_WARNING, L"Vulkan General", L"Out of device memory for a %ux%u image",
+				image->extent.width, image->extent.height);
+		vkDestroyImage(allocator->logical_device, image->handle, NULL);
+		free(image);
+		return NULL;
+	}
+	vkBindImageMemory(allocator->logical_device, image->handle, image->allocation.memory, image->allocation.offset);
+
+	VkImageViewCreateInfo view_create_info = {0};
+	view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view_create_info.image = image->handle;
+	view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	view_create_info.format = image->format;
+	view_create_info.subresourceRange.aspectMask = image->format == VK_FORMAT_D32_SFLOAT ?
+		VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+	view_create_info.subresourceRange.levelCount = 1;
+	view_create_info.subresourceRange.layerCount = 1;
+	if (vkCreateImageView(allocator->logical_device, &view_create_info, NULL, &image->view) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create image view!");
+		exit(1);
+	}
+	return image;
+}
+
+/**
+ * p_graphics_vulkan_image_destroy
+ *
+ * destroys image and its view and gives its memory back to the allocator
+ * the GPU must be done with image
+ */
+void p_graphics_vulkan_image_destroy(PGraphicsImage *image)
+{
+	if (image == NULL)
+		return;
+
+	PVulkanAllocator *allocator = image->allocator;
+	vkDestroyImageView(allocator->logical_device, image->view, NULL);
+	vkDestroyImage(allocator->logical_device, image->handle, NULL);
+
+	p_light_mutex_lock(&allocator->mutex);
+	_vulkan_free(allocator, &image->allocation);
+	p_light_mutex_unlock(&allocator->mutex);
+	free(image);
+}
+
+/**
+ * p_graphics_vulkan_memory_budget
+ *
+ * fills budgets with the budget and usage of every memory heap
+ * returns the number of heaps filled
+ */
+uint p_graphics_vulkan_memory_budget(const PGraphicalDisplayData vulkan_display_data,
+		PGraphicsMemoryBudget budgets[P_GRAPHICS_MEMORY_HEAPS_MAX])
+{
+	PVulkanAllocator *allocator = vulkan_display_data->allocator;
+	VkDeviceSize budget[VK_MAX_MEMORY_HEAPS], usage[VK_MAX_MEMORY_HEAPS];
+	uint heap_count = E_MIN(allocator->memory_properties.memoryHeapCount, P_GRAPHICS_MEMORY_HEAPS_MAX);
+
+	p_light_mutex_lock(&allocator->mutex);
+	_vulkan_heap_budgets(allocator, budget, usage);
+	for (uint i = 0; i < heap_count; i++)
+	{
+		budgets[i].budget = budget[i];
+		budgets[i].usage = usage[i];
+		budgets[i].allocated = allocator->heap_allocated[i];
+		budgets[i].device_local =
+			allocator->memory_properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+	}
+	p_light_mutex_unlock(&allocator->mutex);
+	return heap_count;
+}
+
+/**
+ * _vulkan_defragment_moves_plan
+ *
+ * reserves room in the other blocks of pool for the buffers in its least used block
+ * adds a move for each buffer that fits to moves
+ * must be called with allocator->mutex locked
+ */
+static void _vulkan_defragment_moves_plan(PVulkanAllocator *allocator, PVulkanMemoryPool *pool, bool can_copy,
+		EDynarr *moves)
+{
+	if (pool->blocks->num_items < 2)
+		return;
+
+	PVulkanMemoryBlock *source = NULL;
+	for (uint i = 0; i < pool->blocks->num_items; i++)
+	{
+		PVulkanMemoryBlock *block = E_DYNARR_GET(pool->blocks, PVulkanMemoryBlock *, i);
+		if (source == NULL || block->used < source->used)
+			source = block;
+	}
+	if (!can_copy && source->mapped == NULL)
+		return;
+
+	for (uint i = 0; i < source->buffers->num_items; i++)
+	{
+		PGraphicsBuffer *buffer = E_DYNARR_GET(source->buffers, PGraphicsBuffer *, i);
+		PVulkanDefragmentMove move = {0};
+		move.buffer = buffer;
+		move.destination = *buffer;
+
+		VkMemoryRequirements memory_requirements;
+		move.destination.handle = _vulkan_buffer_handle_create(allocator, buffer->size, buffer->usage,
+				&memory_requirements);
+
+		bool reserved = false;
+		for (uint j = 0; j < pool->blocks->num_items && !reserved; j++)
+		{
+			PVulkanMemoryBlock *block = E_DYNARR_GET(pool->blocks, PVulkanMemoryBlock *, j);
+			VkDeviceSize offset;
+			uint order;
+			if (block == source || !_vulkan_buddy_allocate(block, memory_requirements.size,
+						memory_requirements.alignment, &offset, &order))
+				continue;
+			_vulkan_allocation_set(&move.destination.allocation, P_VULKAN_ALLOCATION_BUDDY, block, offset,
+					memory_requirements.size, order);
+			reserved = true;
+		}
+		if (!reserved)
+		{
+			vkDestroyBuffer(allocator->logical_device, move.destination.handle, NULL);
+			continue;
+		}
+		vkBindBufferMemory(allocator->logical_device, move.destination.handle, move.destination.allocation.memory,
+				move.destination.allocation.offset);
+		e_dynarr_add(moves, &move);
+	}
+}
+
+/**
+ * p_graphics_vulkan_memory_defragment
+ *
+ * moves the buffers out of the least used block of every buffer pool into the free space of the other blocks
+ * and frees the emptied blocks
+ * host visible buffers are copied with memcpy, others by move_function, and are skipped if it is NULL
+ * images are never moved. Buffer handles change, nothing may use the moved buffers while this runs
+ * returns the number of buffers moved
+ */
+uint p_graphics_vulkan_memory_defragment(PGraphicalDisplayData vulkan_display_data,
+		PGraphicsMoveFunction move_function, void *args)
+{
+	PVulkanAllocator *allocator = vulkan_display_data->allocator;
+	EDynarr *moves = e_dynarr_init(sizeof (PVulkanDefragmentMove), 1);
+
+	p_light_mutex_lock(&allocator->mutex);
+	for (uint32_t i = 0; i < allocator->memory_properties.memoryTypeCount; i++)
+		_vulkan_defragment_moves_plan(allocator, &allocator->pools[i][P_VULKAN_POOL_KIND_BUFFER],
+				move_function != NULL, moves);
+	p_light_mutex_unlock(&allocator->mutex);
+
+	// copy without the lock, move_function may create buffers of its own
+	for (uint i = 0; i < moves->num_items; i++)
+	{
+		PVulkanDefragmentMove *move = &E_DYNARR_GET(moves, PVulkanDefragmentMove, i);
+		if (move->buffer->allocation.mapped != NULL)
+			memcpy(move->destination.allocation.mapped, move->buffer->allocation.mapped, move->buffer->size);
+		else
+			move_function(move->buffer, &move->destination, args);
+	}
+
+	p_light_mutex_lock(&allocator->mutex);
+	for (uint i = 0; i < moves->num_items; i++)
+	{
+		PVulkanDefragmentMove *move = &E_DYNARR_GET(moves, PVulkanDefragmentMove, i);
+		PGraphicsBuffer *buffer = move->buffer;
+		EDynarr *source_buffers = buffer->allocation.block->buffers;
+		int index = e_dynarr_find(source_buffers, &buffer);
+		if (index != -1)
+			e_dynarr_remove_unordered(source_buffers, index);
+		e_dynarr_add(move->destination.allocation.block->buffers, &buffer);
+
+		PVulkanAllocation source_allocation = buffer->allocation;
+		vkDestroyBuffer(allocator->logical_device, buffer->handle, NULL);
+		buffer->handle = move->destination.handle;
+		buffer->allocation = move->destination.allocation;
+		_vulkan_free(allocator, &source_allocation);
+	}
+	p_light_mutex_unlock(&allocator->mutex);
+
+	uint moved = moves->num_items;
+	e_dynarr_deinit(moves);
+	return moved;
+}
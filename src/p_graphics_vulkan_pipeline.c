@@ -0,0 +1,234 @@
+#include "platinum.h"
+#include "p_graphics_vulkan.h"
+
+/**
+ * _vulkan_topology
+ *
+ * returns the vulkan primitive topology of topology
+ */
+static VkPrimitiveTopology _vulkan_topology(enum PGraphicsTopology topology)
+{
+	switch (topology)
+	{
+		case P_GRAPHICS_TOPOLOGY_TRIANGLE_STRIP: return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+		case P_GRAPHICS_TOPOLOGY_LINE_LIST: return VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+		case P_GRAPHICS_TOPOLOGY_POINT_LIST: return VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+		default: return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	}
+}
+
+/**
+ * p_vulkan_pipeline_create
+ *
+ * compiles a graphics pipeline for subpass 0 of the display's render pass through the shared pipeline cache
+ * safe to call from several threads at once, the pipeline cache is synchronized by the driver
+ * returns VK_NULL_HANDLE if the driver failed to compile it
+ */
+VkPipeline p_vulkan_pipeline_create(const PGraphicalDisplayData vulkan_display_data,
+		const PGraphicsPipelineRequest * const pipeline_request, VkShaderModule vertex_module,
+		VkShaderModule fragment_module)
+{
+	VkPipelineShaderStageCreateInfo shader_stages[2] = {0};
+	shader_stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shader_stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	shader_stages[0].module = vertex_module;
+	shader_stages[0].pName = "main";
+	shader_stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shader_stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	shader_stages[1].module = fragment_module;
+	shader_stages[1].pName = "main";
+
+	VkDynamicState dynamic_states[2] = {
+		VK_DYNAMIC_STATE_VIEWPORT,
+		VK_DYNAMIC_STATE_SCISSOR
+	};
+	VkPipelineDynamicStateCreateInfo dynamic_state = {0};
+	dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamic_state.dynamicStateCount = 2;
+	dynamic_state.pDynamicStates = dynamic_states;
+
+	VkPipelineVertexInputStateCreateInfo vertex_input = {0};
+	vertex_input.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+	VkPipelineInputAssemblyStateCreateInfo input_assembly = {0};
+	input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	input_assembly.topology = _vulkan_topology(pipeline_request->topology);
+	input_assembly.primitiveRestartEnable = VK_FALSE;
+
+	// viewport and scissor are set when recording
+	VkPipelineViewportStateCreateInfo viewport_state = {0};
+	viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewport_state.viewportCount = 1;
+	viewport_state.scissorCount = 1;
+
+	VkPipelineRasterizationStateCreateInfo rasterizer = {0};
+	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizer.depthClampEnable = VK_FALSE;
+	rasterizer.rasterizerDiscardEnable = VK_FALSE;
+	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizer.lineWidth = 1.0f;
+	rasterizer.cullMode = pipeline_request->cull ? VK_CULL_MODE_BACK_BIT : VK_CULL_MODE_NONE;
+	rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+	rasterizer.depthBiasEnable = VK_FALSE;
+
+	VkPipelineMultisampleStateCreateInfo multisampling = {0};
+	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampling.sampleShadingEnable = VK_FALSE;
+	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	VkPipelineColorBlendAttachmentState color_blend_attachment = {0};
+	color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+		VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	if (pipeline_request->blend)
+	{
+		color_blend_attachment.blendEnable = VK_TRUE;
+		color_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+		color_blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+		color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+		color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+		color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+	}
+
+	VkPipelineColorBlendStateCreateInfo color_blending = {0};
+	color_blending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	color_blending.logicOpEnable = VK_FALSE;
+	color_blending.attachmentCount = 1;
+	color_blending.pAttachments = &color_blend_attachment;
+
+	VkGraphicsPipelineCreateInfo pipeline_create_info = {0};
+	pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipeline_create_info.stageCount = 2;
+	pipeline_create_info.pStages = shader_stages;
+	pipeline_create_info.pVertexInputState = &vertex_input;
+	pipeline_create_info.pInputAssemblyState = &input_assembly;
+	pipeline_create_info.pViewportState = &viewport_state;
+	pipeline_create_info.pRasterizationState = &rasterizer;
+	pipeline_create_info.pMultisampleState = &multisampling;
+	pipeline_create_info.pColorBlendState = &color_blending;
+	pipeline_create_info.pDynamicState = &dynamic_state;
+	pipeline_create_info.layout = vulkan_display_data->pipeline_layout;
+	pipeline_create_info.renderPass = vulkan_display_data->render_pass;
+	pipeline_create_info.subpass = 0;
+	pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
+	pipeline_create_info.basePipelineIndex = -1;
+
+	// every pipeline goes through the pipeline cache so later runs skip shader compilation
+	VkPipeline pipeline;
+	if (vkCreateGraphicsPipelines(vulkan_display_data->logical_device, vulkan_display_data->pipeline_cache, 1,
+				&pipeline_create_info, NULL, &pipeline) != VK_SUCCESS)
+		return VK_NULL_HANDLE;
+	return pipeline;
+}
+
+/**
+ * _vulkan_pipeline_build_job
+ *
+ * job that compiles one pipeline of a batch
+ */
+static void _vulkan_pipeline_build_job(void *args)
+{
+	PGraphicsPipeline *pipeline = args;
+	PGraphicalDisplayData vulkan_display_data = pipeline->display;
+	pipeline->handle = p_vulkan_pipeline_create(vulkan_display_data, &pipeline->request, pipeline->vertex_module,
+			pipeline->fragment_module);
+	if (pipeline->handle == VK_NULL_HANDLE)
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create graphics pipeline!");
+
+	// compiled pipelines do not need their shader modules
+	p_vulkan_shader_module_release(vulkan_display_data->shader_cache, pipeline->vertex_module);
+	p_vulkan_shader_module_release(vulkan_display_data->shader_cache, pipeline->fragment_module);
+	pipeline->vertex_module = VK_NULL_HANDLE;
+	pipeline->fragment_module = VK_NULL_HANDLE;
+}
+
+/**
+ * p_graphics_vulkan_pipelines_build
+ *
+ * starts compiling count pipelines at once, one job each on job_system, all through the shared pipeline cache
+ * pipelines gets a handle per request right away, to be checked with p_graphics_vulkan_pipeline_ready or waited
+ * on with p_graphics_vulkan_pipeline_wait
+ * the shader modules are made on the calling thread first, so variants sharing a shader share its module
+ * a NULL job_system compiles them one after another before returning
+ * the pipelines must be destroyed before the display
+ */
+void p_graphics_vulkan_pipelines_build(PGraphicalDisplayData vulkan_display_data, PJobSystem *job_system, uint count,
+		const PGraphicsPipelineRequest *pipeline_requests, PGraphicsPipeline **pipelines)
+{
+	for (uint i = 0; i < count; i++)
+	{
+		const PGraphicsPipelineRequest *pipeline_request = &pipeline_requests[i];
+		if (pipeline_request->vertex_shader == NULL || pipeline_request->fragment_shader == NULL)
+		{
+			p_log_message(P_LOG_ERROR, L"Vulkan General", L"Pipeline is missing a shader!");
+			exit(1);
+		}
+		PGraphicsPipeline *pipeline = calloc(1, sizeof *pipeline);
+		pipeline->display = vulkan_display_data;
+		pipeline->job_system = job_system;
+		pipeline->request = *pipeline_request;
+		pipeline->vertex_module = p_vulkan_shader_module_acquire(vulkan_display_data->shader_cache,
+				pipeline_request->vertex_shader->code, pipeline_request->vertex_shader->size);
+		pipeline->fragment_module = p_vulkan_shader_module_acquire(vulkan_display_data->shader_cache,
+				pipeline_request->fragment_shader->code, pipeline_request->fragment_shader->size);
+		pipelines[i] = pipeline;
+	}
+
+	for (uint i = 0; i < count; i++)
+	{
+		if (job_system == NULL)
+			_vulkan_pipeline_build_job(pipelines[i]);
+		else
+			p_job_submit(job_system, _vulkan_pipeline_build_job, pipelines[i], &pipelines[i]->built);
+	}
+}
+
+/**
+ * p_graphics_vulkan_pipeline_ready
+ *
+ * returns true once the pipeline is done compiling, without waiting
+ */
+bool p_graphics_vulkan_pipeline_ready(const PGraphicsPipeline *pipeline)
+{
+	return atomic_load(&pipeline->built.value) == 0;
+}
+
+/**
+ * p_graphics_vulkan_pipeline_wait
+ *
+ * waits for the pipeline to be done compiling, running other jobs in the meantime
+ * returns false if compiling it failed
+ */
+bool p_graphics_vulkan_pipeline_wait(PGraphicsPipeline *pipeline)
+{
+	if (pipeline->job_system != NULL)
+		p_job_wait(pipeline->job_system, &pipeline->built);
+	return pipeline->handle != VK_NULL_HANDLE;
+}
+
+/**
+ * p_graphics_vulkan_pipeline_destroy
+ *
+ * destroys a pipeline, waiting for it to be compiled first
+ * the GPU must be done with every frame that used it
+ */
+void p_graphics_vulkan_pipeline_destroy(PGraphicsPipeline *pipeline)
+{
+	if (pipeline == NULL)
+		return;
+	if (p_graphics_vulkan_pipeline_wait(pipeline))
+		vkDestroyPipeline(pipeline->display->logical_device, pipeline->handle, NULL);
+	free(pipeline);
+}
+
+/**
+ * p_graphics_vulkan_command_bind_pipeline
+ *
+ * makes the following draws in command_buffer use pipeline
+ * pipeline must be ready, see p_graphics_vulkan_pipeline_ready
+ */
+void p_graphics_vulkan_command_bind_pipeline(PGraphicsCommandBuffer *command_buffer,
+		const PGraphicsPipeline *pipeline)
+{
+	vkCmdBindPipeline(command_buffer->handle, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->handle);
+}
@@ -0,0 +1,293 @@
+#include "platinum.h"
+#include "p_graphics_vulkan.h"
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * p_vulkan_profiler_init
+ *
+ * creates a profiler with a timestamp query pool per frame in flight
+ * timestamp_period and timestamp_valid_bits come from the device limits and the graphics queue family
+ */
+PVulkanProfiler *p_vulkan_profiler_init(const VkDevice logical_device, float timestamp_period,
+		uint32_t timestamp_valid_bits)
+{
+	PVulkanProfiler *profiler = calloc(1, sizeof *profiler);
+	profiler->logical_device = logical_device;
+	profiler->timestamp_period = timestamp_period;
+	profiler->timestamp_mask = timestamp_valid_bits >= 64 ? UINT64_MAX : (1ull << timestamp_valid_bits) - 1;
+	p_light_mutex_init(&profiler->mutex);
+
+	VkQueryPoolCreateInfo query_pool_create_info = {0};
+	query_pool_create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	query_pool_create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	query_pool_create_info.queryCount = P_VULKAN_PROFILE_SCOPES_MAX * 2;
+	for (uint i = 0; i < P_VULKAN_FRAMES_IN_FLIGHT; i++)
+	{
+		if (vkCreateQueryPool(logical_device, &query_pool_create_info, NULL, &profiler->frames[i].query_pool)
+				!= VK_SUCCESS)
+		{
+			p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create timestamp query pool!");
+			exit(1);
+		}
+	}
+	return profiler;
+}
+
+/**
+ * p_vulkan_profiler_deinit
+ *
+ * destroys the profiler, the GPU must be done with every frame
+ */
+void p_vulkan_profiler_deinit(PVulkanProfiler *profiler)
+{
+	if (profiler == NULL)
+		return;
+	for (uint i = 0; i < P_VULKAN_FRAMES_IN_FLIGHT; i++)
+		vkDestroyQueryPool(profiler->logical_device, profiler->frames[i].query_pool, NULL);
+	free(profiler);
+}
+
+/**
+ * _vulkan_profiler_table_update
+ *
+ * fills the table of the latest resolved frame from a history frame
+ */
+static void _vulkan_profiler_table_update(PVulkanProfiler *profiler, const PVulkanProfileHistoryFrame *history_frame)
+{
+	double frame_begin = 0.0;
+	for (uint i = 0; i < history_frame->event_count; i++)
+	{
+		if (i == 0 || history_frame->events[i].begin < frame_begin)
+			frame_begin = history_frame->events[i].begin;
+	}
+	for (uint i = 0; i < history_frame->event_count; i++)
+	{
+		const PVulkanProfileEvent *event = &history_frame->events[i];
+		profiler->table[i].name = event->name;
+		profiler->table[i].begin_ms = (event->begin - frame_begin) / 1e6;
+		profiler->table[i].duration_ms = (event->end - event->begin) / 1e6;
+		profiler->table[i].depth = event->depth;
+	}
+	profiler->table_count = history_frame->event_count;
+}
+
+/**
+ * p_vulkan_profiler_resolve
+ *
+ * reads the timestamps of a frame in flight into the history and the table
+ * the frame's fence must have signaled, so the results are there and reading them never waits
+ */
+void p_vulkan_profiler_resolve(PVulkanProfiler *profiler, uint frame_index)
+{
+	if (profiler == NULL)
+		return;
+	PVulkanProfileFrame *frame = &profiler->frames[frame_index];
+	if (frame->scope_count == 0)
+		return;
+
+	// each query is its value followed by whether it is available
+	uint64_t results[P_VULKAN_PROFILE_SCOPES_MAX * 2][2];
+	VkResult result = vkGetQueryPoolResults(profiler->logical_device, frame->query_pool, 0,
+			frame->scope_count * 2, sizeof results, results, sizeof results[0],
+			VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+	if (result != VK_SUCCESS && result != VK_NOT_READY)
+	{
+		frame->scope_count = 0;
+		return;
+	}
+
+	PVulkanProfileHistoryFrame *history_frame = &profiler->history[profiler->history_next];
+	history_frame->frame_count = frame->frame_count;
+	history_frame->event_count = 0;
+	for (uint i = 0; i < frame->scope_count; i++)
+	{
+		// scopes left open or never reached by the GPU have no end
+		if (!results[i * 2][1] || !results[i * 2 + 1][1])
+			continue;
+		uint64_t begin = results[i * 2][0] & profiler->timestamp_mask;
+		uint64_t end = results[i * 2 + 1][0] & profiler->timestamp_mask;
+		if (end < begin)
+			end += profiler->timestamp_mask + 1;
+		PVulkanProfileEvent *event = &history_frame->events[history_frame->event_count++];
+		event->name = frame->scopes[i].name;
+		event->begin = (double)begin * profiler->timestamp_period;
+		event->end = (double)end * profiler->timestamp_period;
+		event->depth = frame->scopes[i].depth;
+	}
+	frame->scope_count = 0;
+
+	profiler->history_next = (profiler->history_next + 1) % P_VULKAN_PROFILE_HISTORY;
+	profiler->history_count = E_MIN(profiler->history_count + 1, P_VULKAN_PROFILE_HISTORY);
+	_vulkan_profiler_table_update(profiler, history_frame);
+}
+
+/**
+ * p_vulkan_profiler_frame_begin
+ *
+ * resets the queries of a frame in flight, command_buffer is the frame's primary command buffer
+ * must be recorded outside of the render pass and before any scope of the frame
+ */
+void p_vulkan_profiler_frame_begin(PVulkanProfiler *profiler, uint frame_index, uint64_t frame_count,
+		VkCommandBuffer command_buffer)
+{
+	if (profiler == NULL)
+		return;
+	PVulkanProfileFrame *frame = &profiler->frames[frame_index];
+	frame->scope_count = 0;
+	frame->frame_count = frame_count;
+	vkCmdResetQueryPool(command_buffer, frame->query_pool, 0, P_VULKAN_PROFILE_SCOPES_MAX * 2);
+}
+
+/**
+ * p_graphics_vulkan_profile_begin
+ *
+ * writes a timestamp when the GPU reaches this point of command_buffer
+ * scopes past P_VULKAN_PROFILE_SCOPES_MAX in a frame are not measured, name is kept as is and never copied
+ */
+void p_graphics_vulkan_profile_begin(PGraphicsCommandBuffer *command_buffer, const char *name)
+{
+	PVulkanProfiler *profiler = command_buffer->display->profiler;
+	if (profiler == NULL)
+		return;
+	if (command_buffer->profile_depth == P_VULKAN_PROFILE_DEPTH_MAX)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Too many nested profile scopes!");
+		exit(1);
+	}
+
+	PVulkanProfileFrame *frame = &profiler->frames[command_buffer->display->frame_index];
+	uint scope = UINT_MAX;
+	p_light_mutex_lock(&profiler->mutex);
+	if (frame->scope_count < P_VULKAN_PROFILE_SCOPES_MAX)
+		scope = frame->scope_count++;
+	p_light_mutex_unlock(&profiler->mutex);
+
+	command_buffer->profile_scopes[command_buffer->profile_depth] = scope;
+	if (scope != UINT_MAX)
+	{
+		frame->scopes[scope].name = name;
+		frame->scopes[scope].depth = command_buffer->profile_base_depth + command_buffer->profile_depth;
+		vkCmdWriteTimestamp(command_buffer->handle, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame->query_pool,
+				scope * 2);
+	}
+	command_buffer->profile_depth++;
+}
+
+/**
+ * p_graphics_vulkan_profile_end
+ *
+ * writes a timestamp when the GPU is done with everything recorded into command_buffer since the scope began
+ */
+void p_graphics_vulkan_profile_end(PGraphicsCommandBuffer *command_buffer)
+{
+	PVulkanProfiler *profiler = command_buffer->display->profiler;
+	if (profiler == NULL || command_buffer->profile_depth == 0)
+		return;
+
+	uint scope = command_buffer->profile_scopes[--command_buffer->profile_depth];
+	if (scope == UINT_MAX)
+		return;
+	PVulkanProfileFrame *frame = &profiler->frames[command_buffer->display->frame_index];
+	vkCmdWriteTimestamp(command_buffer->handle, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame->query_pool,
+			scope * 2 + 1);
+}
+
+/**
+ * p_graphics_vulkan_profile_frame
+ *
+ * sets scopes to the table of the latest resolved frame and returns its size, 0 without timestamps
+ */
+uint p_graphics_vulkan_profile_frame(const PGraphicalDisplayData vulkan_display_data,
+		const PGraphicsProfileScope **scopes)
+{
+	PVulkanProfiler *profiler = vulkan_display_data->profiler;
+	if (profiler == NULL)
+	{
+		*scopes = NULL;
+		return 0;
+	}
+	*scopes = profiler->table;
+	return profiler->table_count;
+}
+
+/**
+ * _vulkan_trace_append_name
+ *
+ * appends name as the contents of a JSON string
+ * returns false if the trace could not grow
+ */
+static bool _vulkan_trace_append_name(char **trace, size_t *size, size_t *capacity, const char *name)
+{
+	bool ok = true;
+	for (const char *c = name; ok && *c != '\0'; c++)
+	{
+		if (*c == '"' || *c == '\\')
+			ok = p_file_text_append(trace, size, capacity, "\\%c", *c);
+		else if ((unsigned char)*c < 0x20)
+			ok = p_file_text_append(trace, size, capacity, "\\u%04x", (unsigned char)*c);
+		else
+			ok = p_file_text_append(trace, size, capacity, "%c", *c);
+	}
+	return ok;
+}
+
+/**
+ * p_graphics_vulkan_profile_dump
+ *
+ * writes the resolved frames in the history to path in the Chrome trace event format
+ * every scope is a complete event on one GPU track, timestamps start at the oldest frame
+ */
+bool p_graphics_vulkan_profile_dump(const PGraphicalDisplayData vulkan_display_data, const char *path)
+{
+	PVulkanProfiler *profiler = vulkan_display_data->profiler;
+	if (profiler == NULL)
+		return false;
+
+	size_t size = 0;
+	size_t capacity = 0;
+	char *trace = NULL;
+	bool ok = p_file_text_append(&trace, &size, &capacity,
+			"{\"traceEvents\":[\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,"
+			"\"args\":{\"name\":\"GPU\"}}");
+
+	uint first = (profiler->history_next + P_VULKAN_PROFILE_HISTORY - profiler->history_count) %
+		P_VULKAN_PROFILE_HISTORY;
+	double origin = 0.0;
+	bool origin_set = false;
+	for (uint i = 0; i < profiler->history_count; i++)
+	{
+		const PVulkanProfileHistoryFrame *history_frame = &profiler->history[(first + i) % P_VULKAN_PROFILE_HISTORY];
+		for (uint j = 0; j < history_frame->event_count; j++)
+		{
+			const PVulkanProfileEvent *event = &history_frame->events[j];
+			if (!origin_set || event->begin < origin)
+			{
+				origin = event->begin;
+				origin_set = true;
+			}
+		}
+	}
+
+	for (uint i = 0; ok && i < profiler->history_count; i++)
+	{
+		const PVulkanProfileHistoryFrame *history_frame = &profiler->history[(first + i) % P_VULKAN_PROFILE_HISTORY];
+		for (uint j = 0; ok && j < history_frame->event_count; j++)
+		{
+			const PVulkanProfileEvent *event = &history_frame->events[j];
+			ok = p_file_text_append(&trace, &size, &capacity, ",\n{\"name\":\"") &&
+				_vulkan_trace_append_name(&trace, &size, &capacity, event->name) &&
+				p_file_text_append(&trace, &size, &capacity,
+					"\",\"cat\":\"gpu\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":0,"
+					"\"args\":{\"frame\":%llu}}",
+					(event->begin - origin) / 1e3, (event->end - event->begin) / 1e3,
+					(unsigned long long)history_frame->frame_count);
+		}
+	}
+	ok = ok && p_file_text_append(&trace, &size, &capacity, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+	ok = ok && p_file_replace(path, trace, size);
+	(free)(trace);
+	return ok;
+}
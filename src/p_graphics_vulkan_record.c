@@ -0,0 +1,248 @@
+#include "platinum.h"
+#include "p_graphics_vulkan.h"
+
+/**
+ * _vulkan_thread_pools_create
+ *
+ * creates the per thread command pools of every frame of the display
+ */
+static void _vulkan_thread_pools_create(PGraphicalDisplayData vulkan_display_data)
+{
+	VkCommandPoolCreateInfo command_pool_create_info = {0};
+	command_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	command_pool_create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	command_pool_create_info.queueFamilyIndex = vulkan_display_data->queue_family_infos[P_VULKAN_QUEUE_TYPE_GRAPHICS].index;
+
+	for (uint i = 0; i < P_VULKAN_FRAMES_IN_FLIGHT; i++)
+	{
+		PVulkanFrame *frame = &vulkan_display_data->frames[i];
+		frame->thread_pools = calloc(vulkan_display_data->thread_pool_count, sizeof *frame->thread_pools);
+		for (uint j = 0; j < vulkan_display_data->thread_pool_count; j++)
+		{
+			PVulkanThreadCommandPool *thread_pool = &frame->thread_pools[j];
+			if (vkCreateCommandPool(vulkan_display_data->logical_device, &command_pool_create_info, NULL,
+						&thread_pool->command_pool) != VK_SUCCESS)
+			{
+				p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create thread command pool!");
+				exit(1);
+			}
+			thread_pool->command_buffers = e_dynarr_init(sizeof (VkCommandBuffer), 4);
+		}
+	}
+}
+
+/**
+ * p_vulkan_thread_pools_destroy
+ *
+ * destroys the per thread command pools of every frame of the display
+ * the GPU must be done with every frame
+ */
+void p_vulkan_thread_pools_destroy(PGraphicalDisplayData vulkan_display_data)
+{
+	for (uint i = 0; i < P_VULKAN_FRAMES_IN_FLIGHT; i++)
+	{
+		PVulkanFrame *frame = &vulkan_display_data->frames[i];
+		if (frame->thread_pools == NULL)
+			continue;
+		for (uint j = 0; j < vulkan_display_data->thread_pool_count; j++)
+		{
+			// destroying the pool frees its command buffers
+			vkDestroyCommandPool(vulkan_display_data->logical_device, frame->thread_pools[j].command_pool, NULL);
+			e_dynarr_deinit(frame->thread_pools[j].command_buffers);
+		}
+		free(frame->thread_pools);
+		frame->thread_pools = NULL;
+	}
+}
+
+/**
+ * p_vulkan_thread_pools_reset
+ *
+ * resets the thread command pools of frame, the GPU must be done with frame
+ */
+void p_vulkan_thread_pools_reset(PVulkanFrame *frame, uint thread_pool_count, const VkDevice logical_device)
+{
+	if (frame->thread_pools == NULL)
+		return;
+	for (uint i = 0; i < thread_pool_count; i++)
+	{
+		PVulkanThreadCommandPool *thread_pool = &frame->thread_pools[i];
+		if (thread_pool->used == 0)
+			continue;
+		vkResetCommandPool(logical_device, thread_pool->command_pool, 0);
+		thread_pool->used = 0;
+	}
+}
+
+/**
+ * _vulkan_thread_command_buffer_get
+ *
+ * returns an unused secondary command buffer of thread_pool, allocating one if all are used
+ */
+static VkCommandBuffer _vulkan_thread_command_buffer_get(const VkDevice logical_device,
+		PVulkanThreadCommandPool *thread_pool)
+{
+	if (thread_pool->used == thread_pool->command_buffers->num_items)
+	{
+		VkCommandBufferAllocateInfo allocate_info = {0};
+		allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocate_info.commandPool = thread_pool->command_pool;
+		allocate_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocate_info.commandBufferCount = 1;
+		VkCommandBuffer command_buffer;
+		if (vkAllocateCommandBuffers(logical_device, &allocate_info, &command_buffer) != VK_SUCCESS)
+		{
+			p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to allocate secondary command buffer!");
+			exit(1);
+		}
+		e_dynarr_add(thread_pool->command_buffers, &command_buffer);
+	}
+	return E_DYNARR_GET(thread_pool->command_buffers, VkCommandBuffer, thread_pool->used++);
+}
+
+/**
+ * _vulkan_record_job
+ *
+ * job that records one part of a frame into a secondary command buffer
+ * uses the command pool of the thread it runs on, so no two threads share a pool
+ */
+static void _vulkan_record_job(void *args)
+{
+	PVulkanRecordTask *task = args;
+	PGraphicalDisplayData vulkan_display_data = task->display;
+	VkDevice logical_device = vulkan_display_data->logical_device;
+
+	// any thread waiting on jobs may run this one, those that are not workers of its job system share the last pool
+	int worker_index = p_job_worker_index(vulkan_display_data->job_system);
+	uint pool_index = worker_index < 0 ? vulkan_display_data->thread_pool_count - 1 : (uint)worker_index;
+	PVulkanThreadCommandPool *thread_pool =
+		&vulkan_display_data->frames[vulkan_display_data->frame_index].thread_pools[pool_index];
+	if (worker_index < 0)
+		p_light_mutex_lock(&vulkan_display_data->shared_pool_mutex);
+	VkCommandBuffer command_buffer = _vulkan_thread_command_buffer_get(logical_device, thread_pool);
+
+	VkCommandBufferInheritanceInfo inheritance_info = {0};
+	inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritance_info.renderPass = vulkan_display_data->render_pass;
+	inheritance_info.subpass = 0;
+	inheritance_info.framebuffer = task->framebuffer;
+
+	VkCommandBufferBeginInfo begin_info = {0};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+		VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	begin_info.pInheritanceInfo = &inheritance_info;
+	if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to begin recording secondary command buffer!");
+		exit(1);
+	}
+
+	// secondary command buffers inherit no state from the primary
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vulkan_display_data->graphics_pipeline);
+	VkViewport viewport = {0};
+	viewport.width = (float) vulkan_display_data->swapchain_extent.width;
+	viewport.height = (float) vulkan_display_data->swapchain_extent.height;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+	VkRect2D scissor = {0};
+	scissor.extent = vulkan_display_data->swapchain_extent;
+	vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+
+	// the primary command buffer has the frame's scope open
+	PGraphicsCommandBuffer graphics_command_buffer = { .handle = command_buffer, .display = vulkan_display_data,
+		.profile_base_depth = 1 };
+	vulkan_display_data->record_function(&graphics_command_buffer, task->index, vulkan_display_data->record_args);
+
+	if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to record secondary command buffer!");
+		exit(1);
+	}
+	if (worker_index < 0)
+		p_light_mutex_unlock(&vulkan_display_data->shared_pool_mutex);
+	task->command_buffer = command_buffer;
+}
+
+/**
+ * p_vulkan_record_secondaries
+ *
+ * records every part of the frame on the job system and executes them in order in command_buffer
+ * command_buffer must be inside the render pass, begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+ */
+void p_vulkan_record_secondaries(PGraphicalDisplayData vulkan_display_data, VkFramebuffer framebuffer,
+		VkCommandBuffer command_buffer)
+{
+	PJobCounter counter = {0};
+	for (uint i = 0; i < vulkan_display_data->record_count; i++)
+	{
+		PVulkanRecordTask *task = &vulkan_display_data->record_tasks[i];
+		task->framebuffer = framebuffer;
+		task->command_buffer = VK_NULL_HANDLE;
+		p_job_submit(vulkan_display_data->job_system, _vulkan_record_job, task, &counter);
+	}
+	p_job_wait(vulkan_display_data->job_system, &counter);
+
+	VkCommandBuffer secondaries[vulkan_display_data->record_count];
+	for (uint i = 0; i < vulkan_display_data->record_count; i++)
+		secondaries[i] = vulkan_display_data->record_tasks[i].command_buffer;
+	vkCmdExecuteCommands(command_buffer, vulkan_display_data->record_count, secondaries);
+}
+
+/**
+ * p_graphics_vulkan_display_set_recorder
+ *
+ * records each frame of the display as record_count secondary command buffers on job_system
+ * every worker thread gets a command pool per frame in flight, reset as a whole when the frame is reused
+ * a NULL job_system or a record_count of 0 goes back to recording on the drawing thread
+ */
+void p_graphics_vulkan_display_set_recorder(PGraphicalDisplayData vulkan_display_data, PJobSystem *job_system,
+		uint record_count, PGraphicsRecordFunction record_function, void *args)
+{
+	// the pools may still be in use by frames in flight
+	for (uint i = 0; i < P_VULKAN_FRAMES_IN_FLIGHT; i++)
+		vkWaitForFences(vulkan_display_data->logical_device, 1, &vulkan_display_data->frames[i].in_flight, VK_TRUE,
+				UINT64_MAX);
+	p_vulkan_thread_pools_destroy(vulkan_display_data);
+	free(vulkan_display_data->record_tasks);
+	vulkan_display_data->record_tasks = NULL;
+	vulkan_display_data->record_count = 0;
+	vulkan_display_data->job_system = NULL;
+
+	if (job_system == NULL || record_count == 0 || record_function == NULL)
+		return;
+
+	vulkan_display_data->job_system = job_system;
+	vulkan_display_data->thread_pool_count = p_job_system_worker_count(job_system) + 1;
+	vulkan_display_data->record_function = record_function;
+	vulkan_display_data->record_args = args;
+	vulkan_display_data->record_count = record_count;
+	vulkan_display_data->record_tasks = calloc(record_count, sizeof *vulkan_display_data->record_tasks);
+	for (uint i = 0; i < record_count; i++)
+	{
+		vulkan_display_data->record_tasks[i].display = vulkan_display_data;
+		vulkan_display_data->record_tasks[i].index = i;
+	}
+	_vulkan_thread_pools_create(vulkan_display_data);
+}
+
+/**
+ * p_graphics_vulkan_command_draw
+ *
+ * records a non-indexed draw into command_buffer
+ */
+void p_graphics_vulkan_command_draw(PGraphicsCommandBuffer *command_buffer, uint vertex_count, uint instance_count,
+		uint first_vertex, uint first_instance)
+{
+	vkCmdDraw(command_buffer->handle, vertex_count, instance_count, first_vertex, first_instance);
+}
+
+/**
+ * p_graphics_vulkan_command_buffer_handle
+ *
+ * returns the VkCommandBuffer of command_buffer, for recording vulkan commands platinum has no wrapper for
+ */
+void *p_graphics_vulkan_command_buffer_handle(const PGraphicsCommandBuffer *command_buffer)
+{
+	return command_buffer->handle;
+}
@@ -0,0 +1,170 @@
+#include "platinum.h"
+#include "p_graphics_vulkan.h"
+#include <string.h>
+
+/**
+ * _vulkan_shader_hash
+ *
+ * FNV-1a hash of SPIR-V bytes
+ */
+static uint64_t _vulkan_shader_hash(const uint32_t *code, size_t size)
+{
+	const uint8_t *bytes = (const uint8_t *)code;
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+/**
+ * p_vulkan_shader_cache_init
+ *
+ * creates an empty shader cache for logical_device
+ */
+PVulkanShaderCache *p_vulkan_shader_cache_init(const VkDevice logical_device)
+{
+	PVulkanShaderCache *shader_cache = calloc(1, sizeof *shader_cache);
+	shader_cache->logical_device = logical_device;
+	p_light_mutex_init(&shader_cache->mutex);
+	shader_cache->mask = 15;
+	shader_cache->slots = calloc(shader_cache->mask + 1, sizeof *shader_cache->slots);
+	return shader_cache;
+}
+
+/**
+ * p_vulkan_shader_cache_deinit
+ *
+ * destroys the shader cache along with every module still in it
+ */
+void p_vulkan_shader_cache_deinit(PVulkanShaderCache *shader_cache)
+{
+	for (uint32_t i = 0; i <= shader_cache->mask; i++)
+	{
+		PVulkanShaderEntry *entry = &shader_cache->slots[i];
+		if (entry->module == VK_NULL_HANDLE)
+			continue;
+		vkDestroyShaderModule(shader_cache->logical_device, entry->module, NULL);
+		free(entry->code);
+	}
+	free(shader_cache->slots);
+	free(shader_cache);
+}
+
+/**
+ * _vulkan_shader_cache_insert
+ *
+ * puts entry in the first free slot of its probe sequence, the table must have a free slot
+ */
+static void _vulkan_shader_cache_insert(PVulkanShaderCache *shader_cache, const PVulkanShaderEntry *entry)
+{
+	uint32_t i = (uint32_t)entry->hash & shader_cache->mask;
+	while (shader_cache->slots[i].module != VK_NULL_HANDLE)
+		i = (i + 1) & shader_cache->mask;
+	shader_cache->slots[i] = *entry;
+}
+
+/**
+ * _vulkan_shader_cache_grow
+ *
+ * doubles the number of slots of the shader cache
+ */
+static void _vulkan_shader_cache_grow(PVulkanShaderCache *shader_cache)
+{
+	PVulkanShaderEntry *old_slots = shader_cache->slots;
+	uint32_t old_slot_count = shader_cache->mask + 1;
+	shader_cache->mask = old_slot_count * 2 - 1;
+	shader_cache->slots = calloc(old_slot_count * 2, sizeof *shader_cache->slots);
+	for (uint32_t i = 0; i < old_slot_count; i++)
+	{
+		if (old_slots[i].module != VK_NULL_HANDLE)
+			_vulkan_shader_cache_insert(shader_cache, &old_slots[i]);
+	}
+	free(old_slots);
+}
+
+/**
+ * p_vulkan_shader_module_acquire
+ *
+ * returns the shader module made from code, creating it only if no identical SPIR-V is in the cache
+ * every acquire must be matched by a p_vulkan_shader_module_release
+ */
+VkShaderModule p_vulkan_shader_module_acquire(PVulkanShaderCache *shader_cache, const uint32_t *code, size_t size)
+{
+	uint64_t hash = _vulkan_shader_hash(code, size);
+	p_light_mutex_lock(&shader_cache->mutex);
+	for (uint32_t i = (uint32_t)hash & shader_cache->mask;; i = (i + 1) & shader_cache->mask)
+	{
+		PVulkanShaderEntry *entry = &shader_cache->slots[i];
+		if (entry->module == VK_NULL_HANDLE)
+			break;
+		if (entry->hash == hash && entry->size == size && memcmp(entry->code, code, size) == 0)
+		{
+			entry->reference_count++;
+			p_light_mutex_unlock(&shader_cache->mutex);
+			return entry->module;
+		}
+	}
+
+	PVulkanShaderEntry entry = {0};
+	entry.hash = hash;
+	entry.size = size;
+	entry.reference_count = 1;
+	VkShaderModuleCreateInfo create_info = {0};
+	create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	create_info.codeSize = size;
+	create_info.pCode = code;
+	if (vkCreateShaderModule(shader_cache->logical_device, &create_info, NULL, &entry.module) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create shader module!");
+		exit(1);
+	}
+	entry.code = malloc(size);
+	memcpy(entry.code, code, size);
+
+	// keep the table at most half full so probes stay short
+	if ((shader_cache->count + 1) * 2 > shader_cache->mask + 1)
+		_vulkan_shader_cache_grow(shader_cache);
+	_vulkan_shader_cache_insert(shader_cache, &entry);
+	shader_cache->count++;
+	p_light_mutex_unlock(&shader_cache->mutex);
+	return entry.module;
+}
+
+/**
+ * p_vulkan_shader_module_release
+ *
+ * drops a reference to module, destroying it when it was the last one
+ * pipelines made from the module do not need it to stay alive
+ */
+void p_vulkan_shader_module_release(PVulkanShaderCache *shader_cache, VkShaderModule module)
+{
+	p_light_mutex_lock(&shader_cache->mutex);
+	uint32_t i = 0;
+	while (i <= shader_cache->mask && shader_cache->slots[i].module != module)
+		i++;
+	if (i > shader_cache->mask || --shader_cache->slots[i].reference_count > 0)
+	{
+		p_light_mutex_unlock(&shader_cache->mutex);
+		return;
+	}
+	vkDestroyShaderModule(shader_cache->logical_device, module, NULL);
+	free(shader_cache->slots[i].code);
+
+	// shift the rest of the probe sequence back, so lookups never stop early at the freed slot
+	for (uint32_t j = (i + 1) & shader_cache->mask; shader_cache->slots[j].module != VK_NULL_HANDLE;
+			j = (j + 1) & shader_cache->mask)
+	{
+		uint32_t home = (uint32_t)shader_cache->slots[j].hash & shader_cache->mask;
+		if (((j - home) & shader_cache->mask) >= ((j - i) & shader_cache->mask))
+		{
+			shader_cache->slots[i] = shader_cache->slots[j];
+			i = j;
+		}
+	}
+	shader_cache->slots[i] = (PVulkanShaderEntry){0};
+	shader_cache->count--;
+	p_light_mutex_unlock(&shader_cache->mutex);
+}
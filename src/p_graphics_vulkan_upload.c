@@ -0,0 +1,496 @@
+#include "platinum.h"
+#include "p_graphics_vulkan.h"
+#include <string.h>
+
+// Staging copies start on this, a multiple of every texel size and of what vkCmdCopyBufferToImage needs
+#define P_VULKAN_STAGING_ALIGNMENT 16
+
+// Largest piece of one upload, so the next piece can be written while the previous one is copied
+#define P_VULKAN_STAGING_CHUNK_SIZE (P_VULKAN_STAGING_SIZE / 4)
+
+/**
+ * _vulkan_uploads_completed
+ *
+ * returns the value of the last upload batch the GPU is done with
+ * must be called with uploader->mutex locked
+ */
+static uint64_t _vulkan_uploads_completed(PVulkanUploader *uploader)
+{
+	if (uploader->timeline != VK_NULL_HANDLE)
+	{
+		vkGetSemaphoreCounterValue(uploader->logical_device, uploader->timeline, &uploader->completed_value);
+		return uploader->completed_value;
+	}
+
+	// batches on one queue finish in the order they were submitted, the oldest is the one after batch_index
+	for (uint i = 1; i <= P_VULKAN_UPLOAD_BATCHES; i++)
+	{
+		PVulkanUploadBatch *batch = &uploader->batches[(uploader->batch_index + i) % P_VULKAN_UPLOAD_BATCHES];
+		if (batch->value <= uploader->completed_value)
+			continue;
+		if (vkGetFenceStatus(uploader->logical_device, batch->fence) != VK_SUCCESS)
+			break;
+		uploader->completed_value = batch->value;
+	}
+	return uploader->completed_value;
+}
+
+/**
+ * _vulkan_uploads_wait
+ *
+ * blocks until the GPU is done with upload batch value
+ * must be called with uploader->mutex locked
+ */
+static void _vulkan_uploads_wait(PVulkanUploader *uploader, uint64_t value)
+{
+	if (value <= _vulkan_uploads_completed(uploader))
+		return;
+
+	if (uploader->timeline != VK_NULL_HANDLE)
+	{
+		VkSemaphoreWaitInfo wait_info = {0};
+		wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+		wait_info.semaphoreCount = 1;
+		wait_info.pSemaphores = &uploader->timeline;
+		wait_info.pValues = &value;
+		vkWaitSemaphores(uploader->logical_device, &wait_info, UINT64_MAX);
+	} else {
+		for (uint i = 0; i < P_VULKAN_UPLOAD_BATCHES; i++)
+		{
+			if (uploader->batches[i].value == value)
+				vkWaitForFences(uploader->logical_device, 1, &uploader->batches[i].fence, VK_TRUE, UINT64_MAX);
+		}
+	}
+	_vulkan_uploads_completed(uploader);
+}
+
+/**
+ * _vulkan_uploads_reclaim
+ *
+ * gives the staging space of finished batches back to the ring
+ * must be called with uploader->mutex locked
+ */
+static void _vulkan_uploads_reclaim(PVulkanUploader *uploader)
+{
+	uint64_t completed = _vulkan_uploads_completed(uploader);
+	for (uint i = 0; i < P_VULKAN_UPLOAD_BATCHES; i++)
+	{
+		const PVulkanUploadBatch *batch = &uploader->batches[i];
+		if (batch->value != 0 && batch->value <= completed)
+			uploader->ring_tail = E_MAX(uploader->ring_tail, batch->ring_end);
+	}
+}
+
+/**
+ * _vulkan_upload_batch_submit
+ *
+ * submits the batch being recorded to the transfer queue
+ * must be called with uploader->mutex locked
+ */
+static void _vulkan_upload_batch_submit(PVulkanUploader *uploader)
+{
+	if (!uploader->recording)
+		return;
+
+	PVulkanUploadBatch *batch = &uploader->batches[uploader->batch_index];
+	if (vkEndCommandBuffer(batch->command_buffer) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to record upload command buffer!");
+		exit(1);
+	}
+
+	uint64_t value = uploader->submitted_value + 1;
+	VkTimelineSemaphoreSubmitInfo timeline_submit_info = {0};
+	timeline_submit_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timeline_submit_info.signalSemaphoreValueCount = 1;
+	timeline_submit_info.pSignalSemaphoreValues = &value;
+
+	VkSubmitInfo submit_info = {0};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &batch->command_buffer;
+	if (uploader->timeline != VK_NULL_HANDLE)
+	{
+		submit_info.pNext = &timeline_submit_info;
+		submit_info.signalSemaphoreCount = 1;
+		submit_info.pSignalSemaphores = &uploader->timeline;
+	}
+
+	p_light_mutex_lock(uploader->queue_mutex);
+	if (vkQueueSubmit(uploader->queue, 1, &submit_info, batch->fence) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to submit upload command buffer!");
+		exit(1);
+	}
+	p_light_mutex_unlock(uploader->queue_mutex);
+
+	batch->value = value;
+	batch->ring_end = uploader->ring_head;
+	uploader->submitted_value = value;
+	uploader->batch_index = (uploader->batch_index + 1) % P_VULKAN_UPLOAD_BATCHES;
+	uploader->recording = false;
+}
+
+/**
+ * _vulkan_upload_batch_begin
+ *
+ * returns the command buffer of the batch being recorded, starting a new batch if needed
+ * must be called with uploader->mutex locked
+ */
+static VkCommandBuffer _vulkan_upload_batch_begin(PVulkanUploader *uploader)
+{
+	PVulkanUploadBatch *batch = &uploader->batches[uploader->batch_index];
+	if (uploader->recording)
+		return batch->command_buffer;
+
+	// the batch is reused, wait for its last submit
+	_vulkan_uploads_wait(uploader, batch->value);
+	if (batch->fence != VK_NULL_HANDLE)
+		vkResetFences(uploader->logical_device, 1, &batch->fence);
+
+	vkResetCommandBuffer(batch->command_buffer, 0);
+	VkCommandBufferBeginInfo begin_info = {0};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if (vkBeginCommandBuffer(batch->command_buffer, &begin_info) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to begin recording upload command buffer!");
+		exit(1);
+	}
+	uploader->recording = true;
+	return batch->command_buffer;
+}
+
+/**
+ * _vulkan_staging_allocate
+ *
+ * takes size bytes out of the staging ring, size must be at most P_VULKAN_STAGING_SIZE
+ * submits the batch being recorded and waits for older batches when the ring is full
+ * sets offset to the place in the staging buffer and returns its mapped address
+ * must be called with uploader->mutex locked
+ */
+static uint8_t *_vulkan_staging_allocate(PVulkanUploader *uploader, uint64_t size, VkDeviceSize *offset)
+{
+	for (;;)
+	{
+		// nothing is pending, start at the beginning so large pieces never have to wrap
+		if (uploader->ring_tail == uploader->ring_head)
+		{
+			uploader->ring_head = (uploader->ring_head + P_VULKAN_STAGING_SIZE - 1) / P_VULKAN_STAGING_SIZE *
+				P_VULKAN_STAGING_SIZE;
+			uploader->ring_tail = uploader->ring_head;
+		}
+
+		uint64_t position = (uploader->ring_head + P_VULKAN_STAGING_ALIGNMENT - 1) &
+			~(uint64_t)(P_VULKAN_STAGING_ALIGNMENT - 1);
+		if (position % P_VULKAN_STAGING_SIZE + size > P_VULKAN_STAGING_SIZE)
+			position = (position / P_VULKAN_STAGING_SIZE + 1) * P_VULKAN_STAGING_SIZE; // skip the end, it is too small
+		if (position + size - uploader->ring_tail <= P_VULKAN_STAGING_SIZE)
+		{
+			uploader->ring_head = position + size;
+			*offset = position % P_VULKAN_STAGING_SIZE;
+			return (uint8_t *)uploader->staging->allocation.mapped + *offset;
+		}
+
+		_vulkan_uploads_reclaim(uploader);
+		if (position + size - uploader->ring_tail <= P_VULKAN_STAGING_SIZE)
+			continue;
+
+		// full, the batch being recorded may be what holds the space
+		_vulkan_upload_batch_submit(uploader);
+		if (uploader->submitted_value > uploader->completed_value)
+			_vulkan_uploads_wait(uploader, uploader->completed_value + 1);
+		_vulkan_uploads_reclaim(uploader);
+	}
+}
+
+/**
+ * p_vulkan_uploader_init
+ *
+ * creates the uploader and its staging ring
+ * uploads are submitted to the queue of transfer_queue_family_info
+ */
+PVulkanUploader *p_vulkan_uploader_init(const VkDevice logical_device, PVulkanAllocator *allocator,
+		const PVulkanQueueFamilyInfo transfer_queue_family_info, PLightMutex *queue_mutex, bool timeline_semaphore)
+{
+	PVulkanUploader *uploader = calloc(1, sizeof *uploader);
+	uploader->logical_device = logical_device;
+	uploader->queue = transfer_queue_family_info.queue;
+	uploader->queue_mutex = queue_mutex;
+	p_light_mutex_init(&uploader->mutex);
+
+	if (timeline_semaphore)
+	{
+		VkSemaphoreTypeCreateInfo semaphore_type_info = {0};
+		semaphore_type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+		semaphore_type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		semaphore_type_info.initialValue = 0;
+		VkSemaphoreCreateInfo semaphore_create_info = {0};
+		semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphore_create_info.pNext = &semaphore_type_info;
+		if (vkCreateSemaphore(logical_device, &semaphore_create_info, NULL, &uploader->timeline) != VK_SUCCESS)
+		{
+			p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create upload timeline semaphore!");
+			exit(1);
+		}
+	}
+
+	VkCommandPoolCreateInfo pool_create_info = {0};
+	pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	pool_create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	pool_create_info.queueFamilyIndex = transfer_queue_family_info.index;
+	if (vkCreateCommandPool(logical_device, &pool_create_info, NULL, &uploader->command_pool) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create upload command pool!");
+		exit(1);
+	}
+
+	VkCommandBuffer command_buffers[P_VULKAN_UPLOAD_BATCHES];
+	VkCommandBufferAllocateInfo allocate_info = {0};
+	allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocate_info.commandPool = uploader->command_pool;
+	allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocate_info.commandBufferCount = P_VULKAN_UPLOAD_BATCHES;
+	if (vkAllocateCommandBuffers(logical_device, &allocate_info, command_buffers) != VK_SUCCESS)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to allocate upload command buffers!");
+		exit(1);
+	}
+
+	VkFenceCreateInfo fence_create_info = {0};
+	fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	for (uint i = 0; i < P_VULKAN_UPLOAD_BATCHES; i++)
+	{
+		uploader->batches[i].command_buffer = command_buffers[i];
+		if (uploader->timeline == VK_NULL_HANDLE &&
+				vkCreateFence(logical_device, &fence_create_info, NULL, &uploader->batches[i].fence) != VK_SUCCESS)
+		{
+			p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create upload fence!");
+			exit(1);
+		}
+	}
+
+	PGraphicsBufferRequest staging_request = {0};
+	staging_request.size = P_VULKAN_STAGING_SIZE;
+	staging_request.usage = P_GRAPHICS_BUFFER_TRANSFER_SRC;
+	staging_request.memory_usage = P_GRAPHICS_MEMORY_CPU_TO_GPU;
+	uploader->staging = p_vulkan_buffer_create(allocator, &staging_request);
+	if (uploader->staging == NULL)
+	{
+		p_log_message(P_LOG_ERROR, L"Vulkan General", L"Failed to create the staging buffer!");
+		exit(1);
+	}
+	return uploader;
+}
+
+/**
+ * p_vulkan_uploader_deinit
+ *
+ * waits for pending uploads and frees uploader
+ */
+void p_vulkan_uploader_deinit(PVulkanUploader *uploader)
+{
+	if (uploader == NULL)
+		return;
+
+	p_light_mutex_lock(&uploader->mutex);
+	_vulkan_upload_batch_submit(uploader);
+	_vulkan_uploads_wait(uploader, uploader->submitted_value);
+	p_light_mutex_unlock(&uploader->mutex);
+
+	p_graphics_vulkan_buffer_destroy(uploader->staging);
+	for (uint i = 0; i < P_VULKAN_UPLOAD_BATCHES; i++)
+	{
+		if (uploader->batches[i].fence != VK_NULL_HANDLE)
+			vkDestroyFence(uploader->logical_device, uploader->batches[i].fence, NULL);
+	}
+	vkDestroyCommandPool(uploader->logical_device, uploader->command_pool, NULL);
+	if (uploader->timeline != VK_NULL_HANDLE)
+		vkDestroySemaphore(uploader->logical_device, uploader->timeline, NULL);
+	free(uploader);
+}
+
+/**
+ * p_vulkan_uploader_flush
+ *
+ * submits the uploads recorded so far
+ * returns the upload value that is reached once all of them are done, 0 if nothing was ever uploaded
+ */
+uint64_t p_vulkan_uploader_flush(PVulkanUploader *uploader)
+{
+	p_light_mutex_lock(&uploader->mutex);
+	_vulkan_upload_batch_submit(uploader);
+	uint64_t value = uploader->submitted_value;
+	p_light_mutex_unlock(&uploader->mutex);
+	return value;
+}
+
+/**
+ * p_vulkan_uploader_wait
+ *
+ * blocks until upload is done, submitting it first if it is still being recorded
+ */
+void p_vulkan_uploader_wait(PVulkanUploader *uploader, uint64_t upload)
+{
+	p_light_mutex_lock(&uploader->mutex);
+	if (upload > uploader->submitted_value)
+		_vulkan_upload_batch_submit(uploader);
+	_vulkan_uploads_wait(uploader, E_MIN(upload, uploader->submitted_value));
+	p_light_mutex_unlock(&uploader->mutex);
+}
+
+/**
+ * p_graphics_vulkan_buffer_upload
+ *
+ * copies size bytes of data to buffer at offset through the staging ring on the transfer queue
+ * data can be reused as soon as this returns. buffer needs P_GRAPHICS_BUFFER_TRANSFER_DST
+ * returns the upload value, see p_graphics_vulkan_upload_done
+ */
+uint64_t p_graphics_vulkan_buffer_upload(PGraphicalDisplayData vulkan_display_data, PGraphicsBuffer *buffer,
+		uint64_t offset, const void *data, uint64_t size)
+{
+	PVulkanUploader *uploader = vulkan_display_data->uploader;
+	const uint8_t *bytes = data;
+
+	p_light_mutex_lock(&uploader->mutex);
+	while (size > 0)
+	{
+		uint64_t chunk_size = E_MIN(size, P_VULKAN_STAGING_CHUNK_SIZE);
+		VkDeviceSize staging_offset;
+		uint8_t *staging = _vulkan_staging_allocate(uploader, chunk_size, &staging_offset);
+		memcpy(staging, bytes, chunk_size);
+		p_graphics_vulkan_buffer_flush(uploader->staging, staging_offset, chunk_size);
+
+		VkBufferCopy region = {0};
+		region.srcOffset = staging_offset;
+		region.dstOffset = offset;
+		region.size = chunk_size;
+		vkCmdCopyBuffer(_vulkan_upload_batch_begin(uploader), uploader->staging->handle, buffer->handle, 1, &region);
+
+		bytes += chunk_size;
+		offset += chunk_size;
+		size -= chunk_size;
+	}
+	uint64_t value = uploader->submitted_value + 1; // the batch being recorded
+	p_light_mutex_unlock(&uploader->mutex);
+	return value;
+}
+
+/**
+ * _vulkan_image_barrier
+ *
+ * records a layout transition of the whole image
+ */
+static void _vulkan_image_barrier(const VkCommandBuffer command_buffer, const PGraphicsImage * const image,
+		VkImageLayout old_layout, VkImageLayout new_layout, VkAccessFlags src_access, VkAccessFlags dst_access,
+		VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage)
+{
+	VkImageMemoryBarrier barrier = {0};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = src_access;
+	barrier.dstAccessMask = dst_access;
+	barrier.oldLayout = old_layout;
+	barrier.newLayout = new_layout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image->handle;
+	barrier.subresourceRange.aspectMask = image->format == VK_FORMAT_D32_SFLOAT ?
+		VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.layerCount = 1;
+	vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0, 0, NULL, 0, NULL, 1, &barrier);
+}
+
+/**
+ * p_graphics_vulkan_image_upload
+ *
+ * replaces the contents of image with data, tightly packed rows of texels, on the transfer queue
+ * data can be reused as soon as this returns. image needs P_GRAPHICS_IMAGE_TRANSFER_DST
+ * the image is left in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL if it can be sampled
+ * returns the upload value, see p_graphics_vulkan_upload_done, 0 if image cannot be uploaded to
+ */
+uint64_t p_graphics_vulkan_image_upload(PGraphicalDisplayData vulkan_display_data, PGraphicsImage *image,
+		const void *data)
+{
+	PVulkanUploader *uploader = vulkan_display_data->uploader;
+	if (!(image->usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT))
+	{
+		p_log_message(P_LOG_WARNING, L"Vulkan General", L"Image was not created with P_GRAPHICS_IMAGE_TRANSFER_DST");
+		return 0;
+	}
+
+	// every format in PGraphicsFormat has 4 byte texels
+	const uint64_t row_size = (uint64_t)image->extent.width * 4;
+	const uint rows_per_chunk = E_MAX(P_VULKAN_STAGING_CHUNK_SIZE / row_size, 1);
+	const VkImageLayout final_layout = image->usage & VK_IMAGE_USAGE_SAMPLED_BIT ?
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	const uint8_t *bytes = data;
+
+	p_light_mutex_lock(&uploader->mutex);
+	_vulkan_image_barrier(_vulkan_upload_batch_begin(uploader), image, VK_IMAGE_LAYOUT_UNDEFINED,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+	for (uint row = 0; row < image->extent.height; row += rows_per_chunk)
+	{
+		uint rows = E_MIN(rows_per_chunk, image->extent.height - row);
+		uint64_t chunk_size = rows * row_size;
+		VkDeviceSize staging_offset;
+		uint8_t *staging = _vulkan_staging_allocate(uploader, chunk_size, &staging_offset);
+		memcpy(staging, bytes + row * row_size, chunk_size);
+		p_graphics_vulkan_buffer_flush(uploader->staging, staging_offset, chunk_size);
+
+		VkBufferImageCopy region = {0};
+		region.bufferOffset = staging_offset;
+		region.imageSubresource.aspectMask = image->format == VK_FORMAT_D32_SFLOAT ?
+			VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = (VkOffset3D){0, row, 0};
+		region.imageExtent = (VkExtent3D){image->extent.width, rows, 1};
+		vkCmdCopyBufferToImage(_vulkan_upload_batch_begin(uploader), uploader->staging->handle, image->handle,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	}
+
+	if (final_layout != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+		_vulkan_image_barrier(_vulkan_upload_batch_begin(uploader), image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				final_layout, VK_ACCESS_TRANSFER_WRITE_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+	image->layout = final_layout;
+	uint64_t value = uploader->submitted_value + 1; // the batch being recorded
+	p_light_mutex_unlock(&uploader->mutex);
+	return value;
+}
+
+/**
+ * p_graphics_vulkan_upload_flush
+ *
+ * submits the uploads recorded so far instead of waiting for the next draw to do it
+ */
+void p_graphics_vulkan_upload_flush(PGraphicalDisplayData vulkan_display_data)
+{
+	p_vulkan_uploader_flush(vulkan_display_data->uploader);
+}
+
+/**
+ * p_graphics_vulkan_upload_done
+ *
+ * returns whether the GPU has finished the upload with value upload
+ */
+bool p_graphics_vulkan_upload_done(const PGraphicalDisplayData vulkan_display_data, uint64_t upload)
+{
+	PVulkanUploader *uploader = vulkan_display_data->uploader;
+	p_light_mutex_lock(&uploader->mutex);
+	bool done = upload <= _vulkan_uploads_completed(uploader);
+	p_light_mutex_unlock(&uploader->mutex);
+	return done;
+}
+
+/**
+ * p_graphics_vulkan_upload_wait
+ *
+ * blocks until the GPU has finished the upload with value upload
+ */
+void p_graphics_vulkan_upload_wait(PGraphicalDisplayData vulkan_display_data, uint64_t upload)
+{
+	p_vulkan_uploader_wait(vulkan_display_data->uploader, upload);
+}
@@ -14,10 +14,41 @@ void _x11_window_close(PWindowData *window_data);
 void _win32_window_close(PWindowData *window_data);
 #endif // PLATINUM_DISPLAY
 
+/**
+ * p_window_system_init
+ *
+ * sets up the connection to the display server that is shared by every window.
+ * returns NULL if the back-end keeps a connection per window
+ */
+PWindowSystem *p_window_system_init(PAppData *app_data)
+{
+#ifdef PLATINUM_DISPLAY_X11
+	return p_x11_window_system_init(app_data);
+#else
+	E_UNUSED(app_data);
+	return NULL;
+#endif // PLATINUM_DISPLAY
+}
+
+/**
+ * p_window_system_deinit
+ *
+ * closes the connection to the display server.
+ * every window must be closed beforehand
+ */
+void p_window_system_deinit(PWindowSystem *window_system)
+{
+#ifdef PLATINUM_DISPLAY_X11
+	p_x11_window_system_deinit(window_system);
+#else
+	E_UNUSED(window_system);
+#endif // PLATINUM_DISPLAY
+}
+
 /**
  * p_window_create
  *
- * creates a window with parameters set from window_request.
+ * creates a window with parameters set from window_request, headless apps cannot create any.
  * adds the window_data associated with the window to app_data.
  */
 void p_window_create(PAppData *app_data, const PWindowRequest window_request)
@@ -50,21 +81,42 @@ void p_window_close(PWindowData *window_data)
 
 
 /**
- * _window_close
+ * _window_destroyed
  *
- * internal close function that actually closes the window and frees data
+ * moves a window the display server has destroyed from window_data to closed_window_data.
+ * called by the event thread after it has pushed the last event of the window,
+ * the window is reported and freed later by the thread that polls events and draws
  */
-void _window_close(PAppData *app_data, PWindowData *window_data)
+void _window_destroyed(PAppData *app_data, PWindowData *window_data)
 {
-	// If window exists delete it.
-	p_mutex_lock(app_data->window_mutex);
+	p_light_mutex_lock(&app_data->window_mutex);
 	int index = e_dynarr_find(app_data->window_data, &window_data);
 	if (index == -1)
 	{
 		p_log_message(P_LOG_ERROR, L"Phantom", L"Window does not exist...");
 		exit(1);
 	}
-	p_graphics_display_destroy(window_data->graphical_display_data);
+	if (window_data->status == P_WINDOW_STATUS_ALIVE)
+		window_data->status = P_WINDOW_STATUS_CLOSE;
+	e_dynarr_remove_unordered(app_data->window_data, index);
+	window_data->closed_event_position = p_event_queue_pushed(app_data->event_queue);
+	e_dynarr_add(app_data->closed_window_data, &window_data);
+	atomic_fetch_add(&app_data->num_closed_windows, 1);
+	p_cond_var_broadcast(&app_data->window_cond_var);
+	p_light_mutex_unlock(&app_data->window_mutex);
+}
+
+/**
+ * _window_close
+ *
+ * internal close function that actually closes the window and frees data.
+ * must run on the thread that draws to the window, so its display is never destroyed mid frame
+ */
+void _window_close(PAppData *app_data, PWindowData *window_data)
+{
+	E_UNUSED(app_data);
+	if (window_data->graphical_display_data != NULL)
+		p_graphics_display_destroy(window_data->graphical_display_data);
 
 #ifdef PLATINUM_DISPLAY_WAYLAND
 	_wayland_window_close(window_data);
@@ -75,15 +127,11 @@ void _window_close(PAppData *app_data, PWindowData *window_data)
 #endif // PLATINUM_PLATFORM
 
 	free(window_data->display_info);
-	if (window_data->status == P_WINDOW_STATUS_CLOSE)
-	{
-		free(window_data->event_calls);
-		free(window_data->name);
-		free(window_data);
-		p_thread_detach(p_thread_self());
-	}
-	e_dynarr_remove_unordered(app_data->window_data, index);
-	p_mutex_unlock(app_data->window_mutex);
+	if (window_data->event_manager != NULL)
+		p_thread_detach(window_data->event_manager);
+	free(window_data->event_calls);
+	free(window_data->name);
+	free(window_data);
 }
 
 /**
@@ -6,7 +6,7 @@
 #endif // PLATINUM_BACKEND
 
 // Forward function declarations for internal functions
-void _window_close(PAppData *app_data, PWindowData *window_data);
+void _window_destroyed(PAppData *app_data, PWindowData *window_data);
 
 // Internal Enums
 
@@ -175,11 +175,7 @@ static LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM l
 			if (window_data->event_calls->enable_destroy && window_data->event_calls->destroy != NULL)
 				window_data->event_calls->destroy();
 			PostQuitMessage(0);
-			p_mutex_lock(app_instance->window_mutex);
-			if (window_data->status == P_WINDOW_STATUS_ALIVE)
-				window_data->status = P_WINDOW_STATUS_CLOSE;
-			p_mutex_unlock(app_instance->window_mutex);
-			_window_close(app_instance, window_data);
+			_window_destroyed(app_instance, window_data);
 			return 0;
 		}
 
@@ -291,7 +287,7 @@ PLATINUM_API void p_win32_window_close(PWindowData *window_data)
 void _win32_window_close(PAppInstance *app_instance, PWindowData *window_data)
 {
 	// If window exists delete it.
-	p_mutex_lock(app_instance->window_mutex);
+	p_light_mutex_lock(&app_instance->window_mutex);
 	int index = e_dynarr_find(app_instance->window_data, &window_data);
 	if (index == -1)
 	{
@@ -308,7 +304,7 @@ void _win32_window_close(PAppInstance *app_instance, PWindowData *window_data)
 		p_thread_detach(p_thread_self());
 	}
 	e_dynarr_remove_unordered(app_instance->window_data, index);
-	p_mutex_unlock(app_instance->window_mutex);
+	p_light_mutex_unlock(&app_instance->window_mutex);
 }
 
 /**
@@ -361,9 +357,9 @@ PThreadResult WINAPI _win32_window_event_manage(PThreadArguments args)
 
 	p_graphics_display_create(window_data, app_data->graphical_app_data, &window_request.graphical_display_request);
 
-	p_mutex_lock(app_instance->window_mutex);
+	p_light_mutex_lock(&app_instance->window_mutex);
 	e_dynarr_add(app_instance->window_data, &window_data);
-	p_mutex_unlock(app_instance->window_mutex);
+	p_light_mutex_unlock(&app_instance->window_mutex);
 
 	SetWindowLongPtr(window_data->display_info->hwnd, GWLP_USERDATA, (LONG_PTR)args);
 	SetEvent(window_creation_event);
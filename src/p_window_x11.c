@@ -1,7 +1,12 @@
 #include "platinum.h"
 #include <enigma.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
 #include <wchar.h>
 
 #ifdef PLATINUM_GRAPHICS_VULKAN
@@ -9,8 +14,16 @@
 #endif // PLATINUM_GRAPHICS_VULKAN
 
 // Forward function declarations for internal functions
-void _window_close(PAppData *app_data, PWindowData *window_data);
-static PThreadResult _x11_window_event_manage(PThreadArguments args);
+void _window_destroyed(PAppData *app_data, PWindowData *window_data);
+static PThreadResult _x11_event_manage(PThreadArguments args);
+
+// Longest the event thread sleeps without checking the connection.
+// Other threads (and the vulkan WSI) reading replies can pull events into xcb's queue
+// without the socket becoming readable again, so epoll alone could miss them.
+#define P_X11_EVENT_TIMEOUT_MS 16
+
+// Most events the event thread takes off the connection before handling them
+#define P_X11_EVENT_BATCH_SIZE 64
 
 // Internal Enums
 
@@ -37,6 +50,25 @@ enum PAtomTypes {
 
 // Internal Structs
 
+/**
+ * PWindowSystem
+ *
+ * This struct holds the X connection shared by every window of the app
+ * and the thread that dispatches its events
+ */
+struct PWindowSystem {
+	PAppData *app_data;
+	xcb_connection_t *connection;
+	xcb_screen_t *screen;
+	const xcb_atom_t *atoms;
+
+	// Event dispatching
+	PThread event_manager;
+	atomic_bool running;
+	int epoll_fd;
+	int wake_fd; // eventfd used to wake the event thread on shutdown
+};
+
 /**
  * PDisplayInfo
  *
@@ -44,8 +76,8 @@ enum PAtomTypes {
  * Values here should never be set directly
  */
 struct PDisplayInfo {
-	// X info
-	xcb_atom_t atoms[P_ATOM_MAX];
+	// X info, owned by the PWindowSystem
+	const xcb_atom_t *atoms;
 	xcb_connection_t *connection;
 	xcb_screen_t *screen;
 	xcb_window_t window;
@@ -60,23 +92,72 @@ struct PDisplayInfo {
 // the pattern (free)(x) comes up a few times in this code. It is only used to bypass the memory debugger macros
 // which will error because the data is malloc'd in a library call instead of in-code
 
+// names of the atoms in PAtomTypes, in the same order
+static const char *p_x11_atom_names[P_ATOM_MAX] = {
+	"UTF8_STRING",
+	"_NET_WM_NAME",
+	"_NET_WM_STATE",
+	"_NET_WM_STATE_FULLSCREEN",
+	"_NET_WM_DECORATION",
+	"_NET_WM_DECORATION_ALL",
+	"_NET_WM_WINDOW_TYPE",
+	"_NET_WM_WINDOW_TYPE_NORMAL",
+	"_NET_WM_WINDOW_TYPE_DIALOG",
+	"_NET_WM_WINDOW_TYPE_DOCK",
+	"_MOTIF_WM_HINTS",
+};
+
+// atoms shared by every connection, see _x11_atoms_intern
+static PLightMutex p_x11_atom_mutex = P_LIGHT_MUTEX_INIT;
+static bool p_x11_atoms_interned = false;
+static xcb_atom_t p_x11_atoms[P_ATOM_MAX];
+
 /**
- * p_x11_generate_atom
+ * _x11_atoms_intern
  *
- * generates an xcb atom and returns it.
- * Returns XCB_ATOM_NONE if atom cannot be found.
+ * interns every atom in PAtomTypes, sending all requests before waiting on any reply.
+ * atoms belong to the X server, so they are only interned once per process
+ * returns the interned atoms
  */
-static xcb_atom_t p_x11_generate_atom(xcb_connection_t *connection, const char *atom_name)
+static const xcb_atom_t *_x11_atoms_intern(xcb_connection_t *connection)
 {
-	xcb_intern_atom_cookie_t cookie = xcb_intern_atom(connection, 0, strlen(atom_name), atom_name);
-	xcb_intern_atom_reply_t *reply = xcb_intern_atom_reply(connection, cookie, NULL);
-	if (!reply) {
-		p_log_message(P_LOG_ERROR, L"Phantom", L"Could not get atom reply...");
-		exit(1);
+	p_light_mutex_lock(&p_x11_atom_mutex);
+	if (p_x11_atoms_interned)
+	{
+		p_light_mutex_unlock(&p_x11_atom_mutex);
+		return p_x11_atoms;
 	}
-	xcb_atom_t atom = reply->atom;
-	(free)(reply);
-	return atom;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	xcb_intern_atom_cookie_t cookies[P_ATOM_MAX];
+	for (uint i = 0; i < P_ATOM_MAX; i++)
+		cookies[i] = xcb_intern_atom(connection, 0, strlen(p_x11_atom_names[i]), p_x11_atom_names[i]);
+
+	for (uint i = 0; i < P_ATOM_MAX; i++)
+	{
+		xcb_intern_atom_reply_t *reply = xcb_intern_atom_reply(connection, cookies[i], NULL);
+		if (!reply) {
+			p_log_message(P_LOG_ERROR, L"Phantom", L"Could not get atom reply...");
+			exit(1);
+		}
+		p_x11_atoms[i] = reply->atom;
+		(free)(reply);
+		if (p_x11_atoms[i] == XCB_ATOM_NONE)
+		{
+			p_log_message(P_LOG_ERROR, L"Phantom", L"XCB atoms not initialized. Aborting...");
+			exit(1);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double intern_time_ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+	p_log_message(P_LOG_DEBUG, L"Phantom", L"Interned %u atoms in %.3f ms", P_ATOM_MAX, intern_time_ms);
+
+	p_x11_atoms_interned = true;
+	p_light_mutex_unlock(&p_x11_atom_mutex);
+	return p_x11_atoms;
 }
 
 /**
@@ -128,58 +209,90 @@ void p_x11_window_set_name(PDisplayInfo *display_info, const wchar_t *name)
 
 
 /**
- * p_x11_window_create
+ * p_x11_window_system_init
  *
- * creates a window with parameters set from window_request.
- * adds the window_data associated with the window to app_data.
+ * opens the X connection shared by every window of the app,
+ * interns the atoms and starts the event thread
  */
-void p_x11_window_create(PAppData *app_data, const PWindowRequest window_request)
+PWindowSystem *p_x11_window_system_init(PAppData *app_data)
 {
-	// Create an XCB connection and window
-	xcb_connection_t *connection = xcb_connect(NULL, NULL);
+	PWindowSystem *window_system = malloc(sizeof *window_system);
+	window_system->app_data = app_data;
+	window_system->connection = xcb_connect(NULL, NULL);
 
 	// Check if the connection was successful
-	if (xcb_connection_has_error(connection))
+	if (xcb_connection_has_error(window_system->connection))
 	{
 		p_log_message(P_LOG_ERROR, L"Phantom", L"Unable to open the connection to the X server");
 		exit(1);
 	}
+	window_system->screen = xcb_setup_roots_iterator(xcb_get_setup(window_system->connection)).data;
+
+	window_system->atoms = _x11_atoms_intern(window_system->connection);
+
+	// wait on the connection and on wake_fd
+	window_system->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	window_system->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (window_system->epoll_fd == -1 || window_system->wake_fd == -1)
+	{
+		p_log_message(P_LOG_ERROR, L"Phantom", L"Could not create the event poller. Error code: %i", errno);
+		exit(1);
+	}
+	struct epoll_event connection_event = {.events = EPOLLIN, .data.fd = xcb_get_file_descriptor(
+			window_system->connection)};
+	struct epoll_event wake_event = {.events = EPOLLIN, .data.fd = window_system->wake_fd};
+	epoll_ctl(window_system->epoll_fd, EPOLL_CTL_ADD, connection_event.data.fd, &connection_event);
+	epoll_ctl(window_system->epoll_fd, EPOLL_CTL_ADD, wake_event.data.fd, &wake_event);
+
+	atomic_init(&window_system->running, true);
+	window_system->event_manager = p_thread_create(_x11_event_manage, window_system);
+
+	return window_system;
+}
+
+/**
+ * p_x11_window_system_deinit
+ *
+ * stops the event thread and closes the X connection.
+ * every window must be closed beforehand
+ */
+void p_x11_window_system_deinit(PWindowSystem *window_system)
+{
+	atomic_store(&window_system->running, false);
+	uint64_t wake = 1;
+	if (write(window_system->wake_fd, &wake, sizeof wake) != sizeof wake)
+		p_log_message(P_LOG_WARNING, L"Phantom", L"Could not wake the event thread. Error code: %i", errno);
+	p_thread_join(window_system->event_manager);
+
+	close(window_system->wake_fd);
+	close(window_system->epoll_fd);
+	xcb_disconnect(window_system->connection);
+	free(window_system);
+}
 
-	xcb_screen_t *screen = xcb_setup_roots_iterator(xcb_get_setup(connection)).data;
+/**
+ * p_x11_window_create
+ *
+ * creates a window with parameters set from window_request.
+ * adds the window_data associated with the window to app_data.
+ */
+void p_x11_window_create(PAppData *app_data, const PWindowRequest window_request)
+{
+	PWindowSystem *window_system = app_data->window_system;
+	if (window_system == NULL)
+	{
+		p_log_message(P_LOG_ERROR, L"Phantom", L"Headless apps cannot create windows!");
+		return;
+	}
+	xcb_connection_t *connection = window_system->connection;
+	xcb_screen_t *screen = window_system->screen;
 	xcb_window_t window = xcb_generate_id(connection);
 
 	PDisplayInfo *display_info = malloc(sizeof *display_info);
 	display_info->connection = connection;
 	display_info->screen = screen;
 	display_info->window = window;
-	display_info->atoms[P_ATOM_UTF8_STRING] = p_x11_generate_atom(display_info->connection, "UTF8_STRING");
-	display_info->atoms[P_ATOM_NET_WM_NAME] = p_x11_generate_atom(display_info->connection, "_NET_WM_NAME");
-	display_info->atoms[P_ATOM_NET_WM_STATE] = p_x11_generate_atom(display_info->connection, "_NET_WM_STATE");
-	display_info->atoms[P_ATOM_NET_WM_STATE_FULLSCREEN] = p_x11_generate_atom(display_info->connection,
-			"_NET_WM_STATE_FULLSCREEN");
-	display_info->atoms[P_ATOM_NET_WM_DECORATION] = p_x11_generate_atom(display_info->connection,
-			"_NET_WM_DECORATION");
-	display_info->atoms[P_ATOM_NET_WM_DECORATION_ALL] = p_x11_generate_atom(display_info->connection,
-			"_NET_WM_DECORATION_ALL");
-	display_info->atoms[P_ATOM_NET_WM_WINDOW_TYPE] = p_x11_generate_atom(display_info->connection,
-			"_NET_WM_WINDOW_TYPE");
-	display_info->atoms[P_ATOM_NET_WM_WINDOW_TYPE_NORMAL] = p_x11_generate_atom(display_info->connection,
-			"_NET_WM_WINDOW_TYPE_NORMAL");
-	display_info->atoms[P_ATOM_NET_WM_WINDOW_TYPE_DIALOG] = p_x11_generate_atom(display_info->connection,
-			"_NET_WM_WINDOW_TYPE_DIALOG");
-	display_info->atoms[P_ATOM_NET_WM_WINDOW_TYPE_DOCK] = p_x11_generate_atom(display_info->connection,
-			"_NET_WM_WINDOW_TYPE_DOCK");
-	display_info->atoms[P_ATOM_MOTIF_WM_HINTS] = p_x11_generate_atom(display_info->connection,
-			"_MOTIF_WM_HINTS");
-
-	for (uint i = 0; i < P_ATOM_MAX; i++)
-	{
-		if (display_info->atoms[i] == XCB_ATOM_NONE)
-		{
-			p_log_message(P_LOG_ERROR, L"Phantom", L"XCB atoms not initialized. Aborting...");
-			exit(1);
-		}
-	}
+	display_info->atoms = window_system->atoms;
 
 	uint class = P_INTERACT_INPUT_OUTPUT;
 	uint border_width = 0;
@@ -197,6 +310,8 @@ void p_x11_window_create(PAppData *app_data, const PWindowRequest window_request
 	window_data->event_calls = calloc(1, sizeof *window_data->event_calls);
 	memcpy(window_data->event_calls, &window_request.event_calls, sizeof *window_data->event_calls);
 	window_data->status = P_WINDOW_STATUS_ALIVE;
+	window_data->event_manager = NULL; // events are handled by the window system's thread
+	window_data->graphical_display_data = NULL;
 
 
 	// Listen different events in the window
@@ -230,6 +345,11 @@ void p_x11_window_create(PAppData *app_data, const PWindowRequest window_request
 			XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK,
 			&value_list);
 
+	// register the window before it is mapped so the event thread can route its first events
+	p_light_mutex_lock(&app_data->window_mutex);
+	e_dynarr_add(app_data->window_data, &window_data);
+	p_light_mutex_unlock(&app_data->window_mutex);
+
 	p_window_set_name(display_info, window_data->name);
 
 	// Create a graphics context
@@ -265,22 +385,13 @@ void p_x11_window_create(PAppData *app_data, const PWindowRequest window_request
 	}
 
 	p_graphics_display_create(window_data, app_data->graphical_app_data, &window_request.graphical_display_request);
-
-	p_mutex_lock(app_data->window_mutex);
-	e_dynarr_add(app_data->window_data, &window_data);
-	p_mutex_unlock(app_data->window_mutex);
-
-	// Start the window event manager
-	PThreadArguments args = malloc(sizeof (PAppData *) + sizeof (PWindowData *));
-	memcpy(args, &app_data, sizeof (PAppData **));
-	memcpy(&((char *)args)[sizeof (PAppData **)], &window_data, sizeof (PWindowData **));
-	window_data->event_manager = p_thread_create(_x11_window_event_manage, args);
 }
 
 /**
  * p_x11_window_close
  *
- * sends a signal to close the window and the connection to the Xserver
+ * sends a signal to close the window.
+ * the window is freed by the event thread once the X server has destroyed it
  */
 void p_x11_window_close(PWindowData *window_data)
 {
@@ -293,180 +404,358 @@ void p_x11_window_close(PWindowData *window_data)
 /**
  * _x11_window_close
  *
- * internal close function that actually closes the window and frees data
+ * internal close function that frees the X resources of a destroyed window
  */
 void _x11_window_close(PWindowData *window_data)
 {
 	PDisplayInfo *display_info = window_data->display_info;
-	xcb_unmap_window(display_info->connection, display_info->window);
-	xcb_disconnect(display_info->connection);
-	p_thread_discard(window_data->event_manager);
+	xcb_free_pixmap(display_info->connection, display_info->pixmap);
+	xcb_free_gc(display_info->connection, display_info->graphics_context);
+	xcb_flush(display_info->connection);
 }
 
 /**
- * _x11_window_event_manage
+ * _x11_event_push
  *
- * This function runs in its own thread and manages window manager events
- * returns NULL
+ * queues an event without a payload for the app and runs the matching user callback
+ */
+static void _x11_event_push(PAppData *app_data, PWindowData *window_data, enum PEventType type,
+		void (*callback)(void))
+{
+	PEvent event = {.type = type, .window_data = window_data};
+	p_event_queue_push(app_data->event_queue, &event);
+	if (callback != NULL)
+		callback();
+}
+
+/**
+ * _x11_window_display_type_update
+ *
+ * reads the window state and type back from the X server and updates display_type to match.
+ * both requests are sent before waiting, so this costs a single round trip
  */
-PThreadResult _x11_window_event_manage(PThreadArguments args)
+static void _x11_window_display_type_update(PWindowData *window_data)
 {
-	// unpack args
-	PAppData *app_data = ((PAppData **)args)[0];
-	PWindowData *window_data = *(PWindowData **)&((char *)args)[sizeof (PAppData **)];
-	//PWindowData *window_data = ((PWindowData **)args)[1];
 	PDisplayInfo *display_info = window_data->display_info;
-	PEventCalls *event_calls = window_data->event_calls;
 
+	xcb_get_property_cookie_t property_cookie_state = xcb_get_property(display_info->connection, 0,
+			display_info->window, display_info->atoms[P_ATOM_NET_WM_STATE], XCB_ATOM_ANY, 0, 1024);
+	xcb_get_property_cookie_t property_cookie_type = xcb_get_property(display_info->connection, 0,
+			display_info->window, display_info->atoms[P_ATOM_NET_WM_WINDOW_TYPE], XCB_ATOM_ANY, 0, 1024);
+	xcb_get_property_reply_t *property_reply_state = xcb_get_property_reply(display_info->connection,
+			property_cookie_state, NULL);
+	xcb_get_property_reply_t *property_reply_type = xcb_get_property_reply(display_info->connection,
+			property_cookie_type, NULL);
 
-	while (window_data->status == P_WINDOW_STATUS_ALIVE) {
-		xcb_generic_event_t *event = xcb_wait_for_event(display_info->connection);
-		if (!event)
+	if (property_reply_state && property_reply_type)
+	{
+		xcb_atom_t *state_state = (xcb_atom_t *)xcb_get_property_value(property_reply_state);
+		xcb_atom_t *state_type = (xcb_atom_t *)xcb_get_property_value(property_reply_type);
+		int num_state_atoms = xcb_get_property_value_length(property_reply_state) / sizeof(xcb_atom_t);
+		int num_type_atoms = xcb_get_property_value_length(property_reply_type) / sizeof(xcb_atom_t);
+
+		// Check what atoms are present
+		bool is_fullscreen = false;
+		bool is_normal = false;
+		bool is_dock = false;
+		for (int i = 0; i < num_state_atoms; i++)
+			is_fullscreen |= (state_state[i] == display_info->atoms[P_ATOM_NET_WM_STATE_FULLSCREEN]);
+		for (int i = 0; i < num_type_atoms; i++)
 		{
-			p_log_message(P_LOG_WARNING, L"Phantom", L"Event was null...");
-			p_mutex_lock(app_data->window_mutex);
-			if (window_data->status == P_WINDOW_STATUS_ALIVE)
-				window_data->status = P_WINDOW_STATUS_CLOSE;
-			p_mutex_unlock(app_data->window_mutex);
-			_window_close(app_data, window_data);
-			break;
+			is_dock |= (state_type[i] == display_info->atoms[P_ATOM_NET_WM_WINDOW_TYPE_DOCK]);
+			is_normal |= (state_type[i] == display_info->atoms[P_ATOM_NET_WM_WINDOW_TYPE_NORMAL]);
 		}
-		switch (event->response_type & ~0x80)
+
+		if (is_fullscreen)
+			window_data->display_type = P_DISPLAY_FULLSCREEN;
+		else if (is_normal)
+			window_data->display_type = P_DISPLAY_WINDOWED;
+		else if (is_dock)
+			window_data->display_type = P_DISPLAY_DOCKED_FULLSCREEN;
+	}
+
+	(free)(property_reply_state);
+	(free)(property_reply_type);
+}
+
+/**
+ * _x11_window_event_handle
+ *
+ * handles an event that belongs to window_data
+ */
+static void _x11_window_event_handle(PAppData *app_data, PWindowData *window_data, xcb_generic_event_t *event)
+{
+	PDisplayInfo *display_info = window_data->display_info;
+	PEventCalls *event_calls = window_data->event_calls;
+
+	switch (event->response_type & ~0x80)
+	{
+		// TODO: experiment with capturing mouse and keyboard
+		case XCB_EXPOSE:
 		{
-			// TODO: experiment with capturing mouse and keyboard
-			case XCB_EXPOSE:
+			xcb_expose_event_t *expose_event = (xcb_expose_event_t *)event;
+			// TODO: redraw (only new part?)
+			if (event_calls->enable_expose)
 			{
-				xcb_expose_event_t *expose_event = (xcb_expose_event_t *)event;
-				E_UNUSED(expose_event);
-				// TODO: redraw (only new part?)
-				if (event_calls->enable_expose && event_calls->expose != NULL)
+				PEvent queued_event = {.type = P_EVENT_EXPOSE, .window_data = window_data};
+				queued_event.expose.x = expose_event->x;
+				queued_event.expose.y = expose_event->y;
+				queued_event.expose.width = expose_event->width;
+				queued_event.expose.height = expose_event->height;
+				queued_event.expose.count = expose_event->count;
+				p_event_queue_push(app_data->event_queue, &queued_event);
+				if (event_calls->expose != NULL)
 					event_calls->expose();
-				break;
 			}
-			case XCB_CONFIGURE_NOTIFY:
+			break;
+		}
+		case XCB_CONFIGURE_NOTIFY:
+		{
+			xcb_configure_notify_event_t *config_notify_event = (xcb_configure_notify_event_t *)event;
+			window_data->x = config_notify_event->x;
+			window_data->y = config_notify_event->y;
+			window_data->width = config_notify_event->width;
+			window_data->height = config_notify_event->height;
+			if (event_calls->enable_configure)
 			{
-				xcb_configure_notify_event_t *config_notify_event = (xcb_configure_notify_event_t *)event;
-				window_data->x = config_notify_event->x;
-				window_data->y = config_notify_event->y;
-				window_data->width = config_notify_event->width;
-				window_data->height = config_notify_event->height;
-				if (event_calls->enable_configure && event_calls->configure != NULL)
+				PEvent queued_event = {.type = P_EVENT_CONFIGURE, .window_data = window_data};
+				queued_event.configure.x = config_notify_event->x;
+				queued_event.configure.y = config_notify_event->y;
+				queued_event.configure.width = config_notify_event->width;
+				queued_event.configure.height = config_notify_event->height;
+				p_event_queue_push(app_data->event_queue, &queued_event);
+				if (event_calls->configure != NULL)
 					event_calls->configure();
-				break;
 			}
-			case XCB_PROPERTY_NOTIFY:
-			{
-				xcb_property_notify_event_t *property_notify_event = (xcb_property_notify_event_t *)event;
-				E_UNUSED(property_notify_event);
+			break;
+		}
+		case XCB_PROPERTY_NOTIFY:
+		{
+			xcb_property_notify_event_t *property_notify_event = (xcb_property_notify_event_t *)event;
 
-				xcb_get_property_cookie_t property_cookie_state = xcb_get_property(display_info->connection, 0,
-						display_info->window, display_info->atoms[P_ATOM_NET_WM_STATE], XCB_ATOM_ANY, 0, 1024);
-				xcb_get_property_reply_t *property_reply_state = xcb_get_property_reply(display_info->connection,
-						property_cookie_state, NULL);
+			// only the window state and type change display_type, skip the round trip for anything else
+			if (property_notify_event->atom == display_info->atoms[P_ATOM_NET_WM_STATE] ||
+					property_notify_event->atom == display_info->atoms[P_ATOM_NET_WM_WINDOW_TYPE])
+				_x11_window_display_type_update(window_data);
 
-				xcb_get_property_cookie_t property_cookie_type = xcb_get_property(display_info->connection, 0,
-						display_info->window, display_info->atoms[P_ATOM_NET_WM_WINDOW_TYPE], XCB_ATOM_ANY, 0,
-						1024);
-				xcb_get_property_reply_t *property_reply_type = xcb_get_property_reply(display_info->connection,
-						property_cookie_type, NULL);
+			if (event_calls->enable_property)
+				_x11_event_push(app_data, window_data, P_EVENT_PROPERTY, event_calls->property);
+			break;
+		}
+		case XCB_CLIENT_MESSAGE:
+		{
+			xcb_client_message_event_t *message_event = (xcb_client_message_event_t *)event;
+			E_UNUSED(message_event);
+			if (event_calls->enable_client)
+				_x11_event_push(app_data, window_data, P_EVENT_CLIENT, event_calls->client);
+			break;
+		}
+		case XCB_FOCUS_IN:
+		{
+			xcb_focus_in_event_t *focus_in_event = (xcb_focus_in_event_t *)event;
+			E_UNUSED(focus_in_event);
+			if (event_calls->enable_focus_in)
+				_x11_event_push(app_data, window_data, P_EVENT_FOCUS_IN, event_calls->focus_in);
+			break;
+		}
+		case XCB_FOCUS_OUT:
+		{
+			xcb_focus_out_event_t *focus_out_event = (xcb_focus_out_event_t *)event;
+			E_UNUSED(focus_out_event);
+			if (event_calls->enable_focus_out)
+				_x11_event_push(app_data, window_data, P_EVENT_FOCUS_OUT, event_calls->focus_out);
+			break;
+		}
+		case XCB_ENTER_NOTIFY:
+		{
+			xcb_enter_notify_event_t *enter_notify_event = (xcb_enter_notify_event_t *)event;
+			E_UNUSED(enter_notify_event);
+			if (event_calls->enable_enter)
+				_x11_event_push(app_data, window_data, P_EVENT_ENTER, event_calls->enter);
+			break;
+		}
+		case XCB_LEAVE_NOTIFY:
+		{
+			xcb_leave_notify_event_t *leave_notify_event = (xcb_leave_notify_event_t *)event;
+			E_UNUSED(leave_notify_event);
+			if (event_calls->enable_leave)
+				_x11_event_push(app_data, window_data, P_EVENT_LEAVE, event_calls->leave);
+			break;
+		}
+		case XCB_DESTROY_NOTIFY:
+		{
+			xcb_destroy_notify_event_t *destroy_notify_event = (xcb_destroy_notify_event_t *)event;
+			E_UNUSED(destroy_notify_event);
 
-				if (property_reply_state && property_reply_type)
-				{
-					xcb_atom_t *state_state = (xcb_atom_t *)xcb_get_property_value(property_reply_state);
-					xcb_atom_t *state_type = (xcb_atom_t *)xcb_get_property_value(property_reply_type);
-					int num_state_atoms = xcb_get_property_value_length(property_reply_state) / sizeof(xcb_atom_t);
-					int num_type_atoms = xcb_get_property_value_length(property_reply_type) / sizeof(xcb_atom_t);
-
-					// Check what atoms are present
-					bool is_fullscreen = false;
-					bool is_normal = false;
-					bool is_dock = false;
-					for (int i = 0; i < num_state_atoms; i++)
-						is_fullscreen |= (state_state[i] == display_info->atoms[P_ATOM_NET_WM_STATE_FULLSCREEN]);
-					for (int i = 0; i < num_type_atoms; i++)
-					{
-						is_dock |= (state_type[i] == display_info->atoms[P_ATOM_NET_WM_WINDOW_TYPE_DOCK]);
-						is_normal |= (state_type[i] == display_info->atoms[P_ATOM_NET_WM_WINDOW_TYPE_NORMAL]);
-					}
+			// the P_EVENT_DESTROY itself is made by p_app_poll_events, so it can never be dropped
+			if (event_calls->enable_destroy && event_calls->destroy != NULL)
+				event_calls->destroy();
+			_window_destroyed(app_data, window_data);
 
-					(free)(property_reply_state);
-					(free)(property_reply_type);
+			break;
+		}
+	}
+}
 
-					if (is_fullscreen)
-						window_data->display_type = P_DISPLAY_FULLSCREEN;
-					else if (is_normal)
-						window_data->display_type = P_DISPLAY_WINDOWED;
-					else if (is_dock)
-						window_data->display_type = P_DISPLAY_DOCKED_FULLSCREEN;
-				}
+/**
+ * _x11_event_window
+ *
+ * returns the window an event is meant for, or XCB_WINDOW_NONE if it is not handled
+ */
+static xcb_window_t _x11_event_window(const xcb_generic_event_t *event)
+{
+	switch (event->response_type & ~0x80)
+	{
+		case XCB_EXPOSE:
+			return ((const xcb_expose_event_t *)event)->window;
+		case XCB_CONFIGURE_NOTIFY:
+			return ((const xcb_configure_notify_event_t *)event)->window;
+		case XCB_PROPERTY_NOTIFY:
+			return ((const xcb_property_notify_event_t *)event)->window;
+		case XCB_CLIENT_MESSAGE:
+			return ((const xcb_client_message_event_t *)event)->window;
+		case XCB_FOCUS_IN:
+			return ((const xcb_focus_in_event_t *)event)->event;
+		case XCB_FOCUS_OUT:
+			return ((const xcb_focus_out_event_t *)event)->event;
+		case XCB_ENTER_NOTIFY:
+			return ((const xcb_enter_notify_event_t *)event)->event;
+		case XCB_LEAVE_NOTIFY:
+			return ((const xcb_leave_notify_event_t *)event)->event;
+		case XCB_DESTROY_NOTIFY:
+			return ((const xcb_destroy_notify_event_t *)event)->window;
+		default:
+			return XCB_WINDOW_NONE;
+	}
+}
 
-				if (event_calls->enable_property && event_calls->property != NULL)
-					event_calls->property();
-				break;
-			}
-			case XCB_CLIENT_MESSAGE:
-			{
-				xcb_client_message_event_t *message_event = (xcb_client_message_event_t *)event;
-				E_UNUSED(message_event);
-				if (event_calls->enable_client && event_calls->client != NULL)
-					event_calls->client();
-				break;
-			}
-			case XCB_FOCUS_IN:
-			{
-				xcb_focus_in_event_t *focus_in_event = (xcb_focus_in_event_t *)event;
-				E_UNUSED(focus_in_event);
-				if (event_calls->enable_focus_in && event_calls->focus_in != NULL)
-					event_calls->focus_in();
-				break;
-			}
-			case XCB_FOCUS_OUT:
-			{
-				xcb_focus_out_event_t *focus_out_event = (xcb_focus_out_event_t *)event;
-				E_UNUSED(focus_out_event);
-				if (event_calls->enable_focus_out && event_calls->focus_out != NULL)
-					event_calls->focus_out();
-				break;
-			}
-			case XCB_ENTER_NOTIFY:
+/**
+ * _x11_event_superseded
+ *
+ * returns true if events[index] is a configure notify that a later one in the batch overrides.
+ * interactive resizes send bursts of these, only the final size needs handling
+ */
+static bool _x11_event_superseded(xcb_generic_event_t **events, uint num_events, uint index)
+{
+	if ((events[index]->response_type & ~0x80) != XCB_CONFIGURE_NOTIFY)
+		return false;
+
+	xcb_window_t window = ((xcb_configure_notify_event_t *)events[index])->window;
+	for (uint i = index + 1; i < num_events; i++)
+	{
+		if ((events[i]->response_type & ~0x80) == XCB_CONFIGURE_NOTIFY &&
+				((xcb_configure_notify_event_t *)events[i])->window == window)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * _x11_window_find
+ *
+ * returns the window_data of window, or NULL if it does not belong to the app
+ */
+static PWindowData *_x11_window_find(PAppData *app_data, xcb_window_t window)
+{
+	PWindowData *found = NULL;
+	p_light_mutex_lock(&app_data->window_mutex);
+	for (uint i = 0; i < app_data->window_data->num_items; i++)
+	{
+		PWindowData *window_data = E_DYNARR_GET(app_data->window_data, PWindowData *, i);
+		if (window_data->display_info->window == window)
+		{
+			found = window_data;
+			break;
+		}
+	}
+	p_light_mutex_unlock(&app_data->window_mutex);
+	return found;
+}
+
+/**
+ * _x11_event_manage
+ *
+ * This function runs in its own thread and dispatches the events of every window to their window_data.
+ * windows are only handed over to be freed by this thread, so window_data stays valid while its event is handled
+ * returns NULL
+ */
+static PThreadResult _x11_event_manage(PThreadArguments args)
+{
+	PWindowSystem *window_system = args;
+	PAppData *app_data = window_system->app_data;
+	p_thread_set_name("p_x11_events");
+
+	// runs of events mostly target one window, whose window_data only this thread can free
+	xcb_window_t last_window = XCB_WINDOW_NONE;
+	PWindowData *last_window_data = NULL;
+
+	while (atomic_load(&window_system->running))
+	{
+		// drain everything that is pending, in batches, including events handling a batch pulled in
+		xcb_generic_event_t *events[P_X11_EVENT_BATCH_SIZE];
+		uint num_events;
+		do {
+			num_events = 0;
+			while (num_events < P_X11_EVENT_BATCH_SIZE &&
+					(events[num_events] = xcb_poll_for_event(window_system->connection)) != NULL)
+				num_events++;
+
+			for (uint i = 0; i < num_events; i++)
 			{
-				xcb_enter_notify_event_t *enter_notify_event = (xcb_enter_notify_event_t *)event;
-				E_UNUSED(enter_notify_event);
-				if (event_calls->enable_enter && event_calls->enter != NULL)
-					event_calls->enter();
-				break;
+				xcb_window_t window = _x11_event_window(events[i]);
+				if (window != XCB_WINDOW_NONE && !_x11_event_superseded(events, num_events, i))
+				{
+					if (window != last_window)
+					{
+						last_window_data = _x11_window_find(app_data, window);
+						last_window = last_window_data != NULL ? window : XCB_WINDOW_NONE;
+					}
+					if (last_window_data != NULL)
+					{
+						_x11_window_event_handle(app_data, last_window_data, events[i]);
+						if ((events[i]->response_type & ~0x80) == XCB_DESTROY_NOTIFY)
+						{
+							last_window = XCB_WINDOW_NONE;
+							last_window_data = NULL;
+						}
+					}
+				}
+				(free)(events[i]);
 			}
-			case XCB_LEAVE_NOTIFY:
+		} while (num_events > 0);
+
+		if (xcb_connection_has_error(window_system->connection))
+		{
+			p_log_message(P_LOG_ERROR, L"Phantom", L"Lost the connection to the X server");
+			// nothing more will arrive for the windows, so hand them all over to be freed
+			p_light_mutex_lock(&app_data->window_mutex);
+			while (app_data->window_data->num_items > 0)
 			{
-				xcb_leave_notify_event_t *leave_notify_event = (xcb_leave_notify_event_t *)event;
-				E_UNUSED(leave_notify_event);
-				if (event_calls->enable_leave && event_calls->leave != NULL)
-					event_calls->leave();
-				break;
+				PWindowData *window_data = E_DYNARR_GET(app_data->window_data, PWindowData *, 0);
+				p_light_mutex_unlock(&app_data->window_mutex);
+				_window_destroyed(app_data, window_data);
+				p_light_mutex_lock(&app_data->window_mutex);
 			}
-			case XCB_DESTROY_NOTIFY:
-			{
-				xcb_destroy_notify_event_t *destroy_notify_event = (xcb_destroy_notify_event_t *)event;
-				E_UNUSED(destroy_notify_event);
-
-				if (event_calls->enable_destroy && event_calls->destroy != NULL)
-					event_calls->destroy();
-
-				p_mutex_lock(app_data->window_mutex);
-				if (window_data->status == P_WINDOW_STATUS_ALIVE)
-					window_data->status = P_WINDOW_STATUS_CLOSE;
-				p_mutex_unlock(app_data->window_mutex);
-				_window_close(app_data, window_data);
+			p_light_mutex_unlock(&app_data->window_mutex);
+			break;
+		}
 
-				break;
+		struct epoll_event epoll_events[2];
+		int num_epoll_events = epoll_wait(window_system->epoll_fd, epoll_events, 2, P_X11_EVENT_TIMEOUT_MS);
+		for (int i = 0; i < num_epoll_events; i++)
+		{
+			if (epoll_events[i].data.fd == window_system->wake_fd)
+			{
+				uint64_t wake;
+				while (read(window_system->wake_fd, &wake, sizeof wake) > 0);
 			}
 		}
-		(free)(event);
 	}
-	free(args);
+	p_arena_scratch_deinit();
 	return NULL;
 }
 
+
 /**
  * p_x11_window_fullscreen
  *
@@ -0,0 +1,211 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "platinum.h"
+
+// Size of the first block of an arena when none is given
+#define P_ARENA_BLOCK_SIZE (64 * 1024)
+
+// Growing arenas double the size of every new block up to this
+#define P_ARENA_BLOCK_MAX (16 * 1024 * 1024)
+
+// Every allocation is aligned for any type
+#define P_ARENA_ALIGN(size) (((size) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
+/**
+ * PArenaBlock
+ *
+ * A chunk of memory bumped through by an arena, its bytes follow the header
+ */
+struct PArenaBlock {
+	PArenaBlock *next; // blocks after this one, kept for reuse once the arena is reset past them
+	size_t size; // usable bytes after the header
+};
+
+/**
+ * PArena
+ *
+ * A chain of blocks allocated from in order, freed all at once
+ */
+struct PArena {
+	PArenaBlock *first;
+	PArenaBlock *block; // block allocated from, NULL before the first allocation
+	size_t used; // bytes used in block
+	size_t block_size; // size of the next block to make
+	bool grow;
+};
+
+static _Thread_local PArena *p_arena_thread_scratch = NULL;
+
+/**
+ * _arena_block_create
+ *
+ * returns a new block with room for size bytes, NULL if it could not be allocated
+ */
+static PArenaBlock *_arena_block_create(size_t size)
+{
+	if (size > SIZE_MAX - P_ARENA_ALIGN(sizeof (PArenaBlock)))
+		return NULL;
+	PArenaBlock *block = malloc(P_ARENA_ALIGN(sizeof (PArenaBlock)) + size);
+	if (block == NULL)
+		return NULL;
+	block->next = NULL;
+	block->size = size;
+	return block;
+}
+
+/**
+ * p_arena_init
+ *
+ * creates an arena whose first block holds block_size bytes, 0 for 64 KiB
+ * a growing arena chains on larger blocks when full, a fixed one makes its only block now
+ */
+PArena *p_arena_init(size_t block_size, bool grow)
+{
+	PArena *arena = calloc(1, sizeof *arena);
+	arena->block_size = block_size == 0 ? P_ARENA_BLOCK_SIZE : P_ARENA_ALIGN(block_size);
+	arena->grow = grow;
+	if (!grow)
+	{
+		arena->first = _arena_block_create(arena->block_size);
+		if (arena->first == NULL)
+		{
+			p_log_message(P_LOG_ERROR, L"Memory", L"Could not allocate an arena of %zu bytes", arena->block_size);
+			exit(1);
+		}
+	}
+	return arena;
+}
+
+/**
+ * p_arena_deinit
+ *
+ * frees the arena along with everything allocated from it
+ */
+void p_arena_deinit(PArena *arena)
+{
+	PArenaBlock *block = arena->first;
+	while (block != NULL)
+	{
+		PArenaBlock *next = block->next;
+		free(block);
+		block = next;
+	}
+	free(arena);
+}
+
+/**
+ * p_arena_alloc
+ *
+ * returns size bytes from arena, aligned for any type
+ * returns NULL if a fixed arena is full, or a growing one could not get a new block
+ */
+void *p_arena_alloc(PArena *arena, size_t size)
+{
+	if (size > SIZE_MAX / 2)
+		return NULL;
+	size = P_ARENA_ALIGN(size);
+	if (arena->block == NULL || arena->block->size - arena->used < size)
+	{
+		// blocks past the current one are left from before a reset and are reused in order
+		PArenaBlock *next = arena->block == NULL ? arena->first : arena->block->next;
+		if (next == NULL || next->size < size)
+		{
+			if (!arena->grow)
+			{
+				p_log_message(P_LOG_ERROR, L"Memory", L"Fixed arena of %zu bytes is full", arena->block_size);
+				return NULL;
+			}
+			PArenaBlock *block = _arena_block_create(E_MAX(arena->block_size, size));
+			if (block == NULL)
+				return NULL;
+			arena->block_size = E_MIN(arena->block_size * 2, E_MAX(arena->block_size, P_ARENA_BLOCK_MAX));
+			block->next = next;
+			if (arena->block == NULL)
+				arena->first = block;
+			else
+				arena->block->next = block;
+			next = block;
+		}
+		arena->block = next;
+		arena->used = 0;
+	}
+	void *pointer = (uint8_t *)arena->block + P_ARENA_ALIGN(sizeof (PArenaBlock)) + arena->used;
+	arena->used += size;
+	return pointer;
+}
+
+/**
+ * p_arena_calloc
+ *
+ * returns nmemb * size zeroed bytes from arena, NULL under the same conditions as p_arena_alloc
+ */
+void *p_arena_calloc(PArena *arena, size_t nmemb, size_t size)
+{
+	if (size != 0 && nmemb > SIZE_MAX / size)
+		return NULL;
+	void *pointer = p_arena_alloc(arena, nmemb * size);
+	if (pointer != NULL)
+		memset(pointer, 0, nmemb * size);
+	return pointer;
+}
+
+/**
+ * p_arena_mark
+ *
+ * returns the current position of arena, for use with p_arena_reset
+ */
+PArenaMark p_arena_mark(const PArena *arena)
+{
+	return (PArenaMark){arena->block, arena->used};
+}
+
+/**
+ * p_arena_reset
+ *
+ * releases everything allocated from arena after mark was taken
+ * blocks are kept for later allocations, marks taken after mark are no longer valid
+ */
+void p_arena_reset(PArena *arena, PArenaMark mark)
+{
+	arena->block = mark.block;
+	arena->used = mark.used;
+}
+
+/**
+ * p_arena_clear
+ *
+ * releases everything allocated from arena, keeping its blocks
+ */
+void p_arena_clear(PArena *arena)
+{
+	arena->block = NULL;
+	arena->used = 0;
+}
+
+/**
+ * p_arena_scratch
+ *
+ * returns the growing arena of the calling thread, made on first use
+ * callers take a mark first and reset to it before returning, so nested callers share it safely
+ */
+PArena *p_arena_scratch(void)
+{
+	if (p_arena_thread_scratch == NULL)
+		p_arena_thread_scratch = p_arena_init(0, true);
+	return p_arena_thread_scratch;
+}
+
+/**
+ * p_arena_scratch_deinit
+ *
+ * frees the scratch arena of the calling thread, if it made one
+ */
+void p_arena_scratch_deinit(void)
+{
+	if (p_arena_thread_scratch == NULL)
+		return;
+	p_arena_deinit(p_arena_thread_scratch);
+	p_arena_thread_scratch = NULL;
+}
@@ -1,305 +1,718 @@
+#include <limits.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include "platinum.h"
 
+#ifdef PLATINUM_PLATFORM_WINDOWS
+#include <windows.h>
+#elif defined PLATINUM_PLATFORM_LINUX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif // PLATINUM_PLATFORM
+
 extern void p_debug_mem_print(uint min_allocs);
 
 #define P_MEM_OVER_ALLOC 32
 #define P_MEM_MAGIC_NUMBER 132
 
+// Marks the header of an allocation made by the memory debugger, and of one already freed
+#define P_MEM_HEADER_MAGIC 0x6d656d21u
+#define P_MEM_HEADER_FREED 0x66726565u
+
+// First number of slots of the tables below, they double whenever they get half full
+#define P_MEM_TABLE_SIZE 1024
+
 typedef struct{
+	void *buf; // NULL if the slot is empty
 	uint size;
-	void *buf;
+	uint over_alloc; // magic bytes after buf, fewer than P_MEM_OVER_ALLOC when a guard page follows them
+	uint line; // index into lines of the thread
 }STMemAllocBuf;
 
 typedef struct{
 	uint line;
 	char file[256];
-	STMemAllocBuf *allocs;
-	uint alloc_count;
-	uint alloc_alocated;
+	uint32_t hash;
+	uint alloc_count; // allocations not freed yet
 	uint size;
 	uint alocated;
 	uint freed;
 }STMemAllocLine;
 
-STMemAllocLine p_alloc_lines[1024];
-uint p_alloc_line_count = 0;
-void *p_alloc_mutex = NULL;
-void (*p_alloc_mutex_lock)(PMutex mutex) = NULL;
-void (*p_alloc_mutex_unlock)(PMutex mutex) = NULL;
+typedef union STMemAllocHeader STMemAllocHeader;
+
+/**
+ * STMemThread
+ *
+ * The allocations made by one thread, only that thread adds to or removes from its tables
+ * Other threads hand their frees of its allocations over through the lock free returned stack
+ * Kept after the thread exits, its allocations may still be freed
+ */
+typedef struct STMemThread{
+	PLightMutex mutex; // held by the thread while it changes its tables, contended only by the merging functions
+
+	// Allocation sites, open addressing on file and line, each slot is an index into lines + 1, 0 if empty
+	STMemAllocLine *lines;
+	uint line_count;
+	uint line_alocated;
+	uint *line_slots;
+	uint line_mask;
+
+	// Open addressing on the pointer of every allocation not freed yet
+	STMemAllocBuf *bufs;
+	uint buf_count;
+	uint buf_mask;
+
+	_Atomic(STMemAllocHeader *) returned; // allocations freed by other threads, removed and freed by this one
+	struct STMemThread *next;
+}STMemThread;
+
+/**
+ * STMemAllocHeader
+ *
+ * Put in front of every allocation, keeps the memory after it aligned for any type
+ */
+union STMemAllocHeader{
+	struct{
+		STMemThread *owner; // thread whose tables hold the allocation
+		STMemAllocHeader *next; // in the returned stack of owner once freed by another thread
+		size_t size;
+		uint32_t magic; // P_MEM_HEADER_MAGIC while allocated
+		bool guarded; // mapped on its own pages by _debug_mem_guard_alloc
+	}info;
+	max_align_t align;
+};
+
+PLightMutex *p_alloc_mutex = NULL; // serializes the functions that merge every thread's tables
+static _Atomic(STMemThread *) p_alloc_threads = NULL; // every thread that allocated, pushed without a lock
+static _Thread_local STMemThread *p_alloc_thread = NULL;
+
+// Guard page mode, see p_debug_memory_guard
+static atomic_bool p_alloc_guard = false;
+static size_t p_alloc_page_size = 0;
+
+typedef struct{
+	void *pages;
+	size_t size;
+}STMemQuarantine;
+
+// Freed guarded allocations left inaccessible, oldest first, released once they hold over p_alloc_quarantine_limit bytes
+static PLightMutex p_alloc_quarantine_mutex;
+static STMemQuarantine *p_alloc_quarantine = NULL;
+static uint p_alloc_quarantine_first = 0;
+static uint p_alloc_quarantine_count = 0;
+static uint p_alloc_quarantine_alocated = 0;
+static size_t p_alloc_quarantine_bytes = 0;
+static size_t p_alloc_quarantine_limit = 0;
 
 
-void p_debug_memory_init(PMutex *mutex)
+void p_debug_memory_init(PLightMutex *mutex)
 {
 #ifdef PLATINUM_DEBUG_MEMORY
 	p_alloc_mutex = mutex;
-	p_alloc_mutex_lock = p_mutex_lock;
-	p_alloc_mutex_unlock = p_mutex_unlock;
 #else
 	E_UNUSED(mutex);
 #endif
 }
 
-bool p_debug_memory(void)
+void p_debug_memory_guard(bool guard, size_t quarantine_bytes)
 {
-	bool output = false;
 #ifdef PLATINUM_DEBUG_MEMORY
-	uint i, j, k;
-	if (p_alloc_mutex != NULL)
-		p_alloc_mutex_lock(p_alloc_mutex);
-	for (i = 0; i < p_alloc_line_count; i++)
+	p_light_mutex_lock(&p_alloc_quarantine_mutex);
+	p_alloc_quarantine_limit = quarantine_bytes;
+	p_light_mutex_unlock(&p_alloc_quarantine_mutex);
+	atomic_store(&p_alloc_guard, guard);
+#else
+	E_UNUSED(guard);
+	E_UNUSED(quarantine_bytes);
+#endif
+}
+
+/**
+ * _debug_mem_crash
+ *
+ * writes to NULL so a debugger stops where memory was misused
+ */
+static void _debug_mem_crash(void)
+{
+	uint *X = NULL;
+	X[0] = 0;
+}
+
+/**
+ * _debug_mem_line_hash
+ *
+ * FNV-1a hash of line and the part of file that is stored
+ */
+static uint32_t _debug_mem_line_hash(const char *file, uint line)
+{
+	uint32_t hash = 2166136261u ^ line;
+	uint i;
+	for (i = 0; i < 255 && file[i] != 0; i++)
 	{
-		for (j = 0; j < p_alloc_lines[i].alloc_count; j++)
-		{
-			uint8_t *buf;
-			uint size;
-			buf = p_alloc_lines[i].allocs[j].buf;
-			size = p_alloc_lines[i].allocs[j].size;
-			for (k = 0; k < P_MEM_OVER_ALLOC; k++)
-				if (buf[size + k] != P_MEM_MAGIC_NUMBER)
-					break;
-			if (k < P_MEM_OVER_ALLOC)
-			{
-				p_log_message(P_LOG_ERROR, L"Memory", L"Overshoot at line %u in file %s\n", p_alloc_lines[i].line,
-						p_alloc_lines[i].file);
-				{
-					uint *X = NULL;
-					X[0] = 0;
-				}
-				output = true;
-			}
-		}
+		hash ^= (uint8_t)file[i];
+		hash *= 16777619u;
 	}
-	if (p_alloc_mutex != NULL)
-		p_alloc_mutex_unlock(p_alloc_mutex);
-#endif
-	return output;
+	return hash;
 }
 
-void p_debug_mem_add(void *pointer, uint size, char *file, uint line)
+/**
+ * _debug_mem_line_slots_grow
+ *
+ * doubles the number of slots of the allocation site table of thread, creating it on first use
+ */
+static void _debug_mem_line_slots_grow(STMemThread *thread)
 {
 	uint i, j;
-	for (i = 0; i < P_MEM_OVER_ALLOC; i++)
+	uint slot_count = thread->line_slots == NULL ? P_MEM_TABLE_SIZE : (thread->line_mask + 1) * 2;
+	(free)(thread->line_slots);
+	thread->line_slots = (calloc)(slot_count, sizeof *thread->line_slots);
+	thread->line_mask = slot_count - 1;
+	for (i = 0; i < thread->line_count; i++)
+	{
+		for (j = thread->lines[i].hash & thread->line_mask; thread->line_slots[j] != 0; j = (j + 1) & thread->line_mask);
+		thread->line_slots[j] = i + 1;
+	}
+}
+
+/**
+ * _debug_mem_line_get
+ *
+ * returns the index of the allocation site file and line in thread, adding it if it is new
+ */
+static uint _debug_mem_line_get(STMemThread *thread, const char *file, uint line)
+{
+	uint32_t hash = _debug_mem_line_hash(file, line);
+	uint i, j;
+	if (thread->line_slots == NULL)
+		_debug_mem_line_slots_grow(thread);
+	for (i = hash & thread->line_mask; thread->line_slots[i] != 0; i = (i + 1) & thread->line_mask)
+	{
+		STMemAllocLine *alloc_line = &thread->lines[thread->line_slots[i] - 1];
+		if (alloc_line->hash == hash && alloc_line->line == line && strncmp(alloc_line->file, file, 255) == 0)
+			return thread->line_slots[i] - 1;
+	}
+
+	if (thread->line_count == thread->line_alocated)
+	{
+		thread->line_alocated = thread->line_alocated == 0 ? 256 : thread->line_alocated * 2;
+		thread->lines = (realloc)(thread->lines, (sizeof *thread->lines) * thread->line_alocated);
+	}
+	if ((thread->line_count + 1) * 2 > thread->line_mask + 1)
+	{
+		_debug_mem_line_slots_grow(thread);
+		for (i = hash & thread->line_mask; thread->line_slots[i] != 0; i = (i + 1) & thread->line_mask);
+	}
+	thread->line_slots[i] = thread->line_count + 1;
+
+	STMemAllocLine *alloc_line = &thread->lines[thread->line_count];
+	memset(alloc_line, 0, sizeof *alloc_line);
+	alloc_line->line = line;
+	for (j = 0; j < 255 && file[j] != 0; j++)
+		alloc_line->file[j] = file[j];
+	alloc_line->file[j] = 0;
+	alloc_line->hash = hash;
+	return thread->line_count++;
+}
+
+/**
+ * _debug_mem_pointer_hash
+ *
+ * mixes the bits of pointer, the low ones are always the same because of alignment
+ */
+static uint32_t _debug_mem_pointer_hash(const void *pointer)
+{
+	uint64_t key = (uintptr_t)pointer;
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdull;
+	key ^= key >> 33;
+	return (uint32_t)key;
+}
+
+/**
+ * _debug_mem_buf_slots_grow
+ *
+ * doubles the number of slots of the allocation table of thread, creating it on first use
+ */
+static void _debug_mem_buf_slots_grow(STMemThread *thread)
+{
+	STMemAllocBuf *old_bufs = thread->bufs;
+	uint old_slot_count = old_bufs == NULL ? 0 : thread->buf_mask + 1;
+	uint slot_count = old_bufs == NULL ? P_MEM_TABLE_SIZE : old_slot_count * 2;
+	uint i, j;
+	thread->bufs = (calloc)(slot_count, sizeof *thread->bufs);
+	thread->buf_mask = slot_count - 1;
+	for (i = 0; i < old_slot_count; i++)
+	{
+		if (old_bufs[i].buf == NULL)
+			continue;
+		for (j = _debug_mem_pointer_hash(old_bufs[i].buf) & thread->buf_mask; thread->bufs[j].buf != NULL;
+				j = (j + 1) & thread->buf_mask);
+		thread->bufs[j] = old_bufs[i];
+	}
+	(free)(old_bufs);
+}
+
+/**
+ * _debug_mem_buf_find
+ *
+ * returns the slot of the allocation at pointer in thread, or UINT_MAX if it is not one of its live allocations
+ */
+static uint _debug_mem_buf_find(const STMemThread *thread, const void *pointer)
+{
+	uint i;
+	if (thread->bufs == NULL)
+		return UINT_MAX;
+	for (i = _debug_mem_pointer_hash(pointer) & thread->buf_mask; thread->bufs[i].buf != NULL;
+			i = (i + 1) & thread->buf_mask)
+	{
+		if (thread->bufs[i].buf == pointer)
+			return i;
+	}
+	return UINT_MAX;
+}
+
+/**
+ * _debug_mem_add
+ *
+ * writes the overshoot guard after pointer and adds it to the tables of thread, thread->mutex must be held
+ */
+static void _debug_mem_add(STMemThread *thread, void *pointer, uint size, uint over_alloc, const char *file,
+		uint line)
+{
+	uint i;
+	for (i = 0; i < over_alloc; i++)
 		((uint8_t *)pointer)[size + i] = P_MEM_MAGIC_NUMBER;
 
-	for (i = 0; i < p_alloc_line_count; i++)
+	if (thread->bufs == NULL || (thread->buf_count + 1) * 2 > thread->buf_mask + 1)
+		_debug_mem_buf_slots_grow(thread);
+	for (i = _debug_mem_pointer_hash(pointer) & thread->buf_mask; thread->bufs[i].buf != NULL;
+			i = (i + 1) & thread->buf_mask);
+	thread->bufs[i].buf = pointer;
+	thread->bufs[i].size = size;
+	thread->bufs[i].over_alloc = over_alloc;
+	thread->bufs[i].line = _debug_mem_line_get(thread, file, line);
+	thread->buf_count++;
+
+	STMemAllocLine *alloc_line = &thread->lines[thread->bufs[i].line];
+	alloc_line->alloc_count++;
+	alloc_line->size += size;
+	alloc_line->alocated++;
+}
+
+/**
+ * _debug_mem_remove
+ *
+ * checks the overshoot guard of buf and takes it out of the tables of thread, thread->mutex must be held
+ * returns false if buf is not a live allocation of thread
+ */
+static bool _debug_mem_remove(STMemThread *thread, void *buf)
+{
+	uint i, j, k;
+	i = _debug_mem_buf_find(thread, buf);
+	if (i == UINT_MAX)
+		return false;
+
+	STMemAllocLine *alloc_line = &thread->lines[thread->bufs[i].line];
+	for (k = 0; k < thread->bufs[i].over_alloc; k++)
+		if (((uint8_t *)buf)[thread->bufs[i].size + k] != P_MEM_MAGIC_NUMBER)
+			break;
+	if (k < thread->bufs[i].over_alloc)
+		p_log_message(P_LOG_ERROR, L"Memory", L"Overshoot at line %u in file %s\n", alloc_line->line,
+				alloc_line->file);
+	alloc_line->size -= thread->bufs[i].size;
+	alloc_line->alloc_count--;
+	alloc_line->freed++;
+
+	// shift the rest of the probe sequence back, so lookups never stop early at the freed slot
+	for (j = (i + 1) & thread->buf_mask; thread->bufs[j].buf != NULL; j = (j + 1) & thread->buf_mask)
 	{
-		if (line == p_alloc_lines[i].line)
+		uint home = _debug_mem_pointer_hash(thread->bufs[j].buf) & thread->buf_mask;
+		if (((j - home) & thread->buf_mask) >= ((j - i) & thread->buf_mask))
 		{
-			for (j = 0; file[j] != 0 && file[j] == p_alloc_lines[i].file[j] ; j++);
-			if (file[j] == p_alloc_lines[i].file[j])
-				break;
+			thread->bufs[i] = thread->bufs[j];
+			i = j;
 		}
 	}
-	if (i < p_alloc_line_count)
+	thread->bufs[i].buf = NULL;
+	thread->buf_count--;
+	return true;
+}
+
+/**
+ * _debug_mem_guard_span
+ *
+ * returns the bytes before the guard page of a guarded allocation of size, with its header and the slack
+ * that keeps the memory after the header aligned
+ */
+static size_t _debug_mem_guard_span(size_t size, size_t *aligned)
+{
+	*aligned = (size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+	return (sizeof (STMemAllocHeader) + *aligned + p_alloc_page_size - 1) & ~(p_alloc_page_size - 1);
+}
+
+/**
+ * _debug_mem_guard_alloc
+ *
+ * maps pages for an allocation of size that ends right before an inaccessible guard page, so writing past it
+ * faults at once, aligned is set to size rounded up to the alignment of max_align_t
+ * returns NULL if the pages could not be mapped
+ */
+static STMemAllocHeader *_debug_mem_guard_alloc(size_t size, size_t *aligned)
+{
+	size_t span;
+	uint8_t *pages;
+	if (p_alloc_page_size == 0)
 	{
-		if (p_alloc_lines[i].alloc_alocated == p_alloc_lines[i].alloc_count)
-		{
-			p_alloc_lines[i].alloc_alocated += 1024;
-			p_alloc_lines[i].allocs = (realloc)(p_alloc_lines[i].allocs, (sizeof *p_alloc_lines[i].allocs) * p_alloc_lines[i].alloc_alocated);
-		}
-		p_alloc_lines[i].allocs[p_alloc_lines[i].alloc_count].size = size;
-		p_alloc_lines[i].allocs[p_alloc_lines[i].alloc_count++].buf = pointer;
-		p_alloc_lines[i].size += size;
-		p_alloc_lines[i].alocated++;
-	} else
+#ifdef PLATINUM_PLATFORM_WINDOWS
+		SYSTEM_INFO system_info;
+		GetSystemInfo(&system_info);
+		p_alloc_page_size = system_info.dwPageSize;
+#elif defined PLATINUM_PLATFORM_LINUX
+		p_alloc_page_size = (size_t)sysconf(_SC_PAGESIZE);
+#endif // PLATINUM_PLATFORM
+	}
+	*aligned = 0;
+	if (size > SIZE_MAX / 2)
+		return NULL;
+	span = _debug_mem_guard_span(size, aligned);
+
+#ifdef PLATINUM_PLATFORM_WINDOWS
+	DWORD old_protect;
+	pages = VirtualAlloc(NULL, span + p_alloc_page_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (pages == NULL)
+		return NULL;
+	VirtualProtect(pages + span, p_alloc_page_size, PAGE_NOACCESS, &old_protect);
+#elif defined PLATINUM_PLATFORM_LINUX
+	pages = mmap(NULL, span + p_alloc_page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pages == MAP_FAILED)
+		return NULL;
+	mprotect(pages + span, p_alloc_page_size, PROT_NONE);
+#endif // PLATINUM_PLATFORM
+	return (STMemAllocHeader *)(pages + span - *aligned) - 1;
+}
+
+/**
+ * _debug_mem_guard_unmap
+ *
+ * gives the pages of a guarded allocation back to the system
+ */
+static void _debug_mem_guard_unmap(void *pages, size_t size)
+{
+#ifdef PLATINUM_PLATFORM_WINDOWS
+	E_UNUSED(size);
+	VirtualFree(pages, 0, MEM_RELEASE);
+#elif defined PLATINUM_PLATFORM_LINUX
+	munmap(pages, size);
+#endif // PLATINUM_PLATFORM
+}
+
+/**
+ * _debug_mem_release
+ *
+ * frees the memory of an allocation already taken out of the tables
+ * guarded allocations are made inaccessible and quarantined so any later use of them faults
+ */
+static void _debug_mem_release(STMemAllocHeader *header)
+{
+	size_t aligned, span;
+	uint8_t *pages;
+	if (!header->info.guarded)
+	{
+		(free)(header);
+		return;
+	}
+	span = _debug_mem_guard_span(header->info.size, &aligned);
+	pages = (uint8_t *)(header + 1) + aligned - span;
+
+	p_light_mutex_lock(&p_alloc_quarantine_mutex);
+	if (p_alloc_quarantine_limit == 0)
+	{
+		p_light_mutex_unlock(&p_alloc_quarantine_mutex);
+		_debug_mem_guard_unmap(pages, span + p_alloc_page_size);
+		return;
+	}
+#ifdef PLATINUM_PLATFORM_WINDOWS
+	DWORD old_protect;
+	VirtualProtect(pages, span, PAGE_NOACCESS, &old_protect);
+#elif defined PLATINUM_PLATFORM_LINUX
+	mprotect(pages, span, PROT_NONE);
+#endif // PLATINUM_PLATFORM
+
+	if (p_alloc_quarantine_count == p_alloc_quarantine_alocated)
+	{
+		uint i, alocated = p_alloc_quarantine_alocated == 0 ? 256 : p_alloc_quarantine_alocated * 2;
+		STMemQuarantine *quarantine = (malloc)((sizeof *quarantine) * alocated);
+		for (i = 0; i < p_alloc_quarantine_count; i++)
+			quarantine[i] = p_alloc_quarantine[(p_alloc_quarantine_first + i) % p_alloc_quarantine_alocated];
+		(free)(p_alloc_quarantine);
+		p_alloc_quarantine = quarantine;
+		p_alloc_quarantine_alocated = alocated;
+		p_alloc_quarantine_first = 0;
+	}
+	STMemQuarantine *entry = &p_alloc_quarantine[(p_alloc_quarantine_first + p_alloc_quarantine_count++)
+			% p_alloc_quarantine_alocated];
+	entry->pages = pages;
+	entry->size = span + p_alloc_page_size;
+	p_alloc_quarantine_bytes += entry->size;
+
+	while (p_alloc_quarantine_bytes > p_alloc_quarantine_limit)
+	{
+		entry = &p_alloc_quarantine[p_alloc_quarantine_first];
+		p_alloc_quarantine_first = (p_alloc_quarantine_first + 1) % p_alloc_quarantine_alocated;
+		p_alloc_quarantine_count--;
+		p_alloc_quarantine_bytes -= entry->size;
+		_debug_mem_guard_unmap(entry->pages, entry->size);
+	}
+	p_light_mutex_unlock(&p_alloc_quarantine_mutex);
+}
+
+/**
+ * _debug_mem_returned_free
+ *
+ * removes and frees the allocations of thread that other threads freed, thread->mutex must be held
+ */
+static void _debug_mem_returned_free(STMemThread *thread)
+{
+	STMemAllocHeader *header = atomic_exchange(&thread->returned, NULL);
+	while (header != NULL)
+	{
+		STMemAllocHeader *next = header->info.next;
+		if (!_debug_mem_remove(thread, header + 1))
+			_debug_mem_crash();
+		_debug_mem_release(header);
+		header = next;
+	}
+}
+
+/**
+ * _debug_mem_thread_get
+ *
+ * returns the tables of the calling thread, making them on first use
+ */
+static STMemThread *_debug_mem_thread_get(void)
+{
+	if (p_alloc_thread != NULL)
+		return p_alloc_thread;
+	STMemThread *thread = (calloc)(1, sizeof *thread);
+	p_light_mutex_init(&thread->mutex);
+	thread->next = atomic_load(&p_alloc_threads);
+	while (!atomic_compare_exchange_weak(&p_alloc_threads, &thread->next, thread));
+	p_alloc_thread = thread;
+	return thread;
+}
+
+bool p_debug_memory(void)
+{
+	bool output = false;
+#ifdef PLATINUM_DEBUG_MEMORY
+	uint i, k;
+	STMemThread *thread;
+	if (p_alloc_mutex != NULL)
+		p_light_mutex_lock(p_alloc_mutex);
+	for (thread = atomic_load(&p_alloc_threads); thread != NULL; thread = thread->next)
 	{
-		if (i < 1024)
+		p_light_mutex_lock(&thread->mutex);
+		_debug_mem_returned_free(thread);
+		for (i = 0; thread->bufs != NULL && i <= thread->buf_mask; i++)
 		{
-			p_alloc_lines[i].line = line;
-			for (j = 0; j < 255 && file[j] != 0; j++)
-				p_alloc_lines[i].file[j] = file[j];
-			p_alloc_lines[i].file[j] = 0;
-			p_alloc_lines[i].alloc_alocated = 256;
-			p_alloc_lines[i].allocs = (malloc)((sizeof *p_alloc_lines[i].allocs) * p_alloc_lines[i].alloc_alocated);
-			p_alloc_lines[i].allocs[0].size = size;
-			p_alloc_lines[i].allocs[0].buf = pointer;
-			p_alloc_lines[i].alloc_count = 1;
-			p_alloc_lines[i].size = size;
-			p_alloc_lines[i].freed = 0;
-			p_alloc_lines[i].alocated++;
-			p_alloc_line_count++;
+			uint8_t *buf;
+			uint size;
+			if (thread->bufs[i].buf == NULL)
+				continue;
+			buf = thread->bufs[i].buf;
+			size = thread->bufs[i].size;
+			for (k = 0; k < thread->bufs[i].over_alloc; k++)
+				if (buf[size + k] != P_MEM_MAGIC_NUMBER)
+					break;
+			if (k < thread->bufs[i].over_alloc)
+			{
+				p_log_message(P_LOG_ERROR, L"Memory", L"Overshoot at line %u in file %s\n",
+						thread->lines[thread->bufs[i].line].line, thread->lines[thread->bufs[i].line].file);
+				_debug_mem_crash();
+				output = true;
+			}
 		}
+		p_light_mutex_unlock(&thread->mutex);
 	}
+	if (p_alloc_mutex != NULL)
+		p_light_mutex_unlock(p_alloc_mutex);
+#endif
+	return output;
 }
 
 void *p_debug_mem_malloc(size_t size, char *file, uint line)
 {
+	STMemThread *thread = _debug_mem_thread_get();
+	STMemAllocHeader *header;
 	void *pointer;
-	if (p_alloc_mutex != NULL)
-		p_alloc_mutex_lock(p_alloc_mutex);
-	pointer = (malloc)(size + P_MEM_OVER_ALLOC);
+	uint over_alloc = P_MEM_OVER_ALLOC;
+	bool guarded = atomic_load_explicit(&p_alloc_guard, memory_order_relaxed);
+	if (guarded)
+	{
+		size_t aligned;
+		header = _debug_mem_guard_alloc(size, &aligned);
+		over_alloc = (uint)(aligned - size);
+	}
+	else
+		header = (malloc)(sizeof *header + size + P_MEM_OVER_ALLOC);
 
-	if (pointer == NULL)
+	if (header == NULL)
 	{
 		p_log_message(P_LOG_ERROR, L"Memory",
 				L"Malloc returns NULL when trying to allocate %zu bytes at line %u in file %s\n", size, line, file);
-		if (p_alloc_mutex != NULL)
-			p_alloc_mutex_unlock(p_alloc_mutex);
 		p_debug_mem_print(0);
 		exit(0);
 	}
-	memset(pointer, P_MEM_MAGIC_NUMBER+1, size + P_MEM_OVER_ALLOC);
-	p_debug_mem_add(pointer, size, file, line);
-	if (p_alloc_mutex != NULL)
-		p_alloc_mutex_unlock(p_alloc_mutex);
+	header->info.owner = thread;
+	header->info.next = NULL;
+	header->info.size = size;
+	header->info.magic = P_MEM_HEADER_MAGIC;
+	header->info.guarded = guarded;
+	pointer = header + 1;
+	memset(pointer, P_MEM_MAGIC_NUMBER+1, size + over_alloc);
+
+	p_light_mutex_lock(&thread->mutex);
+	if (atomic_load_explicit(&thread->returned, memory_order_relaxed) != NULL)
+		_debug_mem_returned_free(thread);
+	_debug_mem_add(thread, pointer, size, over_alloc, file, line);
+	p_light_mutex_unlock(&thread->mutex);
 	return pointer;
 }
 
 void *p_debug_mem_calloc(size_t nmemb, size_t size, char *file, uint line)
 {
 	void *pointer;
-	if (p_alloc_mutex != NULL)
-		p_alloc_mutex_lock(p_alloc_mutex);
-	pointer = (malloc)((nmemb * size) + P_MEM_OVER_ALLOC);
-
-	if (pointer == NULL)
+	if (size != 0 && nmemb > (SIZE_MAX - sizeof (STMemAllocHeader) - P_MEM_OVER_ALLOC) / size)
 	{
 		p_log_message(P_LOG_ERROR, L"Memory",
 				L"Calloc returns NULL when trying to allocate %zu bytes at line %u in file %s\n", size, line, file);
-		if (p_alloc_mutex != NULL)
-			p_alloc_mutex_unlock(p_alloc_mutex);
 		p_debug_mem_print(0);
 		exit(0);
 	}
-	memset(pointer, P_MEM_MAGIC_NUMBER+1, nmemb * size + P_MEM_OVER_ALLOC);
+	pointer = p_debug_mem_malloc(nmemb * size, file, line);
 	memset(pointer, 0, nmemb * size);
-	p_debug_mem_add(pointer, size, file, line);
-	if (p_alloc_mutex != NULL)
-		p_alloc_mutex_unlock(p_alloc_mutex);
 	return pointer;
 }
 
-bool p_debug_mem_remove(void *buf)
-{
-	uint i, j, k;
-	for (i = 0; i < p_alloc_line_count; i++)
-	{
-		for (j = 0; j < p_alloc_lines[i].alloc_count; j++)
-		{
-			if (p_alloc_lines[i].allocs[j].buf == buf)
-			{
-				for (k = 0; k < P_MEM_OVER_ALLOC; k++)
-					if (((uint8_t *)buf)[p_alloc_lines[i].allocs[j].size + k] != P_MEM_MAGIC_NUMBER)
-						break;
-				if (k < P_MEM_OVER_ALLOC)
-					p_log_message(P_LOG_ERROR, L"Memory", L"Overshoot at line %u in file %s\n", p_alloc_lines[i].line,
-							p_alloc_lines[i].file);
-				p_alloc_lines[i].size -= p_alloc_lines[i].allocs[j].size;
-				p_alloc_lines[i].allocs[j] = p_alloc_lines[i].allocs[--p_alloc_lines[i].alloc_count];
-				p_alloc_lines[i].freed++;
-				return true;
-			}
-		}
-	}
-	return false;
-}
-
 void p_debug_mem_free(void *buf)
 {
-	if (p_alloc_mutex != NULL)
-		p_alloc_mutex_lock(p_alloc_mutex);
-	if (!p_debug_mem_remove(buf))
+	STMemAllocHeader *header;
+	STMemThread *thread;
+	if (buf == NULL)
+		_debug_mem_crash();
+	header = (STMemAllocHeader *)buf - 1;
+	if (header->info.magic != P_MEM_HEADER_MAGIC)
+		_debug_mem_crash();
+	header->info.magic = P_MEM_HEADER_FREED;
+
+	// the owner takes frees of its allocations off the returned stack the next time it allocates
+	thread = p_alloc_thread;
+	if (header->info.owner != thread)
 	{
-		uint *X = NULL;
-		X[0] = 0;
+		STMemThread *owner = header->info.owner;
+		header->info.next = atomic_load(&owner->returned);
+		while (!atomic_compare_exchange_weak(&owner->returned, &header->info.next, header));
+		return;
 	}
-	(free)(buf);
-	if (p_alloc_mutex != NULL)
-		p_alloc_mutex_unlock(p_alloc_mutex);
+	p_light_mutex_lock(&thread->mutex);
+	if (!_debug_mem_remove(thread, buf))
+		_debug_mem_crash();
+	p_light_mutex_unlock(&thread->mutex);
+	_debug_mem_release(header);
 }
 
 
 void *p_debug_mem_realloc(void *pointer, size_t size, char *file, uint line)
 {
-	uint i, j, k, move;
+	uint j;
+	size_t move;
 	void *pointer2;
+	STMemAllocHeader *header;
+	STMemThread *thread;
 	if (pointer == NULL)
 		return p_debug_mem_malloc( size, file, line);
 
-	if (p_alloc_mutex != NULL)
-		p_alloc_mutex_lock(p_alloc_mutex);
-	for (i = 0; i < p_alloc_line_count; i++)
-	{
-		for (j = 0; j < p_alloc_lines[i].alloc_count; j++)
-			if (p_alloc_lines[i].allocs[j].buf == pointer)
-				break;
-		if (j < p_alloc_lines[i].alloc_count)
-			break;
-	}
-	if (i == p_alloc_line_count)
+	header = (STMemAllocHeader *)pointer - 1;
+	if (header->info.magic != P_MEM_HEADER_MAGIC)
 	{
 		p_log_message(P_LOG_ERROR, L"Memory",
 				L"Trying to reallocate pointer %p in %s line %u. Pointer has never beein allocated\n", pointer, file,
 				line);
-		for (i = 0; i < p_alloc_line_count; i++)
+		if (p_alloc_mutex != NULL)
+			p_light_mutex_lock(p_alloc_mutex);
+		for (thread = atomic_load(&p_alloc_threads); thread != NULL; thread = thread->next)
 		{
-			for (j = 0; j < p_alloc_lines[i].alloc_count; j++)
+			p_light_mutex_lock(&thread->mutex);
+			for (j = 0; thread->bufs != NULL && j <= thread->buf_mask; j++)
 			{
-				uint *buf;
-				buf = p_alloc_lines[i].allocs[j].buf;
-				for (k = 0; k < p_alloc_lines[i].allocs[j].size; k++)
+				uint8_t *buf;
+				buf = thread->bufs[j].buf;
+				if (buf != NULL && (uint8_t *)pointer > buf && (uint8_t *)pointer < buf + thread->bufs[j].size)
 				{
-					if (&buf[k] == pointer)
-					{
-						p_log_message(P_LOG_ERROR, L"Memory",
-								L"Trying to reallocate pointer %u bytes (out of %u) in to allocation made in %s on line %u.\n",
-								k, p_alloc_lines[i].allocs[j].size, p_alloc_lines[i].file, p_alloc_lines[i].line);
-					}
+					p_log_message(P_LOG_ERROR, L"Memory",
+							L"Trying to reallocate pointer %u bytes (out of %u) in to allocation made in %s on line %u.\n",
+							(uint)((uint8_t *)pointer - buf), thread->bufs[j].size,
+							thread->lines[thread->bufs[j].line].file, thread->lines[thread->bufs[j].line].line);
 				}
 			}
+			p_light_mutex_unlock(&thread->mutex);
 		}
 		exit(0);
 	}
-	move = p_alloc_lines[i].allocs[j].size;
+	move = header->info.size;
 
 	if (move > size)
 		move = size;
 
-	pointer2 = (malloc)(size + P_MEM_OVER_ALLOC);
-	if (pointer2 == NULL)
-	{
-		p_log_message(P_LOG_ERROR, L"Memory",
-				L"Realloc returns NULL when trying to allocate %zu bytes at line %u in file %s\n", size, line, file);
-		if (p_alloc_mutex != NULL)
-			p_alloc_mutex_unlock(p_alloc_mutex);
-		p_debug_mem_print(0);
-		exit(0);
-	}
-	for (i = 0; i < size + P_MEM_OVER_ALLOC; i++)
-		((uint8_t *)pointer2)[i] = P_MEM_MAGIC_NUMBER + 1;
+	pointer2 = p_debug_mem_malloc(size, file, line);
 	memcpy(pointer2, pointer, move);
-
-	p_debug_mem_add(pointer2, size, file, line);
-	p_debug_mem_remove(pointer);
-	(free)(pointer);
-
-	if (p_alloc_mutex != NULL)
-		p_alloc_mutex_unlock(p_alloc_mutex);
+	p_debug_mem_free(pointer);
 	return pointer2;
 }
 
 void p_debug_mem_print(uint min_allocs)
 {
 #ifdef PLATINUM_DEBUG_MEMORY
-	uint i;
+	uint i, j;
+	STMemThread merged = {0};
+	STMemThread *thread;
 	if (p_alloc_mutex != NULL)
-		p_alloc_mutex_lock(p_alloc_mutex);
+		p_light_mutex_lock(p_alloc_mutex);
+
+	// the same site may have allocated on several threads
+	for (thread = atomic_load(&p_alloc_threads); thread != NULL; thread = thread->next)
+	{
+		p_light_mutex_lock(&thread->mutex);
+		_debug_mem_returned_free(thread);
+		for (i = 0; i < thread->line_count; i++)
+		{
+			j = _debug_mem_line_get(&merged, thread->lines[i].file, thread->lines[i].line);
+			merged.lines[j].alloc_count += thread->lines[i].alloc_count;
+			merged.lines[j].size += thread->lines[i].size;
+			merged.lines[j].alocated += thread->lines[i].alocated;
+			merged.lines[j].freed += thread->lines[i].freed;
+		}
+		p_light_mutex_unlock(&thread->mutex);
+	}
+
 	p_log_message(P_LOG_DEBUG, L"Memory",L"----------------------------------------------");
-	for (i = 0; i < p_alloc_line_count; i++)
+	for (i = 0; i < merged.line_count; i++)
 	{
-		if (min_allocs < p_alloc_lines[i].alocated)
+		if (min_allocs < merged.lines[i].alocated)
 		{
-			p_log_message(P_LOG_DEBUG, L"Memory", L"%s line: %u",p_alloc_lines[i].file, p_alloc_lines[i].line);
-			p_log_message(P_LOG_DEBUG, L"Memory", L"    - Bytes allocated: %u", p_alloc_lines[i].size);
-			p_log_message(P_LOG_DEBUG, L"Memory", L"    - Allocations:     %u", p_alloc_lines[i].alocated);
-			p_log_message(P_LOG_DEBUG, L"Memory", L"    - Frees:           %u", p_alloc_lines[i].freed);
+			p_log_message(P_LOG_DEBUG, L"Memory", L"%s line: %u",merged.lines[i].file, merged.lines[i].line);
+			p_log_message(P_LOG_DEBUG, L"Memory", L"    - Bytes allocated: %u", merged.lines[i].size);
+			p_log_message(P_LOG_DEBUG, L"Memory", L"    - Allocations:     %u", merged.lines[i].alocated);
+			p_log_message(P_LOG_DEBUG, L"Memory", L"    - Frees:           %u", merged.lines[i].freed);
 		}
 	}
 	p_log_message(P_LOG_DEBUG, L"Memory",L"----------------------------------------------");
+	(free)(merged.lines);
+	(free)(merged.line_slots);
 	if (p_alloc_mutex != NULL)
-		p_alloc_mutex_unlock(p_alloc_mutex);
+		p_light_mutex_unlock(p_alloc_mutex);
 #else
 	E_UNUSED(min_allocs);
 #endif
@@ -309,13 +722,20 @@ uint32_t p_debug_mem_consumption(void)
 {
 #ifdef PLATINUM_DEBUG_MEMORY
 	uint i, sum = 0;
+	STMemThread *thread;
 
 	if (p_alloc_mutex != NULL)
-		p_alloc_mutex_lock(p_alloc_mutex);
-	for (i = 0; i < p_alloc_line_count; i++)
-		sum += p_alloc_lines[i].size;
+		p_light_mutex_lock(p_alloc_mutex);
+	for (thread = atomic_load(&p_alloc_threads); thread != NULL; thread = thread->next)
+	{
+		p_light_mutex_lock(&thread->mutex);
+		_debug_mem_returned_free(thread);
+		for (i = 0; i < thread->line_count; i++)
+			sum += thread->lines[i].size;
+		p_light_mutex_unlock(&thread->mutex);
+	}
 	if (p_alloc_mutex != NULL)
-		p_alloc_mutex_unlock(p_alloc_mutex);
+		p_light_mutex_unlock(p_alloc_mutex);
 	return sum;
 #else
 	return 0;
@@ -325,15 +745,24 @@ uint32_t p_debug_mem_consumption(void)
 void p_debug_mem_reset(void)
 {
 #ifdef PLATINUM_DEBUG_MEMORY
-	uint i;
+	STMemThread *thread;
 	if (p_alloc_mutex != NULL)
-		p_alloc_mutex_lock(p_alloc_mutex);
-	for (i = 0; i < p_alloc_line_count; i++)
-		(free)(p_alloc_lines[i].allocs);
-	p_alloc_line_count = 0;
+		p_light_mutex_lock(p_alloc_mutex);
+	for (thread = atomic_load(&p_alloc_threads); thread != NULL; thread = thread->next)
+	{
+		p_light_mutex_lock(&thread->mutex);
+		_debug_mem_returned_free(thread);
+		thread->line_count = 0;
+		if (thread->line_slots != NULL)
+			memset(thread->line_slots, 0, (thread->line_mask + 1) * sizeof *thread->line_slots);
+		thread->buf_count = 0;
+		if (thread->bufs != NULL)
+			memset(thread->bufs, 0, (thread->buf_mask + 1) * sizeof *thread->bufs);
+		p_light_mutex_unlock(&thread->mutex);
+	}
 
 	if (p_alloc_mutex != NULL)
-		p_alloc_mutex_unlock(p_alloc_mutex);
+		p_light_mutex_unlock(p_alloc_mutex);
 #endif
 }
 
@@ -1,6 +1,14 @@
+#include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include "platinum.h"
 
+#ifdef PLATINUM_PLATFORM_WINDOWS
+#include <windows.h>
+#elif defined PLATINUM_PLATFORM_LINUX
+#include <unistd.h>
+#endif // PLATINUM_PLATFORM
+
 /**
  * p_file_exists
  *
@@ -56,6 +64,56 @@ bool p_file_write(const char *filename, void *buffer, uint size)
 	return true;
 }
 
+/**
+ * p_file_replace
+ *
+ * Writes a file by writing a temporary file next to it and renaming it over the original,
+ * so readers see either the old or the new contents and never a partial write
+ * returns true on success
+ */
+bool p_file_replace(const char *filename, void *buffer, uint size)
+{
+	size_t filename_length = strlen(filename);
+	char *temp_filename = malloc(filename_length + sizeof ".tmp");
+	memcpy(temp_filename, filename, filename_length);
+	memcpy(temp_filename + filename_length, ".tmp", sizeof ".tmp");
+
+	FILE *f;
+	f = fopen(temp_filename, "wb");
+	if (f == NULL)
+	{
+		p_log_message(P_LOG_WARNING, L"File", L"File %s cannot be written to", temp_filename);
+		free(temp_filename);
+		return false;
+	}
+	bool written = fwrite(buffer, size, 1, f) == 1 || size == 0;
+	written = fflush(f) == 0 && written;
+#ifdef PLATINUM_PLATFORM_LINUX
+	written = fsync(fileno(f)) == 0 && written;
+#endif // PLATINUM_PLATFORM_LINUX
+	written = fclose(f) == 0 && written;
+	if (!written)
+	{
+		p_log_message(P_LOG_WARNING, L"File", L"File %s cannot be written to", temp_filename);
+		remove(temp_filename);
+		free(temp_filename);
+		return false;
+	}
+
+#ifdef PLATINUM_PLATFORM_WINDOWS
+	bool replaced = MoveFileExA(temp_filename, filename, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+	bool replaced = rename(temp_filename, filename) == 0;
+#endif // PLATINUM_PLATFORM
+	if (!replaced)
+	{
+		p_log_message(P_LOG_WARNING, L"File", L"File %s cannot be replaced", filename);
+		remove(temp_filename);
+	}
+	free(temp_filename);
+	return replaced;
+}
+
 /**
  * p_file_read
  *
@@ -75,3 +133,34 @@ bool p_file_read(const char *filename, void *buffer, uint size)
 	return true;
 }
 
+/**
+ * p_file_text_append
+ *
+ * appends printf formatted text to a buffer of *capacity bytes holding *length, growing it as needed.
+ * *text may start as NULL. It is grown with the untracked realloc, so the memory debugger and heap profiler
+ * can build their reports with it, and must be released with (free)
+ * returns false if the text could not be formatted or the buffer could not grow
+ */
+bool p_file_text_append(char **text, size_t *length, size_t *capacity, const char *format, ...)
+{
+	for (;;)
+	{
+		va_list args;
+		va_start(args, format);
+		int written = vsnprintf(*text == NULL ? NULL : *text + *length, *capacity - *length, format, args);
+		va_end(args);
+		if (written < 0)
+			return false;
+		if (*text != NULL && *length + (size_t)written < *capacity)
+		{
+			*length += (size_t)written;
+			return true;
+		}
+		size_t grown_capacity = E_MAX(*capacity * 2, *length + (size_t)written + 1);
+		char *grown = (realloc)(*text, grown_capacity);
+		if (grown == NULL)
+			return false;
+		*text = grown;
+		*capacity = grown_capacity;
+	}
+}
@@ -0,0 +1,516 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "platinum.h"
+
+#ifdef PLATINUM_HEAP_PROFILE
+
+#ifdef PLATINUM_PLATFORM_WINDOWS
+#include <windows.h>
+#elif defined PLATINUM_PLATFORM_LINUX
+#include <execinfo.h>
+#endif // PLATINUM_PLATFORM
+
+// Mean number of bytes allocated between two samples when none is given
+#define P_HEAP_PROFILE_SAMPLE_BYTES (512 * 1024)
+
+// Deepest backtrace recorded for a sample
+#define P_HEAP_PROFILE_DEPTH 32
+
+// Samples a thread keeps before adding them to the shared stack table
+#define P_HEAP_PROFILE_BUFFER 64
+
+// Frames of the profiler itself at the top of every backtrace, fewer if the compiler inlined them
+#define P_HEAP_PROFILE_SKIP 2
+
+enum PHeapSampleState {
+	P_HEAP_SAMPLE_PENDING, // in the buffer of the thread that took it
+	P_HEAP_SAMPLE_COUNTED, // added to its stack, freeing it takes it out again
+	P_HEAP_SAMPLE_FREED, // freed while pending, the thread's next flush drops it
+};
+
+/**
+ * PHeapStack
+ *
+ * This struct is every sample taken with the same backtrace, never freed once made
+ */
+typedef struct PHeapStack {
+	uint64_t hash;
+	uint depth;
+	void *frames[P_HEAP_PROFILE_DEPTH];
+	uint64_t alloc_count; // guarded by p_heap_profile.mutex
+	uint64_t alloc_bytes;
+	atomic_uint_fast64_t live_count; // also lowered by frees, which take no lock
+	atomic_uint_fast64_t live_bytes;
+} PHeapStack;
+
+/**
+ * PHeapSample
+ *
+ * This struct is one sampled allocation, pointed to by the header in front of it
+ */
+typedef struct PHeapSample {
+	atomic_uint state; // PHeapSampleState, whichever of the flush and the free comes second frees the sample
+	size_t size;
+	PHeapStack *stack; // set when the sample is counted
+	uint depth;
+	void *frames[P_HEAP_PROFILE_DEPTH];
+} PHeapSample;
+
+/**
+ * PHeapProfileThread
+ *
+ * This struct is the samples of one thread not yet added to the stack table
+ * It is kept after the thread exits, so its last samples are still dumped
+ */
+typedef struct PHeapProfileThread {
+	PLightMutex mutex; // only contended while dumping
+	uint64_t random; // xorshift state for the sample intervals
+	uint sample_count;
+	PHeapSample *samples[P_HEAP_PROFILE_BUFFER];
+	struct PHeapProfileThread *next;
+} PHeapProfileThread;
+
+/**
+ * PHeapProfileHeader
+ *
+ * Put in front of every allocation, keeps the memory after it aligned for any type
+ */
+typedef union {
+	PHeapSample *sample; // NULL if the allocation was not sampled
+	max_align_t align;
+} PHeapProfileHeader;
+
+static struct {
+	atomic_bool enabled;
+	atomic_size_t sample_bytes;
+	_Atomic(PHeapProfileThread *) threads; // every thread that took a sample, pushed without a lock
+	PLightMutex mutex; // guards the stack table
+	PHeapStack **stacks; // open addressing on the backtrace hash, NULL if the slot is empty
+	uint stack_count;
+	uint stack_mask; // number of slots - 1, 0 before the table is made
+} p_heap_profile;
+
+// Bytes this thread may still allocate before its next sample
+static _Thread_local int64_t p_heap_profile_countdown = 0;
+// Set until the thread draws its first interval after profiling started
+static _Thread_local bool p_heap_profile_fresh = true;
+static _Thread_local PHeapProfileThread *p_heap_profile_thread = NULL;
+
+/**
+ * _heap_profile_random
+ *
+ * returns the next number of the thread's xorshift64* sequence
+ */
+static uint64_t _heap_profile_random(PHeapProfileThread *thread)
+{
+	thread->random ^= thread->random >> 12;
+	thread->random ^= thread->random << 25;
+	thread->random ^= thread->random >> 27;
+	return thread->random * 2685821657736338717ull;
+}
+
+/**
+ * _heap_profile_interval
+ *
+ * returns the bytes until the next sample, exponentially distributed around sample_bytes
+ * so every byte is equally likely to be sampled, as pprof assumes when scaling the samples up
+ */
+static int64_t _heap_profile_interval(PHeapProfileThread *thread)
+{
+	// -ln(u) from the exponent and a quadratic fit of log2 on the mantissa, close enough for sampling
+	uint64_t u = (_heap_profile_random(thread) >> 11) | 1; // uniform in [1, 2^53)
+	int exponent = 63 - __builtin_clzll(u);
+	double mantissa = (double)u / (double)(1ull << exponent) - 1.0;
+	double log2_u = exponent + mantissa * (1.3465 - 0.3465 * mantissa);
+	double interval = (53.0 - log2_u) * 0.6931471805599453 *
+		(double)atomic_load_explicit(&p_heap_profile.sample_bytes, memory_order_relaxed);
+	return (int64_t)interval + 1;
+}
+
+/**
+ * _heap_profile_thread_get
+ *
+ * returns the profiling state of the calling thread, making it on first use
+ */
+static PHeapProfileThread *_heap_profile_thread_get(void)
+{
+	if (p_heap_profile_thread != NULL)
+		return p_heap_profile_thread;
+	PHeapProfileThread *thread = (calloc)(1, sizeof *thread);
+	if (thread == NULL)
+		return NULL;
+	p_light_mutex_init(&thread->mutex);
+	thread->random = ((uint64_t)(uintptr_t)thread * 0x9e3779b97f4a7c15ull) | 1;
+	thread->next = atomic_load(&p_heap_profile.threads);
+	while (!atomic_compare_exchange_weak(&p_heap_profile.threads, &thread->next, thread));
+	p_heap_profile_thread = thread;
+	return thread;
+}
+
+/**
+ * _heap_profile_stack_hash
+ *
+ * FNV-1a hash of a backtrace
+ */
+static uint64_t _heap_profile_stack_hash(void * const *frames, uint depth)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (uint i = 0; i < depth; i++)
+	{
+		hash ^= (uint64_t)(uintptr_t)frames[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+/**
+ * _heap_profile_stacks_grow
+ *
+ * doubles the slots of the stack table, making it on first use, p_heap_profile.mutex must be held
+ */
+static bool _heap_profile_stacks_grow(void)
+{
+	uint old_slot_count = p_heap_profile.stacks == NULL ? 0 : p_heap_profile.stack_mask + 1;
+	uint slot_count = old_slot_count == 0 ? 256 : old_slot_count * 2;
+	PHeapStack **stacks = (calloc)(slot_count, sizeof *stacks);
+	if (stacks == NULL)
+		return false;
+	for (uint i = 0; i < old_slot_count; i++)
+	{
+		PHeapStack *stack = p_heap_profile.stacks[i];
+		if (stack == NULL)
+			continue;
+		uint j = (uint)stack->hash & (slot_count - 1);
+		while (stacks[j] != NULL)
+			j = (j + 1) & (slot_count - 1);
+		stacks[j] = stack;
+	}
+	(free)(p_heap_profile.stacks);
+	p_heap_profile.stacks = stacks;
+	p_heap_profile.stack_mask = slot_count - 1;
+	return true;
+}
+
+/**
+ * _heap_profile_stack_get
+ *
+ * returns the stack of the sample's backtrace, adding it if it is new, p_heap_profile.mutex must be held
+ * returns NULL if out of memory
+ */
+static PHeapStack *_heap_profile_stack_get(const PHeapSample *sample)
+{
+	uint64_t hash = _heap_profile_stack_hash(sample->frames, sample->depth);
+	if ((p_heap_profile.stack_count + 1) * 2 > p_heap_profile.stack_mask + 1 && !_heap_profile_stacks_grow())
+		return NULL;
+	uint i = (uint)hash & p_heap_profile.stack_mask;
+	for (; p_heap_profile.stacks[i] != NULL; i = (i + 1) & p_heap_profile.stack_mask)
+	{
+		PHeapStack *stack = p_heap_profile.stacks[i];
+		if (stack->hash == hash && stack->depth == sample->depth &&
+				memcmp(stack->frames, sample->frames, sample->depth * sizeof *sample->frames) == 0)
+			return stack;
+	}
+	PHeapStack *stack = (calloc)(1, sizeof *stack);
+	if (stack == NULL)
+		return NULL;
+	stack->hash = hash;
+	stack->depth = sample->depth;
+	memcpy(stack->frames, sample->frames, sample->depth * sizeof *sample->frames);
+	p_heap_profile.stacks[i] = stack;
+	p_heap_profile.stack_count++;
+	return stack;
+}
+
+/**
+ * _heap_profile_flush
+ *
+ * adds the samples of thread to the stack table, thread->mutex must be held
+ */
+static void _heap_profile_flush(PHeapProfileThread *thread)
+{
+	p_light_mutex_lock(&p_heap_profile.mutex);
+	for (uint i = 0; i < thread->sample_count; i++)
+	{
+		PHeapSample *sample = thread->samples[i];
+		PHeapStack *stack = _heap_profile_stack_get(sample);
+		if (stack != NULL)
+		{
+			stack->alloc_count++;
+			stack->alloc_bytes += sample->size;
+			atomic_fetch_add(&stack->live_count, 1);
+			atomic_fetch_add(&stack->live_bytes, sample->size);
+		}
+		// whichever of this and the free comes second frees the sample
+		sample->stack = stack;
+		if (atomic_exchange(&sample->state, P_HEAP_SAMPLE_COUNTED) == P_HEAP_SAMPLE_FREED)
+		{
+			if (stack != NULL)
+			{
+				atomic_fetch_sub(&stack->live_count, 1);
+				atomic_fetch_sub(&stack->live_bytes, sample->size);
+			}
+			(free)(sample);
+		}
+	}
+	thread->sample_count = 0;
+	p_light_mutex_unlock(&p_heap_profile.mutex);
+}
+
+/**
+ * _heap_profile_sample
+ *
+ * called when the thread's countdown ran out, samples the allocation of size and draws the next interval
+ * returns the sample to put in its header, or NULL
+ */
+static PHeapSample *_heap_profile_sample(size_t size)
+{
+	// while profiling is stopped the thread still checks back every so often
+	if (!atomic_load_explicit(&p_heap_profile.enabled, memory_order_relaxed))
+	{
+		p_heap_profile_countdown = P_HEAP_PROFILE_SAMPLE_BYTES;
+		p_heap_profile_fresh = true;
+		return NULL;
+	}
+	PHeapProfileThread *thread = _heap_profile_thread_get();
+	if (thread == NULL)
+		return NULL;
+
+	// the countdown the thread had before its first interval samples nothing
+	p_heap_profile_countdown = _heap_profile_interval(thread);
+	if (p_heap_profile_fresh)
+	{
+		p_heap_profile_fresh = false;
+		return NULL;
+	}
+
+	PHeapSample *sample = (malloc)(sizeof *sample);
+	if (sample == NULL)
+		return NULL;
+	atomic_init(&sample->state, P_HEAP_SAMPLE_PENDING);
+	sample->size = size;
+	sample->stack = NULL;
+	void *frames[P_HEAP_PROFILE_DEPTH + P_HEAP_PROFILE_SKIP];
+#ifdef PLATINUM_PLATFORM_WINDOWS
+	int depth = CaptureStackBackTrace(0, P_HEAP_PROFILE_DEPTH + P_HEAP_PROFILE_SKIP, frames, NULL);
+#elif defined PLATINUM_PLATFORM_LINUX
+	int depth = backtrace(frames, P_HEAP_PROFILE_DEPTH + P_HEAP_PROFILE_SKIP);
+#else
+	int depth = 0;
+#endif // PLATINUM_PLATFORM
+	// drop the profiler's own frames, the caller of the wrapper is always kept
+	int skip = depth > P_HEAP_PROFILE_SKIP ? P_HEAP_PROFILE_SKIP : depth;
+	sample->depth = (uint)(depth - skip);
+	memcpy(sample->frames, frames + skip, sample->depth * sizeof *frames);
+
+	p_light_mutex_lock(&thread->mutex);
+	if (thread->sample_count == P_HEAP_PROFILE_BUFFER)
+		_heap_profile_flush(thread);
+	thread->samples[thread->sample_count++] = sample;
+	p_light_mutex_unlock(&thread->mutex);
+	return sample;
+}
+
+/**
+ * _heap_profile_track
+ *
+ * puts the header in front of a new allocation of size and returns the memory after it
+ */
+static void *_heap_profile_track(PHeapProfileHeader *header, size_t size)
+{
+	if (header == NULL)
+		return NULL;
+	header->sample = NULL;
+	p_heap_profile_countdown -= (int64_t)size;
+	if (p_heap_profile_countdown <= 0)
+		header->sample = _heap_profile_sample(size);
+	return header + 1;
+}
+
+/**
+ * _heap_profile_untrack
+ *
+ * takes the sample of a freed allocation out of the profile
+ */
+static void _heap_profile_untrack(PHeapSample *sample)
+{
+	if (atomic_exchange(&sample->state, P_HEAP_SAMPLE_FREED) != P_HEAP_SAMPLE_COUNTED)
+		return;
+	if (sample->stack != NULL)
+	{
+		atomic_fetch_sub(&sample->stack->live_count, 1);
+		atomic_fetch_sub(&sample->stack->live_bytes, sample->size);
+	}
+	(free)(sample);
+}
+
+#endif // PLATINUM_HEAP_PROFILE
+
+/**
+ * p_heap_profile_start
+ *
+ * starts sampling about one allocation per sample_bytes on every thread, 0 uses 512 KiB
+ */
+void p_heap_profile_start(size_t sample_bytes)
+{
+#ifdef PLATINUM_HEAP_PROFILE
+	atomic_store(&p_heap_profile.sample_bytes, sample_bytes == 0 ? P_HEAP_PROFILE_SAMPLE_BYTES : sample_bytes);
+	atomic_store(&p_heap_profile.enabled, true);
+#else
+	E_UNUSED(sample_bytes);
+	p_log_message(P_LOG_WARNING, L"Memory", L"Heap profiling needs platinum built with PLATINUM_HEAP_PROFILE");
+#endif // PLATINUM_HEAP_PROFILE
+}
+
+/**
+ * p_heap_profile_stop
+ *
+ * stops sampling, threads notice on their next sample so some may still be taken
+ */
+void p_heap_profile_stop(void)
+{
+#ifdef PLATINUM_HEAP_PROFILE
+	atomic_store(&p_heap_profile.enabled, false);
+#endif // PLATINUM_HEAP_PROFILE
+}
+
+/**
+ * p_heap_profile_dump
+ *
+ * writes every backtrace that allocated sampled memory to path in the gperftools heap profile format
+ * counts are of samples, pprof scales them up to estimates using the sample rate in the header
+ * on linux the loaded libraries are appended, so pprof can symbolize the addresses
+ * returns false if nothing could be written
+ */
+bool p_heap_profile_dump(const char *path)
+{
+#ifdef PLATINUM_HEAP_PROFILE
+	for (PHeapProfileThread *thread = atomic_load(&p_heap_profile.threads); thread != NULL; thread = thread->next)
+	{
+		p_light_mutex_lock(&thread->mutex);
+		_heap_profile_flush(thread);
+		p_light_mutex_unlock(&thread->mutex);
+	}
+
+	size_t length = 0, allocated = 0;
+	char *text = NULL;
+	bool ok = true;
+	uint64_t live_count = 0, live_bytes = 0, alloc_count = 0, alloc_bytes = 0;
+	p_light_mutex_lock(&p_heap_profile.mutex);
+	for (uint i = 0; p_heap_profile.stacks != NULL && i <= p_heap_profile.stack_mask; i++)
+	{
+		PHeapStack *stack = p_heap_profile.stacks[i];
+		if (stack == NULL)
+			continue;
+		live_count += atomic_load(&stack->live_count);
+		live_bytes += atomic_load(&stack->live_bytes);
+		alloc_count += stack->alloc_count;
+		alloc_bytes += stack->alloc_bytes;
+	}
+	ok = ok && p_file_text_append(&text, &length, &allocated,
+			"heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%zu\n", (unsigned long long)live_count,
+			(unsigned long long)live_bytes, (unsigned long long)alloc_count, (unsigned long long)alloc_bytes,
+			atomic_load(&p_heap_profile.sample_bytes));
+	for (uint i = 0; ok && p_heap_profile.stacks != NULL && i <= p_heap_profile.stack_mask; i++)
+	{
+		PHeapStack *stack = p_heap_profile.stacks[i];
+		if (stack == NULL)
+			continue;
+		ok = p_file_text_append(&text, &length, &allocated, "%llu: %llu [%llu: %llu] @",
+				(unsigned long long)atomic_load(&stack->live_count),
+				(unsigned long long)atomic_load(&stack->live_bytes), (unsigned long long)stack->alloc_count,
+				(unsigned long long)stack->alloc_bytes);
+		for (uint j = 0; ok && j < stack->depth; j++)
+			ok = p_file_text_append(&text, &length, &allocated, " %p", stack->frames[j]);
+		ok = ok && p_file_text_append(&text, &length, &allocated, "\n");
+	}
+	p_light_mutex_unlock(&p_heap_profile.mutex);
+
+#ifdef PLATINUM_PLATFORM_LINUX
+	// /proc files report no size, so they are read until they end
+	FILE *maps = fopen("/proc/self/maps", "r");
+	if (ok && maps != NULL)
+	{
+		ok = p_file_text_append(&text, &length, &allocated, "\nMAPPED_LIBRARIES:\n");
+		char line[1024];
+		while (ok && fgets(line, sizeof line, maps) != NULL)
+			ok = p_file_text_append(&text, &length, &allocated, "%s", line);
+	}
+	if (maps != NULL)
+		fclose(maps);
+#endif // PLATINUM_PLATFORM_LINUX
+
+	ok = ok && p_file_replace(path, text, (uint)length);
+	(free)(text);
+	return ok;
+#else
+	E_UNUSED(path);
+	return false;
+#endif // PLATINUM_HEAP_PROFILE
+}
+
+#ifdef PLATINUM_HEAP_PROFILE
+
+/**
+ * p_heap_profile_malloc
+ *
+ * malloc that may sample the allocation, costs a thread local subtraction when it does not
+ */
+void *p_heap_profile_malloc(size_t size)
+{
+	if (size > SIZE_MAX - sizeof (PHeapProfileHeader))
+		return NULL;
+	return _heap_profile_track((malloc)(sizeof (PHeapProfileHeader) + size), size);
+}
+
+/**
+ * p_heap_profile_calloc
+ *
+ * calloc that may sample the allocation
+ */
+void *p_heap_profile_calloc(size_t nmemb, size_t size)
+{
+	if (size != 0 && nmemb > (SIZE_MAX - sizeof (PHeapProfileHeader)) / size)
+		return NULL;
+	return _heap_profile_track((calloc)(1, sizeof (PHeapProfileHeader) + nmemb * size), nmemb * size);
+}
+
+/**
+ * p_heap_profile_realloc
+ *
+ * realloc that treats the result as a new allocation, which may be sampled
+ */
+void *p_heap_profile_realloc(void *pointer, size_t size)
+{
+	if (pointer == NULL)
+		return p_heap_profile_malloc(size);
+	if (size > SIZE_MAX - sizeof (PHeapProfileHeader))
+		return NULL;
+	PHeapProfileHeader *header = (PHeapProfileHeader *)pointer - 1;
+	PHeapSample *sample = header->sample;
+	PHeapProfileHeader *moved = (realloc)(header, sizeof (PHeapProfileHeader) + size);
+	if (moved == NULL)
+		return NULL;
+	if (sample != NULL)
+		_heap_profile_untrack(sample);
+	return _heap_profile_track(moved, size);
+}
+
+/**
+ * p_heap_profile_free
+ *
+ * free of memory from the functions above
+ */
+void p_heap_profile_free(void *pointer)
+{
+	if (pointer == NULL)
+		return;
+	PHeapProfileHeader *header = (PHeapProfileHeader *)pointer - 1;
+	if (header->sample != NULL)
+		_heap_profile_untrack(header->sample);
+	(free)(header);
+}
+
+#endif // PLATINUM_HEAP_PROFILE
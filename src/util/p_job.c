@@ -0,0 +1,671 @@
+#include "platinum.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef PLATINUM_PLATFORM_WINDOWS
+#include <windows.h>
+#elif defined PLATINUM_PLATFORM_LINUX
+#include <sched.h>
+#endif // PLATINUM_PLATFORM
+
+// Sizes must be powers of two
+#define P_JOB_DEQUE_SIZE 4096
+#define P_JOB_POOL_SIZE 4096
+#define P_JOB_INJECT_SIZE 4096
+#define P_JOB_CACHE_LINE 64
+
+// Number of empty polls a worker, or a thread in p_job_wait, spins for before it starts yielding, and then sleeping
+#define P_JOB_IDLE_SPINS 64
+#define P_JOB_IDLE_YIELDS 64
+
+// Internal Structs
+
+typedef struct PJob PJob;
+typedef struct PJobDeque PJobDeque;
+typedef struct PJobWorker PJobWorker;
+
+/**
+ * PJob
+ *
+ * A single unit of work. Jobs live in ring pools and are reused once they have finished.
+ * If the next slot in a pool is still pending the job is allocated on the heap instead.
+ */
+struct PJob {
+	PJobFunction func;
+	void *args;
+	PJobCounter *counter; // decremented when the job finishes, may be NULL
+	PJobCounter *dependency; // job is deferred until this reaches zero, may be NULL
+	atomic_bool in_use;
+	bool heap;
+};
+
+/**
+ * PJobDeque
+ *
+ * Chase-Lev work-stealing deque.
+ * The owning worker pushes and takes at the bottom, any other thread steals from the top.
+ */
+struct PJobDeque {
+	_Alignas(P_JOB_CACHE_LINE) atomic_llong top;
+	_Alignas(P_JOB_CACHE_LINE) atomic_llong bottom;
+	_Alignas(P_JOB_CACHE_LINE) _Atomic(PJob *) jobs[P_JOB_DEQUE_SIZE];
+};
+
+/**
+ * PJobWorker
+ *
+ * Holds everything owned by a single worker thread
+ */
+struct PJobWorker {
+	PJobDeque deque;
+	PJob jobs[P_JOB_POOL_SIZE];
+	uint job_index;
+	uint index;
+	uint32_t random_state;
+	PJobSystem *job_system;
+	PThread thread;
+};
+
+/**
+ * PJobSystem
+ *
+ * A fixed pool of worker threads that execute submitted jobs
+ */
+struct PJobSystem {
+	PJobWorker *workers;
+	uint num_workers;
+	atomic_bool running;
+
+	// Idle workers sleep here until new jobs are pushed
+	PLightMutex sleep_mutex;
+	PCondVar sleep_cond_var;
+	atomic_uint sleeping_workers;
+	PCondVar wait_cond_var; // threads outside of the pool blocked in p_job_wait, signaled when a counter reaches zero
+	atomic_uint sleeping_waiters;
+
+	// Jobs submitted from threads outside of the pool
+	PLightMutex inject_mutex;
+	PJob *inject_queue[P_JOB_INJECT_SIZE];
+	uint inject_head;
+	uint inject_tail;
+	atomic_uint inject_count;
+	PJob external_jobs[P_JOB_POOL_SIZE];
+	uint external_job_index;
+
+	// Jobs waiting on a dependency counter
+	PLightMutex deferred_mutex;
+	EDynarr *deferred_jobs; // contains PJob *
+	atomic_uint deferred_count;
+};
+
+// Internal Variables
+
+static _Thread_local PJobWorker *p_job_current_worker = NULL;
+
+/**
+ * _job_yield
+ *
+ * gives up the rest of the current time slice
+ */
+static void _job_yield(void)
+{
+#ifdef PLATINUM_PLATFORM_WINDOWS
+	SwitchToThread();
+#elif defined PLATINUM_PLATFORM_LINUX
+	sched_yield();
+#endif // PLATINUM_PLATFORM
+}
+
+/**
+ * _job_worker_get
+ *
+ * returns the worker of job_system running on the current thread, or NULL
+ */
+static PJobWorker *_job_worker_get(const PJobSystem *job_system)
+{
+	PJobWorker *worker = p_job_current_worker;
+	if (worker != NULL && worker->job_system == job_system)
+		return worker;
+	return NULL;
+}
+
+/**
+ * _job_deque_push
+ *
+ * pushes a job onto the bottom of the deque. Only the owner may call this.
+ * returns false if the deque is full
+ */
+static bool _job_deque_push(PJobDeque *deque, PJob *job)
+{
+	long long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+	long long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+	if (bottom - top >= P_JOB_DEQUE_SIZE)
+		return false;
+	atomic_store_explicit(&deque->jobs[bottom & (P_JOB_DEQUE_SIZE - 1)], job, memory_order_relaxed);
+	atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+	return true;
+}
+
+/**
+ * _job_deque_take
+ *
+ * pops a job from the bottom of the deque. Only the owner may call this.
+ * returns NULL if the deque is empty
+ */
+static PJob *_job_deque_take(PJobDeque *deque)
+{
+	long long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+	atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	long long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+	if (top > bottom)
+	{
+		atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+		return NULL;
+	}
+
+	PJob *job = atomic_load_explicit(&deque->jobs[bottom & (P_JOB_DEQUE_SIZE - 1)], memory_order_relaxed);
+	if (top == bottom)
+	{
+		// last job, race against thieves for it
+		if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst,
+					memory_order_relaxed))
+			job = NULL;
+		atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+	}
+	return job;
+}
+
+/**
+ * _job_deque_steal
+ *
+ * takes a job from the top of the deque. Any thread may call this.
+ * returns NULL if the deque is empty or another thread won the race
+ */
+static PJob *_job_deque_steal(PJobDeque *deque)
+{
+	long long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	long long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+	if (top >= bottom)
+		return NULL;
+
+	PJob *job = atomic_load_explicit(&deque->jobs[top & (P_JOB_DEQUE_SIZE - 1)], memory_order_relaxed);
+	if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst,
+				memory_order_relaxed))
+		return NULL;
+	return job;
+}
+
+/**
+ * _job_allocate
+ *
+ * returns a job slot from the pool of the calling thread
+ */
+static PJob *_job_allocate(PJobSystem *job_system)
+{
+	PJob *job;
+	PJobWorker *worker = _job_worker_get(job_system);
+	if (worker != NULL)
+	{
+		job = &worker->jobs[worker->job_index++ & (P_JOB_POOL_SIZE - 1)];
+	} else {
+		p_light_mutex_lock(&job_system->inject_mutex);
+		job = &job_system->external_jobs[job_system->external_job_index++ & (P_JOB_POOL_SIZE - 1)];
+		p_light_mutex_unlock(&job_system->inject_mutex);
+	}
+
+	if (atomic_exchange_explicit(&job->in_use, true, memory_order_acquire))
+	{
+		// more than P_JOB_POOL_SIZE jobs are pending from this pool
+		job = malloc(sizeof *job);
+		atomic_init(&job->in_use, true);
+		job->heap = true;
+		return job;
+	}
+	job->heap = false;
+	return job;
+}
+
+/**
+ * _job_inject_pop
+ *
+ * pops a job that was submitted from outside the pool
+ * returns NULL if there is none
+ */
+static PJob *_job_inject_pop(PJobSystem *job_system)
+{
+	if (atomic_load_explicit(&job_system->inject_count, memory_order_relaxed) == 0)
+		return NULL;
+
+	PJob *job = NULL;
+	p_light_mutex_lock(&job_system->inject_mutex);
+	if (job_system->inject_head != job_system->inject_tail)
+	{
+		job = job_system->inject_queue[job_system->inject_head++ & (P_JOB_INJECT_SIZE - 1)];
+		atomic_fetch_sub_explicit(&job_system->inject_count, 1, memory_order_relaxed);
+	}
+	p_light_mutex_unlock(&job_system->inject_mutex);
+	return job;
+}
+
+/**
+ * _job_next
+ *
+ * finds the next job to run for the calling thread.
+ * Workers check their own deque first, then the inject queue, then steal from a random worker.
+ * returns NULL if no work could be found
+ */
+static PJob *_job_next(PJobSystem *job_system, PJobWorker *worker)
+{
+	PJob *job = NULL;
+	if (worker != NULL)
+	{
+		job = _job_deque_take(&worker->deque);
+		if (job != NULL)
+			return job;
+	}
+
+	job = _job_inject_pop(job_system);
+	if (job != NULL)
+		return job;
+
+	uint start = 0;
+	if (worker != NULL)
+	{
+		// xorshift32
+		worker->random_state ^= worker->random_state << 13;
+		worker->random_state ^= worker->random_state >> 17;
+		worker->random_state ^= worker->random_state << 5;
+		start = worker->random_state;
+	}
+	for (uint i = 0; i < job_system->num_workers; i++)
+	{
+		PJobWorker *victim = &job_system->workers[(start + i) % job_system->num_workers];
+		if (victim == worker)
+			continue;
+		job = _job_deque_steal(&victim->deque);
+		if (job != NULL)
+			return job;
+	}
+	return NULL;
+}
+
+/**
+ * _job_has_work
+ *
+ * returns true if any queue of the job system holds a job
+ */
+static bool _job_has_work(PJobSystem *job_system)
+{
+	if (atomic_load(&job_system->inject_count) > 0)
+		return true;
+	for (uint i = 0; i < job_system->num_workers; i++)
+	{
+		PJobDeque *deque = &job_system->workers[i].deque;
+		if (atomic_load(&deque->bottom) > atomic_load(&deque->top))
+			return true;
+	}
+	return false;
+}
+
+/**
+ * _job_sleep
+ *
+ * puts an idle worker to sleep until a job is pushed or the job system shuts down
+ */
+static void _job_sleep(PJobSystem *job_system)
+{
+	p_light_mutex_lock(&job_system->sleep_mutex);
+	atomic_fetch_add(&job_system->sleeping_workers, 1);
+	// pairs with the fence in _job_wake, either the pusher sees us sleeping or we see its job
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&job_system->running) && !_job_has_work(job_system))
+		p_cond_var_wait(&job_system->sleep_cond_var, &job_system->sleep_mutex);
+	atomic_fetch_sub(&job_system->sleeping_workers, 1);
+	p_light_mutex_unlock(&job_system->sleep_mutex);
+}
+
+/**
+ * _job_wake
+ *
+ * wakes a sleeping worker after a job has been pushed
+ */
+static void _job_wake(PJobSystem *job_system)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&job_system->sleeping_workers) == 0)
+		return;
+	p_light_mutex_lock(&job_system->sleep_mutex);
+	p_cond_var_signal(&job_system->sleep_cond_var);
+	p_light_mutex_unlock(&job_system->sleep_mutex);
+}
+
+/**
+ * _job_wait_sleep
+ *
+ * puts a thread outside of the pool to sleep until a counter reaches zero, unless counter already has
+ * or there are queued jobs it could run meanwhile
+ */
+static void _job_wait_sleep(PJobSystem *job_system, PJobCounter *counter)
+{
+	p_light_mutex_lock(&job_system->sleep_mutex);
+	atomic_fetch_add(&job_system->sleeping_waiters, 1);
+	// pairs with the fence in _job_wait_wake, either the last job sees us sleeping or we see the counter at zero
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&counter->value) > 0 && !_job_has_work(job_system))
+		p_cond_var_wait(&job_system->wait_cond_var, &job_system->sleep_mutex);
+	atomic_fetch_sub(&job_system->sleeping_waiters, 1);
+	p_light_mutex_unlock(&job_system->sleep_mutex);
+}
+
+/**
+ * _job_wait_wake
+ *
+ * wakes the threads sleeping in p_job_wait after a counter reached zero
+ */
+static void _job_wait_wake(PJobSystem *job_system)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&job_system->sleeping_waiters) == 0)
+		return;
+	p_light_mutex_lock(&job_system->sleep_mutex);
+	p_cond_var_broadcast(&job_system->wait_cond_var);
+	p_light_mutex_unlock(&job_system->sleep_mutex);
+}
+
+static void _job_release_deferred(PJobSystem *job_system);
+
+/**
+ * _job_execute
+ *
+ * runs a job and signals its counter
+ */
+static void _job_execute(PJobSystem *job_system, PJob *job)
+{
+	PJobCounter *counter = job->counter;
+	job->func(job->args);
+
+	if (job->heap)
+		free(job);
+	else
+		atomic_store_explicit(&job->in_use, false, memory_order_release);
+
+	if (counter != NULL && atomic_fetch_sub(&counter->value, 1) == 1)
+	{
+		if (atomic_load(&job_system->deferred_count) > 0)
+			_job_release_deferred(job_system);
+		_job_wait_wake(job_system);
+	}
+}
+
+/**
+ * _job_push
+ *
+ * queues a ready job on the calling thread's deque, or on the inject queue for non-worker threads.
+ * runs the job immediately if the queue is full
+ */
+static void _job_push(PJobSystem *job_system, PJob *job)
+{
+	PJobWorker *worker = _job_worker_get(job_system);
+	if (worker != NULL)
+	{
+		if (_job_deque_push(&worker->deque, job))
+			_job_wake(job_system);
+		else
+			_job_execute(job_system, job);
+		return;
+	}
+
+	p_light_mutex_lock(&job_system->inject_mutex);
+	if (job_system->inject_tail - job_system->inject_head < P_JOB_INJECT_SIZE)
+	{
+		job_system->inject_queue[job_system->inject_tail++ & (P_JOB_INJECT_SIZE - 1)] = job;
+		atomic_fetch_add_explicit(&job_system->inject_count, 1, memory_order_relaxed);
+		job = NULL;
+	}
+	p_light_mutex_unlock(&job_system->inject_mutex);
+	if (job != NULL)
+		_job_execute(job_system, job);
+	else
+		_job_wake(job_system);
+}
+
+/**
+ * _job_release_deferred
+ *
+ * moves every deferred job whose dependency has finished to the run queues
+ */
+static void _job_release_deferred(PJobSystem *job_system)
+{
+	EDynarr *ready_jobs = e_dynarr_init(sizeof (PJob *), 1);
+	p_light_mutex_lock(&job_system->deferred_mutex);
+	for (uint i = 0; i < job_system->deferred_jobs->num_items;)
+	{
+		PJob *job = E_DYNARR_GET(job_system->deferred_jobs, PJob *, i);
+		if (atomic_load(&job->dependency->value) == 0)
+		{
+			e_dynarr_add(ready_jobs, &job);
+			e_dynarr_remove_unordered(job_system->deferred_jobs, i);
+			atomic_fetch_sub(&job_system->deferred_count, 1);
+		} else {
+			i++;
+		}
+	}
+	p_light_mutex_unlock(&job_system->deferred_mutex);
+
+	for (uint i = 0; i < ready_jobs->num_items; i++)
+		_job_push(job_system, E_DYNARR_GET(ready_jobs, PJob *, i));
+	e_dynarr_deinit(ready_jobs);
+}
+
+/**
+ * _job_worker_run
+ *
+ * This function runs in its own thread and executes jobs until the job system shuts down
+ * returns NULL
+ */
+static PThreadResult _job_worker_run(PThreadArguments args)
+{
+	PJobWorker *worker = args;
+	PJobSystem *job_system = worker->job_system;
+	p_job_current_worker = worker;
+
+	char name[16];
+	snprintf(name, sizeof name, "p_job_%u", worker->index);
+	p_thread_set_name(name);
+
+	uint idle = 0;
+	while (atomic_load_explicit(&job_system->running, memory_order_relaxed))
+	{
+		PJob *job = _job_next(job_system, worker);
+		if (job != NULL)
+		{
+			_job_execute(job_system, job);
+			idle = 0;
+			continue;
+		}
+
+		idle++;
+		if (idle < P_JOB_IDLE_SPINS)
+			continue;
+		else if (idle < P_JOB_IDLE_SPINS + P_JOB_IDLE_YIELDS)
+			_job_yield();
+		else
+			_job_sleep(job_system);
+	}
+	p_arena_scratch_deinit(); // jobs may have used the worker's scratch arena
+	p_job_current_worker = NULL;
+	return NULL;
+}
+
+/**
+ * p_job_system_init
+ *
+ * creates a job system with num_workers worker threads.
+ * if num_workers is 0 one worker is created per core, minus the calling thread
+ */
+PJobSystem *p_job_system_init(uint num_workers)
+{
+	if (num_workers == 0)
+		num_workers = E_MAX(p_thread_core_count(), 2) - 1;
+
+	PJobSystem *job_system = calloc(1, sizeof *job_system);
+	job_system->num_workers = num_workers;
+	job_system->deferred_jobs = e_dynarr_init(sizeof (PJob *), 16);
+	atomic_store(&job_system->running, true);
+
+	job_system->workers = aligned_alloc(P_JOB_CACHE_LINE, num_workers * sizeof *job_system->workers);
+	if (job_system->workers == NULL)
+	{
+		p_log_message(P_LOG_ERROR, L"Thread", L"Could not allocate %u job workers", num_workers);
+		exit(1);
+	}
+	memset(job_system->workers, 0, num_workers * sizeof *job_system->workers);
+	for (uint i = 0; i < num_workers; i++)
+	{
+		PJobWorker *worker = &job_system->workers[i];
+		worker->index = i;
+		worker->random_state = 2463534242u + i * 0x9E3779B9u;
+		worker->job_system = job_system;
+	}
+
+	// start threads only once every deque exists, since workers steal from each other
+	for (uint i = 0; i < num_workers; i++)
+		job_system->workers[i].thread = p_thread_create(_job_worker_run, &job_system->workers[i]);
+
+	return job_system;
+}
+
+/**
+ * p_job_system_deinit
+ *
+ * stops and joins every worker.
+ * all submitted jobs must have been waited on beforehand
+ */
+void p_job_system_deinit(PJobSystem *job_system)
+{
+	atomic_store(&job_system->running, false);
+	p_light_mutex_lock(&job_system->sleep_mutex);
+	p_cond_var_broadcast(&job_system->sleep_cond_var);
+	p_light_mutex_unlock(&job_system->sleep_mutex);
+	for (uint i = 0; i < job_system->num_workers; i++)
+		p_thread_join(job_system->workers[i].thread);
+
+	if (job_system->deferred_jobs->num_items > 0)
+		p_log_message(P_LOG_WARNING, L"Thread", L"Job system destroyed with %u deferred jobs",
+				job_system->deferred_jobs->num_items);
+
+	e_dynarr_deinit(job_system->deferred_jobs);
+	(free)(job_system->workers); // from aligned_alloc, not tracked by the memory debugger
+	free(job_system);
+}
+
+/**
+ * p_job_system_worker_count
+ *
+ * returns the number of worker threads in the job system
+ */
+uint p_job_system_worker_count(const PJobSystem *job_system)
+{
+	return job_system->num_workers;
+}
+
+/**
+ * p_job_worker_index
+ *
+ * returns the index of the worker of job_system running on the current thread
+ * returns -1 if the current thread is not a worker of job_system, workers of other job systems included
+ */
+int p_job_worker_index(const PJobSystem *job_system)
+{
+	PJobWorker *worker = _job_worker_get(job_system);
+	return (worker != NULL) ? (int)worker->index : -1;
+}
+
+/**
+ * p_job_submit
+ *
+ * queues func(args) to run on the job system.
+ * counter may be NULL, otherwise it is incremented now and decremented once the job finishes
+ */
+void p_job_submit(PJobSystem *job_system, PJobFunction func, void *args, PJobCounter *counter)
+{
+	if (counter != NULL)
+		atomic_fetch_add(&counter->value, 1);
+
+	PJob *job = _job_allocate(job_system);
+	job->func = func;
+	job->args = args;
+	job->counter = counter;
+	job->dependency = NULL;
+	_job_push(job_system, job);
+}
+
+/**
+ * p_job_submit_after
+ *
+ * like p_job_submit, but the job only becomes runnable once dependency reaches zero
+ */
+void p_job_submit_after(PJobSystem *job_system, PJobFunction func, void *args, PJobCounter *dependency,
+		PJobCounter *counter)
+{
+	if (dependency == NULL || atomic_load(&dependency->value) == 0)
+	{
+		p_job_submit(job_system, func, args, counter);
+		return;
+	}
+
+	if (counter != NULL)
+		atomic_fetch_add(&counter->value, 1);
+
+	PJob *job = _job_allocate(job_system);
+	job->func = func;
+	job->args = args;
+	job->counter = counter;
+	job->dependency = dependency;
+
+	p_light_mutex_lock(&job_system->deferred_mutex);
+	e_dynarr_add(job_system->deferred_jobs, &job);
+	atomic_fetch_add(&job_system->deferred_count, 1);
+	p_light_mutex_unlock(&job_system->deferred_mutex);
+
+	// the dependency may have finished before the job was deferred
+	if (atomic_load(&dependency->value) == 0)
+		_job_release_deferred(job_system);
+}
+
+/**
+ * p_job_wait
+ *
+ * blocks until counter reaches zero.
+ * the calling thread runs queued jobs while it waits, threads outside of the pool sleep once there are none
+ */
+void p_job_wait(PJobSystem *job_system, PJobCounter *counter)
+{
+	PJobWorker *worker = _job_worker_get(job_system);
+	uint idle = 0;
+	while (atomic_load(&counter->value) > 0)
+	{
+		PJob *job = _job_next(job_system, worker);
+		if (job != NULL)
+		{
+			_job_execute(job_system, job);
+			idle = 0;
+			continue;
+		}
+
+		idle++;
+		if (idle < P_JOB_IDLE_SPINS)
+			continue;
+		// workers keep yielding, only threads outside of the pool are woken through wait_cond_var
+		else if (worker != NULL || idle < P_JOB_IDLE_SPINS + P_JOB_IDLE_YIELDS)
+			_job_yield();
+		else
+			_job_wait_sleep(job_system, counter);
+	}
+}
@@ -1,18 +1,29 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // pthread_setname_np
+#endif // _GNU_SOURCE
+
 #include "platinum.h"
+#include <string.h>
 
 #ifdef PLATINUM_PLATFORM_WINDOWS
 
 #include <windows.h>
+#include <synchapi.h>
 typedef HANDLE PThread;
 typedef DWORD PThreadResult;
 typedef CRITICAL_SECTION PMutex;
 
 #elif defined PLATINUM_PLATFORM_LINUX
 
+#include <limits.h>
+#include <linux/futex.h>
 #include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 struct PThread {
 	pthread_t handle;
+	bool is_self; // returned by p_thread_self, lives in thread local storage
 };
 
 struct PMutex {
@@ -35,6 +46,28 @@ typedef void *PMutex;
 
 #endif // PLATINUM_PLATFORM
 
+// Number of times a contended PLightMutex is polled before the thread goes to sleep
+#define P_LIGHT_MUTEX_SPIN_COUNT 100
+
+// Longest thread name supported by every platform, including the null terminator
+#define P_THREAD_NAME_LENGTH 16
+
+/**
+ * PThreadIdentity
+ *
+ * Identity of the current thread, kept in thread local storage
+ */
+typedef struct PThreadIdentity {
+	uint id; // 0 until first requested
+	char name[P_THREAD_NAME_LENGTH];
+#ifdef PLATINUM_PLATFORM_LINUX
+	struct PThread self;
+#endif
+} PThreadIdentity;
+
+static atomic_uint p_thread_id_counter = 0;
+static _Thread_local PThreadIdentity p_thread_identity;
+
 
 
 /**
@@ -144,6 +177,172 @@ void p_mutex_destroy(PMutex mutex)
 #endif
 }
 
+/**
+ * _cpu_relax
+ *
+ * tells the cpu that the current thread is busy waiting
+ */
+static inline void _cpu_relax(void)
+{
+#ifdef PLATINUM_PLATFORM_WINDOWS
+	YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ volatile("yield");
+#endif
+}
+
+/**
+ * _futex_wait
+ *
+ * sleeps while the value at address equals expected, may wake up spuriously
+ */
+static void _futex_wait(atomic_uint *address, uint expected)
+{
+#ifdef PLATINUM_PLATFORM_WINDOWS
+	WaitOnAddress(address, &expected, sizeof expected, INFINITE);
+#endif
+#ifdef PLATINUM_PLATFORM_LINUX
+	syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+#endif
+}
+
+/**
+ * _futex_wake
+ *
+ * wakes up to count threads sleeping on address
+ */
+static void _futex_wake(atomic_uint *address, int count)
+{
+#ifdef PLATINUM_PLATFORM_WINDOWS
+	if (count == 1)
+		WakeByAddressSingle(address);
+	else
+		WakeByAddressAll(address);
+#endif
+#ifdef PLATINUM_PLATFORM_LINUX
+	syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+#endif
+}
+
+/**
+ * _light_mutex_lock_slow
+ *
+ * marks the mutex as having waiters and sleeps until it can be taken
+ */
+static void _light_mutex_lock_slow(PLightMutex *mutex)
+{
+	while (atomic_exchange_explicit(&mutex->state, 2, memory_order_acquire) != 0)
+		_futex_wait(&mutex->state, 2);
+}
+
+/**
+ * p_light_mutex_init
+ *
+ * initializes a lightweight mutex, the same as zeroing it
+ */
+void p_light_mutex_init(PLightMutex *mutex)
+{
+	atomic_init(&mutex->state, 0);
+}
+
+/**
+ * p_light_mutex_trylock
+ *
+ * locks a lightweight mutex if it is free
+ * returns true if the mutex was locked
+ */
+bool p_light_mutex_trylock(PLightMutex *mutex)
+{
+	uint state = 0;
+	return atomic_compare_exchange_strong_explicit(&mutex->state, &state, 1, memory_order_acquire,
+			memory_order_relaxed);
+}
+
+/**
+ * p_light_mutex_lock
+ *
+ * locks a lightweight mutex.
+ * spins while the owner is expected to release it soon, then sleeps in the kernel
+ */
+void p_light_mutex_lock(PLightMutex *mutex)
+{
+	uint state = 0;
+	if (atomic_compare_exchange_strong_explicit(&mutex->state, &state, 1, memory_order_acquire,
+				memory_order_relaxed))
+		return;
+
+	// only spin while nobody is sleeping, otherwise the owner is likely being held up
+	for (uint i = 0; i < P_LIGHT_MUTEX_SPIN_COUNT && state != 2; i++)
+	{
+		_cpu_relax();
+		state = atomic_load_explicit(&mutex->state, memory_order_relaxed);
+		if (state == 0 && atomic_compare_exchange_weak_explicit(&mutex->state, &state, 1,
+					memory_order_acquire, memory_order_relaxed))
+			return;
+	}
+	_light_mutex_lock_slow(mutex);
+}
+
+/**
+ * p_light_mutex_unlock
+ *
+ * unlocks a lightweight mutex, waking one sleeping waiter if there is any
+ */
+void p_light_mutex_unlock(PLightMutex *mutex)
+{
+	if (atomic_exchange_explicit(&mutex->state, 0, memory_order_release) == 2)
+		_futex_wake(&mutex->state, 1);
+}
+
+/**
+ * p_cond_var_init
+ *
+ * initializes a condition variable, the same as zeroing it
+ */
+void p_cond_var_init(PCondVar *cond_var)
+{
+	atomic_init(&cond_var->sequence, 0);
+}
+
+/**
+ * p_cond_var_wait
+ *
+ * unlocks mutex and sleeps until the condition variable is signaled, then relocks mutex.
+ * may wake up spuriously, so the condition has to be checked in a loop
+ */
+void p_cond_var_wait(PCondVar *cond_var, PLightMutex *mutex)
+{
+	uint sequence = atomic_load_explicit(&cond_var->sequence, memory_order_relaxed);
+	p_light_mutex_unlock(mutex);
+	_futex_wait(&cond_var->sequence, sequence);
+	// other threads may have been woken as well, so assume the mutex is contended
+	_light_mutex_lock_slow(mutex);
+}
+
+/**
+ * p_cond_var_signal
+ *
+ * wakes one thread waiting on the condition variable
+ */
+void p_cond_var_signal(PCondVar *cond_var)
+{
+	atomic_fetch_add_explicit(&cond_var->sequence, 1, memory_order_release);
+	_futex_wake(&cond_var->sequence, 1);
+}
+
+/**
+ * p_cond_var_broadcast
+ *
+ * wakes every thread waiting on the condition variable
+ */
+void p_cond_var_broadcast(PCondVar *cond_var)
+{
+	atomic_fetch_add_explicit(&cond_var->sequence, 1, memory_order_release);
+	_futex_wake(&cond_var->sequence, INT_MAX);
+}
+
 /**
  * p_thread_create
  *
@@ -166,6 +365,7 @@ PThread p_thread_create(PThreadFunction func, PThreadArguments args)
 	return thread;
 #endif
 #ifdef PLATINUM_PLATFORM_LINUX
+	thread->is_self = false;
 	int result = pthread_create(&thread->handle, NULL, func, args);
 	if (result != 0)
 	{
@@ -178,6 +378,10 @@ PThread p_thread_create(PThreadFunction func, PThreadArguments args)
 
 void p_thread_discard(PThread thread)
 {
+#ifdef PLATINUM_PLATFORM_LINUX
+	if (thread->is_self)
+		return;
+#endif
 	free(thread);
 }
 
@@ -185,7 +389,9 @@ void p_thread_discard(PThread thread)
  * p_thread_self
  *
  * wrapper function around pthreads and winapithreads
- * that returns the current thread
+ * that returns the current thread.
+ * the handle is owned by the thread and does not need to be freed,
+ * it may be detached but not joined
  */
 PThread p_thread_self(void)
 {
@@ -193,12 +399,59 @@ PThread p_thread_self(void)
 	return GetCurrentThread();
 #endif
 #ifdef PLATINUM_PLATFORM_LINUX
-	PThread thread = malloc(sizeof *thread);
-	thread->handle = pthread_self();
+	PThread thread = &p_thread_identity.self;
+	if (!thread->is_self)
+	{
+		thread->handle = pthread_self();
+		thread->is_self = true;
+	}
 	return thread;
 #endif
 }
 
+/**
+ * p_thread_id
+ *
+ * returns a small integer unique to the current thread, starting at 1.
+ * ids are handed out the first time a thread asks and never change or get reused
+ */
+uint p_thread_id(void)
+{
+	if (p_thread_identity.id == 0)
+		p_thread_identity.id = atomic_fetch_add_explicit(&p_thread_id_counter, 1, memory_order_relaxed) + 1;
+	return p_thread_identity.id;
+}
+
+/**
+ * p_thread_set_name
+ *
+ * names the current thread, for debuggers and p_thread_name.
+ * names are cut off after 15 characters
+ */
+void p_thread_set_name(const char *name)
+{
+	strncpy(p_thread_identity.name, name, P_THREAD_NAME_LENGTH - 1);
+	p_thread_identity.name[P_THREAD_NAME_LENGTH - 1] = '\0';
+#ifdef PLATINUM_PLATFORM_WINDOWS
+	wchar_t wide_name[P_THREAD_NAME_LENGTH];
+	mbstowcs(wide_name, p_thread_identity.name, P_THREAD_NAME_LENGTH);
+	SetThreadDescription(GetCurrentThread(), wide_name);
+#endif
+#ifdef PLATINUM_PLATFORM_LINUX
+	pthread_setname_np(pthread_self(), p_thread_identity.name);
+#endif
+}
+
+/**
+ * p_thread_name
+ *
+ * returns the name of the current thread, or an empty string if it was never named
+ */
+const char *p_thread_name(void)
+{
+	return p_thread_identity.name;
+}
+
 /**
  * p_thread_join
  *
@@ -222,8 +475,27 @@ void p_thread_join(PThread thread)
 		p_log_message(P_LOG_ERROR, L"Thread", L"Could not join thread. Error code: %i\n", result);
 		exit(1);
 	}
+	if (!thread->is_self)
+		free(thread);
+#endif
+}
+
+/**
+ * p_thread_core_count
+ *
+ * returns the number of cores currently online (at least 1)
+ */
+uint p_thread_core_count(void)
+{
+#ifdef PLATINUM_PLATFORM_WINDOWS
+	SYSTEM_INFO system_info;
+	GetSystemInfo(&system_info);
+	return E_MAX(system_info.dwNumberOfProcessors, 1);
+#endif
+#ifdef PLATINUM_PLATFORM_LINUX
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return (count > 0) ? (uint)count : 1;
 #endif
-	free(thread);
 }
 
 /**
@@ -245,6 +517,7 @@ void p_thread_detach(PThread thread)
 		p_log_message(P_LOG_ERROR, L"Thread", L"Could not detach thread. Error code: %i\n", result);
 		exit(1);
 	}
+	if (!thread->is_self)
+		free(thread);
 #endif
-	free(thread);
 }
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "platinum.h"
+
+// Size of the offscreen images drawn by the test
+#define P_HEADLESS_TEST_WIDTH 64
+#define P_HEADLESS_TEST_HEIGHT 64
+
+// Frames drawn before reading, enough to reuse every frame in flight
+#define P_HEADLESS_TEST_FRAMES 4
+
+/**
+ * main
+ *
+ * draws a few frames of a headless display and reads the last one back
+ * every pixel is covered by the clear or the triangle, both opaque
+ * returns 0 on success, runs without a display server
+ */
+int main(void)
+{
+	PAppConfig app_config = {0};
+	PAppRequest app_request = {0};
+	app_request.graphical_app_request.headless = true;
+	app_request.app_config = &app_config;
+	PAppData *app_data = p_app_init(app_request);
+
+	PGraphicalDisplayRequest display_request = {0};
+	display_request.headless = true;
+	PGraphicalDisplayData display = p_graphics_headless_display_create(app_data->graphical_app_data,
+			&display_request, P_HEADLESS_TEST_WIDTH, P_HEADLESS_TEST_HEIGHT);
+
+	int result = 0;
+	for (uint i = 0; i < P_HEADLESS_TEST_FRAMES; i++)
+	{
+		if (!p_graphics_headless_display_draw(display))
+		{
+			fprintf(stderr, "frame %u was not drawn\n", i);
+			result = 1;
+		}
+	}
+
+	unsigned char *pixels = malloc(P_HEADLESS_TEST_WIDTH * P_HEADLESS_TEST_HEIGHT * 4);
+	if (!p_graphics_display_read(display, pixels))
+	{
+		fprintf(stderr, "the last frame could not be read\n");
+		result = 1;
+	} else {
+		for (uint i = 0; i < P_HEADLESS_TEST_WIDTH * P_HEADLESS_TEST_HEIGHT; i++)
+		{
+			if (pixels[i * 4 + 3] != 255)
+			{
+				fprintf(stderr, "pixel %u is not opaque\n", i);
+				result = 1;
+				break;
+			}
+		}
+	}
+	free(pixels);
+
+	p_graphics_display_destroy(display);
+	p_app_deinit(app_data);
+	return result;
+}